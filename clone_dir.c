@@ -6,7 +6,93 @@
 #include <stdbool.h>
 #include <string.h>
 
-void write_dir(const char* volume, const char* dirname, const char* volumedirname, bool write)
+// Streams a host file into the volume through a fixed size buffer
+int write_file(SIFS_VOLUME* volume, const char* filename, const char* volumefilename, size_t size)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return 1;
+    }
+    SIFS_WRITER* writer = SIFS_wopen(volume, volumefilename, size);
+    if (writer == NULL)
+    {
+        fclose(f);
+        return 1;
+    }
+    static char buffer[64 * 1024];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        if (SIFS_wwrite(writer, buffer, n) != 0)
+        {
+            SIFS_wabort(writer);
+            fclose(f);
+            return 1;
+        }
+    }
+    fclose(f);
+    return SIFS_wcommit(writer);
+}
+
+#define BATCH_FILES     256
+#define BATCH_BYTES     (16 * 1024 * 1024)
+#define STREAM_BYTES    (1024 * 1024)
+
+// Small files are read whole and added to the volume in batches
+SIFS_WRITE_REQ batch[BATCH_FILES];
+size_t nbatch = 0;
+size_t batchbytes = 0;
+
+void flush_batch(SIFS_VOLUME* volume)
+{
+    int errors[BATCH_FILES];
+    SIFS_writefiles(volume, batch, nbatch, errors);
+    for (size_t i = 0; i < nbatch; i++)
+    {
+        if (errors[i] != 0)
+        {
+            SIFS_errno = errors[i];
+            SIFS_perror(batch[i].pathname);
+        }
+        free((void*)batch[i].pathname);
+        free((void*)batch[i].data);
+    }
+    nbatch = 0;
+    batchbytes = 0;
+}
+
+// Reads a small host file and queues it to be added with the next batch
+int batch_file(SIFS_VOLUME* volume, const char* filename, const char* volumefilename, size_t size)
+{
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return 1;
+    }
+    char* data = malloc(size > 0 ? size : 1);
+    char* pathname = malloc(strlen(volumefilename) + 1);
+    if (data == NULL || pathname == NULL || fread(data, 1, size, f) != size)
+    {
+        free(data);
+        free(pathname);
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+    if (nbatch == BATCH_FILES || batchbytes + size > BATCH_BYTES)
+    {
+        flush_batch(volume);
+    }
+    strcpy(pathname, volumefilename);
+    batch[nbatch].pathname = pathname;
+    batch[nbatch].data = data;
+    batch[nbatch++].nbytes = size;
+    batchbytes += size;
+    return 0;
+}
+
+void write_dir(SIFS_VOLUME* volume, const char* volumename, const char* dirname, const char* volumedirname, bool write)
 {
     struct dirent* dp;
     DIR* dir;
@@ -21,7 +107,7 @@ void write_dir(const char* volume, const char* dirname, const char* volumedirnam
 
     if (write)
     {
-        SIFS_mkdir(volume, volumedirname);
+        SIFS_vmkdir(volume, volumedirname);
         SIFS_perror(NULL);
     }
 
@@ -31,26 +117,29 @@ void write_dir(const char* volume, const char* dirname, const char* volumedirnam
         sprintf(filename, "%s/%s", dirname, dp->d_name);
         sprintf(volumefilename, "%s/%s", volumedirname, dp->d_name);
         stat(filename, &st);
-        if (strcmp(dp->d_name, volume) != 0 && strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0)
+        if (strcmp(dp->d_name, volumename) != 0 && strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0)
         {
             if (S_ISDIR(st.st_mode))
             {
                 printf("Writing directory %s as %s\n", filename, volumefilename);
-                write_dir(volume, filename, volumefilename, true);
+                write_dir(volume, volumename, filename, volumefilename, true);
             }
             else if (S_ISREG(st.st_mode))
             {
                 printf("Writing file %s as %s\n", filename, volumefilename);
-                FILE* f = fopen(filename, "rb");
-                void* buffer = malloc(st.st_size);
-                fread(buffer, 1, st.st_size, f);
-                SIFS_writefile(volume, volumefilename, buffer, st.st_size);
-                SIFS_perror(NULL);
-                fclose(f);
-                free(buffer);
+                if (st.st_size < STREAM_BYTES)
+                {
+                    batch_file(volume, filename, volumefilename, st.st_size);
+                }
+                else
+                {
+                    write_file(volume, filename, volumefilename, st.st_size);
+                    SIFS_perror(NULL);
+                }
             }   
         }     
     }
+    closedir(dir);
 }
 
 int main(int argc, char** argv)
@@ -71,5 +160,13 @@ int main(int argc, char** argv)
     remove("volume");
     SIFS_mkvolume("volume", blocksize, nblocks);
 
-    write_dir("volume", dirname, "", false);
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    if (volume == NULL)
+    {
+        SIFS_perror(argv[0]);
+        return 1;
+    }
+    write_dir(volume, "volume", dirname, "", false);
+    flush_batch(volume);
+    SIFS_close(volume);
 }
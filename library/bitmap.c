@@ -0,0 +1,271 @@
+#include "sifsutils.h"
+#include <string.h>
+
+// Scans of the bitmap compare many entries at once: 32 at a time with AVX2 when the processor has it,
+// otherwise 16 at a time with SSE2 on x86-64, or 8 at a time within a 64-bit word everywhere else
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIFS_BITMAP_X86
+#include <immintrin.h>
+#endif
+
+#define ONES    0x0101010101010101ull
+#define HIGHS   0x8080808080808080ull
+
+// Helper function that returns a word with the high bit of each byte set where x has a zero byte
+static inline uint64_t zerobytes(uint64_t x)
+{
+    return ~(((x & ~HIGHS) + ~HIGHS) | x | ~HIGHS);
+}
+
+// Helper function that returns the first entry from from onwards that equals type (or differs from it
+// when equal is false) one word at a time, or nblocks if there is none
+static SIFS_BLOCKID scan_portable(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type, bool equal)
+{
+    uint64_t pattern = ONES * (unsigned char)type;
+    SIFS_BLOCKID i = from;
+    for (; i + 8 <= nblocks; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bitmap + i, 8);
+        uint64_t matches = zerobytes(word ^ pattern);
+        if (equal ? matches != 0 : matches != HIGHS)
+        {
+            break;
+        }
+    }
+    for (; i < nblocks; i++)
+    {
+        if ((bitmap[i] == type) == equal)
+        {
+            return i;
+        }
+    }
+    return nblocks;
+}
+
+static SIFS_BLOCKID count_portable(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    uint64_t pattern = ONES * (unsigned char)type;
+    SIFS_BLOCKID count = 0;
+    SIFS_BLOCKID i = from;
+    for (; i + 8 <= nblocks; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bitmap + i, 8);
+        // One bit per matching byte, summed into the top byte by the multiplication
+        count += (SIFS_BLOCKID)((((zerobytes(word ^ pattern) >> 7) * ONES) >> 56));
+    }
+    for (; i < nblocks; i++)
+    {
+        count += (bitmap[i] == type);
+    }
+    return count;
+}
+
+#ifdef SIFS_BITMAP_X86
+
+static SIFS_BLOCKID scan_sse2(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type, bool equal)
+{
+    __m128i pattern = _mm_set1_epi8(type);
+    unsigned int flip = equal ? 0 : 0xFFFF;
+    SIFS_BLOCKID i = from;
+    for (; i + 16 <= nblocks; i += 16)
+    {
+        __m128i entries = _mm_loadu_si128((const __m128i*)(bitmap + i));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(entries, pattern)) ^ flip;
+        if (mask != 0)
+        {
+            return i + (SIFS_BLOCKID)__builtin_ctz(mask);
+        }
+    }
+    return scan_portable(bitmap, i, nblocks, type, equal);
+}
+
+static SIFS_BLOCKID count_sse2(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    __m128i pattern = _mm_set1_epi8(type);
+    SIFS_BLOCKID count = 0;
+    SIFS_BLOCKID i = from;
+    while (i + 16 <= nblocks)
+    {
+        // Byte counters are summed before any of them can overflow
+        __m128i counters = _mm_setzero_si128();
+        for (int n = 0; n < 255 && i + 16 <= nblocks; n++, i += 16)
+        {
+            __m128i entries = _mm_loadu_si128((const __m128i*)(bitmap + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(entries, pattern));
+        }
+        __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+        count += (SIFS_BLOCKID)(_mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4));
+    }
+    return count + count_portable(bitmap, i, nblocks, type);
+}
+
+__attribute__((target("avx2")))
+static SIFS_BLOCKID scan_avx2(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type, bool equal)
+{
+    __m256i pattern = _mm256_set1_epi8(type);
+    unsigned int flip = equal ? 0 : 0xFFFFFFFFu;
+    SIFS_BLOCKID i = from;
+    for (; i + 32 <= nblocks; i += 32)
+    {
+        __m256i entries = _mm256_loadu_si256((const __m256i*)(bitmap + i));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(entries, pattern)) ^ flip;
+        if (mask != 0)
+        {
+            return i + (SIFS_BLOCKID)__builtin_ctz(mask);
+        }
+    }
+    return scan_sse2(bitmap, i, nblocks, type, equal);
+}
+
+__attribute__((target("avx2")))
+static SIFS_BLOCKID count_avx2(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    __m256i pattern = _mm256_set1_epi8(type);
+    SIFS_BLOCKID count = 0;
+    SIFS_BLOCKID i = from;
+    while (i + 32 <= nblocks)
+    {
+        __m256i counters = _mm256_setzero_si256();
+        for (int n = 0; n < 255 && i + 32 <= nblocks; n++, i += 32)
+        {
+            __m256i entries = _mm256_loadu_si256((const __m256i*)(bitmap + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(entries, pattern));
+        }
+        __m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+        count += (SIFS_BLOCKID)(_mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+            + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3));
+    }
+    return count + count_sse2(bitmap, i, nblocks, type);
+}
+
+// Helper function that returns true if the processor supports AVX2, checked once
+static bool has_avx2(void)
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return supported == 1;
+}
+
+static SIFS_BLOCKID scan(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type, bool equal)
+{
+    return has_avx2() ? scan_avx2(bitmap, from, nblocks, type, equal) : scan_sse2(bitmap, from, nblocks, type, equal);
+}
+
+static SIFS_BLOCKID count(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    return has_avx2() ? count_avx2(bitmap, from, nblocks, type) : count_sse2(bitmap, from, nblocks, type);
+}
+
+#else
+
+#define scan    scan_portable
+#define count   count_portable
+
+#endif
+
+SIFS_BLOCKID SIFS_bitmapfind(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    return (from < nblocks) ? scan(bitmap, from, nblocks, type, true) : nblocks;
+}
+
+SIFS_BLOCKID SIFS_bitmapskip(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    return (from < nblocks) ? scan(bitmap, from, nblocks, type, false) : nblocks;
+}
+
+SIFS_BLOCKID SIFS_bitmapcount(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    return (from < nblocks) ? count(bitmap, from, nblocks, type) : 0;
+}
+
+SIFS_BLOCKID SIFS_bitmapfindrun(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BLOCKID length)
+{
+    SIFS_BLOCKID start = SIFS_bitmapfind(bitmap, from, nblocks, SIFS_UNUSED);
+    while (start < nblocks)
+    {
+        SIFS_BLOCKID end = SIFS_bitmapskip(bitmap, start, nblocks, SIFS_UNUSED);
+        if (end - start >= length)
+        {
+            return start;
+        }
+        start = SIFS_bitmapfind(bitmap, end, nblocks, SIFS_UNUSED);
+    }
+    return nblocks;
+}
+
+// Packed entries hold SIFS_UNUSED as 0, so the bitmap of a new volume is all zeroes apart from the root directory
+static const SIFS_BIT codes[4] = { SIFS_UNUSED, SIFS_DIR, SIFS_FILE, SIFS_DATABLOCK };
+
+static unsigned char encode(SIFS_BIT type)
+{
+    switch (type)
+    {
+    case SIFS_DIR:
+        return 1;
+    case SIFS_FILE:
+        return 2;
+    case SIFS_DATABLOCK:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+void SIFS_bitmappack(const SIFS_BIT* bitmap, SIFS_BLOCKID first, SIFS_BLOCKID nblocks, unsigned char* packed)
+{
+    const SIFS_BIT* entries = bitmap + first;
+    SIFS_BLOCKID i = 0;
+    for (; i + 4 <= nblocks; i += 4)
+    {
+        *packed++ = (unsigned char)(encode(entries[i]) | (encode(entries[i + 1]) << 2)
+            | (encode(entries[i + 2]) << 4) | (encode(entries[i + 3]) << 6));
+    }
+    if (i < nblocks)
+    {
+        unsigned char byte = 0;
+        for (int shift = 0; i < nblocks; i++, shift += 2)
+        {
+            byte |= (unsigned char)(encode(entries[i]) << shift);
+        }
+        *packed = byte;
+    }
+}
+
+void SIFS_bitmapunpack(const unsigned char* packed, SIFS_BLOCKID nblocks, SIFS_BIT* bitmap)
+{
+    // Each byte expands to the same four entries wherever it is, so the expansions are worked out once
+    static SIFS_BIT table[256][4];
+    static bool built = false;
+    if (!built)
+    {
+        for (int byte = 0; byte < 256; byte++)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                table[byte][k] = codes[(byte >> (2 * k)) & 3];
+            }
+        }
+        built = true;
+    }
+    SIFS_BLOCKID i = 0;
+    for (; i + 4 <= nblocks; i += 4)
+    {
+        memcpy(bitmap + i, table[*packed++], 4);
+    }
+    if (i < nblocks)
+    {
+        memcpy(bitmap + i, table[*packed], nblocks - i);
+    }
+}
+
+size_t SIFS_bitmapbytes(SIFS_BLOCKID nblocks, bool packed)
+{
+    return packed ? ((size_t)nblocks + 3) / 4 : (size_t)nblocks * sizeof(SIFS_BIT);
+}
@@ -0,0 +1,385 @@
+//  BLAKE3, FOLLOWING THE REFERENCE IMPLEMENTATION IN THE SPECIFICATION
+//  (https://github.com/BLAKE3-team/BLAKE3-specs, CC0 / APACHE 2.0)
+//  THE INPUT IS SPLIT INTO 1KB CHUNKS WHICH ARE THE LEAVES OF A BINARY TREE, SO
+//  CHUNKS ARE INDEPENDENT: WHOLE CHUNKS ARE HASHED SEVERAL AT ONCE IN THE LANES
+//  OF AN SSE2 OR AVX2 REGISTER, WHICHEVER THE PROCESSOR HAS
+
+#include "blake3.h"
+
+#include <string.h>
+
+#if	defined(__x86_64__) && defined(__GNUC__)
+#define	BLAKE3_X86
+#include <immintrin.h>
+#endif
+
+#define	CHUNK_START	(1 << 0)
+#define	CHUNK_END	(1 << 1)
+#define	PARENT		(1 << 2)
+#define	ROOT		(1 << 3)
+
+#define	BLOCKS_PER_CHUNK	(BLAKE3_CHUNKLEN / 64)
+
+static const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+//  THE MESSAGE WORDS USED BY EACH ROUND, THE PERMUTATION OF THE SPECIFICATION APPLIED r TIMES
+static const uint8_t schedule[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+//  THE SEVEN ROUNDS, EXPANDED WITH THE SCALAR OR VECTOR OPERATIONS DEFINED BEFORE THEM
+#define	G(a, b, c, d, x, y)				\
+	do {						\
+	    (a) = VADD(VADD((a), (b)), (x));		\
+	    (d) = VROR(VXOR((d), (a)), 16);		\
+	    (c) = VADD((c), (d));			\
+	    (b) = VROR(VXOR((b), (c)), 12);		\
+	    (a) = VADD(VADD((a), (b)), (y));		\
+	    (d) = VROR(VXOR((d), (a)), 8);		\
+	    (c) = VADD((c), (d));			\
+	    (b) = VROR(VXOR((b), (c)), 7);		\
+	} while(0)
+
+#define	ROUNDS(v, m)								\
+	for(int r=0 ; r<7 ; r++) {						\
+	    const uint8_t *s = schedule[r];					\
+										\
+	    G(v[0], v[4], v[8],  v[12], m[s[0]],  m[s[1]]);			\
+	    G(v[1], v[5], v[9],  v[13], m[s[2]],  m[s[3]]);			\
+	    G(v[2], v[6], v[10], v[14], m[s[4]],  m[s[5]]);			\
+	    G(v[3], v[7], v[11], v[15], m[s[6]],  m[s[7]]);			\
+	    G(v[0], v[5], v[10], v[15], m[s[8]],  m[s[9]]);			\
+	    G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);			\
+	    G(v[2], v[7], v[8],  v[13], m[s[12]], m[s[13]]);			\
+	    G(v[3], v[4], v[9],  v[14], m[s[14]], m[s[15]]);			\
+	}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	   ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//  --------------------------------------------------------------------------
+
+#define	VADD(x, y)	((x) + (y))
+#define	VXOR(x, y)	((x) ^ (y))
+#define	VROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+//  COMPRESS ONE 64-BYTE BLOCK, LEAVING ALL 16 WORDS OF THE RESULT IN out
+static void compress(const uint32_t cv[8], const uint8_t block[64], uint64_t counter,
+		     uint32_t blocklen, uint32_t flags, uint32_t out[16])
+{
+    uint32_t m[16];
+    uint32_t v[16];
+
+    for(int i=0 ; i<16 ; i++)
+	m[i]	= read32(block + 4*i);
+    memcpy(v, cv, 8*sizeof(uint32_t));
+    memcpy(v + 8, IV, 4*sizeof(uint32_t));
+    v[12]	= (uint32_t)counter;
+    v[13]	= (uint32_t)(counter >> 32);
+    v[14]	= blocklen;
+    v[15]	= flags;
+
+    ROUNDS(v, m);
+
+    for(int i=0 ; i<8 ; i++) {
+	out[i]		= v[i] ^ v[i + 8];
+	out[i + 8]	= v[i + 8] ^ cv[i];
+    }
+}
+
+#undef	VADD
+#undef	VXOR
+#undef	VROR
+
+//  THE CHAINING VALUE OF A WHOLE CHUNK THAT IS NOT THE ROOT
+static void chunk_cv(const uint8_t *chunk, uint64_t counter, uint32_t cv[8])
+{
+    uint32_t out[16];
+
+    memcpy(cv, IV, sizeof(IV));
+    for(int b=0 ; b<BLOCKS_PER_CHUNK ; b++) {
+	uint32_t flags = (b == 0 ? CHUNK_START : 0) | (b == BLOCKS_PER_CHUNK - 1 ? CHUNK_END : 0);
+
+	compress(cv, chunk + 64*b, counter, 64, flags, out);
+	memcpy(cv, out, 8*sizeof(uint32_t));
+    }
+}
+
+//  --------------------------------------------------------------------------
+
+#if	defined(BLAKE3_X86)
+
+#define	MAXLANES	8
+
+//  EACH KERNEL HASHES nlanes CONSECUTIVE WHOLE CHUNKS, THE FIRST OF THEM chunks[0]
+//  WITH INDEX counter, LEAVING THE CHAINING VALUE OF CHUNK l IN cvs[l]
+#define	CHUNKS_KERNEL(vec, nlanes, LOAD, STORE)					\
+    uint32_t	words[16][MAXLANES];						\
+    uint32_t	lanes[8][MAXLANES];						\
+    uint32_t	counters[2][MAXLANES];						\
+    vec		cv[8];								\
+										\
+    for(int l=0 ; l<nlanes ; l++) {						\
+	counters[0][l]	= (uint32_t)(counter + l);				\
+	counters[1][l]	= (uint32_t)((counter + l) >> 32);			\
+    }										\
+    for(int i=0 ; i<8 ; i++)							\
+	cv[i]	= VSET1(IV[i]);							\
+    for(int b=0 ; b<BLOCKS_PER_CHUNK ; b++) {					\
+	uint32_t flags = (b == 0 ? CHUNK_START : 0) |				\
+			 (b == BLOCKS_PER_CHUNK - 1 ? CHUNK_END : 0);		\
+	vec m[16];								\
+	vec v[16];								\
+										\
+	for(int l=0 ; l<nlanes ; l++)						\
+	    for(int i=0 ; i<16 ; i++)						\
+		words[i][l]	= read32(chunks[l] + 64*b + 4*i);		\
+	for(int i=0 ; i<16 ; i++)						\
+	    m[i]	= LOAD(words[i]);					\
+	for(int i=0 ; i<8 ; i++)						\
+	    v[i]	= cv[i];						\
+	for(int i=0 ; i<4 ; i++)						\
+	    v[8 + i]	= VSET1(IV[i]);						\
+	v[12]	= LOAD(counters[0]);						\
+	v[13]	= LOAD(counters[1]);						\
+	v[14]	= VSET1(64);							\
+	v[15]	= VSET1(flags);							\
+										\
+	ROUNDS(v, m);								\
+										\
+	for(int i=0 ; i<8 ; i++)						\
+	    cv[i]	= VXOR(v[i], v[i + 8]);					\
+    }										\
+    for(int i=0 ; i<8 ; i++)							\
+	STORE(lanes[i], cv[i]);							\
+    for(int l=0 ; l<nlanes ; l++)						\
+	for(int i=0 ; i<8 ; i++)						\
+	    cvs[l][i]	= lanes[i][l]
+
+#define	VADD(x, y)	_mm_add_epi32((x), (y))
+#define	VXOR(x, y)	_mm_xor_si128((x), (y))
+#define	VROR(x, n)	_mm_or_si128(_mm_srli_epi32((x), (n)), _mm_slli_epi32((x), 32 - (n)))
+#define	VSET1(k)	_mm_set1_epi32((int)(k))
+#define	LOAD_SSE2(p)	_mm_loadu_si128((const __m128i *)(p))
+#define	STORE_SSE2(p, x)	_mm_storeu_si128((__m128i *)(p), (x))
+
+static void chunks_sse2(const uint8_t *chunks[], uint64_t counter, uint32_t cvs[][8])
+{
+    CHUNKS_KERNEL(__m128i, 4, LOAD_SSE2, STORE_SSE2);
+}
+
+#undef	VADD
+#undef	VXOR
+#undef	VROR
+#undef	VSET1
+
+#define	VADD(x, y)	_mm256_add_epi32((x), (y))
+#define	VXOR(x, y)	_mm256_xor_si256((x), (y))
+#define	VROR(x, n)	_mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define	VSET1(k)	_mm256_set1_epi32((int)(k))
+#define	LOAD_AVX2(p)	_mm256_loadu_si256((const __m256i *)(p))
+#define	STORE_AVX2(p, x)	_mm256_storeu_si256((__m256i *)(p), (x))
+
+__attribute__((target("avx2")))
+static void chunks_avx2(const uint8_t *chunks[], uint64_t counter, uint32_t cvs[][8])
+{
+    CHUNKS_KERNEL(__m256i, 8, LOAD_AVX2, STORE_AVX2);
+}
+
+#undef	VADD
+#undef	VXOR
+#undef	VROR
+#undef	VSET1
+
+typedef void (*Kernel)(const uint8_t *chunks[], uint64_t counter, uint32_t cvs[][8]);
+
+//  CHOOSE THE WIDEST KERNEL THE PROCESSOR SUPPORTS, ONCE
+static int choose_kernel(Kernel *kernel)
+{
+    static int	nlanes	= 0;
+
+    if(nlanes == 0) {
+	__builtin_cpu_init();
+	nlanes	= __builtin_cpu_supports("avx2") ? 8 : 4;
+    }
+    *kernel	= (nlanes == 8) ? chunks_avx2 : chunks_sse2;
+    return nlanes;
+}
+
+#endif
+
+#undef	ROUNDS
+#undef	G
+
+//  --------------------------------------------------------------------------
+
+//  ADD THE CHAINING VALUE OF A FINISHED CHUNK TO THE TREE, MERGING EVERY
+//  SUBTREE IT COMPLETES, ONE FOR EACH TRAILING ZERO BIT OF THE CHUNKS SO FAR
+static void add_chunk(BLAKE3_CTX *ctx, const uint32_t cv[8], uint64_t nchunks)
+{
+    uint32_t	node[8];
+    uint8_t	block[64];
+    uint32_t	out[16];
+
+    memcpy(node, cv, sizeof(node));
+    for( ; (nchunks & 1) == 0 ; nchunks >>= 1) {
+	const uint32_t *left = ctx->stack[--ctx->nstack];
+
+	for(int i=0 ; i<8 ; i++)
+	    for(int j=0 ; j<4 ; j++) {
+		block[4*i + j]		= (uint8_t)(left[i] >> (8*j));
+		block[32 + 4*i + j]	= (uint8_t)(node[i] >> (8*j));
+	    }
+	compress(IV, block, 0, 64, PARENT, out);
+	memcpy(node, out, sizeof(node));
+    }
+    memcpy(ctx->stack[ctx->nstack++], node, sizeof(node));
+}
+
+//  HASH WHOLE CHUNKS STARTING AT input, NONE OF THEM THE LAST OF THE INPUT
+static void add_chunks(BLAKE3_CTX *ctx, const uint8_t *input, size_t nchunks)
+{
+    uint32_t	cv[8];
+    size_t	c	= 0;
+
+#if	defined(BLAKE3_X86)
+    Kernel	kernel;
+    int		nlanes	= choose_kernel(&kernel);
+
+    for( ; c + nlanes <= nchunks ; c += nlanes) {
+	const uint8_t	*chunks[MAXLANES];
+	uint32_t	cvs[MAXLANES][8];
+
+	for(int l=0 ; l<nlanes ; l++)
+	    chunks[l]	= input + (c + l) * BLAKE3_CHUNKLEN;
+	kernel(chunks, ctx->chunk, cvs);
+	for(int l=0 ; l<nlanes ; l++) {
+	    ctx->chunk++;
+	    add_chunk(ctx, cvs[l], ctx->chunk);
+	}
+    }
+#endif
+    for( ; c < nchunks ; c++) {
+	chunk_cv(input + c * BLAKE3_CHUNKLEN, ctx->chunk, cv);
+	ctx->chunk++;
+	add_chunk(ctx, cv, ctx->chunk);
+    }
+}
+
+//  --------------------------------------------------------------------------
+
+//  START AN INCREMENTAL HASH
+void BLAKE3_init(BLAKE3_CTX *ctx)
+{
+    memcpy(ctx->cv, IV, sizeof(IV));
+    ctx->chunk		= 0;
+    ctx->nblock		= 0;
+    ctx->nblocks	= 0;
+    ctx->nstack		= 0;
+}
+
+//  ADD len BYTES OF input TO AN INCREMENTAL HASH
+//  A BLOCK OR CHUNK IS ONLY COMPRESSED ONCE SOME INPUT FOLLOWS IT, THE LAST ONE IS DIFFERENT
+void BLAKE3_update(BLAKE3_CTX *ctx, const void *input, size_t len)
+{
+    const uint8_t	*in	= (const uint8_t *)input;
+    uint32_t		out[16];
+
+    while(len > 0) {
+	if(ctx->nblock == 64) {
+	    uint32_t flags = (ctx->nblocks == 0) ? CHUNK_START : 0;
+
+	    if(ctx->nblocks == BLOCKS_PER_CHUNK - 1) {
+//  THE CHUNK IS FINISHED
+		compress(ctx->cv, ctx->block, ctx->chunk, 64, flags | CHUNK_END, out);
+		ctx->chunk++;
+		add_chunk(ctx, out, ctx->chunk);
+		memcpy(ctx->cv, IV, sizeof(IV));
+		ctx->nblocks	= 0;
+	    }
+	    else {
+		compress(ctx->cv, ctx->block, ctx->chunk, 64, flags, out);
+		memcpy(ctx->cv, out, 8*sizeof(uint32_t));
+		ctx->nblocks++;
+	    }
+	    ctx->nblock	= 0;
+	}
+//  WHOLE CHUNKS ARE HASHED IN PLACE, WITHOUT COPYING THEM
+	if(ctx->nblock == 0 && ctx->nblocks == 0 && len > BLAKE3_CHUNKLEN) {
+	    size_t nchunks = (len - 1) / BLAKE3_CHUNKLEN;
+
+	    add_chunks(ctx, in, nchunks);
+	    in	+= nchunks * BLAKE3_CHUNKLEN;
+	    len	-= nchunks * BLAKE3_CHUNKLEN;
+	}
+	size_t n = 64 - ctx->nblock;
+
+	n	= (n < len) ? n : len;
+	memcpy(ctx->block + ctx->nblock, in, n);
+	ctx->nblock	+= n;
+	in		+= n;
+	len		-= n;
+    }
+}
+
+//  FINISH AN INCREMENTAL HASH, LEAVE THE FIRST len_result BYTES OF IT IN result
+void *BLAKE3_final(BLAKE3_CTX *ctx, void *result, size_t len_result)
+{
+    uint32_t	cv[8];
+    uint8_t	block[64];
+    uint32_t	out[16];
+    uint64_t	counter	= ctx->chunk;
+    uint32_t	blocklen = (uint32_t)ctx->nblock;
+    uint32_t	flags	= CHUNK_END | (ctx->nblocks == 0 ? CHUNK_START : 0);
+
+//  THE LAST BLOCK OF THE LAST CHUNK, THEN ITS PARENTS UP THE RIGHT EDGE OF THE TREE
+    memcpy(cv, ctx->cv, sizeof(cv));
+    memset(block, 0, sizeof(block));
+    memcpy(block, ctx->block, ctx->nblock);
+    for(size_t i = ctx->nstack ; i > 0 ; i--) {
+	compress(cv, block, counter, blocklen, flags, out);
+	for(int w=0 ; w<8 ; w++)
+	    for(int j=0 ; j<4 ; j++) {
+		block[4*w + j]		= (uint8_t)(ctx->stack[i - 1][w] >> (8*j));
+		block[32 + 4*w + j]	= (uint8_t)(out[w] >> (8*j));
+	    }
+	memcpy(cv, IV, sizeof(IV));
+	counter		= 0;
+	blocklen	= 64;
+	flags		= PARENT;
+    }
+    compress(cv, block, 0, blocklen, flags | ROOT, out);
+
+    uint8_t *res	= (uint8_t *)result;
+
+    if(len_result > BLAKE3_BYTELEN)
+	len_result	= BLAKE3_BYTELEN;
+    for(size_t i=0 ; i<len_result ; i++)
+	res[i]	= (uint8_t)(out[i/4] >> (8*(i%4)));
+    return result;
+}
+
+//  CALCULATE THE FIRST len_result BYTES (AT MOST BLAKE3_BYTELEN) OF THE BLAKE3 HASH
+//  OF input BUFFER, LEAVE RESULT IN result
+void *BLAKE3_buffer(const void *input, size_t len, void *result, size_t len_result)
+{
+    BLAKE3_CTX ctx;
+
+    BLAKE3_init(&ctx);
+    BLAKE3_update(&ctx, input, len);
+    return BLAKE3_final(&ctx, result, len_result);
+}
+
+//  vim: ts=8 sw=4
@@ -0,0 +1,32 @@
+//  BLAKE3, THE CRYPTOGRAPHIC HASH (https://github.com/BLAKE3-team/BLAKE3)
+//  IN ITS DEFAULT HASHING MODE, WITH ITS OUTPUT CUT TO THE LENGTH ASKED FOR
+
+#include <stdlib.h>		// defines  size_t
+#include <stdint.h>
+
+#define BLAKE3_BYTELEN      32
+#define BLAKE3_CHUNKLEN     1024
+
+//  CALCULATE THE FIRST len_result BYTES (AT MOST BLAKE3_BYTELEN) OF THE BLAKE3 HASH
+//  OF input BUFFER, LEAVE RESULT IN result
+extern  void    *BLAKE3_buffer(const void *input, size_t len, void *result, size_t len_result);
+
+//  STATE OF AN INCREMENTAL HASH, FOR INPUT THAT IS NOT IN ONE BUFFER
+typedef struct {
+    uint32_t		cv[8];		// chaining value of the chunk being hashed
+    uint64_t		chunk;		// index of that chunk
+    unsigned char	block[64];	// partial block of the chunk not yet compressed
+    size_t		nblock;
+    size_t		nblocks;	// blocks of the chunk already compressed
+    uint32_t		stack[54][8];	// chaining values of finished subtrees, one per level
+    size_t		nstack;
+} BLAKE3_CTX;
+
+//  START AN INCREMENTAL HASH
+extern  void    BLAKE3_init(BLAKE3_CTX *ctx);
+
+//  ADD len BYTES OF input TO AN INCREMENTAL HASH
+extern  void    BLAKE3_update(BLAKE3_CTX *ctx, const void *input, size_t len);
+
+//  FINISH AN INCREMENTAL HASH, LEAVE THE FIRST len_result BYTES OF IT IN result
+extern  void    *BLAKE3_final(BLAKE3_CTX *ctx, void *result, size_t len_result);
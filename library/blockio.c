@@ -0,0 +1,84 @@
+#define _DEFAULT_SOURCE
+
+#include "sifsutils.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Positional I/O on a volume's file descriptor
+// Every transfer is retried until it completes, so callers never see interrupted or short transfers
+
+int SIFS_preadfull(int fd, void* data, size_t length, off_t offset)
+{
+    char* ptr = (char*)data;
+    while (length > 0)
+    {
+        ssize_t n = pread(fd, ptr, length, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            // Read error, or the volume ended early
+            return SIFS_FAILURE;
+        }
+        ptr += n;
+        offset += n;
+        length -= n;
+    }
+    return SIFS_SUCCESS;
+}
+
+int SIFS_pwritefull(int fd, const void* data, size_t length, off_t offset)
+{
+    const char* ptr = (const char*)data;
+    while (length > 0)
+    {
+        ssize_t n = pwrite(fd, ptr, length, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return SIFS_FAILURE;
+        }
+        ptr += n;
+        offset += n;
+        length -= n;
+    }
+    return SIFS_SUCCESS;
+}
+
+int SIFS_pwritevfull(int fd, struct iovec* iov, int iovcnt, off_t offset)
+{
+    // iov is consumed (modified) as the transfer progresses
+    while (iovcnt > 0)
+    {
+        int count = (iovcnt > SIFS_MAX_IOVECS) ? SIFS_MAX_IOVECS : iovcnt;
+        ssize_t n = pwritev(fd, iov, count, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return SIFS_FAILURE;
+        }
+        offset += n;
+        // Skip every buffer that was written completely, then advance into a partially written one
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return SIFS_SUCCESS;
+}
@@ -0,0 +1,446 @@
+#include "sifsutils.h"
+#include <string.h>
+#include <sys/uio.h>
+
+// An LRU write-back cache of single blocks, owned by a SIFS_VOLUME
+// Every cached block lives in one contiguous slab so that SIFS_releaseblock() can recognise them,
+// blocks handed out by SIFS_cacheget() stay pinned (and so cannot be evicted) until released
+
+#define SIFS_CACHE_NONE (-1)
+
+typedef struct
+{
+    SIFS_BLOCKID blockId;
+    bool valid;
+    bool dirty;
+    uint32_t pins;
+    // Doubly linked LRU list, head is the most recently used entry
+    int prev;
+    int next;
+    // Next entry in the same hash bucket
+    int chain;
+} SIFS_CACHEENTRY;
+
+struct SIFS_CACHE
+{
+    uint32_t capacity;
+    size_t blocksize;
+    char* slab;
+    SIFS_CACHEENTRY* entries;
+    int* buckets;
+    uint32_t nbuckets;
+    int head;
+    int tail;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+static uint32_t cache_bucket(SIFS_CACHE* cache, SIFS_BLOCKID blockId)
+{
+    // Fibonacci hashing, nbuckets is always a power of 2
+    return (uint32_t)(blockId * 2654435769u) & (cache->nbuckets - 1);
+}
+
+static char* cache_data(SIFS_CACHE* cache, int index)
+{
+    return cache->slab + (size_t)index * cache->blocksize;
+}
+
+static void cache_unlink(SIFS_CACHE* cache, int index)
+{
+    SIFS_CACHEENTRY* entry = &cache->entries[index];
+    if (entry->prev != SIFS_CACHE_NONE)
+    {
+        cache->entries[entry->prev].next = entry->next;
+    }
+    else
+    {
+        cache->head = entry->next;
+    }
+    if (entry->next != SIFS_CACHE_NONE)
+    {
+        cache->entries[entry->next].prev = entry->prev;
+    }
+    else
+    {
+        cache->tail = entry->prev;
+    }
+    entry->prev = entry->next = SIFS_CACHE_NONE;
+}
+
+static void cache_pushfront(SIFS_CACHE* cache, int index)
+{
+    SIFS_CACHEENTRY* entry = &cache->entries[index];
+    entry->prev = SIFS_CACHE_NONE;
+    entry->next = cache->head;
+    if (cache->head != SIFS_CACHE_NONE)
+    {
+        cache->entries[cache->head].prev = index;
+    }
+    cache->head = index;
+    if (cache->tail == SIFS_CACHE_NONE)
+    {
+        cache->tail = index;
+    }
+}
+
+static int cache_find(SIFS_CACHE* cache, SIFS_BLOCKID blockId)
+{
+    int index = cache->buckets[cache_bucket(cache, blockId)];
+    while (index != SIFS_CACHE_NONE && cache->entries[index].blockId != blockId)
+    {
+        index = cache->entries[index].chain;
+    }
+    return index;
+}
+
+static void cache_unhash(SIFS_CACHE* cache, int index)
+{
+    int* link = &cache->buckets[cache_bucket(cache, cache->entries[index].blockId)];
+    while (*link != index)
+    {
+        link = &cache->entries[*link].chain;
+    }
+    *link = cache->entries[index].chain;
+}
+
+// Writes a single dirty entry back to the volume
+static int cache_writeback(SIFS_VOLUME* volume, SIFS_CACHE* cache, int index)
+{
+    SIFS_CACHEENTRY* entry = &cache->entries[index];
+    size_t offset = volume->blockoffset + (size_t)entry->blockId * cache->blocksize;
+    if (SIFS_updatevolume(volume, offset, cache_data(cache, index), cache->blocksize) == SIFS_FAILURE)
+    {
+        return SIFS_FAILURE;
+    }
+    entry->dirty = false;
+    return SIFS_SUCCESS;
+}
+
+// Finds an entry that can hold a new block, evicting the least recently used unpinned entry
+static int cache_claim(SIFS_VOLUME* volume, SIFS_CACHE* cache, SIFS_BLOCKID blockId)
+{
+    int index = cache->tail;
+    while (index != SIFS_CACHE_NONE && cache->entries[index].pins > 0)
+    {
+        index = cache->entries[index].prev;
+    }
+    if (index == SIFS_CACHE_NONE)
+    {
+        // Every entry is in use
+        return SIFS_CACHE_NONE;
+    }
+    SIFS_CACHEENTRY* entry = &cache->entries[index];
+    if (entry->valid)
+    {
+        if (entry->dirty && cache_writeback(volume, cache, index) == SIFS_FAILURE)
+        {
+            return SIFS_CACHE_NONE;
+        }
+        cache_unhash(cache, index);
+    }
+    entry->blockId = blockId;
+    entry->valid = true;
+    entry->dirty = false;
+    uint32_t bucket = cache_bucket(cache, blockId);
+    entry->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = index;
+    cache_unlink(cache, index);
+    cache_pushfront(cache, index);
+    return index;
+}
+
+SIFS_CACHE* SIFS_cachecreate(size_t blocksize, uint32_t capacity)
+{
+    if (capacity == 0)
+    {
+        return NULL;
+    }
+    SIFS_CACHE* cache = (SIFS_CACHE*)calloc(1, sizeof(SIFS_CACHE));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    cache->capacity = capacity;
+    cache->blocksize = blocksize;
+    cache->nbuckets = 1;
+    while (cache->nbuckets < 2 * capacity)
+    {
+        cache->nbuckets <<= 1;
+    }
+    cache->slab = (char*)malloc((size_t)capacity * blocksize);
+    cache->entries = (SIFS_CACHEENTRY*)malloc(sizeof(SIFS_CACHEENTRY) * capacity);
+    cache->buckets = (int*)malloc(sizeof(int) * cache->nbuckets);
+    if (cache->slab == NULL || cache->entries == NULL || cache->buckets == NULL)
+    {
+        SIFS_cachedestroy(cache);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < cache->nbuckets; i++)
+    {
+        cache->buckets[i] = SIFS_CACHE_NONE;
+    }
+    // All entries start invalid on the LRU list, in order
+    cache->head = cache->tail = SIFS_CACHE_NONE;
+    for (int i = capacity - 1; i >= 0; i--)
+    {
+        cache->entries[i].valid = false;
+        cache->entries[i].dirty = false;
+        cache->entries[i].pins = 0;
+        cache->entries[i].chain = SIFS_CACHE_NONE;
+        cache_pushfront(cache, i);
+    }
+    return cache;
+}
+
+void SIFS_cachedestroy(SIFS_CACHE* cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+    free(cache->slab);
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+}
+
+bool SIFS_cacheowns(SIFS_CACHE* cache, const void* ptr)
+{
+    const char* p = (const char*)ptr;
+    return cache != NULL && p >= cache->slab && p < cache->slab + (size_t)cache->capacity * cache->blocksize;
+}
+
+void* SIFS_cachelookup(SIFS_CACHE* cache, SIFS_BLOCKID blockId)
+{
+    int index = cache_find(cache, blockId);
+    if (index == SIFS_CACHE_NONE)
+    {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    cache->entries[index].pins++;
+    cache_unlink(cache, index);
+    cache_pushfront(cache, index);
+    return cache_data(cache, index);
+}
+
+void* SIFS_cacheget(SIFS_VOLUME* volume, SIFS_BLOCKID blockId)
+{
+    SIFS_CACHE* cache = volume->cache;
+    int index = cache_find(cache, blockId);
+    if (index != SIFS_CACHE_NONE)
+    {
+        cache->hits++;
+    }
+    else
+    {
+        cache->misses++;
+        index = cache_claim(volume, cache, blockId);
+        if (index == SIFS_CACHE_NONE)
+        {
+            return NULL;
+        }
+        size_t offset = volume->blockoffset + (size_t)blockId * cache->blocksize;
+        if (SIFS_readvolumeptr(volume, cache_data(cache, index), offset, cache->blocksize) == SIFS_FAILURE)
+        {
+            cache_unhash(cache, index);
+            cache->entries[index].valid = false;
+            return NULL;
+        }
+    }
+    cache->entries[index].pins++;
+    cache_unlink(cache, index);
+    cache_pushfront(cache, index);
+    return cache_data(cache, index);
+}
+
+void SIFS_cacherelease(SIFS_CACHE* cache, void* block)
+{
+    int index = (int)(((char*)block - cache->slab) / cache->blocksize);
+    if (cache->entries[index].pins > 0)
+    {
+        cache->entries[index].pins--;
+    }
+}
+
+bool SIFS_cacheput(SIFS_VOLUME* volume, SIFS_BLOCKID blockId, const void* data)
+{
+    SIFS_CACHE* cache = volume->cache;
+    int index = cache_find(cache, blockId);
+    if (index == SIFS_CACHE_NONE)
+    {
+        index = cache_claim(volume, cache, blockId);
+        if (index == SIFS_CACHE_NONE)
+        {
+            return false;
+        }
+    }
+    char* ptr = cache_data(cache, index);
+    if (ptr != data)
+    {
+        memcpy(ptr, data, cache->blocksize);
+    }
+    cache->entries[index].dirty = true;
+    cache_unlink(cache, index);
+    cache_pushfront(cache, index);
+    return true;
+}
+
+void SIFS_cacheoverlay(SIFS_CACHE* cache, SIFS_BLOCKID first, void* data, size_t length, bool fromcache)
+{
+    // Copies the dirty cached blocks covered by the length bytes at block first into data (fromcache),
+    // or refreshes the cached copies from data after data was written straight to the volume
+    SIFS_BLOCKID nblocks = length / cache->blocksize + ((length % cache->blocksize == 0) ? 0 : 1);
+    for (uint32_t i = 0; i < cache->capacity; i++)
+    {
+        SIFS_CACHEENTRY* entry = &cache->entries[i];
+        if (entry->valid && entry->blockId >= first && entry->blockId - first < nblocks)
+        {
+            size_t offset = (size_t)(entry->blockId - first) * cache->blocksize;
+            size_t nbytes = (length - offset < cache->blocksize) ? length - offset : cache->blocksize;
+            if (fromcache)
+            {
+                if (entry->dirty)
+                {
+                    memcpy((char*)data + offset, cache_data(cache, i), nbytes);
+                }
+            }
+            else
+            {
+                memcpy(cache_data(cache, i), (const char*)data + offset, nbytes);
+            }
+        }
+    }
+}
+
+typedef struct
+{
+    SIFS_BLOCKID blockId;
+    int index;
+    // For the first block of a run written together, the index just past the run
+    uint32_t runend;
+} SIFS_CACHEDIRTY;
+
+static int compare_dirty(const void* a, const void* b)
+{
+    SIFS_BLOCKID x = ((const SIFS_CACHEDIRTY*)a)->blockId;
+    SIFS_BLOCKID y = ((const SIFS_CACHEDIRTY*)b)->blockId;
+    return (x > y) - (x < y);
+}
+
+int SIFS_cacheflush(SIFS_VOLUME* volume)
+{
+    SIFS_CACHE* cache = volume->cache;
+    SIFS_CACHEDIRTY* dirty = (SIFS_CACHEDIRTY*)malloc(sizeof(SIFS_CACHEDIRTY) * cache->capacity);
+    struct iovec* iov = (struct iovec*)malloc(sizeof(struct iovec) * cache->capacity);
+    if (dirty == NULL || iov == NULL)
+    {
+        // Fall back to writing the dirty blocks back one at a time
+        free(dirty);
+        free(iov);
+        int result = SIFS_SUCCESS;
+        for (uint32_t i = 0; i < cache->capacity; i++)
+        {
+            if (cache->entries[i].valid && cache->entries[i].dirty && cache_writeback(volume, cache, i) == SIFS_FAILURE)
+            {
+                result = SIFS_FAILURE;
+            }
+        }
+        return result;
+    }
+    uint32_t ndirty = 0;
+    for (uint32_t i = 0; i < cache->capacity; i++)
+    {
+        if (cache->entries[i].valid && cache->entries[i].dirty)
+        {
+            dirty[ndirty].blockId = cache->entries[i].blockId;
+            dirty[ndirty++].index = i;
+        }
+    }
+    // Write runs of consecutive dirty blocks with a single gathered write each,
+    // the I/O engine keeps several runs in flight at once
+    qsort(dirty, ndirty, sizeof(SIFS_CACHEDIRTY), compare_dirty);
+    int result = SIFS_SUCCESS;
+    uint32_t outstanding = 0;
+    SIFS_IOCOMPLETION completions[SIFS_IODEPTH];
+    uint32_t first = 0;
+    while (first < ndirty || outstanding > 0)
+    {
+        uint32_t count = 0;
+        if (first < ndirty)
+        {
+            uint32_t last = first + 1;
+            while (last < ndirty && last - first < SIFS_MAX_IOVECS && dirty[last].blockId == dirty[last - 1].blockId + 1)
+            {
+                last++;
+            }
+            dirty[first].runend = last;
+            for (uint32_t i = first; i < last; i++)
+            {
+                iov[i].iov_base = cache_data(cache, dirty[i].index);
+                iov[i].iov_len = cache->blocksize;
+            }
+            off_t offset = volume->blockoffset + (off_t)dirty[first].blockId * cache->blocksize;
+            if (!volume->writable)
+            {
+                result = SIFS_FAILURE;
+            }
+            else if (volume->io == NULL)
+            {
+                completions[count].tag = first;
+                completions[count++].result = (SIFS_pwritevfull(volume->fd, iov + first, last - first, offset) == SIFS_SUCCESS) ? 0 : -1;
+            }
+            else if (SIFS_ioprep(volume->io, true, iov + first, last - first, offset, first) == SIFS_SUCCESS)
+            {
+                outstanding++;
+            }
+            else
+            {
+                // The engine is full, wait for a run to complete and try this one again
+                last = first;
+                count = SIFS_ioreap(volume->io, completions, SIFS_IODEPTH, 1);
+                if (count == 0)
+                {
+                    result = SIFS_FAILURE;
+                    break;
+                }
+                outstanding -= count;
+            }
+            first = last;
+        }
+        else
+        {
+            count = SIFS_ioreap(volume->io, completions, SIFS_IODEPTH, outstanding);
+            if (count == 0)
+            {
+                result = SIFS_FAILURE;
+                break;
+            }
+            outstanding -= count;
+        }
+        // Blocks are only clean once their run has reached the volume
+        for (uint32_t j = 0; j < count; j++)
+        {
+            if (completions[j].result < 0)
+            {
+                result = SIFS_FAILURE;
+                continue;
+            }
+            for (uint32_t i = completions[j].tag; i < dirty[completions[j].tag].runend; i++)
+            {
+                cache->entries[dirty[i].index].dirty = false;
+            }
+        }
+    }
+    free(dirty);
+    free(iov);
+    return result;
+}
+
+void SIFS_cachecounters(SIFS_CACHE* cache, uint64_t* hits, uint64_t* misses)
+{
+    *hits = cache->hits;
+    *misses = cache->misses;
+}
@@ -0,0 +1,302 @@
+#include "sifsutils.h"
+#include <string.h>
+
+// Number of entries of a list of chunks read from the volume at once
+#define SIFS_CHUNK_BATCH    64
+
+// Value the rolling hash adds for each byte, the same for every volume so that chunks end in the same places
+static uint64_t gear[256];
+static bool gearready = false;
+
+// Helper function that fills gear[] with splitmix64 from a fixed seed
+static void init_gear(void)
+{
+    uint64_t x = 0x5349465343484e4bULL;
+    for (int i = 0; i < 256; i++)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+    gearready = true;
+}
+
+// Helper function that returns the length of the chunk at the start of n bytes of data
+static size_t cut(const unsigned char* data, size_t n)
+{
+    if (n <= SIFS_CHUNK_MIN)
+    {
+        return n;
+    }
+    size_t max = (n < SIFS_CHUNK_MAX) ? n : SIFS_CHUNK_MAX;
+    const uint64_t mask = ~(uint64_t)0 << (64 - SIFS_CHUNK_MASKBITS);
+    uint64_t hash = 0;
+    // Each byte is shifted out of the hash 64 bytes later, so it starts that far before the shortest chunk ends
+    for (size_t i = SIFS_CHUNK_MIN - 64; i < max; i++)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        if (i >= SIFS_CHUNK_MIN - 1 && (hash & mask) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return max;
+}
+
+// Helper function that reads n entries of a list of chunks, starting with entry first, from the runs holding it
+static int read_entries(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* runs, uint64_t first, SIFS_CHUNK* chunks, size_t n)
+{
+    return SIFS_readextents(volume, runs, sizeof(uint64_t) + first * sizeof(SIFS_CHUNK), chunks, n * sizeof(SIFS_CHUNK));
+}
+
+// Helper function that adds a reference to the chunk of nbytes of data with the given md5, storing it if it is new
+static int take_chunk(SIFS_VOLUME* volume, const unsigned char* md5, const void* data, size_t nbytes)
+{
+    SIFS_BLOCKID blockId;
+    SIFS_FILEBLOCK* block = SIFS_getfileblock(volume, md5, &blockId);
+    if (block == NULL)
+    {
+        SIFS_EXTENTLIST extents;
+        blockId = SIFS_allocateblocks(volume, 1, SIFS_FILE);
+        if (blockId == SIFS_ROOTDIR_BLOCKID ||
+            SIFS_allocateextents(volume, SIFS_calcnblocks(&volume->header, nbytes), &extents) == SIFS_FAILURE)
+        {
+            if (blockId != SIFS_ROOTDIR_BLOCKID)
+            {
+                SIFS_freeblocks(volume, blockId, 1);
+            }
+            return SIFS_FAILURE;
+        }
+        block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, blockId);
+        if (block == NULL)
+        {
+            SIFS_freeextents(volume, &extents);
+            SIFS_freeblocks(volume, blockId, 1);
+            return SIFS_FAILURE;
+        }
+        block->modtime = time(NULL);
+        memcpy(block->md5, md5, MD5_BYTELEN);
+        block->length = nbytes;
+        SIFS_setextents(volume, block, &extents);
+        // A chunk has no names, the block could still hold those of a previous file
+        block->nfiles = 0;
+        memset(block->filenames, 0, sizeof(block->filenames));
+        SIFS_writeextents(volume, &extents, data, nbytes);
+        SIFS_hashinsert(volume, md5, blockId);
+    }
+    block->nfiles++;
+    SIFS_updateblock(volume, blockId, block, 0);
+    SIFS_releaseblock(volume, block);
+    return SIFS_SUCCESS;
+}
+
+// Helper function that drops a reference to the chunk with the given md5, freeing it with the last one
+static void drop_chunk(SIFS_VOLUME* volume, const unsigned char* md5)
+{
+    SIFS_BLOCKID blockId;
+    SIFS_FILEBLOCK* block = SIFS_getfileblock(volume, md5, &blockId);
+    if (block == NULL)
+    {
+        return;
+    }
+    if (block->nfiles > 0 && --block->nfiles == 0)
+    {
+        SIFS_EXTENTLIST extents;
+        SIFS_getextents(volume, block, &extents);
+        SIFS_freeextents(volume, &extents);
+        SIFS_hashremove(volume, block->md5, blockId);
+        SIFS_freeblocks(volume, blockId, 1);
+    }
+    SIFS_updateblock(volume, blockId, block, 0);
+    SIFS_releaseblock(volume, block);
+}
+
+bool SIFS_ischunked(SIFS_VOLUME* volume, size_t nbytes)
+{
+    return (volume->exthdr.features & SIFS_FEATURE_CHUNKS) && nbytes >= SIFS_CHUNKED_MINFILE;
+}
+
+int SIFS_writechunks(SIFS_VOLUME* volume, const void* data, size_t nbytes, SIFS_EXTENTLIST* extents)
+{
+    if (!gearready)
+    {
+        init_gear();
+    }
+    // Every chunk but the last is at least SIFS_CHUNK_MIN bytes long
+    size_t maxchunks = nbytes / SIFS_CHUNK_MIN + 1;
+    char* list = (char*)malloc(sizeof(uint64_t) + maxchunks * sizeof(SIFS_CHUNK));
+    // Zeroed so that no entry is ever passed on uninitialized, as when there is no data at all
+    const void** inputs = (const void**)calloc(maxchunks, sizeof(void*));
+    size_t* lens = (size_t*)calloc(maxchunks, sizeof(size_t));
+    void** md5s = (void**)calloc(maxchunks, sizeof(void*));
+    if (list == NULL || inputs == NULL || lens == NULL || md5s == NULL)
+    {
+        free(list);
+        free(inputs);
+        free(lens);
+        free(md5s);
+        SIFS_errno = SIFS_ENOMEM;
+        return SIFS_FAILURE;
+    }
+
+    // Find where every chunk ends
+    const unsigned char* bytes = (const unsigned char*)data;
+    SIFS_CHUNK* chunks = (SIFS_CHUNK*)(list + sizeof(uint64_t));
+    uint64_t nchunks = 0;
+    for (size_t start = 0; start < nbytes; nchunks++)
+    {
+        size_t length = cut(bytes + start, nbytes - start);
+        inputs[nchunks] = bytes + start;
+        lens[nchunks] = length;
+        md5s[nchunks] = chunks[nchunks].md5;
+        start += length;
+        chunks[nchunks].end = start;
+    }
+    memcpy(list, &nchunks, sizeof(uint64_t));
+    // The chunks are digested all at once, then inverted so that none can be mistaken for a whole file
+    SIFS_digestbuffers(volume, nchunks, inputs, lens, md5s);
+    for (uint64_t i = 0; i < nchunks; i++)
+    {
+        for (int b = 0; b < MD5_BYTELEN; b++)
+        {
+            chunks[i].md5[b] ^= 0xff;
+        }
+    }
+
+    // Only the chunks not already stored are written, then the list of all of them
+    SIFS_beginbitmapbatch(volume);
+    uint64_t taken = 0;
+    while (taken < nchunks && take_chunk(volume, chunks[taken].md5, inputs[taken], lens[taken]) == SIFS_SUCCESS)
+    {
+        taken++;
+    }
+    size_t listbytes = sizeof(uint64_t) + nchunks * sizeof(SIFS_CHUNK);
+    int result = SIFS_FAILURE;
+    if (taken == nchunks && SIFS_allocateextents(volume, SIFS_calcnblocks(&volume->header, listbytes), extents) == SIFS_SUCCESS)
+    {
+        SIFS_writeextents(volume, extents, list, listbytes);
+        extents->magic = SIFS_CHUNKLIST_MAGIC;
+        result = SIFS_SUCCESS;
+    }
+    else
+    {
+        // Give back the chunks taken before the volume ran out of space
+        while (taken > 0)
+        {
+            drop_chunk(volume, chunks[--taken].md5);
+        }
+        SIFS_errno = SIFS_ENOSPC;
+    }
+    SIFS_endbitmapbatch(volume);
+    free(list);
+    free(inputs);
+    free(lens);
+    free(md5s);
+    return result;
+}
+
+int SIFS_readchunks(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents, size_t offset, void* data, size_t length)
+{
+    if (length == 0)
+    {
+        return SIFS_SUCCESS;
+    }
+    // The runs themselves are read as those of any other file
+    SIFS_EXTENTLIST runs = *extents;
+    runs.magic = SIFS_EXTENTLIST_MAGIC;
+    uint64_t nchunks;
+    if (SIFS_readextents(volume, &runs, 0, &nchunks, sizeof(uint64_t)) == SIFS_FAILURE)
+    {
+        return SIFS_FAILURE;
+    }
+    // Find the first chunk that ends after offset, and where it starts
+    uint64_t low = 0;
+    uint64_t high = nchunks;
+    SIFS_CHUNK chunk;
+    while (low < high)
+    {
+        uint64_t middle = low + (high - low) / 2;
+        if (read_entries(volume, &runs, middle, &chunk, 1) == SIFS_FAILURE)
+        {
+            return SIFS_FAILURE;
+        }
+        if (chunk.end > offset)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    uint64_t start = 0;
+    if (low > 0)
+    {
+        if (read_entries(volume, &runs, low - 1, &chunk, 1) == SIFS_FAILURE)
+        {
+            return SIFS_FAILURE;
+        }
+        start = chunk.end;
+    }
+
+    char* ptr = (char*)data;
+    SIFS_CHUNK chunks[SIFS_CHUNK_BATCH];
+    for (uint64_t i = low; i < nchunks && length > 0; )
+    {
+        size_t n = (nchunks - i < SIFS_CHUNK_BATCH) ? (size_t)(nchunks - i) : SIFS_CHUNK_BATCH;
+        if (read_entries(volume, &runs, i, chunks, n) == SIFS_FAILURE)
+        {
+            return SIFS_FAILURE;
+        }
+        for (size_t k = 0; k < n && length > 0; k++, i++)
+        {
+            SIFS_FILEBLOCK* block = SIFS_getfileblock(volume, chunks[k].md5, NULL);
+            if (block == NULL)
+            {
+                // Every chunk of a list stays stored while the list includes it
+                SIFS_errno = SIFS_ENOTVOL;
+                return SIFS_FAILURE;
+            }
+            SIFS_EXTENTLIST chunkruns;
+            SIFS_getextents(volume, block, &chunkruns);
+            SIFS_releaseblock(volume, block);
+            size_t count = chunks[k].end - offset;
+            count = (count < length) ? count : length;
+            if (SIFS_readextents(volume, &chunkruns, offset - start, ptr, count) == SIFS_FAILURE)
+            {
+                return SIFS_FAILURE;
+            }
+            ptr += count;
+            length -= count;
+            offset += count;
+            start = chunks[k].end;
+        }
+    }
+    return SIFS_SUCCESS;
+}
+
+void SIFS_dropchunks(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents)
+{
+    SIFS_EXTENTLIST runs = *extents;
+    runs.magic = SIFS_EXTENTLIST_MAGIC;
+    uint64_t nchunks;
+    if (SIFS_readextents(volume, &runs, 0, &nchunks, sizeof(uint64_t)) == SIFS_FAILURE)
+    {
+        return;
+    }
+    SIFS_CHUNK chunks[SIFS_CHUNK_BATCH];
+    for (uint64_t i = 0; i < nchunks; )
+    {
+        size_t n = (nchunks - i < SIFS_CHUNK_BATCH) ? (size_t)(nchunks - i) : SIFS_CHUNK_BATCH;
+        if (read_entries(volume, &runs, i, chunks, n) == SIFS_FAILURE)
+        {
+            return;
+        }
+        for (size_t k = 0; k < n; k++, i++)
+        {
+            drop_chunk(volume, chunks[k].md5);
+        }
+    }
+}
@@ -2,196 +2,265 @@
 #include <string.h>
 #include <stdio.h>
 
-// Helper function that finds the fileblock that references datablockId as its data
-SIFS_FILEBLOCK* find_fileblock(const char* volumename, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, SIFS_BLOCKID datablockId, SIFS_BLOCKID* outBlockId)
+// Helper function that finds the fileblock with a run of its data starting at datablockId
+// The runs of the file are copied into extents and the index of that run into outExtent
+SIFS_FILEBLOCK* find_fileblock(SIFS_VOLUME* volume, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, SIFS_BLOCKID datablockId,
+    SIFS_BLOCKID* outBlockId, SIFS_EXTENTLIST* extents, uint32_t* outExtent)
 {
-    // Iterate over all blocks (ignore root directory)
-    for (SIFS_BLOCKID i = SIFS_ROOTDIR_BLOCKID + 1; i < header->nblocks; i++)
+    // Iterate over all fileblocks (ignore root directory)
+    for (SIFS_BLOCKID i = SIFS_bitmapfind(bitmap, SIFS_ROOTDIR_BLOCKID + 1, header->nblocks, SIFS_FILE); i < header->nblocks;
+        i = SIFS_bitmapfind(bitmap, i + 1, header->nblocks, SIFS_FILE))
     {
-        if (bitmap[i] == SIFS_FILE)
+        SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, i);
+        if (fileblock == NULL)
+        {
+            return NULL;
+        }
+        // Check if any run of the fileblock starts at datablockId
+        SIFS_getextents(volume, fileblock, extents);
+        for (uint32_t k = 0; k < extents->nextents; k++)
         {
-            SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, i);
-            // Check if the fileblock references the datablockId
-            if (fileblock->firstblockID == datablockId)
+            if (extents->extents[k].start == datablockId)
             {
                 if (outBlockId)
                 {
                     *outBlockId = i;
                 }
+                *outExtent = k;
                 return fileblock;
             }
-            free(fileblock);
         }
+        SIFS_releaseblock(volume, fileblock);
     }
     // No fileblock references the datablock
     return NULL;
 }
 
 // Helper function that updates the entries of all directories that reference currentIndex
-// Sets the entry to reference newIndex
-void update_references(const char* volumename, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, SIFS_BLOCKID currentIndex, SIFS_BLOCKID newIndex)
+// Sets the entry to reference newIndex, the blocks at both indexes are not yet directories
+void update_references(SIFS_VOLUME* volume, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, SIFS_BLOCKID currentIndex, SIFS_BLOCKID newIndex)
 {
-    // Iterate through all blocks
-    for (SIFS_BLOCKID i = 0; i < header->nblocks; i++)
+    // Iterate through all directory blocks
+    for (SIFS_BLOCKID i = SIFS_bitmapfind(bitmap, 0, header->nblocks, SIFS_DIR); i < header->nblocks;
+        i = SIFS_bitmapfind(bitmap, i + 1, header->nblocks, SIFS_DIR))
     {
-        if (bitmap[i] == SIFS_DIR && i != currentIndex)
+        if (i == currentIndex || i == newIndex)
         {
-            SIFS_DIRBLOCK* dir = (SIFS_DIRBLOCK*)SIFS_getblock(volumename, i);
-            bool updated = false;
-            // Find any entry that references currentIndex and set to newIndex
-            for (int i = 0; i < dir->nentries; i++)
-            {
-                if (dir->entries[i].blockID == currentIndex)
-                {
-                    dir->entries[i].blockID = newIndex;
-                    updated = true;
-                }
-            }
-            if (updated)
+            continue;
+        }
+        SIFS_DIRBLOCK* dir = (SIFS_DIRBLOCK*)SIFS_getblock(volume, i);
+        bool updated = false;
+        // Find any entry that references currentIndex and set to newIndex
+        for (int i = 0; i < dir->nentries; i++)
+        {
+            if (dir->entries[i].blockID == currentIndex)
             {
-                // If we modified the directory, update its data back into the volume
-                SIFS_updateblock(volumename, i, dir, 0);
+                dir->entries[i].blockID = newIndex;
+                updated = true;
             }
-            free(dir);
         }
+        if (updated)
+        {
+            // If we modified the directory, update its data back into the volume
+            SIFS_updateblock(volume, i, dir, 0);
+        }
+        SIFS_releaseblock(volume, dir);
     }
 }
 
-// Helper function that moves a directory block from currentIndex to newIndex
-void move_dirblock(const char* volumename, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, SIFS_BLOCKID currentIndex, SIFS_BLOCKID newIndex)
+// Helper function that moves a directory block from currentIndex to the free block newIndex
+// Returns false, with nothing moved, if the block could not be read or newIndex taken
+bool move_dirblock(SIFS_VOLUME* volume, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, SIFS_BLOCKID currentIndex, SIFS_BLOCKID newIndex)
 {
-    SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)SIFS_getblock(volumename, currentIndex);
-    // Update all entries that refer to this directory
-    update_references(volumename, header, bitmap, currentIndex, newIndex);
-    // Free the existing directory block and update local copy of the bitmap
-    SIFS_freeblocks(volumename, currentIndex, 1);
-    bitmap[currentIndex] = SIFS_UNUSED;
-    // Allocate a new block for the directory and update local copy of the bitmap
-    SIFS_BLOCKID blockId = SIFS_allocateblocks(volumename, 1, SIFS_DIR);
-    bitmap[blockId] = SIFS_DIR;
-    if (blockId != newIndex || blockId == SIFS_ROOTDIR_BLOCKID)
+    SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)SIFS_getblock(volume, currentIndex);
+    if (dirblock == NULL)
     {
-        // If we get here, something has gone horribly wrong (newIndex is not valid?)
-        // In theory, should never get here
-        return;
+        return false;
     }
+    // Take the block at newIndex before giving up the existing one
+    if (!SIFS_allocateblocksat(volume, newIndex, 1, SIFS_DIR))
+    {
+        // The block is free, so only the index of free blocks can have run out of memory
+        SIFS_releaseblock(volume, dirblock);
+        SIFS_errno = SIFS_ENOMEM;
+        return false;
+    }
+    // Update all entries that refer to this directory
+    update_references(volume, header, bitmap, currentIndex, newIndex);
+    SIFS_freeblocks(volume, currentIndex, 1);
     // Update the volume to reflect moved directory
-    SIFS_updateblock(volumename, newIndex, dirblock, 0);
-    free(dirblock);
+    SIFS_updateblock(volume, newIndex, dirblock, 0);
+    SIFS_releaseblock(volume, dirblock);
+    return true;
 }
 
-// Helper function that moves a file block from currentIndex to newIndex
-void move_fileblock(const char* volumename, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, SIFS_BLOCKID currentIndex, SIFS_BLOCKID newIndex)
+// Helper function that moves a file block from currentIndex to the free block newIndex
+// Returns false, with nothing moved, if the block could not be read or newIndex taken
+bool move_fileblock(SIFS_VOLUME* volume, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, SIFS_BLOCKID currentIndex, SIFS_BLOCKID newIndex)
 {
-    SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, currentIndex);
-    // Update all entries that refer to this file
-    update_references(volumename, header, bitmap, currentIndex, newIndex);
-    // Free the existing file block and update the local copy of the bitmap
-    SIFS_freeblocks(volumename, currentIndex, 1);
-    bitmap[currentIndex] = SIFS_UNUSED;
-    // Alocate a new block for the file and update local copy of the bitmap
-    SIFS_BLOCKID blockId = SIFS_allocateblocks(volumename, 1, SIFS_FILE);
-    bitmap[blockId] = SIFS_FILE;
-    if (blockId != newIndex || blockId == SIFS_ROOTDIR_BLOCKID)
+    SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, currentIndex);
+    if (fileblock == NULL)
     {
-        // If we get here, something has gone horribly wrong (newIndex is not valid?)
-        // In theory, should never get here
-        return;
+        return false;
     }
+    // Take the block at newIndex before giving up the existing one
+    if (!SIFS_allocateblocksat(volume, newIndex, 1, SIFS_FILE))
+    {
+        SIFS_releaseblock(volume, fileblock);
+        SIFS_errno = SIFS_ENOMEM;
+        return false;
+    }
+    // Update all entries that refer to this file, the index of fileblocks by md5 and any chain it is in
+    update_references(volume, header, bitmap, currentIndex, newIndex);
+    SIFS_hashmove(volume, fileblock->md5, currentIndex, newIndex);
+    SIFS_movechain(volume, fileblock, currentIndex, newIndex);
+    SIFS_freeblocks(volume, currentIndex, 1);
     // Update the volume to reflect moved file
-    SIFS_updateblock(volumename, newIndex, fileblock, 0);
-    free(fileblock);
+    SIFS_updateblock(volume, newIndex, fileblock, 0);
+    SIFS_releaseblock(volume, fileblock);
+    return true;
 }
 
-// Helper function that moves n datablocks that start at currentIndex to start at newIndex
-void move_datablocks(const char* volumename, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, 
-    SIFS_BLOCKID currentIndex, SIFS_BLOCKID nblocks, SIFS_BLOCKID newIndex, SIFS_FILEBLOCK* fileblock)
+// Helper function that moves n datablocks that start at currentIndex to start at newIndex, every block
+// from newIndex up to currentIndex is free. Returns false, with nothing moved, if the data could not be read
+// or the free blocks taken
+bool move_datablocks(SIFS_VOLUME* volume, SIFS_VOLUME_HEADER* header, SIFS_BIT* bitmap, 
+    SIFS_BLOCKID currentIndex, SIFS_BLOCKID nblocks, SIFS_BLOCKID newIndex)
 {
     // Get a pointer to the data
-    void* dataPtr = SIFS_getblocks(volumename, currentIndex, nblocks);
-    // Free the previous data blocks and update local copy of the bitmap
-    SIFS_freeblocks(volumename, currentIndex, nblocks);
-    for (SIFS_BLOCKID i = currentIndex; i < currentIndex + nblocks; i++)
+    void* dataPtr = SIFS_getblocks(volume, currentIndex, nblocks);
+    if (dataPtr == NULL)
     {
-        bitmap[i] = SIFS_UNUSED;
+        return false;
     }
-    // Allocate new datablocks and update local copy of the bitmap
-    SIFS_BLOCKID blockId = SIFS_allocateblocks(volumename, nblocks, SIFS_DATABLOCK);
-    for (SIFS_BLOCKID i = blockId; i < blockId + nblocks; i++)
+    // The new run can overlap the old one, only its free blocks are taken and only the old blocks
+    // it leaves behind are freed, the blocks in both stay data blocks throughout
+    SIFS_BLOCKID ngap = currentIndex - newIndex;
+    SIFS_BLOCKID ntaken = (nblocks < ngap) ? nblocks : ngap;
+    if (!SIFS_allocateblocksat(volume, newIndex, ntaken, SIFS_DATABLOCK))
     {
-        bitmap[i] = SIFS_DATABLOCK;
+        SIFS_releaseblock(volume, dataPtr);
+        SIFS_errno = SIFS_ENOMEM;
+        return false;
     }
-    if (blockId != newIndex || blockId == SIFS_ROOTDIR_BLOCKID)
-    {
-        // If we get here, something has gone horribly wrong (newIndex is not valid?)
-        // In theory, should never get here
-        return;
-    }
-    // Update the fileblock that references the data
-    fileblock->firstblockID = newIndex;
-    // Update the data in the volume, the fileblock will be written back to the volume elsewhere
-    SIFS_updateblock(volumename, newIndex, dataPtr, fileblock->length);
-    free(dataPtr);
+    // Update the data in the volume, the fileblock referencing it is updated elsewhere
+    SIFS_updateblock(volume, newIndex, dataPtr, nblocks * header->blocksize);
+    SIFS_releaseblock(volume, dataPtr);
+    SIFS_freeblocks(volume, currentIndex + nblocks - ntaken, ntaken);
+    return true;
 }
 
-int SIFS_defrag(const char *volumename)
+int SIFS_vdefrag(SIFS_VOLUME *volume)
 {
-    if (volumename == NULL)
+    if (volume == NULL)
     {
         SIFS_errno = SIFS_EINVAL;
         return SIFS_FAILURE;
     }
-
-    SIFS_VOLUME_HEADER header;
-    if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
+    if (!volume->writable)
     {
-        // SIFS_errno set in SIFS_getvolumeheader()
+        SIFS_errno = SIFS_EROFS;
         return SIFS_FAILURE;
     }
-    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volumename);
+    // The blocks reserved by a writer are not yet referenced by any fileblock, so they could not be moved
+    if (volume->writers != NULL)
+    {
+        SIFS_errno = SIFS_EBUSY;
+        return SIFS_FAILURE;
+    }
+
+    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
     if (bitmap == NULL)
     {
         // SIFS_errno set in SIFS_getvolumebitmap()
         return SIFS_FAILURE;
     }
 
-    SIFS_BLOCKID freeblockId = SIFS_ROOTDIR_BLOCKID;
+    // Moved blocks leave the entries cached by their block IDs out of date
+    SIFS_dentryclear(volume);
+    SIFS_BLOCKID nblocks = volume->header.nblocks;
     // Find the first freeblock available
-    for (SIFS_BLOCKID i = SIFS_ROOTDIR_BLOCKID + 1; i < header.nblocks; i++)
+    SIFS_BLOCKID freeblockId = SIFS_bitmapfind(bitmap, SIFS_ROOTDIR_BLOCKID + 1, nblocks, SIFS_UNUSED);
+    while (freeblockId < nblocks)
     {
-        if (bitmap[i] == SIFS_UNUSED && freeblockId == SIFS_ROOTDIR_BLOCKID)
+        // Find the first block in use to the right of the freeblock
+        SIFS_BLOCKID i = SIFS_bitmapskip(bitmap, freeblockId, nblocks, SIFS_UNUSED);
+        if (i == nblocks)
+        {
+            break;
+        }
+        // Move these block(s) to the left to fill the space
+        bool moved = true;
+        if (bitmap[i] == SIFS_FILE)
         {
-            freeblockId = i;
+            moved = move_fileblock(volume, &volume->header, bitmap, i, freeblockId);
         }
-        // Check if the current block is in use and there is a freeblock to the left of it
-        else if (freeblockId != SIFS_ROOTDIR_BLOCKID && bitmap[i] != SIFS_UNUSED)
+        else if (bitmap[i] == SIFS_DIR)
         {
-            // Move these block(s) to the left to fill the space
-            if (bitmap[i] == SIFS_FILE)
+            moved = move_dirblock(volume, &volume->header, bitmap, i, freeblockId);
+        }
+        else if (bitmap[i] == SIFS_DATABLOCK)
+        {
+            // Also need to find the fileblock that references this data and update it
+            SIFS_BLOCKID fileblockId;
+            SIFS_EXTENTLIST extents;
+            uint32_t k;
+            SIFS_FILEBLOCK* fileblock = find_fileblock(volume, &volume->header, bitmap, i, &fileblockId, &extents, &k);
+            if (fileblock == NULL)
             {
-                move_fileblock(volumename, &header, bitmap, i, freeblockId);
+                // Data no fileblock owns (left by a writer that was never committed) stays where it is,
+                // the search for free blocks carries on after it
+                freeblockId = SIFS_bitmapfind(bitmap, i + 1, nblocks, SIFS_UNUSED);
+                continue;
             }
-            else if (bitmap[i] == SIFS_DIR)
+            moved = move_datablocks(volume, &volume->header, bitmap, i, extents.extents[k].count, freeblockId);
+            if (!moved)
             {
-                move_dirblock(volumename, &header, bitmap, i, freeblockId);
+                // SIFS_errno set in move_datablocks()
+                SIFS_releaseblock(volume, fileblock);
+                return SIFS_FAILURE;
             }
-            else if (bitmap[i] == SIFS_DATABLOCK)
+            extents.extents[k].start = freeblockId;
+            // A run that now follows straight on from the previous run of the same file is joined to it
+            if (k > 0 && extents.extents[k - 1].start + extents.extents[k - 1].count == freeblockId)
             {
-                // Also need to find the fileblock that references this data and update it
-                SIFS_BLOCKID fileblockId;
-                SIFS_FILEBLOCK* fileblock = find_fileblock(volumename, &header, bitmap, i, &fileblockId);
-                SIFS_BLOCKID nblocks = SIFS_calcnblocks(&header, fileblock->length);
-                move_datablocks(volumename, &header, bitmap, i, nblocks, freeblockId, fileblock);
-                SIFS_updateblock(volumename, fileblockId, fileblock, 0);
-                free(fileblock);
+                extents.extents[k - 1].count += extents.extents[k].count;
+                memmove(&extents.extents[k], &extents.extents[k + 1], (extents.nextents - k - 1) * sizeof(SIFS_EXTENT));
+                extents.nextents--;
             }
-            // Modified the layout of the volume, go back and search for free blocks where we started
-            i = freeblockId;
-            freeblockId = SIFS_ROOTDIR_BLOCKID;
+            SIFS_setextents(volume, fileblock, &extents);
+            SIFS_updateblock(volume, fileblockId, fileblock, 0);
+            // The other fileblocks of a chain hold the same runs
+            SIFS_syncchain(volume, fileblock, fileblockId);
+            SIFS_releaseblock(volume, fileblock);
         }
+        if (!moved)
+        {
+            // SIFS_errno set in the helper that could not move the block
+            return SIFS_FAILURE;
+        }
+        // Modified the layout of the volume, go back and search for free blocks where we started
+        freeblockId = SIFS_bitmapfind(bitmap, freeblockId, nblocks, SIFS_UNUSED);
     }
 
-    free(bitmap);
     SIFS_errno = SIFS_EOK;
     return SIFS_SUCCESS;
 }
+
+// move all unused blocks to the end of the volume, opening the volume only for the duration of the call
+int SIFS_defrag(const char *volumename)
+{
+    if (volumename == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vdefrag(volume);
+    return SIFS_closeafter(volume, result);
+}
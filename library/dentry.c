@@ -0,0 +1,108 @@
+#include "sifsutils.h"
+#include <string.h>
+
+// A cache of directory entries owned by a SIFS_VOLUME, mapping the name of an entry within its parent directory to
+// the block it references. Each (parent, name) pair hashes to one slot, a newer entry simply replaces an older one.
+// Only entries that exist are cached, so adding an entry never makes the cache wrong, while anything that removes
+// an entry or moves a block forgets the entries it affects
+
+// Number of slots of the cache, a power of 2
+#define SIFS_DENTRY_SLOTS   1024
+
+typedef struct
+{
+    SIFS_BLOCKID parentId;
+    SIFS_BLOCKID blockId;
+    uint32_t fileindex;
+    // SIFS_UNUSED for an empty slot
+    SIFS_BIT type;
+    char name[SIFS_MAX_NAME_LENGTH];
+} SIFS_DENTRY;
+
+struct SIFS_DENTRIES
+{
+    SIFS_DENTRY slots[SIFS_DENTRY_SLOTS];
+};
+
+// Helper function that returns the slot of an entry, FNV-1a over the parent's block ID and the name
+static SIFS_DENTRY* dentry_slot(SIFS_DENTRIES* dentries, SIFS_BLOCKID parentId, const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 4; i++)
+    {
+        hash = (hash ^ ((parentId >> (8 * i)) & 0xff)) * 16777619u;
+    }
+    for (const unsigned char* c = (const unsigned char*)name; *c != '\0'; c++)
+    {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return &dentries->slots[hash & (SIFS_DENTRY_SLOTS - 1)];
+}
+
+SIFS_BIT SIFS_dentrylookup(SIFS_VOLUME* volume, SIFS_BLOCKID parentId, const char* name, SIFS_BLOCKID* blockId, uint32_t* fileindex)
+{
+    if (volume->dentries == NULL)
+    {
+        return SIFS_UNUSED;
+    }
+    SIFS_DENTRY* slot = dentry_slot(volume->dentries, parentId, name);
+    if (slot->type == SIFS_UNUSED || slot->parentId != parentId || strncmp(slot->name, name, SIFS_MAX_NAME_LENGTH) != 0)
+    {
+        return SIFS_UNUSED;
+    }
+    *blockId = slot->blockId;
+    if (fileindex != NULL)
+    {
+        *fileindex = slot->fileindex;
+    }
+    return slot->type;
+}
+
+void SIFS_dentryinsert(SIFS_VOLUME* volume, SIFS_BLOCKID parentId, const char* name, SIFS_BIT type, SIFS_BLOCKID blockId, uint32_t fileindex)
+{
+    if (strlen(name) >= SIFS_MAX_NAME_LENGTH)
+    {
+        return;
+    }
+    if (volume->dentries == NULL)
+    {
+        // Allocated with the first entry
+        volume->dentries = (SIFS_DENTRIES*)malloc(sizeof(SIFS_DENTRIES));
+        if (volume->dentries == NULL)
+        {
+            return;
+        }
+        for (int i = 0; i < SIFS_DENTRY_SLOTS; i++)
+        {
+            volume->dentries->slots[i].type = SIFS_UNUSED;
+        }
+    }
+    SIFS_DENTRY* slot = dentry_slot(volume->dentries, parentId, name);
+    slot->parentId = parentId;
+    slot->blockId = blockId;
+    slot->fileindex = fileindex;
+    slot->type = type;
+    strcpy(slot->name, name);
+}
+
+void SIFS_dentryforget(SIFS_VOLUME* volume, SIFS_BLOCKID blockId)
+{
+    if (volume->dentries == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < SIFS_DENTRY_SLOTS; i++)
+    {
+        SIFS_DENTRY* slot = &volume->dentries->slots[i];
+        if (slot->type != SIFS_UNUSED && (slot->blockId == blockId || slot->parentId == blockId))
+        {
+            slot->type = SIFS_UNUSED;
+        }
+    }
+}
+
+void SIFS_dentryclear(SIFS_VOLUME* volume)
+{
+    free(volume->dentries);
+    volume->dentries = NULL;
+}
@@ -0,0 +1,84 @@
+#include "sifsutils.h"
+
+// Files are identified by the hash their volume was made with, md5 unless it was made with
+// SIFS_MKVOLUME_XXH128 or SIFS_MKVOLUME_BLAKE3. Every hash is kept to MD5_BYTELEN bytes so that
+// it fits the md5 field of a fileblock and the entries of the index of fileblocks
+
+void SIFS_digestinit(SIFS_VOLUME* volume, SIFS_DIGEST_CTX* ctx)
+{
+    ctx->hashalg = volume->exthdr.hashalg;
+    switch (ctx->hashalg)
+    {
+    case SIFS_HASH_XXH128:
+        XXH128_init(&ctx->ctx.xxh128);
+        break;
+    case SIFS_HASH_BLAKE3:
+        BLAKE3_init(&ctx->ctx.blake3);
+        break;
+    default:
+        MD5_init(&ctx->ctx.md5);
+        break;
+    }
+}
+
+void SIFS_digestupdate(SIFS_DIGEST_CTX* ctx, const void* data, size_t nbytes)
+{
+    switch (ctx->hashalg)
+    {
+    case SIFS_HASH_XXH128:
+        XXH128_update(&ctx->ctx.xxh128, data, nbytes);
+        break;
+    case SIFS_HASH_BLAKE3:
+        BLAKE3_update(&ctx->ctx.blake3, data, nbytes);
+        break;
+    default:
+        MD5_update(&ctx->ctx.md5, data, nbytes);
+        break;
+    }
+}
+
+void SIFS_digestfinal(SIFS_DIGEST_CTX* ctx, void* digest)
+{
+    switch (ctx->hashalg)
+    {
+    case SIFS_HASH_XXH128:
+        XXH128_final(&ctx->ctx.xxh128, digest);
+        break;
+    case SIFS_HASH_BLAKE3:
+        BLAKE3_final(&ctx->ctx.blake3, digest, MD5_BYTELEN);
+        break;
+    default:
+        MD5_final(&ctx->ctx.md5, digest);
+        break;
+    }
+}
+
+void SIFS_digestbuffer(SIFS_VOLUME* volume, const void* data, size_t nbytes, void* digest)
+{
+    switch (volume->exthdr.hashalg)
+    {
+    case SIFS_HASH_XXH128:
+        XXH128_buffer(data, nbytes, digest);
+        break;
+    case SIFS_HASH_BLAKE3:
+        BLAKE3_buffer(data, nbytes, digest, MD5_BYTELEN);
+        break;
+    default:
+        MD5_buffer(data, nbytes, digest);
+        break;
+    }
+}
+
+void SIFS_digestbuffers(SIFS_VOLUME* volume, size_t n, const void* const inputs[], const size_t lens[], void* const digests[])
+{
+    // Only md5 gains from digesting many buffers at once, the others already use the whole processor on one
+    if (volume->exthdr.hashalg == SIFS_HASH_MD5)
+    {
+        MD5_buffers(n, inputs, lens, digests);
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        SIFS_digestbuffer(volume, inputs[i], lens[i], digests[i]);
+    }
+}
@@ -3,10 +3,10 @@
 #include <string.h>
 
 // get information about a requested directory
-int SIFS_dirinfo(const char *volumename, const char *pathname,
-                 char ***entrynames, uint32_t *nentries, time_t *modtime)
+int SIFS_vdirinfo(SIFS_VOLUME *volume, const char *pathname,
+                  char ***entrynames, uint32_t *nentries, time_t *modtime)
 {
-    if (volumename == NULL || pathname == NULL)
+    if (volume == NULL || pathname == NULL)
     {
         SIFS_errno = SIFS_EINVAL;
         return SIFS_FAILURE;
@@ -21,13 +21,45 @@ int SIFS_dirinfo(const char *volumename, const char *pathname,
     }
 
     // Find the directory referenced to by pathname
-    SIFS_DIRBLOCK* dir = SIFS_getdir(volumename, result, count, NULL);
+    SIFS_DIRBLOCK* dir = SIFS_getdir(volume, result, count, NULL);
     if (dir == NULL)
     {
         // SIFS_errno set in SIFS_getdir()
         freesplit(result);
         return SIFS_FAILURE;
     }
+    // The names kept in the directory block list it without reading any other
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, dir);
+    if (names != NULL)
+    {
+        char** entries = (char**)malloc(sizeof(char*) * dir->nentries);
+        for (uint32_t i = 0; i < dir->nentries; i++)
+        {
+            entries[i] = (char*)malloc(SIFS_MAX_NAME_LENGTH);
+            SIFS_copydirname(names, i, entries[i]);
+        }
+        *entrynames = entries;
+        *nentries = dir->nentries;
+        *modtime = dir->modtime;
+        SIFS_releaseblock(volume, dir);
+        freesplit(result);
+        SIFS_errno = SIFS_EOK;
+        return SIFS_SUCCESS;
+    }
+    // Read every entry's block together rather than one after another
+    SIFS_BLOCKID blockIds[SIFS_MAX_ENTRIES];
+    void* blocks[SIFS_MAX_ENTRIES];
+    for (int i = 0; i < dir->nentries; i++)
+    {
+        blockIds[i] = dir->entries[i].blockID;
+    }
+    if (SIFS_getblocksv(volume, blockIds, blocks, dir->nentries) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_getblocksv()
+        SIFS_releaseblock(volume, dir);
+        freesplit(result);
+        return SIFS_FAILURE;
+    }
     *nentries = dir->nentries;
     *modtime = dir->modtime;
     // Create entries vector
@@ -35,31 +67,141 @@ int SIFS_dirinfo(const char *volumename, const char *pathname,
     // Iterate through each entry in the directory
     for (int i = 0; i < dir->nentries; i++)
     {
-        SIFS_BIT type = SIFS_getblocktype(volumename, dir->entries[i].blockID);
+        SIFS_BIT type = SIFS_getblocktype(volume, dir->entries[i].blockID);
         if (type == SIFS_DIR)
         {
             // Found a directory entry, add its name to the list of entries
-            SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)SIFS_getblock(volumename, dir->entries[i].blockID);
+            SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)blocks[i];
             size_t length = strlen(dirblock->name);
             entries[i] = (char*)malloc(length + 1);
             memcpy(entries[i], dirblock->name, length + 1);
-            free(dirblock);
         }
         else
         {
             // Found a file entry, add the correct filename to the list of entries
-            SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, dir->entries[i].blockID);
+            SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)blocks[i];
             char* filename = fileblock->filenames[dir->entries[i].fileindex];
             size_t length = strlen(filename);
             entries[i] = (char*)malloc(length + 1);
             memcpy(entries[i], filename, length + 1);
-            free(fileblock);
         }
+        SIFS_releaseblock(volume, blocks[i]);
     }
     *entrynames = entries;
 
-    free(dir);
+    SIFS_releaseblock(volume, dir);
+    freesplit(result);
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// list every entry of a requested directory with its type, length and modtime
+int SIFS_vreaddir(SIFS_VOLUME *volume, const char *pathname, SIFS_DIRENT **entries, uint32_t *nentries)
+{
+    if (volume == NULL || pathname == NULL || entries == NULL || nentries == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+
+    size_t count;
+    char** result = strsplit(pathname, SIFS_DIR_DELIMITER, &count);
+    if (result == NULL)
+    {
+        SIFS_errno = SIFS_ENOMEM;
+        return SIFS_FAILURE;
+    }
+    SIFS_DIRBLOCK* dir = SIFS_getdir(volume, result, count, NULL);
     freesplit(result);
+    if (dir == NULL)
+    {
+        // SIFS_errno set in SIFS_getdir()
+        return SIFS_FAILURE;
+    }
+    // Every entry's block holds its length and modtime, they are all read together
+    uint32_t n = dir->nentries;
+    SIFS_BLOCKID blockIds[SIFS_MAX_ENTRIES];
+    void* blocks[SIFS_MAX_ENTRIES];
+    for (uint32_t i = 0; i < n; i++)
+    {
+        blockIds[i] = dir->entries[i].blockID;
+    }
+    // The entries are followed by their names in the same allocation, each name is given its longest length
+    SIFS_DIRENT* list = (SIFS_DIRENT*)malloc(n * (sizeof(SIFS_DIRENT) + SIFS_MAX_NAME_LENGTH));
+    if ((list == NULL && n > 0) || SIFS_getblocksv(volume, blockIds, blocks, n) == SIFS_FAILURE)
+    {
+        SIFS_errno = (list == NULL && n > 0) ? SIFS_ENOMEM : SIFS_errno;
+        free(list);
+        SIFS_releaseblock(volume, dir);
+        return SIFS_FAILURE;
+    }
+    char* name = (char*)(list + n);
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, dir);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        SIFS_BIT type = (names != NULL) ? names->types[i] : SIFS_getblocktype(volume, blockIds[i]);
+        if (type == SIFS_DIR)
+        {
+            SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)blocks[i];
+            memcpy(name, dirblock->name, SIFS_MAX_NAME_LENGTH);
+            list[i].length = dirblock->nentries;
+            list[i].modtime = dirblock->modtime;
+        }
+        else
+        {
+            SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)blocks[i];
+            memcpy(name, fileblock->filenames[dir->entries[i].fileindex], SIFS_MAX_NAME_LENGTH);
+            list[i].length = fileblock->length;
+            list[i].modtime = fileblock->modtime;
+        }
+        name[SIFS_MAX_NAME_LENGTH - 1] = '\0';
+        list[i].name = name;
+        list[i].type = type;
+        list[i].blockID = blockIds[i];
+        name += SIFS_MAX_NAME_LENGTH;
+        SIFS_releaseblock(volume, blocks[i]);
+    }
+    *entries = list;
+    *nentries = n;
+
+    SIFS_releaseblock(volume, dir);
     SIFS_errno = SIFS_EOK;
     return SIFS_SUCCESS;
 }
+
+// list every entry of a requested directory, opening the volume only for the duration of the call
+int SIFS_readdir(const char *volumename, const char *pathname, SIFS_DIRENT **entries, uint32_t *nentries)
+{
+    if (volumename == NULL || pathname == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vreaddir(volume, pathname, entries, nentries);
+    return SIFS_closeafter(volume, result);
+}
+
+// get information about a requested directory, opening the volume only for the duration of the call
+int SIFS_dirinfo(const char *volumename, const char *pathname,
+                 char ***entrynames, uint32_t *nentries, time_t *modtime)
+{
+    if (volumename == NULL || pathname == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vdirinfo(volume, pathname, entrynames, nentries, modtime);
+    return SIFS_closeafter(volume, result);
+}
@@ -0,0 +1,80 @@
+#include "sifsutils.h"
+#include <string.h>
+
+// Helper function that returns true if name is the name held in one entry of names
+static bool samename(const char* stored, const char* name)
+{
+    size_t length = strlen(name);
+    if (length >= SIFS_MAX_NAME_LENGTH)
+    {
+        return false;
+    }
+    // A name that fills its slot has no null byte
+    return memcmp(stored, name, length) == 0 && (length == SIFS_MAX_NAME_LENGTH - 1 || stored[length] == '\0');
+}
+
+SIFS_DIRNAMES* SIFS_getdirnames(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir)
+{
+    if (!(volume->exthdr.features & SIFS_FEATURE_DIRNAMES))
+    {
+        return NULL;
+    }
+    SIFS_DIRNAMES* names = (SIFS_DIRNAMES*)((char*)dir + sizeof(SIFS_DIRBLOCK));
+    return (names->magic == SIFS_DIRNAMES_MAGIC) ? names : NULL;
+}
+
+int SIFS_finddirname(const SIFS_DIRBLOCK* dir, const SIFS_DIRNAMES* names, const char* name)
+{
+    for (uint32_t i = 0; i < dir->nentries; i++)
+    {
+        if (samename(names->names[i], name))
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void SIFS_initdirnames(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir)
+{
+    if (volume->exthdr.features & SIFS_FEATURE_DIRNAMES)
+    {
+        SIFS_DIRNAMES* names = (SIFS_DIRNAMES*)((char*)dir + sizeof(SIFS_DIRBLOCK));
+        memset(names, 0, sizeof(SIFS_DIRNAMES));
+        names->magic = SIFS_DIRNAMES_MAGIC;
+    }
+}
+
+void SIFS_adddirname(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BIT type, const char* name)
+{
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, dir);
+    if (names == NULL || dir->nentries == 0)
+    {
+        return;
+    }
+    uint32_t index = dir->nentries - 1;
+    size_t length = strlen(name);
+    names->types[index] = type;
+    memset(names->names[index], 0, SIFS_MAX_NAME_LENGTH - 1);
+    memcpy(names->names[index], name, (length < SIFS_MAX_NAME_LENGTH - 1) ? length : SIFS_MAX_NAME_LENGTH - 1);
+}
+
+void SIFS_removedirname(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, uint32_t index)
+{
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, dir);
+    if (names == NULL || index >= dir->nentries)
+    {
+        return;
+    }
+    uint32_t nafter = dir->nentries - index - 1;
+    memmove(&names->types[index], &names->types[index + 1], nafter * sizeof(SIFS_BIT));
+    memmove(names->names[index], names->names[index + 1], nafter * (SIFS_MAX_NAME_LENGTH - 1));
+    names->types[dir->nentries - 1] = 0;
+    memset(names->names[dir->nentries - 1], 0, SIFS_MAX_NAME_LENGTH - 1);
+}
+
+void SIFS_copydirname(const SIFS_DIRNAMES* names, uint32_t index, char* name)
+{
+    memcpy(name, names->names[index], SIFS_MAX_NAME_LENGTH - 1);
+    name[SIFS_MAX_NAME_LENGTH - 1] = '\0';
+}
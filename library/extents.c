@@ -0,0 +1,407 @@
+#include "sifsutils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Free runs of blocks are kept in a treap ordered by their first block, where each node also records the
+// longest run anywhere beneath it. The lowest run of at least n blocks is then found by walking down
+// from the root, always preferring the left subtree when it holds a long enough run.
+
+// A run of free blocks, nodes refer to each other by index and index 0 is never used
+typedef struct
+{
+    SIFS_BLOCKID start;
+    SIFS_BLOCKID length;
+    // Longest run in the subtree rooted at this node
+    SIFS_BLOCKID maxlength;
+    uint32_t priority;
+    uint32_t left;
+    uint32_t right;
+} SIFS_EXTENTNODE;
+
+struct SIFS_EXTENTS
+{
+    SIFS_EXTENTNODE* nodes;
+    uint32_t capacity;
+    // Number of nodes ever handed out, including index 0
+    uint32_t count;
+    // Nodes no longer in the tree, chained through their left index
+    uint32_t freelist;
+    uint32_t root;
+    // State of the generator of node priorities
+    uint32_t seed;
+    // Number of runs, and of runs of each length by power of two, kept up to date as runs change
+    uint32_t nruns;
+    uint32_t histogram[SIFS_EXTENT_BUCKETS];
+};
+
+// Helper function that adds delta to the number of runs of length blocks
+static void tally(SIFS_EXTENTS* extents, SIFS_BLOCKID length, int delta)
+{
+    int bucket = 0;
+    while (length > 1)
+    {
+        length >>= 1;
+        bucket++;
+    }
+    extents->histogram[bucket] += delta;
+    extents->nruns += delta;
+}
+
+// Helper function that changes the length of node t, keeping the histogram up to date
+static void setlength(SIFS_EXTENTS* extents, uint32_t t, SIFS_BLOCKID length)
+{
+    tally(extents, extents->nodes[t].length, -1);
+    tally(extents, length, 1);
+    extents->nodes[t].length = length;
+}
+
+// Helper function that returns the index of a new node for the run, or 0 if out of memory
+static uint32_t newnode(SIFS_EXTENTS* extents, SIFS_BLOCKID start, SIFS_BLOCKID length)
+{
+    uint32_t index = extents->freelist;
+    if (index != 0)
+    {
+        extents->freelist = extents->nodes[index].left;
+    }
+    else
+    {
+        if (extents->count == extents->capacity)
+        {
+            uint32_t capacity = extents->capacity * 2;
+            SIFS_EXTENTNODE* nodes = (SIFS_EXTENTNODE*)realloc(extents->nodes, capacity * sizeof(SIFS_EXTENTNODE));
+            if (nodes == NULL)
+            {
+                return 0;
+            }
+            extents->nodes = nodes;
+            extents->capacity = capacity;
+        }
+        index = extents->count++;
+    }
+    // xorshift32
+    extents->seed ^= extents->seed << 13;
+    extents->seed ^= extents->seed >> 17;
+    extents->seed ^= extents->seed << 5;
+    SIFS_EXTENTNODE* node = &extents->nodes[index];
+    node->start = start;
+    node->length = length;
+    node->maxlength = length;
+    node->priority = extents->seed;
+    node->left = 0;
+    node->right = 0;
+    tally(extents, length, 1);
+    return index;
+}
+
+static void freenode(SIFS_EXTENTS* extents, uint32_t index)
+{
+    tally(extents, extents->nodes[index].length, -1);
+    extents->nodes[index].left = extents->freelist;
+    extents->freelist = index;
+}
+
+// Helper function that recomputes the longest run beneath node t
+static void update(SIFS_EXTENTS* extents, uint32_t t)
+{
+    SIFS_EXTENTNODE* node = &extents->nodes[t];
+    SIFS_BLOCKID maxlength = node->length;
+    if (node->left != 0 && extents->nodes[node->left].maxlength > maxlength)
+    {
+        maxlength = extents->nodes[node->left].maxlength;
+    }
+    if (node->right != 0 && extents->nodes[node->right].maxlength > maxlength)
+    {
+        maxlength = extents->nodes[node->right].maxlength;
+    }
+    node->maxlength = maxlength;
+}
+
+// Helper function that splits tree t into the runs starting before key and those starting at or after it
+static void split(SIFS_EXTENTS* extents, uint32_t t, SIFS_BLOCKID key, uint32_t* left, uint32_t* right)
+{
+    if (t == 0)
+    {
+        *left = 0;
+        *right = 0;
+    }
+    else if (extents->nodes[t].start < key)
+    {
+        uint32_t rest;
+        split(extents, extents->nodes[t].right, key, &rest, right);
+        extents->nodes[t].right = rest;
+        update(extents, t);
+        *left = t;
+    }
+    else
+    {
+        uint32_t rest;
+        split(extents, extents->nodes[t].left, key, left, &rest);
+        extents->nodes[t].left = rest;
+        update(extents, t);
+        *right = t;
+    }
+}
+
+// Helper function that joins two trees, every run in left starts before every run in right
+static uint32_t merge(SIFS_EXTENTS* extents, uint32_t left, uint32_t right)
+{
+    if (left == 0 || right == 0)
+    {
+        return left | right;
+    }
+    if (extents->nodes[left].priority > extents->nodes[right].priority)
+    {
+        extents->nodes[left].right = merge(extents, extents->nodes[left].right, right);
+        update(extents, left);
+        return left;
+    }
+    extents->nodes[right].left = merge(extents, left, extents->nodes[right].left);
+    update(extents, right);
+    return right;
+}
+
+SIFS_EXTENTS* SIFS_extentscreate(const SIFS_BIT* bitmap, SIFS_BLOCKID nblocks)
+{
+    SIFS_EXTENTS* extents = (SIFS_EXTENTS*)malloc(sizeof(SIFS_EXTENTS));
+    if (extents == NULL)
+    {
+        return NULL;
+    }
+    extents->capacity = 64;
+    extents->count = 1;
+    extents->freelist = 0;
+    extents->root = 0;
+    extents->seed = 2463534242u;
+    extents->nruns = 0;
+    memset(extents->histogram, 0, sizeof(extents->histogram));
+    extents->nodes = (SIFS_EXTENTNODE*)malloc(extents->capacity * sizeof(SIFS_EXTENTNODE));
+    if (extents->nodes == NULL)
+    {
+        free(extents);
+        return NULL;
+    }
+    // Runs are found in increasing order, so each is merged onto the right of the tree
+    SIFS_BLOCKID start = SIFS_bitmapfind(bitmap, SIFS_ROOTDIR_BLOCKID + 1, nblocks, SIFS_UNUSED);
+    while (start < nblocks)
+    {
+        SIFS_BLOCKID end = SIFS_bitmapskip(bitmap, start, nblocks, SIFS_UNUSED);
+        uint32_t node = newnode(extents, start, end - start);
+        if (node == 0)
+        {
+            SIFS_extentsdestroy(extents);
+            return NULL;
+        }
+        extents->root = merge(extents, extents->root, node);
+        start = SIFS_bitmapfind(bitmap, end, nblocks, SIFS_UNUSED);
+    }
+    return extents;
+}
+
+void SIFS_extentsdestroy(SIFS_EXTENTS* extents)
+{
+    if (extents != NULL)
+    {
+        free(extents->nodes);
+        free(extents);
+    }
+}
+
+SIFS_BLOCKID SIFS_extentstake(SIFS_EXTENTS* extents, SIFS_BLOCKID nblocks)
+{
+    uint32_t t = extents->root;
+    if (t == 0 || nblocks == 0 || extents->nodes[t].maxlength < nblocks)
+    {
+        return SIFS_ROOTDIR_BLOCKID;
+    }
+    // Find the lowest run that is long enough
+    while (true)
+    {
+        uint32_t left = extents->nodes[t].left;
+        if (left != 0 && extents->nodes[left].maxlength >= nblocks)
+        {
+            t = left;
+        }
+        else if (extents->nodes[t].length >= nblocks)
+        {
+            break;
+        }
+        else
+        {
+            t = extents->nodes[t].right;
+        }
+    }
+    // Detach the run, and put back whatever is left of it
+    SIFS_BLOCKID start = extents->nodes[t].start;
+    uint32_t left, middle, right;
+    split(extents, extents->root, start, &left, &right);
+    split(extents, right, start + 1, &middle, &right);
+    if (extents->nodes[middle].length > nblocks)
+    {
+        extents->nodes[middle].start += nblocks;
+        setlength(extents, middle, extents->nodes[middle].length - nblocks);
+        update(extents, middle);
+        left = merge(extents, left, middle);
+    }
+    else
+    {
+        freenode(extents, middle);
+    }
+    extents->root = merge(extents, left, right);
+    return start;
+}
+
+// Helper function that returns the lowest run in tree t starting at or after from that holds nblocks blocks
+static uint32_t findfrom(SIFS_EXTENTS* extents, uint32_t t, SIFS_BLOCKID from, SIFS_BLOCKID nblocks)
+{
+    while (t != 0 && extents->nodes[t].maxlength >= nblocks)
+    {
+        SIFS_EXTENTNODE* node = &extents->nodes[t];
+        if (node->start < from)
+        {
+            t = node->right;
+            continue;
+        }
+        uint32_t found = findfrom(extents, node->left, from, nblocks);
+        if (found != 0)
+        {
+            return found;
+        }
+        if (node->length >= nblocks)
+        {
+            return t;
+        }
+        t = node->right;
+    }
+    return 0;
+}
+
+SIFS_BLOCKID SIFS_extentsfind(SIFS_EXTENTS* extents, SIFS_BLOCKID from, SIFS_BLOCKID nblocks)
+{
+    if (nblocks == 0)
+    {
+        return SIFS_ROOTDIR_BLOCKID;
+    }
+    // The run holding from may have enough blocks left after it
+    uint32_t holding = 0;
+    for (uint32_t t = extents->root; t != 0; )
+    {
+        if (extents->nodes[t].start <= from)
+        {
+            holding = t;
+            t = extents->nodes[t].right;
+        }
+        else
+        {
+            t = extents->nodes[t].left;
+        }
+    }
+    if (holding != 0 && extents->nodes[holding].start + extents->nodes[holding].length >= from + nblocks)
+    {
+        return from;
+    }
+    uint32_t found = findfrom(extents, extents->root, from, nblocks);
+    return (found != 0) ? extents->nodes[found].start : SIFS_ROOTDIR_BLOCKID;
+}
+
+bool SIFS_extentstakeat(SIFS_EXTENTS* extents, SIFS_BLOCKID first, SIFS_BLOCKID nblocks)
+{
+    // Find the run starting at or before first
+    uint32_t found = 0;
+    for (uint32_t t = extents->root; t != 0; )
+    {
+        if (extents->nodes[t].start <= first)
+        {
+            found = t;
+            t = extents->nodes[t].right;
+        }
+        else
+        {
+            t = extents->nodes[t].left;
+        }
+    }
+    if (found == 0 || nblocks == 0)
+    {
+        return false;
+    }
+    SIFS_BLOCKID start = extents->nodes[found].start;
+    SIFS_BLOCKID end = start + extents->nodes[found].length;
+    if (end < first || end - first < nblocks)
+    {
+        return false;
+    }
+    // Any free blocks after the taken ones need a run of their own, made before the tree is changed
+    uint32_t after = 0;
+    if (end > first + nblocks)
+    {
+        after = newnode(extents, first + nblocks, end - first - nblocks);
+        if (after == 0)
+        {
+            return false;
+        }
+    }
+    uint32_t left, middle, right;
+    split(extents, extents->root, start, &left, &right);
+    split(extents, right, start + 1, &middle, &right);
+    if (first > start)
+    {
+        setlength(extents, middle, first - start);
+        update(extents, middle);
+        left = merge(extents, left, middle);
+    }
+    else
+    {
+        freenode(extents, middle);
+    }
+    extents->root = merge(extents, merge(extents, left, after), right);
+    return true;
+}
+
+bool SIFS_extentsgive(SIFS_EXTENTS* extents, SIFS_BLOCKID first, SIFS_BLOCKID nblocks)
+{
+    uint32_t node = newnode(extents, first, nblocks);
+    if (node == 0)
+    {
+        return false;
+    }
+    uint32_t left, right, neighbour;
+    split(extents, extents->root, first, &left, &right);
+    // Join the run ending at first
+    uint32_t t = left;
+    while (t != 0 && extents->nodes[t].right != 0)
+    {
+        t = extents->nodes[t].right;
+    }
+    if (t != 0 && extents->nodes[t].start + extents->nodes[t].length == first)
+    {
+        split(extents, left, extents->nodes[t].start, &left, &neighbour);
+        extents->nodes[node].start = extents->nodes[neighbour].start;
+        setlength(extents, node, extents->nodes[node].length + extents->nodes[neighbour].length);
+        freenode(extents, neighbour);
+    }
+    // Join the run starting straight after the given blocks
+    t = right;
+    while (t != 0 && extents->nodes[t].left != 0)
+    {
+        t = extents->nodes[t].left;
+    }
+    if (t != 0 && extents->nodes[t].start == first + nblocks)
+    {
+        split(extents, right, first + nblocks + 1, &neighbour, &right);
+        setlength(extents, node, extents->nodes[node].length + extents->nodes[neighbour].length);
+        freenode(extents, neighbour);
+    }
+    update(extents, node);
+    extents->root = merge(extents, merge(extents, left, node), right);
+    return true;
+}
+
+SIFS_BLOCKID SIFS_extentslongest(SIFS_EXTENTS* extents)
+{
+    return (extents->root != 0) ? extents->nodes[extents->root].maxlength : 0;
+}
+
+void SIFS_extentshistogram(SIFS_EXTENTS* extents, uint32_t* nruns, uint32_t* histogram)
+{
+    *nruns = extents->nruns;
+    memcpy(histogram, extents->histogram, sizeof(extents->histogram));
+}
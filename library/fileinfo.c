@@ -1,10 +1,10 @@
 #include "sifsutils.h"
 
 // get information about a requested file
-int SIFS_fileinfo(const char *volumename, const char *pathname,
-		  size_t *length, time_t *modtime)
+int SIFS_vfileinfo(SIFS_VOLUME *volume, const char *pathname,
+		   size_t *length, time_t *modtime)
 {
-    if (volumename == NULL || pathname == NULL)
+    if (volume == NULL || pathname == NULL)
     {
         SIFS_errno = SIFS_EINVAL;
         return SIFS_FAILURE;
@@ -19,7 +19,7 @@ int SIFS_fileinfo(const char *volumename, const char *pathname,
     }
 
     // Find fileblock referenced by pathname
-    SIFS_FILEBLOCK* fileblock = SIFS_getfile(volumename, result, count, NULL);
+    SIFS_FILEBLOCK* fileblock = SIFS_getfile(volume, result, count, NULL);
     if (fileblock == NULL)
     {
         // SIFS_errno set in SIFS_getfile()
@@ -36,7 +36,26 @@ int SIFS_fileinfo(const char *volumename, const char *pathname,
     }
 
     freesplit(result);
-    free(fileblock);
+    SIFS_releaseblock(volume, fileblock);
     SIFS_errno = SIFS_EOK;
     return SIFS_SUCCESS;
 }
+
+// get information about a requested file, opening the volume only for the duration of the call
+int SIFS_fileinfo(const char *volumename, const char *pathname,
+		  size_t *length, time_t *modtime)
+{
+    if (volumename == NULL || pathname == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vfileinfo(volume, pathname, length, modtime);
+    return SIFS_closeafter(volume, result);
+}
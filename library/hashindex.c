@@ -0,0 +1,171 @@
+#include "sifsutils.h"
+#include <string.h>
+
+// The index of fileblocks by md5 is a table of buckets after the last block of the volume, each one page long.
+// A fileblock is held by the bucket its md5 selects, so looking it up reads one page, unless that bucket was full
+// when it was added. Each bucket counts the fileblocks held after it because it was full, and the search only
+// carries on to the next bucket while that count is not 0.
+
+uint32_t SIFS_hashbuckets(SIFS_BLOCKID nblocks)
+{
+    // Buckets are kept at most three quarters full
+    size_t perbucket = SIFS_HASHBUCKET_SLOTS * 3 / 4;
+    size_t nfiles = ((size_t)nblocks + 1) / 2;
+    return (uint32_t)((nfiles + perbucket - 1) / perbucket);
+}
+
+// Helper function that returns the bucket an md5 selects, md5s are evenly spread so its first bytes will do
+static uint32_t homebucket(SIFS_VOLUME* volume, const void* md5)
+{
+    uint64_t key;
+    memcpy(&key, md5, sizeof(key));
+    return (uint32_t)(key % volume->exthdr.nhashbuckets);
+}
+
+static int readbucket(SIFS_VOLUME* volume, uint32_t b, SIFS_HASHBUCKET* bucket)
+{
+    size_t offset = volume->exthdr.hashoffset + (size_t)b * SIFS_HASHBUCKET_BYTES;
+    return SIFS_readvolumeptr(volume, bucket, offset, sizeof(SIFS_HASHBUCKET));
+}
+
+static int writebucket(SIFS_VOLUME* volume, uint32_t b, const SIFS_HASHBUCKET* bucket)
+{
+    size_t offset = volume->exthdr.hashoffset + (size_t)b * SIFS_HASHBUCKET_BYTES;
+    return SIFS_updatevolume(volume, offset, bucket, sizeof(SIFS_HASHBUCKET));
+}
+
+// Helper function that finds the entry for md5 (and blockId, unless it is SIFS_ROOTDIR_BLOCKID)
+// Returns the bucket holding it, read into bucket, or nhashbuckets if there is no such entry
+static uint32_t findentry(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID blockId, SIFS_HASHBUCKET* bucket, uint32_t* outEntry)
+{
+    uint32_t nbuckets = volume->exthdr.nhashbuckets;
+    uint32_t b = homebucket(volume, md5);
+    for (uint32_t probe = 0; probe < nbuckets; probe++, b = (b + 1) % nbuckets)
+    {
+        if (readbucket(volume, b, bucket) == SIFS_FAILURE)
+        {
+            break;
+        }
+        for (uint32_t i = 0; i < bucket->nentries && i < SIFS_HASHBUCKET_SLOTS; i++)
+        {
+            if (memcmp(bucket->entries[i].md5, md5, MD5_BYTELEN) == 0 &&
+                (blockId == SIFS_ROOTDIR_BLOCKID || bucket->entries[i].blockID == blockId))
+            {
+                *outEntry = i;
+                return b;
+            }
+        }
+        if (bucket->overflow == 0)
+        {
+            break;
+        }
+    }
+    return nbuckets;
+}
+
+// Helper function that adds delta to the overflow count of each bucket from the one md5 selects up to, not including, last
+static int addoverflow(SIFS_VOLUME* volume, const void* md5, uint32_t last, int delta)
+{
+    SIFS_HASHBUCKET bucket;
+    for (uint32_t b = homebucket(volume, md5); b != last; b = (b + 1) % volume->exthdr.nhashbuckets)
+    {
+        if (readbucket(volume, b, &bucket) == SIFS_FAILURE)
+        {
+            return SIFS_FAILURE;
+        }
+        bucket.overflow += delta;
+        if (writebucket(volume, b, &bucket) == SIFS_FAILURE)
+        {
+            return SIFS_FAILURE;
+        }
+    }
+    return SIFS_SUCCESS;
+}
+
+bool SIFS_hashlookup(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID* outBlockId)
+{
+    if (!(volume->exthdr.features & SIFS_FEATURE_HASHINDEX))
+    {
+        return false;
+    }
+    SIFS_HASHBUCKET bucket;
+    uint32_t entry = 0;
+    if (findentry(volume, md5, SIFS_ROOTDIR_BLOCKID, &bucket, &entry) == volume->exthdr.nhashbuckets)
+    {
+        return false;
+    }
+    *outBlockId = bucket.entries[entry].blockID;
+    return true;
+}
+
+int SIFS_hashinsert(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID blockId)
+{
+    if (!(volume->exthdr.features & SIFS_FEATURE_HASHINDEX))
+    {
+        return SIFS_SUCCESS;
+    }
+    // Find the first bucket with room from the one md5 selects onwards
+    uint32_t nbuckets = volume->exthdr.nhashbuckets;
+    uint32_t b = homebucket(volume, md5);
+    SIFS_HASHBUCKET bucket;
+    for (uint32_t probe = 0; probe < nbuckets; probe++, b = (b + 1) % nbuckets)
+    {
+        if (readbucket(volume, b, &bucket) == SIFS_FAILURE)
+        {
+            return SIFS_FAILURE;
+        }
+        if (bucket.nentries < SIFS_HASHBUCKET_SLOTS)
+        {
+            memcpy(bucket.entries[bucket.nentries].md5, md5, MD5_BYTELEN);
+            bucket.entries[bucket.nentries++].blockID = blockId;
+            if (writebucket(volume, b, &bucket) == SIFS_FAILURE)
+            {
+                return SIFS_FAILURE;
+            }
+            // Every full bucket passed over must send later lookups on to the next one
+            return addoverflow(volume, md5, b, 1);
+        }
+    }
+    // Every bucket is full, the fileblock is only found by its lookups failing over to a scan of the volume
+    return SIFS_FAILURE;
+}
+
+int SIFS_hashremove(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID blockId)
+{
+    if (!(volume->exthdr.features & SIFS_FEATURE_HASHINDEX))
+    {
+        return SIFS_SUCCESS;
+    }
+    SIFS_HASHBUCKET bucket;
+    uint32_t entry;
+    uint32_t b = findentry(volume, md5, blockId, &bucket, &entry);
+    if (b == volume->exthdr.nhashbuckets)
+    {
+        return SIFS_SUCCESS;
+    }
+    // The last entry of the bucket takes the place of the removed one
+    bucket.entries[entry] = bucket.entries[--bucket.nentries];
+    memset(&bucket.entries[bucket.nentries], 0, sizeof(bucket.entries[0]));
+    if (writebucket(volume, b, &bucket) == SIFS_FAILURE)
+    {
+        return SIFS_FAILURE;
+    }
+    return addoverflow(volume, md5, b, -1);
+}
+
+int SIFS_hashmove(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID blockId, SIFS_BLOCKID newBlockId)
+{
+    if (!(volume->exthdr.features & SIFS_FEATURE_HASHINDEX))
+    {
+        return SIFS_SUCCESS;
+    }
+    SIFS_HASHBUCKET bucket;
+    uint32_t entry;
+    uint32_t b = findentry(volume, md5, blockId, &bucket, &entry);
+    if (b == volume->exthdr.nhashbuckets)
+    {
+        return SIFS_SUCCESS;
+    }
+    bucket.entries[entry].blockID = newBlockId;
+    return writebucket(volume, b, &bucket);
+}
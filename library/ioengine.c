@@ -0,0 +1,370 @@
+#define _DEFAULT_SOURCE
+
+#include "sifsutils.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define SIFS_HAVE_URING
+#endif
+
+// Asynchronous positional I/O on a volume's file descriptor
+// Requests are prepared with SIFS_ioprep(), handed to the kernel together by SIFS_iosubmit() and
+// collected with SIFS_ioreap(). Without io_uring every request is performed as soon as it is prepared
+// and only its completion is queued, so callers are written once for both engines
+
+// A prepared or submitted request, indexed by the slot number carried in the request's user data
+typedef struct
+{
+    bool write;
+    const struct iovec* iov;
+    int iovcnt;
+    off_t offset;
+    size_t length;
+    uint64_t tag;
+    // Next free slot
+    int next;
+} SIFS_IOSLOT;
+
+struct SIFS_IOENGINE
+{
+    int fd;
+    uint32_t depth;
+    SIFS_IOSLOT* slots;
+    int freeslot;
+    // Completions waiting to be reaped by the synchronous engine
+    SIFS_IOCOMPLETION* done;
+    uint32_t ndone;
+    // Number of requests prepared but not yet submitted, and submitted but not yet reaped
+    uint32_t queued;
+    uint32_t inflight;
+    // The io_uring instance, ringfd is -1 for the synchronous engine
+    int ringfd;
+#if defined(SIFS_HAVE_URING)
+    void* sqring;
+    size_t sqringsize;
+    void* cqring;
+    size_t cqringsize;
+    struct io_uring_sqe* sqes;
+    size_t sqessize;
+    unsigned* sqhead;
+    unsigned* sqtail;
+    unsigned* sqmask;
+    unsigned* sqarray;
+    unsigned* cqhead;
+    unsigned* cqtail;
+    unsigned* cqmask;
+    struct io_uring_cqe* cqes;
+#endif
+};
+
+// Helper function that performs a request with blocking system calls, returns the number of bytes transferred or -1
+static ssize_t io_sync(SIFS_IOENGINE* engine, SIFS_IOSLOT* slot)
+{
+    int result = SIFS_SUCCESS;
+    off_t offset = slot->offset;
+    if (slot->write)
+    {
+        // SIFS_pwritevfull() consumes its iovec, so give it a copy
+        struct iovec copy[SIFS_MAX_IOVECS];
+        for (int i = 0; i < slot->iovcnt && result == SIFS_SUCCESS; i += SIFS_MAX_IOVECS)
+        {
+            int count = (slot->iovcnt - i < SIFS_MAX_IOVECS) ? slot->iovcnt - i : SIFS_MAX_IOVECS;
+            memcpy(copy, slot->iov + i, sizeof(struct iovec) * count);
+            size_t length = 0;
+            for (int j = 0; j < count; j++)
+            {
+                length += copy[j].iov_len;
+            }
+            result = SIFS_pwritevfull(engine->fd, copy, count, offset);
+            offset += length;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < slot->iovcnt && result == SIFS_SUCCESS; i++)
+        {
+            result = SIFS_preadfull(engine->fd, slot->iov[i].iov_base, slot->iov[i].iov_len, offset);
+            offset += slot->iov[i].iov_len;
+        }
+    }
+    return (result == SIFS_SUCCESS) ? (ssize_t)slot->length : -1;
+}
+
+#if defined(SIFS_HAVE_URING)
+static int io_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ringfd, unsigned tosubmit, unsigned mincomplete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ringfd, tosubmit, mincomplete, flags, NULL, 0);
+}
+
+// Helper function that maps the rings of a new io_uring instance, returns false if io_uring cannot be used
+static bool io_setupring(SIFS_IOENGINE* engine)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    engine->ringfd = io_uring_setup(engine->depth, &params);
+    if (engine->ringfd < 0)
+    {
+        // Not supported by the kernel, or disabled
+        engine->ringfd = -1;
+        return false;
+    }
+    engine->sqringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    engine->cqringsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        // Both rings share one mapping
+        if (engine->cqringsize > engine->sqringsize)
+        {
+            engine->sqringsize = engine->cqringsize;
+        }
+        engine->cqringsize = engine->sqringsize;
+    }
+    engine->sqring = mmap(NULL, engine->sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        engine->ringfd, IORING_OFF_SQ_RING);
+    engine->cqring = engine->sqring;
+    if (engine->sqring != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        engine->cqring = mmap(NULL, engine->cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            engine->ringfd, IORING_OFF_CQ_RING);
+    }
+    engine->sqessize = params.sq_entries * sizeof(struct io_uring_sqe);
+    engine->sqes = mmap(NULL, engine->sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        engine->ringfd, IORING_OFF_SQES);
+    if (engine->sqring == MAP_FAILED || engine->cqring == MAP_FAILED || engine->sqes == MAP_FAILED)
+    {
+        if (engine->sqes != MAP_FAILED)
+        {
+            munmap(engine->sqes, engine->sqessize);
+        }
+        if (engine->cqring != MAP_FAILED && engine->cqring != engine->sqring)
+        {
+            munmap(engine->cqring, engine->cqringsize);
+        }
+        if (engine->sqring != MAP_FAILED)
+        {
+            munmap(engine->sqring, engine->sqringsize);
+        }
+        close(engine->ringfd);
+        engine->ringfd = -1;
+        return false;
+    }
+    char* sq = (char*)engine->sqring;
+    char* cq = (char*)engine->cqring;
+    engine->sqhead = (unsigned*)(sq + params.sq_off.head);
+    engine->sqtail = (unsigned*)(sq + params.sq_off.tail);
+    engine->sqmask = (unsigned*)(sq + params.sq_off.ring_mask);
+    engine->sqarray = (unsigned*)(sq + params.sq_off.array);
+    engine->cqhead = (unsigned*)(cq + params.cq_off.head);
+    engine->cqtail = (unsigned*)(cq + params.cq_off.tail);
+    engine->cqmask = (unsigned*)(cq + params.cq_off.ring_mask);
+    engine->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    // The rings may hold more entries than were asked for, but never fewer
+    engine->depth = (params.sq_entries < engine->depth) ? params.sq_entries : engine->depth;
+    return true;
+}
+#endif
+
+SIFS_IOENGINE* SIFS_iocreate(int fd, uint32_t depth, bool useuring)
+{
+    SIFS_IOENGINE* engine = (SIFS_IOENGINE*)calloc(1, sizeof(SIFS_IOENGINE));
+    if (engine == NULL)
+    {
+        return NULL;
+    }
+    engine->fd = fd;
+    engine->depth = (depth > 0) ? depth : 1;
+    engine->ringfd = -1;
+#if defined(SIFS_HAVE_URING)
+    if (useuring)
+    {
+        // Fall back to the synchronous engine when io_uring is unavailable
+        io_setupring(engine);
+    }
+#endif
+    engine->slots = (SIFS_IOSLOT*)malloc(sizeof(SIFS_IOSLOT) * engine->depth);
+    engine->done = (SIFS_IOCOMPLETION*)malloc(sizeof(SIFS_IOCOMPLETION) * engine->depth);
+    if (engine->slots == NULL || engine->done == NULL)
+    {
+        SIFS_iodestroy(engine);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < engine->depth; i++)
+    {
+        engine->slots[i].next = (i + 1 < engine->depth) ? (int)i + 1 : -1;
+    }
+    engine->freeslot = 0;
+    return engine;
+}
+
+void SIFS_iodestroy(SIFS_IOENGINE* engine)
+{
+    if (engine == NULL)
+    {
+        return;
+    }
+#if defined(SIFS_HAVE_URING)
+    if (engine->ringfd >= 0)
+    {
+        // Requests still in flight refer to memory that is about to be freed, wait for them
+        SIFS_IOCOMPLETION completion;
+        while (engine->queued + engine->inflight > 0 && SIFS_ioreap(engine, &completion, 1, 1) > 0)
+        {
+        }
+        munmap(engine->sqes, engine->sqessize);
+        if (engine->cqring != engine->sqring)
+        {
+            munmap(engine->cqring, engine->cqringsize);
+        }
+        munmap(engine->sqring, engine->sqringsize);
+        close(engine->ringfd);
+    }
+#endif
+    free(engine->slots);
+    free(engine->done);
+    free(engine);
+}
+
+bool SIFS_iouring(SIFS_IOENGINE* engine)
+{
+    return engine->ringfd >= 0;
+}
+
+uint32_t SIFS_iodepth(SIFS_IOENGINE* engine)
+{
+    return engine->depth;
+}
+
+int SIFS_ioprep(SIFS_IOENGINE* engine, bool write, const struct iovec* iov, int iovcnt, off_t offset, uint64_t tag)
+{
+    if (engine->freeslot < 0 || engine->queued + engine->inflight + engine->ndone >= engine->depth)
+    {
+        // Every slot is in use, completions must be reaped first
+        return SIFS_FAILURE;
+    }
+    int index = engine->freeslot;
+    SIFS_IOSLOT* slot = &engine->slots[index];
+    engine->freeslot = slot->next;
+    slot->write = write;
+    slot->iov = iov;
+    slot->iovcnt = iovcnt;
+    slot->offset = offset;
+    slot->tag = tag;
+    slot->length = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        slot->length += iov[i].iov_len;
+    }
+
+#if defined(SIFS_HAVE_URING)
+    if (engine->ringfd >= 0 && iovcnt <= SIFS_MAX_IOVECS)
+    {
+        unsigned tail = *engine->sqtail;
+        unsigned ringindex = tail & *engine->sqmask;
+        struct io_uring_sqe* sqe = &engine->sqes[ringindex];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = engine->fd;
+        sqe->addr = (uint64_t)(uintptr_t)iov;
+        sqe->len = (uint32_t)iovcnt;
+        sqe->off = (uint64_t)offset;
+        sqe->user_data = (uint64_t)index;
+        engine->sqarray[ringindex] = ringindex;
+        // The kernel may read the entry as soon as it sees the new tail
+        __atomic_store_n(engine->sqtail, tail + 1, __ATOMIC_RELEASE);
+        engine->queued++;
+        return SIFS_SUCCESS;
+    }
+#endif
+    // Synchronous engine, the request is complete before it is even submitted
+    engine->done[engine->ndone].tag = tag;
+    engine->done[engine->ndone++].result = io_sync(engine, slot);
+    slot->next = engine->freeslot;
+    engine->freeslot = index;
+    return SIFS_SUCCESS;
+}
+
+int SIFS_iosubmit(SIFS_IOENGINE* engine)
+{
+#if defined(SIFS_HAVE_URING)
+    while (engine->ringfd >= 0 && engine->queued > 0)
+    {
+        int n = io_uring_enter(engine->ringfd, engine->queued, 0, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return SIFS_FAILURE;
+        }
+        engine->queued -= n;
+        engine->inflight += n;
+    }
+#endif
+    return SIFS_SUCCESS;
+}
+
+uint32_t SIFS_ioreap(SIFS_IOENGINE* engine, SIFS_IOCOMPLETION* completions, uint32_t max, uint32_t min)
+{
+    uint32_t count = 0;
+    // Completions of the synchronous engine (and of requests that had to be performed synchronously)
+    while (count < max && engine->ndone > 0)
+    {
+        completions[count++] = engine->done[--engine->ndone];
+    }
+#if defined(SIFS_HAVE_URING)
+    if (engine->ringfd < 0)
+    {
+        return count;
+    }
+    if (SIFS_iosubmit(engine) == SIFS_FAILURE)
+    {
+        return count;
+    }
+    while (count < max && engine->inflight > 0)
+    {
+        unsigned head = *engine->cqhead;
+        unsigned tail = __atomic_load_n(engine->cqtail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            if (count >= min)
+            {
+                break;
+            }
+            if (io_uring_enter(engine->ringfd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            {
+                break;
+            }
+            continue;
+        }
+        struct io_uring_cqe* cqe = &engine->cqes[head & *engine->cqmask];
+        int index = (int)cqe->user_data;
+        ssize_t result = cqe->res;
+        __atomic_store_n(engine->cqhead, head + 1, __ATOMIC_RELEASE);
+        engine->inflight--;
+
+        SIFS_IOSLOT* slot = &engine->slots[index];
+        if (result != (ssize_t)slot->length)
+        {
+            // Short or interrupted transfers are finished synchronously, like SIFS_preadfull() would
+            result = io_sync(engine, slot);
+        }
+        completions[count].tag = slot->tag;
+        completions[count++].result = result;
+        slot->next = engine->freeslot;
+        engine->freeslot = index;
+    }
+#endif
+    return count;
+}
@@ -6,127 +6,190 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <math.h>
 
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/stat.h>
 #include <stdint.h>
 
-typedef uint32_t (*DgstFctn)(uint32_t a[]);
- 
-static uint32_t f0(uint32_t abcd[])
+typedef uint32_t Digest[4];
+
+static const Digest init	= { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+
+//  THE FOUR AUXILIARY FUNCTIONS OF RFC1321, F AND G IN THEIR CHEAPER EQUIVALENT FORMS
+#define	F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	G(x, y, z)	((y) ^ ((z) & ((x) ^ (y))))
+#define	H(x, y, z)	((x) ^ (y) ^ (z))
+#define	I(x, y, z)	((y) ^ ((x) | ~(z)))
+
+//  ONE STEP OF A ROUND, k IS floor(abs(sin(i+1)) * 2^32) FOR STEP i
+#define	STEP(f, a, b, c, d, w, k, s)				\
+	do {							\
+	    (a) += f((b), (c), (d)) + (w) + (uint32_t)(k);	\
+	    (a)  = ((a) << (s)) | ((a) >> (32 - (s)));		\
+	    (a) += (b);						\
+	} while(0)
+
+//  READ A 32-BIT WORD STORED LEAST SIGNIFICANT BYTE FIRST
+static inline uint32_t load32(const uint8_t *p)
 {
-    return (abcd[1] & abcd[2]) | (~abcd[1] & abcd[3]);
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	   ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
 }
- 
-static uint32_t f1(uint32_t abcd[])
+
+//  PROCESS ONE 64-BYTE GROUP OF THE MESSAGE, UPDATING THE DIGEST result
+static void MD5_transform(Digest result, const uint8_t *group)
 {
-    return (abcd[3] & abcd[1]) | (~abcd[3] & abcd[2]);
+    uint32_t w[16];
+
+    for(int i=0 ; i<16 ; i++)
+	w[i]	= load32(group + 4*i);
+
+    uint32_t a = result[0], b = result[1], c = result[2], d = result[3];
+
+    STEP(F, a, b, c, d, w[ 0], 0xd76aa478,  7);
+    STEP(F, d, a, b, c, w[ 1], 0xe8c7b756, 12);
+    STEP(F, c, d, a, b, w[ 2], 0x242070db, 17);
+    STEP(F, b, c, d, a, w[ 3], 0xc1bdceee, 22);
+    STEP(F, a, b, c, d, w[ 4], 0xf57c0faf,  7);
+    STEP(F, d, a, b, c, w[ 5], 0x4787c62a, 12);
+    STEP(F, c, d, a, b, w[ 6], 0xa8304613, 17);
+    STEP(F, b, c, d, a, w[ 7], 0xfd469501, 22);
+    STEP(F, a, b, c, d, w[ 8], 0x698098d8,  7);
+    STEP(F, d, a, b, c, w[ 9], 0x8b44f7af, 12);
+    STEP(F, c, d, a, b, w[10], 0xffff5bb1, 17);
+    STEP(F, b, c, d, a, w[11], 0x895cd7be, 22);
+    STEP(F, a, b, c, d, w[12], 0x6b901122,  7);
+    STEP(F, d, a, b, c, w[13], 0xfd987193, 12);
+    STEP(F, c, d, a, b, w[14], 0xa679438e, 17);
+    STEP(F, b, c, d, a, w[15], 0x49b40821, 22);
+
+    STEP(G, a, b, c, d, w[ 1], 0xf61e2562,  5);
+    STEP(G, d, a, b, c, w[ 6], 0xc040b340,  9);
+    STEP(G, c, d, a, b, w[11], 0x265e5a51, 14);
+    STEP(G, b, c, d, a, w[ 0], 0xe9b6c7aa, 20);
+    STEP(G, a, b, c, d, w[ 5], 0xd62f105d,  5);
+    STEP(G, d, a, b, c, w[10], 0x02441453,  9);
+    STEP(G, c, d, a, b, w[15], 0xd8a1e681, 14);
+    STEP(G, b, c, d, a, w[ 4], 0xe7d3fbc8, 20);
+    STEP(G, a, b, c, d, w[ 9], 0x21e1cde6,  5);
+    STEP(G, d, a, b, c, w[14], 0xc33707d6,  9);
+    STEP(G, c, d, a, b, w[ 3], 0xf4d50d87, 14);
+    STEP(G, b, c, d, a, w[ 8], 0x455a14ed, 20);
+    STEP(G, a, b, c, d, w[13], 0xa9e3e905,  5);
+    STEP(G, d, a, b, c, w[ 2], 0xfcefa3f8,  9);
+    STEP(G, c, d, a, b, w[ 7], 0x676f02d9, 14);
+    STEP(G, b, c, d, a, w[12], 0x8d2a4c8a, 20);
+
+    STEP(H, a, b, c, d, w[ 5], 0xfffa3942,  4);
+    STEP(H, d, a, b, c, w[ 8], 0x8771f681, 11);
+    STEP(H, c, d, a, b, w[11], 0x6d9d6122, 16);
+    STEP(H, b, c, d, a, w[14], 0xfde5380c, 23);
+    STEP(H, a, b, c, d, w[ 1], 0xa4beea44,  4);
+    STEP(H, d, a, b, c, w[ 4], 0x4bdecfa9, 11);
+    STEP(H, c, d, a, b, w[ 7], 0xf6bb4b60, 16);
+    STEP(H, b, c, d, a, w[10], 0xbebfbc70, 23);
+    STEP(H, a, b, c, d, w[13], 0x289b7ec6,  4);
+    STEP(H, d, a, b, c, w[ 0], 0xeaa127fa, 11);
+    STEP(H, c, d, a, b, w[ 3], 0xd4ef3085, 16);
+    STEP(H, b, c, d, a, w[ 6], 0x04881d05, 23);
+    STEP(H, a, b, c, d, w[ 9], 0xd9d4d039,  4);
+    STEP(H, d, a, b, c, w[12], 0xe6db99e5, 11);
+    STEP(H, c, d, a, b, w[15], 0x1fa27cf8, 16);
+    STEP(H, b, c, d, a, w[ 2], 0xc4ac5665, 23);
+
+    STEP(I, a, b, c, d, w[ 0], 0xf4292244,  6);
+    STEP(I, d, a, b, c, w[ 7], 0x432aff97, 10);
+    STEP(I, c, d, a, b, w[14], 0xab9423a7, 15);
+    STEP(I, b, c, d, a, w[ 5], 0xfc93a039, 21);
+    STEP(I, a, b, c, d, w[12], 0x655b59c3,  6);
+    STEP(I, d, a, b, c, w[ 3], 0x8f0ccc92, 10);
+    STEP(I, c, d, a, b, w[10], 0xffeff47d, 15);
+    STEP(I, b, c, d, a, w[ 1], 0x85845dd1, 21);
+    STEP(I, a, b, c, d, w[ 8], 0x6fa87e4f,  6);
+    STEP(I, d, a, b, c, w[15], 0xfe2ce6e0, 10);
+    STEP(I, c, d, a, b, w[ 6], 0xa3014314, 15);
+    STEP(I, b, c, d, a, w[13], 0x4e0811a1, 21);
+    STEP(I, a, b, c, d, w[ 4], 0xf7537e82,  6);
+    STEP(I, d, a, b, c, w[11], 0xbd3af235, 10);
+    STEP(I, c, d, a, b, w[ 2], 0x2ad7d2bb, 15);
+    STEP(I, b, c, d, a, w[ 9], 0xeb86d391, 21);
+
+    result[0] += a;
+    result[1] += b;
+    result[2] += c;
+    result[3] += d;
 }
- 
-static uint32_t f2(uint32_t abcd[])
+
+#undef	STEP
+#undef	F
+#undef	G
+#undef	H
+#undef	I
+
+//  --------------------------------------------------------------------------
+
+//  START AN INCREMENTAL DIGEST
+void MD5_init(MD5_CTX *ctx)
 {
-    return  abcd[1] ^ abcd[2] ^ abcd[3];
+    memcpy(ctx->state, init, sizeof(Digest));
+    ctx->length	= 0;
 }
- 
-static uint32_t f3(uint32_t abcd[])
+
+//  ADD len BYTES OF input TO AN INCREMENTAL DIGEST
+void MD5_update(MD5_CTX *ctx, const void *input, size_t len)
 {
-    return abcd[2] ^ (abcd[1] |~ abcd[3]);
+    const uint8_t *in	= (const uint8_t *)input;
+    size_t used		= ctx->length % 64;
+
+    ctx->length	+= len;
+//  COMPLETE ANY PARTIAL GROUP LEFT BY THE PREVIOUS CALL
+    if(used > 0) {
+	size_t n = (len < 64 - used) ? len : 64 - used;
+
+	memcpy(ctx->buffer + used, in, n);
+	in	+= n;
+	len	-= n;
+	if(used + n < 64)
+	    return;
+	MD5_transform(ctx->state, ctx->buffer);
+    }
+//  WHOLE GROUPS ARE DIGESTED IN PLACE, WITHOUT COPYING THEM
+    for( ; len >= 64 ; in += 64, len -= 64)
+	MD5_transform(ctx->state, in);
+    memcpy(ctx->buffer, in, len);
 }
- 
-// ROtate v Left by amt bits
-static uint32_t ROL(uint32_t v, int amt)
+
+//  FINISH AN INCREMENTAL DIGEST, LEAVE RESULT IN md5_result
+void *MD5_final(MD5_CTX *ctx, void *md5_result)
 {
-    uint32_t  msk1 = (1<<amt) -1;
-    return ((v>>(32-amt)) & msk1) | ((v<<amt) & ~msk1);
+    uint8_t padding[64 + 8]	= { 0x80 };
+    uint64_t bits		= 8*ctx->length;
+    size_t used			= ctx->length % 64;
+    size_t npad			= (used < 56) ? 56 - used : 120 - used;
+
+//  THE LENGTH IS APPENDED IN BITS, LEAST SIGNIFICANT BYTE FIRST
+    for(int i=0 ; i<8 ; i++)
+	padding[npad + i] = (uint8_t)(bits >> (8*i));
+    MD5_update(ctx, padding, npad + 8);
+
+//  THE DIGEST IS ALSO STORED LEAST SIGNIFICANT BYTE FIRST
+    uint8_t *res	= (uint8_t *)md5_result;
+
+    for(int i=0 ; i<MD5_BYTELEN ; i++)
+	res[i]	= (uint8_t)(ctx->state[i/4] >> (8*(i%4)));
+    return md5_result;
 }
- 
-//  --------------------------------------------------------------------------
 
-static void *MD5(const char *msg, size_t mlen) 
-{
-    typedef uint32_t Digest[4];
- 
-    static Digest result;
-    static Digest init	= { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
-
-    memcpy(result, init, sizeof(Digest));		// initialise
- 
-    static DgstFctn funcs[]	= { &f0, &f1, &f2, &f3 };
-    static int16_t M[]		= { 1, 5, 3, 7 };
-    static int16_t O[]		= { 0, 1, 5, 0 };
-    static int16_t rot0[]	= { 7, 12, 17, 22 };
-    static int16_t rot1[]	= { 5, 9, 14, 20 };
-    static int16_t rot2[]	= { 4, 11, 16, 23 };
-    static int16_t rot3[]	= { 6, 10, 15, 21 };
-    static int16_t *rots[]	= { rot0, rot1, rot2, rot3 };
-    static uint32_t *k		= NULL;
- 
-    if(k == NULL) {
-	static uint32_t kspace[64];
-	k = kspace;
-
-	for(int i=0; i<64; i++) {
-	    double s = fabs(sin((double)(1+i)));
-
-#define	TWO32		4294967296UL
-	    k[i] = (uint32_t)(s * TWO32);
-#undef	TWO32
-	}
-    }
- 
-    int	ngroups	= (mlen+8)/64 + 1;
-    uint8_t msgcopy[64*ngroups];
-
-    memset(msgcopy, 0, sizeof(msgcopy));
-    memcpy(msgcopy, msg, mlen);
-    msgcopy[mlen] = (uint8_t)0x80;  
-
-    uint32_t l = 8*mlen;
-    memcpy(msgcopy + (64*ngroups - 8), &l, 4);
- 
-    union {
-        uint32_t w[16];
-        char     b[64];
-    } mm;
- 
-    int offset = 0;
-    for(int group=0 ; group<ngroups ; ++group, offset += 64) {
-	Digest abcd;
-	memcpy(abcd, result, sizeof(Digest));
-
-        memcpy(mm.b, msgcopy+offset, 64);
-
-        for(int p=0 ; p<4 ; p++) {
-	    DgstFctn fctn	= funcs[p];
-            int16_t *rotn	= rots[p];
-            int m		= M[p];
-	    int o		= O[p];
-
-            for(int q=0 ; q<16 ; q++) {
-                int g		= (m*q + o) % 16;
-		uint32_t f	=
-		    abcd[1] + ROL(abcd[0]+ fctn(abcd) + k[q+16*p] + mm.w[g], rotn[q%4]);
- 
-                abcd[0] = abcd[3];
-                abcd[3] = abcd[2];
-                abcd[2] = abcd[1];
-                abcd[1] = f;
-            }
-        }
-        for(int p=0 ; p<4 ; p++)
-            result[p] += abcd[p];
-    }
-    return result;
-}    
- 
 //  --------------------------------------------------------------------------
 
 //  CALCULATE THE MD5 DIGEST OF input BUFFER, LEAVE RESULT IN md5_result
 void *MD5_buffer(const char *buffer, size_t len, void *md5_result)
 {
-    return memcpy(md5_result, MD5(buffer, len), MD5_BYTELEN);
+    MD5_CTX ctx;
+
+    MD5_init(&ctx);
+    MD5_update(&ctx, buffer, len);
+    return MD5_final(&ctx, md5_result);
 }
 
 //  RETURNS A 'HUMAN-READABLE' FORMATTED STRING OF AN MD5 DIGEST
@@ -146,28 +209,31 @@ char *MD5_format(const void *md5_result)
 //  RETURNS A 'HUMAN-READABLE' FORMATTED STRING OF DIGEST OF A FILE'S CONTENTS
 char *MD5_file(const char *filenm)
 {
-    int	fd = open(filenm, O_RDONLY, 0);
+    static unsigned char md5_result[MD5_BYTELEN];
+    MD5_CTX	ctx;
+    int		fd = open(filenm, O_RDONLY, 0);
 
+    MD5_init(&ctx);
     if(fd >= 0) {
-	struct stat sbuf;
-
-	if(fstat(fd, &sbuf) == 0) {
-	    char bytes[sbuf.st_size];
+	char	bytes[64*1024];
+	ssize_t	got;
 
-	    if(read(fd, bytes, sbuf.st_size) == sbuf.st_size) {
-		close(fd);
-		return MD5_format(MD5(bytes, sbuf.st_size));
-	    }
-	}
+//  THE FILE IS DIGESTED A PIECE AT A TIME, HOWEVER LARGE IT IS
+	while((got = read(fd, bytes, sizeof(bytes))) > 0)
+	    MD5_update(&ctx, bytes, (size_t)got);
+	if(got < 0)
+	    MD5_init(&ctx);
 	close(fd);
     }
-    return MD5_format(MD5("", 0));
+    return MD5_format(MD5_final(&ctx, md5_result));
 }
 
 //  RETURNS A 'HUMAN-READABLE' FORMATTED STRING OF DIGEST OF A STRING
 char *MD5_str(const char *str)
 {
-    return MD5_format(MD5(str, strlen(str)));
+    unsigned char md5_result[MD5_BYTELEN];
+
+    return MD5_format(MD5_buffer(str, strlen(str), md5_result));
 }
 
 //  --------------------------------------------------------------------------
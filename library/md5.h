@@ -3,6 +3,7 @@
 //  simple enough that I can almost understand it!
 
 #include <stdlib.h>		// defines  size_t
+#include <stdint.h>
 
 #define MD5_BYTELEN     16
 #define MD5_STRLEN      32
@@ -10,6 +11,27 @@
 //  CALCULATE THE MD5 DIGEST OF input BUFFER, LEAVE RESULT IN md5_result
 extern  void    *MD5_buffer(const char *input, size_t len, void *md5_result);
 
+//  STATE OF AN INCREMENTAL DIGEST, FOR INPUT THAT IS NOT IN ONE BUFFER
+typedef struct {
+    uint32_t		state[4];
+    uint64_t		length;		// bytes added so far
+    unsigned char	buffer[64];	// partial group not yet digested
+} MD5_CTX;
+
+//  CALCULATE THE MD5 DIGESTS OF n BUFFERS AT ONCE, LEAVE THE RESULT FOR
+//  inputs[i] IN md5_results[i]
+extern  void    MD5_buffers(size_t n, const void *const inputs[], const size_t lens[],
+			    void *const md5_results[]);
+
+//  START AN INCREMENTAL DIGEST
+extern  void    MD5_init(MD5_CTX *ctx);
+
+//  ADD len BYTES OF input TO AN INCREMENTAL DIGEST
+extern  void    MD5_update(MD5_CTX *ctx, const void *input, size_t len);
+
+//  FINISH AN INCREMENTAL DIGEST, LEAVE RESULT IN md5_result
+extern  void    *MD5_final(MD5_CTX *ctx, void *md5_result);
+
 //  RETURNS A 'HUMAN-READABLE' FORMATTED STRING OF AN MD5 DIGEST
 extern  char    *MD5_format(const void *md5_result);
 
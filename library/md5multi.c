@@ -0,0 +1,396 @@
+//  MULTI-BUFFER MD5: THE GROUPS OF ONE MESSAGE MUST BE DIGESTED IN ORDER, BUT
+//  THOSE OF DIFFERENT MESSAGES ARE INDEPENDENT, SO EACH LANE OF A VECTOR
+//  REGISTER DIGESTS A DIFFERENT MESSAGE.  16 LANES WITH AVX-512, 8 WITH AVX2
+//  OR 4 WITH SSE2, WHICHEVER THE PROCESSOR HAS, ONE MESSAGE AT A TIME ELSEWHERE.
+
+#include "md5.h"
+
+#include <string.h>
+
+#if	defined(__x86_64__) && defined(__GNUC__)
+#define	MD5_MULTI_X86
+#include <immintrin.h>
+#endif
+
+#if	defined(MD5_MULTI_X86)
+
+#define	MAXLANES	16
+
+//  THE 64 STEPS OF RFC1321, EXPANDED WITH EACH KERNEL'S OWN VECTOR OPERATIONS
+#define	F(x, y, z)	VXOR((z), VAND((x), VXOR((y), (z))))
+#define	G(x, y, z)	VXOR((y), VAND((z), VXOR((x), (y))))
+#define	H(x, y, z)	VXOR(VXOR((x), (y)), (z))
+#define	I(x, y, z)	VXOR((y), VOR((x), VNOT(z)))
+
+#define	STEP(f, a, b, c, d, g, k, s)					\
+	do {								\
+	    (a) = VADD(VADD((a), f((b), (c), (d))), VADD(w[g], VSET1(k)));	\
+	    (a) = VADD(VROL((a), (s)), (b));				\
+	} while(0)
+
+#define	MD5_STEPS							\
+    STEP(F, a, b, c, d,  0, 0xd76aa478,  7);				\
+    STEP(F, d, a, b, c,  1, 0xe8c7b756, 12);				\
+    STEP(F, c, d, a, b,  2, 0x242070db, 17);				\
+    STEP(F, b, c, d, a,  3, 0xc1bdceee, 22);				\
+    STEP(F, a, b, c, d,  4, 0xf57c0faf,  7);				\
+    STEP(F, d, a, b, c,  5, 0x4787c62a, 12);				\
+    STEP(F, c, d, a, b,  6, 0xa8304613, 17);				\
+    STEP(F, b, c, d, a,  7, 0xfd469501, 22);				\
+    STEP(F, a, b, c, d,  8, 0x698098d8,  7);				\
+    STEP(F, d, a, b, c,  9, 0x8b44f7af, 12);				\
+    STEP(F, c, d, a, b, 10, 0xffff5bb1, 17);				\
+    STEP(F, b, c, d, a, 11, 0x895cd7be, 22);				\
+    STEP(F, a, b, c, d, 12, 0x6b901122,  7);				\
+    STEP(F, d, a, b, c, 13, 0xfd987193, 12);				\
+    STEP(F, c, d, a, b, 14, 0xa679438e, 17);				\
+    STEP(F, b, c, d, a, 15, 0x49b40821, 22);				\
+    STEP(G, a, b, c, d,  1, 0xf61e2562,  5);				\
+    STEP(G, d, a, b, c,  6, 0xc040b340,  9);				\
+    STEP(G, c, d, a, b, 11, 0x265e5a51, 14);				\
+    STEP(G, b, c, d, a,  0, 0xe9b6c7aa, 20);				\
+    STEP(G, a, b, c, d,  5, 0xd62f105d,  5);				\
+    STEP(G, d, a, b, c, 10, 0x02441453,  9);				\
+    STEP(G, c, d, a, b, 15, 0xd8a1e681, 14);				\
+    STEP(G, b, c, d, a,  4, 0xe7d3fbc8, 20);				\
+    STEP(G, a, b, c, d,  9, 0x21e1cde6,  5);				\
+    STEP(G, d, a, b, c, 14, 0xc33707d6,  9);				\
+    STEP(G, c, d, a, b,  3, 0xf4d50d87, 14);				\
+    STEP(G, b, c, d, a,  8, 0x455a14ed, 20);				\
+    STEP(G, a, b, c, d, 13, 0xa9e3e905,  5);				\
+    STEP(G, d, a, b, c,  2, 0xfcefa3f8,  9);				\
+    STEP(G, c, d, a, b,  7, 0x676f02d9, 14);				\
+    STEP(G, b, c, d, a, 12, 0x8d2a4c8a, 20);				\
+    STEP(H, a, b, c, d,  5, 0xfffa3942,  4);				\
+    STEP(H, d, a, b, c,  8, 0x8771f681, 11);				\
+    STEP(H, c, d, a, b, 11, 0x6d9d6122, 16);				\
+    STEP(H, b, c, d, a, 14, 0xfde5380c, 23);				\
+    STEP(H, a, b, c, d,  1, 0xa4beea44,  4);				\
+    STEP(H, d, a, b, c,  4, 0x4bdecfa9, 11);				\
+    STEP(H, c, d, a, b,  7, 0xf6bb4b60, 16);				\
+    STEP(H, b, c, d, a, 10, 0xbebfbc70, 23);				\
+    STEP(H, a, b, c, d, 13, 0x289b7ec6,  4);				\
+    STEP(H, d, a, b, c,  0, 0xeaa127fa, 11);				\
+    STEP(H, c, d, a, b,  3, 0xd4ef3085, 16);				\
+    STEP(H, b, c, d, a,  6, 0x04881d05, 23);				\
+    STEP(H, a, b, c, d,  9, 0xd9d4d039,  4);				\
+    STEP(H, d, a, b, c, 12, 0xe6db99e5, 11);				\
+    STEP(H, c, d, a, b, 15, 0x1fa27cf8, 16);				\
+    STEP(H, b, c, d, a,  2, 0xc4ac5665, 23);				\
+    STEP(I, a, b, c, d,  0, 0xf4292244,  6);				\
+    STEP(I, d, a, b, c,  7, 0x432aff97, 10);				\
+    STEP(I, c, d, a, b, 14, 0xab9423a7, 15);				\
+    STEP(I, b, c, d, a,  5, 0xfc93a039, 21);				\
+    STEP(I, a, b, c, d, 12, 0x655b59c3,  6);				\
+    STEP(I, d, a, b, c,  3, 0x8f0ccc92, 10);				\
+    STEP(I, c, d, a, b, 10, 0xffeff47d, 15);				\
+    STEP(I, b, c, d, a,  1, 0x85845dd1, 21);				\
+    STEP(I, a, b, c, d,  8, 0x6fa87e4f,  6);				\
+    STEP(I, d, a, b, c, 15, 0xfe2ce6e0, 10);				\
+    STEP(I, c, d, a, b,  6, 0xa3014314, 15);				\
+    STEP(I, b, c, d, a, 13, 0x4e0811a1, 21);				\
+    STEP(I, a, b, c, d,  4, 0xf7537e82,  6);				\
+    STEP(I, d, a, b, c, 11, 0xbd3af235, 10);				\
+    STEP(I, c, d, a, b,  2, 0x2ad7d2bb, 15);				\
+    STEP(I, b, c, d, a,  9, 0xeb86d391, 21)
+
+//  EACH KERNEL DIGESTS ONE GROUP PER LANE: words[i][lane] IS WORD i OF THAT
+//  LANE'S GROUP, AND state[j][lane] IS WORD j OF THAT LANE'S DIGEST
+
+#define	VADD(x, y)	_mm_add_epi32((x), (y))
+#define	VAND(x, y)	_mm_and_si128((x), (y))
+#define	VOR(x, y)	_mm_or_si128((x), (y))
+#define	VXOR(x, y)	_mm_xor_si128((x), (y))
+#define	VNOT(x)		_mm_xor_si128((x), _mm_set1_epi32(-1))
+#define	VROL(x, s)	_mm_or_si128(_mm_slli_epi32((x), (s)), _mm_srli_epi32((x), 32 - (s)))
+#define	VSET1(k)	_mm_set1_epi32((int)(k))
+
+static void transform_sse2(uint32_t state[4][MAXLANES], uint32_t words[16][MAXLANES])
+{
+    __m128i w[16];
+
+    for(int i=0 ; i<16 ; i++)
+	w[i]	= _mm_loadu_si128((const __m128i *)words[i]);
+
+    __m128i a = _mm_loadu_si128((const __m128i *)state[0]);
+    __m128i b = _mm_loadu_si128((const __m128i *)state[1]);
+    __m128i c = _mm_loadu_si128((const __m128i *)state[2]);
+    __m128i d = _mm_loadu_si128((const __m128i *)state[3]);
+    __m128i aa = a, bb = b, cc = c, dd = d;
+
+    MD5_STEPS;
+
+    _mm_storeu_si128((__m128i *)state[0], VADD(a, aa));
+    _mm_storeu_si128((__m128i *)state[1], VADD(b, bb));
+    _mm_storeu_si128((__m128i *)state[2], VADD(c, cc));
+    _mm_storeu_si128((__m128i *)state[3], VADD(d, dd));
+}
+
+#undef	VADD
+#undef	VAND
+#undef	VOR
+#undef	VXOR
+#undef	VNOT
+#undef	VROL
+#undef	VSET1
+
+#define	VADD(x, y)	_mm256_add_epi32((x), (y))
+#define	VAND(x, y)	_mm256_and_si256((x), (y))
+#define	VOR(x, y)	_mm256_or_si256((x), (y))
+#define	VXOR(x, y)	_mm256_xor_si256((x), (y))
+#define	VNOT(x)		_mm256_xor_si256((x), _mm256_set1_epi32(-1))
+#define	VROL(x, s)	_mm256_or_si256(_mm256_slli_epi32((x), (s)), _mm256_srli_epi32((x), 32 - (s)))
+#define	VSET1(k)	_mm256_set1_epi32((int)(k))
+
+__attribute__((target("avx2")))
+static void transform_avx2(uint32_t state[4][MAXLANES], uint32_t words[16][MAXLANES])
+{
+    __m256i w[16];
+
+    for(int i=0 ; i<16 ; i++)
+	w[i]	= _mm256_loadu_si256((const __m256i *)words[i]);
+
+    __m256i a = _mm256_loadu_si256((const __m256i *)state[0]);
+    __m256i b = _mm256_loadu_si256((const __m256i *)state[1]);
+    __m256i c = _mm256_loadu_si256((const __m256i *)state[2]);
+    __m256i d = _mm256_loadu_si256((const __m256i *)state[3]);
+    __m256i aa = a, bb = b, cc = c, dd = d;
+
+    MD5_STEPS;
+
+    _mm256_storeu_si256((__m256i *)state[0], VADD(a, aa));
+    _mm256_storeu_si256((__m256i *)state[1], VADD(b, bb));
+    _mm256_storeu_si256((__m256i *)state[2], VADD(c, cc));
+    _mm256_storeu_si256((__m256i *)state[3], VADD(d, dd));
+}
+
+#undef	VADD
+#undef	VAND
+#undef	VOR
+#undef	VXOR
+#undef	VNOT
+#undef	VROL
+#undef	VSET1
+
+//  AVX-512 ROTATES IN ONE INSTRUCTION, AND F, G AND I EACH NEED ONLY ONE TERNARY LOGIC
+//  INSTRUCTION, BUT THE STEPS ARE KEPT THE SAME AS THE OTHER KERNELS' FOR SIMPLICITY
+#define	VADD(x, y)	_mm512_add_epi32((x), (y))
+#define	VAND(x, y)	_mm512_and_si512((x), (y))
+#define	VOR(x, y)	_mm512_or_si512((x), (y))
+#define	VXOR(x, y)	_mm512_xor_si512((x), (y))
+#define	VNOT(x)		_mm512_xor_si512((x), _mm512_set1_epi32(-1))
+#define	VROL(x, s)	_mm512_rol_epi32((x), (s))
+#define	VSET1(k)	_mm512_set1_epi32((int)(k))
+
+__attribute__((target("avx512f")))
+static void transform_avx512(uint32_t state[4][MAXLANES], uint32_t words[16][MAXLANES])
+{
+    __m512i w[16];
+
+    for(int i=0 ; i<16 ; i++)
+	w[i]	= _mm512_loadu_si512((const void *)words[i]);
+
+    __m512i a = _mm512_loadu_si512((const void *)state[0]);
+    __m512i b = _mm512_loadu_si512((const void *)state[1]);
+    __m512i c = _mm512_loadu_si512((const void *)state[2]);
+    __m512i d = _mm512_loadu_si512((const void *)state[3]);
+    __m512i aa = a, bb = b, cc = c, dd = d;
+
+    MD5_STEPS;
+
+    _mm512_storeu_si512((void *)state[0], VADD(a, aa));
+    _mm512_storeu_si512((void *)state[1], VADD(b, bb));
+    _mm512_storeu_si512((void *)state[2], VADD(c, cc));
+    _mm512_storeu_si512((void *)state[3], VADD(d, dd));
+}
+
+#undef	VADD
+#undef	VAND
+#undef	VOR
+#undef	VXOR
+#undef	VNOT
+#undef	VROL
+#undef	VSET1
+
+#undef	MD5_STEPS
+#undef	STEP
+#undef	F
+#undef	G
+#undef	H
+#undef	I
+
+typedef void (*Kernel)(uint32_t state[4][MAXLANES], uint32_t words[16][MAXLANES]);
+
+//  CHOOSE THE NARROWEST KERNEL THAT GIVES EACH OF n MESSAGES ITS OWN LANE,
+//  OR THE WIDEST ONE THE PROCESSOR SUPPORTS IF NONE DOES
+static int choose_kernel(size_t n, Kernel *kernel)
+{
+    static int	widest	= 0;
+
+    if(widest == 0) {
+	__builtin_cpu_init();
+	widest	= __builtin_cpu_supports("avx512f") ? 16 :
+		  __builtin_cpu_supports("avx2") ? 8 : 4;
+    }
+    if(n > 8 && widest == 16) {
+	*kernel	= transform_avx512;
+	return 16;
+    }
+    if(n > 4 && widest >= 8) {
+	*kernel	= transform_avx2;
+	return 8;
+    }
+    *kernel	= transform_sse2;
+    return 4;
+}
+
+//  --------------------------------------------------------------------------
+
+//  ONE LANE'S MESSAGE: ITS WHOLE GROUPS ARE READ IN PLACE, THEN THE ONE OR TWO
+//  GROUPS HOLDING ITS LAST BYTES, PADDING AND LENGTH ARE READ FROM tail
+typedef struct {
+    const uint8_t	*next;		// next whole group to digest
+    size_t		ngroups;	// whole groups left at next
+    uint8_t		tail[128];
+    size_t		ntail;		// groups of tail
+    size_t		tailgroup;	// groups of tail already digested
+    size_t		message;	// index of the message, n for an idle lane
+} Lane;
+
+//  A MESSAGE WAITING FOR A LANE
+typedef struct {
+    size_t		len;
+    size_t		message;
+} Job;
+
+//  THE LONGEST MESSAGES ARE STARTED FIRST SO THAT THE LANES FINISH TOGETHER
+static int longest_first(const void *a, const void *b)
+{
+    const Job *x = (const Job *)a;
+    const Job *y = (const Job *)b;
+
+    return (x->len < y->len) - (x->len > y->len);
+}
+
+//  READ A 32-BIT WORD STORED LEAST SIGNIFICANT BYTE FIRST
+static inline uint32_t load32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	   ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void start_lane(Lane *lane, uint32_t state[4][MAXLANES], int l,
+		       size_t message, const uint8_t *input, size_t len)
+{
+    static const uint32_t init[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    size_t rest		= len % 64;
+    uint64_t bits	= 8*(uint64_t)len;
+
+    for(int j=0 ; j<4 ; j++)
+	state[j][l]	= init[j];
+    lane->next		= input;
+    lane->ngroups	= len / 64;
+    lane->ntail		= (rest < 56) ? 1 : 2;
+    lane->tailgroup	= 0;
+    lane->message	= message;
+    memset(lane->tail, 0, sizeof(lane->tail));
+    if(rest > 0)
+	memcpy(lane->tail, input + len - rest, rest);
+    lane->tail[rest]	= 0x80;
+    for(int i=0 ; i<8 ; i++)
+	lane->tail[64*lane->ntail - 8 + i] = (uint8_t)(bits >> (8*i));
+}
+
+//  RETURN THE NEXT GROUP OF A LANE'S MESSAGE, THERE IS ALWAYS ONE LEFT
+static const uint8_t *next_group(Lane *lane)
+{
+    if(lane->ngroups > 0) {
+	lane->ngroups--;
+	lane->next	+= 64;
+	return lane->next - 64;
+    }
+    return lane->tail + 64*lane->tailgroup++;
+}
+
+static void multi_buffer(Kernel kernel, int nlanes, Job *jobs, size_t n,
+			 const void *const inputs[], void *const md5_results[])
+{
+    static const uint8_t idle[64];
+    Lane	lanes[MAXLANES];
+    uint32_t	state[4][MAXLANES];
+    uint32_t	words[16][MAXLANES];
+    size_t	started	= 0;
+    int		nactive	= 0;
+
+    for(int l=0 ; l<nlanes ; l++) {
+	lanes[l].message	= n;
+	if(started < n) {
+	    start_lane(&lanes[l], state, l, jobs[started].message,
+		       (const uint8_t *)inputs[jobs[started].message], jobs[started].len);
+	    started++;
+	    nactive++;
+	}
+    }
+    while(nactive > 0) {
+//  GATHER WORD i OF EVERY LANE'S NEXT GROUP INTO words[i], IDLE LANES DIGEST ZEROS
+	for(int l=0 ; l<nlanes ; l++) {
+	    const uint8_t *group = (lanes[l].message < n) ? next_group(&lanes[l]) : idle;
+
+	    for(int i=0 ; i<16 ; i++)
+		words[i][l]	= load32(group + 4*i);
+	}
+	kernel(state, words);
+
+//  A LANE THAT HAS DIGESTED ITS WHOLE MESSAGE TAKES THE NEXT ONE
+	for(int l=0 ; l<nlanes ; l++) {
+	    Lane *lane	= &lanes[l];
+
+	    if(lane->message == n || lane->ngroups > 0 || lane->tailgroup < lane->ntail)
+		continue;
+
+	    uint8_t *res	= (uint8_t *)md5_results[lane->message];
+
+	    for(int i=0 ; i<MD5_BYTELEN ; i++)
+		res[i]	= (uint8_t)(state[i/4][l] >> (8*(i%4)));
+	    lane->message	= n;
+	    if(started < n) {
+		start_lane(lane, state, l, jobs[started].message,
+			   (const uint8_t *)inputs[jobs[started].message], jobs[started].len);
+		started++;
+	    }
+	    else
+		nactive--;
+	}
+    }
+}
+
+#endif
+
+//  CALCULATE THE MD5 DIGESTS OF n BUFFERS AT ONCE, LEAVE THE RESULT FOR
+//  inputs[i] IN md5_results[i]
+void MD5_buffers(size_t n, const void *const inputs[], const size_t lens[],
+		 void *const md5_results[])
+{
+#if	defined(MD5_MULTI_X86)
+    Job *jobs	= (n > 1) ? (Job *)malloc(n * sizeof(Job)) : NULL;
+
+    if(jobs != NULL) {
+	Kernel	kernel;
+	int	nlanes	= choose_kernel(n, &kernel);
+
+	for(size_t i=0 ; i<n ; i++) {
+	    jobs[i].len		= lens[i];
+	    jobs[i].message	= i;
+	}
+	qsort(jobs, n, sizeof(Job), longest_first);
+	multi_buffer(kernel, nlanes, jobs, n, inputs, md5_results);
+	free(jobs);
+	return;
+    }
+#endif
+//  ONE MESSAGE, OR NO VECTOR KERNEL, IS DIGESTED ONE GROUP AT A TIME
+    for(size_t i=0 ; i<n ; i++)
+	MD5_buffer((const char *)inputs[i], lens[i], md5_results[i]);
+}
+
+//  vim: ts=8 sw=4
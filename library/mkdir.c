@@ -4,13 +4,18 @@
 #include <string.h>
 
 // make a new directory within an existing volume
-int SIFS_mkdir(const char *volumename, const char *pathname)
+int SIFS_vmkdir(SIFS_VOLUME *volume, const char *pathname)
 {
-    if (volumename == NULL || pathname == NULL || strlen(pathname) == 0)
+    if (volume == NULL || pathname == NULL || strlen(pathname) == 0)
     {
         SIFS_errno = SIFS_EINVAL;
         return SIFS_FAILURE;
     }
+    if (!volume->writable)
+    {
+        SIFS_errno = SIFS_EROFS;
+        return SIFS_FAILURE;
+    }
 
     size_t dircount;
     char** dirnames = strsplit(pathname, SIFS_DIR_DELIMITER, &dircount);
@@ -37,7 +42,7 @@ int SIFS_mkdir(const char *volumename, const char *pathname)
 
     // Find the parent directory to make the directory in
     SIFS_BLOCKID dirblockId;
-    SIFS_DIRBLOCK* dirblock = SIFS_getdir(volumename, dirnames, dircount - 1, &dirblockId);
+    SIFS_DIRBLOCK* dirblock = SIFS_getdir(volume, dirnames, dircount - 1, &dirblockId);
     if (dirblock == NULL)
     {
         // SIFS_errno set in SIFS_getdir()
@@ -48,44 +53,73 @@ int SIFS_mkdir(const char *volumename, const char *pathname)
     if (dirblock->nentries >= SIFS_MAX_ENTRIES)
     {
         freesplit(dirnames);
-        free(dirblock);
+        SIFS_releaseblock(volume, dirblock);
         SIFS_errno = SIFS_EMAXENTRY;
         return SIFS_FAILURE;
     }
     // Make sure that the directory has no entries with newdirname (file or directory)
-    if (SIFS_hasentry(volumename, dirblock, newdirname))
+    bool found;
+    if (SIFS_hasentry(volume, dirblock, newdirname, &found) == SIFS_FAILURE)
     {
+        // SIFS_errno set in SIFS_hasentry()
         freesplit(dirnames);
-        free(dirblock);
+        SIFS_releaseblock(volume, dirblock);
+        return SIFS_FAILURE;
+    }
+    if (found)
+    {
+        freesplit(dirnames);
+        SIFS_releaseblock(volume, dirblock);
         SIFS_errno = SIFS_EEXIST;
         return SIFS_FAILURE;
     }
     // Allocate a new directory block
-    SIFS_BLOCKID newBlockId = SIFS_allocateblocks(volumename, 1, SIFS_DIR);
+    SIFS_BLOCKID newBlockId = SIFS_allocateblocks(volume, 1, SIFS_DIR);
     // Check if the allocation was successful
     if (newBlockId == SIFS_ROOTDIR_BLOCKID)
     {
         freesplit(dirnames);
-        free(dirblock);
+        SIFS_releaseblock(volume, dirblock);
         SIFS_errno = SIFS_ENOSPC;
         return SIFS_FAILURE;
     }
     // Update parent directory entries and modtime
     dirblock->modtime = time(NULL);
     dirblock->entries[dirblock->nentries++].blockID = newBlockId;
+    SIFS_adddirname(volume, dirblock, SIFS_DIR, newdirname);
     // Get the new directory block and set its entries and modtime
-    SIFS_DIRBLOCK* newBlock = (SIFS_DIRBLOCK*)SIFS_getblock(volumename, newBlockId);
+    SIFS_DIRBLOCK* newBlock = (SIFS_DIRBLOCK*)SIFS_getblock(volume, newBlockId);
     memcpy(newBlock->name, newdirname, strlen(newdirname) + 1);
     newBlock->modtime = dirblock->modtime;
     newBlock->nentries = 0;
+    SIFS_initdirnames(volume, newBlock);
+    SIFS_dentryinsert(volume, dirblockId, newdirname, SIFS_DIR, newBlockId, 0);
 
     // Rewrite both directory blocks to the volume
-    SIFS_updateblock(volumename, dirblockId, dirblock, 0);
-    SIFS_updateblock(volumename, newBlockId, newBlock, 0);
+    SIFS_updateblock(volume, dirblockId, dirblock, 0);
+    SIFS_updateblock(volume, newBlockId, newBlock, 0);
     
-    free(newBlock);
-    free(dirblock);
+    SIFS_releaseblock(volume, newBlock);
+    SIFS_releaseblock(volume, dirblock);
     freesplit(dirnames);
     SIFS_errno = SIFS_EOK;
     return SIFS_SUCCESS;
 }
+
+// make a new directory within an existing volume, opening the volume only for the duration of the call
+int SIFS_mkdir(const char *volumename, const char *pathname)
+{
+    if (volumename == NULL || pathname == NULL || strlen(pathname) == 0)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vmkdir(volume, pathname);
+    return SIFS_closeafter(volume, result);
+}
@@ -1,11 +1,22 @@
-#include <stdio.h>
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 #include "sifsutils.h"
 
 // make a new volume
 int SIFS_mkvolume(const char *volumename, size_t blocksize, uint32_t nblocks)
+{
+    return SIFS_makevolume(volumename, blocksize, nblocks, 0);
+}
+
+// make a new volume, only its header, bitmap and root directory are written
+int SIFS_makevolume(const char *volumename, size_t blocksize, uint32_t nblocks, int flags)
 {
 //  ENSURE THAT RECEIVED PARAMETERS ARE VALID
     if(volumename == NULL || nblocks == 0 || blocksize < SIFS_MIN_BLOCKSIZE) {
@@ -13,18 +24,44 @@ int SIFS_mkvolume(const char *volumename, size_t blocksize, uint32_t nblocks)
         return SIFS_FAILURE;
     }
 
-//  ENSURE THAT THE REQUESTED VOLUME DOES NOT ALREADY EXIST
-    if(access(volumename, F_OK) == 0) {
-        SIFS_errno	= SIFS_EEXIST;
+//  ONLY ONE HASH CAN IDENTIFY THE FILES OF A VOLUME
+    int		hashes		= flags & (SIFS_MKVOLUME_XXH128 | SIFS_MKVOLUME_BLAKE3);
+
+    if(hashes == (SIFS_MKVOLUME_XXH128 | SIFS_MKVOLUME_BLAKE3)) {
+        SIFS_errno	= SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+
+//  THE bitmap AND rootdir CAN BE FAR TOO LARGE FOR THE STACK
+    bool	packed		= (flags & (SIFS_MKVOLUME_PACKED | SIFS_MKVOLUME_CHUNKED)) != 0 || hashes != 0;
+    size_t	bitmapbytes	= SIFS_bitmapbytes(nblocks, packed);
+
+//  THE BLOCKS OF A PACKED VOLUME START ON A PAGE BOUNDARY, THE BITMAP IS PADDED UP TO THEM
+    if(packed) {
+        size_t	blockoffset	= sizeof(SIFS_VOLUME_HEADER) + sizeof(SIFS_VOLUME_EXTHEADER) + bitmapbytes;
+
+        blockoffset	= (blockoffset + SIFS_BLOCKALIGN - 1) / SIFS_BLOCKALIGN * SIFS_BLOCKALIGN;
+        bitmapbytes	= blockoffset - sizeof(SIFS_VOLUME_HEADER) - sizeof(SIFS_VOLUME_EXTHEADER);
+    }
+    SIFS_BIT	*bitmap		= malloc(bitmapbytes);
+    char	*oneblock	= calloc(1, blocksize);	// cleared to all zeroes
+
+    if(bitmap == NULL || oneblock == NULL) {
+        free(bitmap);
+        free(oneblock);
+        SIFS_errno	= SIFS_ENOMEM;
         return SIFS_FAILURE;
     }
 
-//  ATTEMPT TO CREATE THE NEW VOLUME - OPEN FOR WRITING
-    FILE *vol	= fopen(volumename, "w");
+//  ATTEMPT TO CREATE THE NEW VOLUME - OPEN FOR WRITING,
+//  FAILING IF THE REQUESTED VOLUME ALREADY EXISTS
+    int vol	= open(volumename, O_WRONLY | O_CREAT | O_EXCL, 0666);
 
 //  VOLUME CREATION FAILED
-    if(vol == NULL) {
-        SIFS_errno	= SIFS_ECREATE;
+    if(vol < 0) {
+        free(bitmap);
+        free(oneblock);
+        SIFS_errno	= (errno == EEXIST) ? SIFS_EEXIST : SIFS_ECREATE;
         return SIFS_FAILURE;
     }
 
@@ -34,14 +71,31 @@ int SIFS_mkvolume(const char *volumename, size_t blocksize, uint32_t nblocks)
         .nblocks	= nblocks,
     };
 
-    SIFS_BIT	bitmap[nblocks];
+    SIFS_VOLUME_EXTHEADER	exthdr;
+    memset(&exthdr, 0, sizeof exthdr);
 
-    bitmap[SIFS_ROOTDIR_BLOCKID] = SIFS_DIR;	// the root directory
-    for(int b=1 ; b<nblocks ; ++b) {
-        bitmap[b]	= SIFS_UNUSED;
-    }
+    if(packed) {
+        SIFS_BIT	rootdir	= SIFS_DIR;
 
-    char		oneblock[blocksize];
+        memcpy(exthdr.magic, SIFS_EXTHEADER_MAGIC, sizeof SIFS_EXTHEADER_MAGIC);
+        exthdr.version		= SIFS_FORMAT_PACKED;
+        exthdr.blockoffset	= sizeof header + sizeof exthdr + bitmapbytes;
+        SIFS_initzones(&exthdr, nblocks);
+        exthdr.features		|= SIFS_FEATURE_EXTENTS | SIFS_FEATURE_HASHINDEX | SIFS_FEATURE_DIRNAMES;
+        if(flags & SIFS_MKVOLUME_CHUNKED) {
+            exthdr.features	|= SIFS_FEATURE_CHUNKS;
+        }
+        exthdr.hashoffset	= exthdr.blockoffset + (uint64_t)blocksize * nblocks;
+        exthdr.nhashbuckets	= SIFS_hashbuckets(nblocks);
+        exthdr.hashalg		= (hashes == SIFS_MKVOLUME_XXH128) ? SIFS_HASH_XXH128 :
+				  (hashes == SIFS_MKVOLUME_BLAKE3) ? SIFS_HASH_BLAKE3 : SIFS_HASH_MD5;
+        memset(bitmap, 0, bitmapbytes);		// SIFS_UNUSED packs to zero, as does the padding
+        SIFS_bitmappack(&rootdir, 0, 1, (unsigned char *)bitmap);
+    }
+    else {
+        memset(bitmap, SIFS_UNUSED, nblocks);
+        bitmap[SIFS_ROOTDIR_BLOCKID] = SIFS_DIR;	// the root directory
+    }
 
     SIFS_DIRBLOCK	rootdir_block;
     memset(&rootdir_block, 0, sizeof rootdir_block);	// cleared to all zeroes
@@ -49,21 +103,58 @@ int SIFS_mkvolume(const char *volumename, size_t blocksize, uint32_t nblocks)
     rootdir_block.name[0]       = '\0';
     rootdir_block.modtime	= time(NULL);
     rootdir_block.nentries	= 0;
-    memset(oneblock, 0, sizeof oneblock);        // cleared to all zeroes
     memcpy(oneblock, &rootdir_block, sizeof rootdir_block);
 
-//  WRITE ALL OF THE INITIALISED SECTIONS TO THE VOLUME
-    fwrite(&header, sizeof header, 1, vol);
-    fwrite(bitmap,  sizeof bitmap, 1, vol);
+//  THE ROOT DIRECTORY OF A PACKED VOLUME STARTS WITH NO NAMES OF ENTRIES
+    if(packed) {
+        uint32_t	magic	= SIFS_DIRNAMES_MAGIC;
 
-    fwrite(oneblock, sizeof oneblock, 1, vol);	// write rootdir
-    memset(oneblock, 0, sizeof oneblock);	// reset to all zeroes
-    for(int b=1 ; b<nblocks ; ++b) {
-        fwrite(oneblock, sizeof oneblock, 1, vol);
+        memcpy(oneblock + sizeof rootdir_block, &magic, sizeof magic);
+    }
+
+//  WRITE ALL OF THE INITIALISED SECTIONS TO THE VOLUME WITH ONE GATHERED WRITE
+    struct iovec	iov[4];
+    int			iovcnt	= 0;
+
+    iov[iovcnt].iov_base	= &header;
+    iov[iovcnt++].iov_len	= sizeof header;
+    if(packed) {
+        iov[iovcnt].iov_base	= &exthdr;	// only volumes not in the original layout
+        iov[iovcnt++].iov_len	= sizeof exthdr;
+    }
+    iov[iovcnt].iov_base	= bitmap;
+    iov[iovcnt++].iov_len	= bitmapbytes;
+    iov[iovcnt].iov_base	= oneblock;		// the rootdir
+    iov[iovcnt++].iov_len	= blocksize;
+    int result	= SIFS_pwritevfull(vol, iov, iovcnt, 0);
+
+//  THE REMAINING BLOCKS ARE ALL ZEROES, SO THE FILE IS EXTENDED TO ITS FULL
+//  LENGTH WITHOUT WRITING THEM - LEAVING A SPARSE FILE UNLESS PREALLOCATED
+//  THE EMPTY INDEX OF FILEBLOCKS OF A PACKED VOLUME FOLLOWS ITS BLOCKS, ALSO ALL ZEROES
+    off_t	length	= (off_t)(sizeof header + (packed ? sizeof exthdr : 0) + bitmapbytes)
+			+ (off_t)blocksize * nblocks
+			+ (off_t)exthdr.nhashbuckets * SIFS_HASHBUCKET_BYTES;
+
+    if(result == SIFS_SUCCESS) {
+        if(flags & SIFS_MKVOLUME_PREALLOCATE) {
+            result	= (posix_fallocate(vol, 0, length) == 0) ? SIFS_SUCCESS : SIFS_FAILURE;
+        }
+        else {
+            result	= (ftruncate(vol, length) == 0) ? SIFS_SUCCESS : SIFS_FAILURE;
+        }
     }
 
 //  FINISHED, CLOSE THE VOLUME
-    fclose(vol);
+    close(vol);
+    free(bitmap);
+    free(oneblock);
+
+//  A PARTIALLY WRITTEN VOLUME IS OF NO USE TO ANYONE
+    if(result != SIFS_SUCCESS) {
+        unlink(volumename);
+        SIFS_errno	= SIFS_ECREATE;
+        return SIFS_FAILURE;
+    }
 
 //  AND RETURN INDICATING SUCCESS
     return SIFS_SUCCESS;
@@ -0,0 +1,344 @@
+#include "sifsutils.h"
+#include <string.h>
+
+// Helper function that reads the link of a fileblock into link, returns false if the fileblock is not in a chain
+static bool getlink(const SIFS_FILEBLOCK* block, SIFS_NAMELINK* link)
+{
+    memcpy(link, block->filenames[SIFS_MAX_ENTRIES - 1], sizeof(SIFS_NAMELINK));
+    return block->nfiles < SIFS_MAX_ENTRIES && link->empty[0] == '\0' && link->magic == SIFS_NAMELINK_MAGIC;
+}
+
+// Helper function that stores the link of a fileblock in place of its last name
+static void setlink(SIFS_FILEBLOCK* block, SIFS_BLOCKID head, SIFS_BLOCKID next)
+{
+    SIFS_NAMELINK link;
+    memset(&link, 0, sizeof(link));
+    link.magic = SIFS_NAMELINK_MAGIC;
+    link.head = head;
+    link.next = next;
+    memset(block->filenames[SIFS_MAX_ENTRIES - 1], 0, SIFS_MAX_NAME_LENGTH);
+    memcpy(block->filenames[SIFS_MAX_ENTRIES - 1], &link, sizeof(link));
+}
+
+// Helper function that makes the last name of a fileblock an unused name again
+static void clearlink(SIFS_FILEBLOCK* block)
+{
+    memset(block->filenames[SIFS_MAX_ENTRIES - 1], 0, SIFS_MAX_NAME_LENGTH);
+}
+
+// Helper function that points the entry of whichever directory references name fileindex of fileblock blockId at
+// name newIndex of fileblock newBlockId, dir is updated in memory and every other directory on the volume
+static void move_entry(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId,
+    SIFS_BLOCKID blockId, uint32_t fileindex, SIFS_BLOCKID newBlockId, uint32_t newIndex)
+{
+    SIFS_dentryforget(volume, blockId);
+    for (uint32_t j = 0; j < dir->nentries; j++)
+    {
+        if (dir->entries[j].blockID == blockId && dir->entries[j].fileindex == fileindex)
+        {
+            dir->entries[j].blockID = newBlockId;
+            dir->entries[j].fileindex = newIndex;
+            return;
+        }
+    }
+    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
+    if (bitmap == NULL)
+    {
+        return;
+    }
+    SIFS_BLOCKID nblocks = volume->header.nblocks;
+    for (SIFS_BLOCKID i = SIFS_bitmapfind(bitmap, 0, nblocks, SIFS_DIR); i < nblocks; i = SIFS_bitmapfind(bitmap, i + 1, nblocks, SIFS_DIR))
+    {
+        if (i == dirblockId)
+        {
+            continue;
+        }
+        SIFS_DIRBLOCK* other = (SIFS_DIRBLOCK*)SIFS_getblock(volume, i);
+        if (other == NULL)
+        {
+            continue;
+        }
+        for (uint32_t j = 0; j < other->nentries; j++)
+        {
+            if (other->entries[j].blockID == blockId && other->entries[j].fileindex == fileindex)
+            {
+                other->entries[j].blockID = newBlockId;
+                other->entries[j].fileindex = newIndex;
+                SIFS_updateblock(volume, i, other, 0);
+                SIFS_releaseblock(volume, other);
+                return;
+            }
+        }
+        SIFS_releaseblock(volume, other);
+    }
+}
+
+// Helper function that adds an empty fileblock to the chain of head straight after it, making one if there is none
+static SIFS_FILEBLOCK* add_continuation(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId,
+    SIFS_FILEBLOCK* head, SIFS_BLOCKID headId, SIFS_BLOCKID* outBlockId)
+{
+    SIFS_BLOCKID blockId = SIFS_allocateblocks(volume, 1, SIFS_FILE);
+    if (blockId == SIFS_ROOTDIR_BLOCKID)
+    {
+        SIFS_errno = SIFS_ENOSPC;
+        return NULL;
+    }
+    SIFS_FILEBLOCK* block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, blockId);
+    if (block == NULL)
+    {
+        SIFS_freeblocks(volume, blockId, 1);
+        return NULL;
+    }
+    // A copy of the head, including the runs after it, is read like any other fileblock
+    memcpy(block, head, volume->header.blocksize);
+    memset(block->filenames, 0, sizeof(block->filenames));
+    block->nfiles = 0;
+    SIFS_NAMELINK link;
+    if (!getlink(head, &link))
+    {
+        // The last name of the head makes way for the link, it becomes the first name of the new fileblock
+        memcpy(block->filenames[block->nfiles++], head->filenames[SIFS_MAX_ENTRIES - 1], SIFS_MAX_NAME_LENGTH);
+        head->nfiles--;
+        move_entry(volume, dir, dirblockId, headId, SIFS_MAX_ENTRIES - 1, blockId, 0);
+        link.next = SIFS_ROOTDIR_BLOCKID;
+    }
+    setlink(block, headId, link.next);
+    setlink(head, headId, blockId);
+    SIFS_updateblock(volume, headId, head, 0);
+    SIFS_updateblock(volume, blockId, block, 0);
+    *outBlockId = blockId;
+    return block;
+}
+
+SIFS_BLOCKID SIFS_chainhead(const SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId)
+{
+    SIFS_NAMELINK link;
+    return getlink(block, &link) ? link.head : blockId;
+}
+
+SIFS_FILEBLOCK* SIFS_namesblock(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId,
+    SIFS_FILEBLOCK* block, SIFS_BLOCKID* blockId)
+{
+    SIFS_NAMELINK link;
+    if (!getlink(block, &link))
+    {
+        if (block->nfiles < SIFS_MAX_ENTRIES)
+        {
+            return block;
+        }
+        SIFS_FILEBLOCK* added = add_continuation(volume, dir, dirblockId, block, *blockId, blockId);
+        SIFS_releaseblock(volume, block);
+        return added;
+    }
+    // Without an index the fileblock found by md5 can be any of the chain, look from its head
+    SIFS_BLOCKID headId = link.head;
+    if (headId != *blockId)
+    {
+        SIFS_releaseblock(volume, block);
+        block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, headId);
+        if (block == NULL || !getlink(block, &link))
+        {
+            if (block != NULL)
+            {
+                SIFS_releaseblock(volume, block);
+            }
+            SIFS_errno = SIFS_ENOTVOL;
+            return NULL;
+        }
+    }
+    // New fileblocks are added straight after the head, so the first with room is usually found at once
+    SIFS_BLOCKID id = headId;
+    SIFS_FILEBLOCK* head = block;
+    while (block->nfiles >= SIFS_MAX_ENTRIES - 1 && link.next != SIFS_ROOTDIR_BLOCKID && link.next != headId)
+    {
+        id = link.next;
+        if (block != head)
+        {
+            SIFS_releaseblock(volume, block);
+        }
+        block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, id);
+        if (block == NULL || !getlink(block, &link))
+        {
+            if (block != NULL)
+            {
+                SIFS_releaseblock(volume, block);
+            }
+            SIFS_releaseblock(volume, head);
+            SIFS_errno = SIFS_ENOTVOL;
+            return NULL;
+        }
+    }
+    if (block->nfiles < SIFS_MAX_ENTRIES - 1)
+    {
+        if (block != head)
+        {
+            SIFS_releaseblock(volume, head);
+        }
+        *blockId = id;
+        return block;
+    }
+    if (block != head)
+    {
+        SIFS_releaseblock(volume, block);
+    }
+    SIFS_FILEBLOCK* added = add_continuation(volume, dir, dirblockId, head, headId, blockId);
+    SIFS_releaseblock(volume, head);
+    return added;
+}
+
+bool SIFS_leavechain(SIFS_VOLUME* volume, SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId)
+{
+    SIFS_NAMELINK link;
+    if (!getlink(block, &link))
+    {
+        return false;
+    }
+    // The head owns the data, and keeps it while there are other fileblocks in the chain
+    if (link.head == blockId)
+    {
+        if (link.next != SIFS_ROOTDIR_BLOCKID)
+        {
+            return true;
+        }
+        clearlink(block);
+        return false;
+    }
+    SIFS_FILEBLOCK* head = (SIFS_FILEBLOCK*)SIFS_getblock(volume, link.head);
+    if (head == NULL)
+    {
+        return true;
+    }
+    // Find the fileblock before this one and point it at the one after
+    SIFS_FILEBLOCK* prev = head;
+    SIFS_BLOCKID prevId = link.head;
+    SIFS_NAMELINK prevlink;
+    bool linked = getlink(prev, &prevlink);
+    while (linked && prevlink.next != blockId && prevlink.next != SIFS_ROOTDIR_BLOCKID)
+    {
+        if (prev != head)
+        {
+            SIFS_releaseblock(volume, prev);
+        }
+        prevId = prevlink.next;
+        prev = (SIFS_FILEBLOCK*)SIFS_getblock(volume, prevId);
+        linked = prev != NULL && getlink(prev, &prevlink);
+    }
+    if (linked && prevlink.next == blockId)
+    {
+        setlink(prev, prevlink.head, link.next);
+        SIFS_updateblock(volume, prevId, prev, 0);
+    }
+    if (prev != NULL && prev != head)
+    {
+        SIFS_releaseblock(volume, prev);
+    }
+    clearlink(block);
+    SIFS_freeblocks(volume, blockId, 1);
+
+    // A head left on its own has room for all of its names again, and is freed with its data if it has none
+    SIFS_NAMELINK headlink;
+    if (getlink(head, &headlink) && headlink.next == SIFS_ROOTDIR_BLOCKID)
+    {
+        clearlink(head);
+        if (head->nfiles == 0)
+        {
+            SIFS_EXTENTLIST extents;
+            SIFS_getextents(volume, head, &extents);
+            SIFS_freeextents(volume, &extents);
+            SIFS_hashremove(volume, head->md5, link.head);
+            SIFS_freeblocks(volume, link.head, 1);
+        }
+        SIFS_updateblock(volume, link.head, head, 0);
+    }
+    SIFS_releaseblock(volume, head);
+    return true;
+}
+
+void SIFS_movechain(SIFS_VOLUME* volume, SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId, SIFS_BLOCKID newBlockId)
+{
+    SIFS_NAMELINK link;
+    if (!getlink(block, &link))
+    {
+        return;
+    }
+    if (link.head == blockId)
+    {
+        // Every fileblock of the chain records where its head is
+        setlink(block, newBlockId, link.next);
+        for (SIFS_BLOCKID id = link.next; id != SIFS_ROOTDIR_BLOCKID; )
+        {
+            SIFS_FILEBLOCK* other = (SIFS_FILEBLOCK*)SIFS_getblock(volume, id);
+            SIFS_NAMELINK otherlink;
+            if (other == NULL || !getlink(other, &otherlink))
+            {
+                if (other != NULL)
+                {
+                    SIFS_releaseblock(volume, other);
+                }
+                break;
+            }
+            setlink(other, newBlockId, otherlink.next);
+            SIFS_updateblock(volume, id, other, 0);
+            SIFS_releaseblock(volume, other);
+            id = otherlink.next;
+        }
+        return;
+    }
+    // Only the fileblock before it records where it is
+    for (SIFS_BLOCKID id = link.head; id != SIFS_ROOTDIR_BLOCKID; )
+    {
+        SIFS_FILEBLOCK* other = (SIFS_FILEBLOCK*)SIFS_getblock(volume, id);
+        SIFS_NAMELINK otherlink;
+        if (other == NULL || !getlink(other, &otherlink))
+        {
+            if (other != NULL)
+            {
+                SIFS_releaseblock(volume, other);
+            }
+            break;
+        }
+        if (otherlink.next == blockId)
+        {
+            setlink(other, otherlink.head, newBlockId);
+            SIFS_updateblock(volume, id, other, 0);
+            SIFS_releaseblock(volume, other);
+            break;
+        }
+        SIFS_releaseblock(volume, other);
+        id = otherlink.next;
+    }
+}
+
+void SIFS_syncchain(SIFS_VOLUME* volume, const SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId)
+{
+    SIFS_NAMELINK link;
+    if (!getlink(block, &link))
+    {
+        return;
+    }
+    SIFS_EXTENTLIST extents;
+    SIFS_getextents(volume, block, &extents);
+    for (SIFS_BLOCKID id = link.head; id != SIFS_ROOTDIR_BLOCKID; )
+    {
+        if (id == blockId)
+        {
+            getlink(block, &link);
+            id = link.next;
+            continue;
+        }
+        SIFS_FILEBLOCK* other = (SIFS_FILEBLOCK*)SIFS_getblock(volume, id);
+        SIFS_NAMELINK otherlink;
+        if (other == NULL || !getlink(other, &otherlink))
+        {
+            if (other != NULL)
+            {
+                SIFS_releaseblock(volume, other);
+            }
+            break;
+        }
+        SIFS_setextents(volume, other, &extents);
+        SIFS_updateblock(volume, id, other, 0);
+        SIFS_releaseblock(volume, other);
+        id = otherlink.next;
+    }
+}
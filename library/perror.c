@@ -18,6 +18,10 @@ char	*SIFS_errlist[] = {
 	"Memory allocation failed",			// SIFS_ENOMEM
         "Not yet implemented",                          // SIFS_ENOTYET
 	"Directory is not empty",			// SIFS_ENOTEMPTY
+	"Buffer too small",				// SIFS_ETOOSMALL
+	"Volume is read-only",				// SIFS_EROFS
+	"Volume has files still being written",		// SIFS_EBUSY
+	"Volume could not be written",			// SIFS_EIO
 };
 
 #define	SIFS_NERRS	(sizeof(SIFS_errlist) / sizeof(SIFS_errlist[0]))
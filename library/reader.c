@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "sifsutils.h"
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Number of bytes read ahead by a reader opened without a readahead size
+#define SIFS_DEFAULT_READAHEAD  (128 * 1024)
+
+// An existing file being read from start to end, see SIFS_ropen()
+struct SIFS_READER
+{
+    SIFS_VOLUME* volume;
+    // The runs holding the file's data, found once when the reader was opened
+    SIFS_EXTENTLIST extents;
+    size_t length;
+    // Offset within the file of the next byte returned by SIFS_rread()
+    size_t position;
+    // Number of bytes read from the volume at once (a whole number of blocks)
+    size_t readahead;
+    // Bytes of the file from windowstart to windowstart + windowlength, NULL for mapped volumes
+    char* window;
+    size_t windowstart;
+    size_t windowlength;
+};
+
+// Helper function that hints to the kernel that nbytes of the file starting at offset will be read soon
+static void advise(SIFS_READER* reader, size_t offset, size_t nbytes)
+{
+    SIFS_VOLUME* volume = reader->volume;
+    if (offset >= reader->length)
+    {
+        return;
+    }
+    if (nbytes > reader->length - offset)
+    {
+        nbytes = reader->length - offset;
+    }
+    // The chunks of a file are looked up as they are read, there are no runs to hint
+    if (reader->extents.magic == SIFS_CHUNKLIST_MAGIC)
+    {
+        return;
+    }
+    // Only the run holding offset is hinted, the next window will hint the one after it
+    size_t blocksize = volume->header.blocksize;
+    const SIFS_EXTENT* extent = reader->extents.extents;
+    while (offset >= (size_t)extent->count * blocksize)
+    {
+        offset -= (size_t)extent->count * blocksize;
+        extent++;
+    }
+    if (nbytes > (size_t)extent->count * blocksize - offset)
+    {
+        nbytes = (size_t)extent->count * blocksize - offset;
+    }
+    size_t start = volume->blockoffset + blocksize * extent->start + offset;
+    if (volume->map != NULL)
+    {
+        // madvise() needs a page aligned address, round the start of the range down
+        size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t delta = start % pagesize;
+        posix_madvise(volume->map + start - delta, nbytes + delta, POSIX_MADV_WILLNEED);
+    }
+    else
+    {
+        posix_fadvise(volume->fd, (off_t)start, (off_t)nbytes, POSIX_FADV_WILLNEED);
+    }
+}
+
+// Helper function that reads the next window of the file, starting the readahead of the one after it
+static int fill_window(SIFS_READER* reader)
+{
+    size_t n = reader->length - reader->position;
+    if (n > reader->readahead)
+    {
+        n = reader->readahead;
+    }
+    // The position only ever advances past whole windows, so every window starts on a block boundary
+    if (SIFS_readextents(reader->volume, &reader->extents, reader->position, reader->window, n) == SIFS_FAILURE)
+    {
+        return SIFS_FAILURE;
+    }
+    reader->windowstart = reader->position;
+    reader->windowlength = n;
+    advise(reader, reader->position + n, reader->readahead);
+    return SIFS_SUCCESS;
+}
+
+// start reading an existing file sequentially, readahead (which may be 0) is how many bytes are read ahead
+SIFS_READER* SIFS_ropen(SIFS_VOLUME *volume, const char *pathname, size_t readahead)
+{
+    if (volume == NULL || pathname == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return NULL;
+    }
+
+    SIFS_READER* reader = (SIFS_READER*)malloc(sizeof(SIFS_READER));
+    if (reader == NULL)
+    {
+        SIFS_errno = SIFS_ENOMEM;
+        return NULL;
+    }
+    if (SIFS_getfiledata(volume, pathname, &reader->extents, &reader->length) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_getfiledata()
+        free(reader);
+        return NULL;
+    }
+    // The readahead is a whole number of blocks so that every window is block aligned
+    size_t blocksize = volume->header.blocksize;
+    if (readahead == 0)
+    {
+        readahead = SIFS_DEFAULT_READAHEAD;
+    }
+    reader->volume = volume;
+    reader->position = 0;
+    reader->readahead = ((readahead + blocksize - 1) / blocksize) * blocksize;
+    reader->windowstart = 0;
+    reader->windowlength = 0;
+    reader->window = NULL;
+    // A mapped volume is read in place, there is nothing to buffer
+    if (volume->map == NULL)
+    {
+        size_t size = (reader->length < reader->readahead) ? reader->length : reader->readahead;
+        reader->window = (char*)malloc(size > 0 ? size : 1);
+        if (reader->window == NULL)
+        {
+            free(reader);
+            SIFS_errno = SIFS_ENOMEM;
+            return NULL;
+        }
+    }
+    advise(reader, 0, reader->readahead);
+    SIFS_errno = SIFS_EOK;
+    return reader;
+}
+
+// read up to nbytes of the file opened with SIFS_ropen() into data, nread is 0 at the end of the file
+int SIFS_rread(SIFS_READER *reader, void *data, size_t nbytes, size_t *nread)
+{
+    if (reader == NULL || (data == NULL && nbytes > 0))
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = reader->volume;
+    size_t remaining = reader->length - reader->position;
+    if (nbytes > remaining)
+    {
+        nbytes = remaining;
+    }
+
+    char* ptr = (char*)data;
+    size_t done = 0;
+    if (volume->map != NULL && nbytes > 0)
+    {
+        // Copy straight out of the mapping and keep the kernel one window ahead
+        if (SIFS_readextents(volume, &reader->extents, reader->position, ptr, nbytes) == SIFS_FAILURE)
+        {
+            // SIFS_errno set in SIFS_readextents()
+            return SIFS_FAILURE;
+        }
+        size_t previous = reader->position / reader->readahead;
+        reader->position += nbytes;
+        if (reader->position / reader->readahead != previous)
+        {
+            advise(reader, (reader->position / reader->readahead + 1) * reader->readahead, reader->readahead);
+        }
+        done = nbytes;
+    }
+    while (done < nbytes)
+    {
+        // Serve what is left in the current window
+        size_t windowend = reader->windowstart + reader->windowlength;
+        if (reader->position < windowend)
+        {
+            size_t n = windowend - reader->position;
+            n = (n < nbytes - done) ? n : nbytes - done;
+            memcpy(ptr + done, reader->window + (reader->position - reader->windowstart), n);
+            reader->position += n;
+            done += n;
+            continue;
+        }
+        // Whole windows wanted by the caller are read straight into its buffer
+        size_t whole = ((nbytes - done) / reader->readahead) * reader->readahead;
+        if (whole > 0)
+        {
+            if (SIFS_readextents(volume, &reader->extents, reader->position, ptr + done, whole) == SIFS_FAILURE)
+            {
+                // SIFS_errno set in SIFS_readextents()
+                return SIFS_FAILURE;
+            }
+            reader->position += whole;
+            done += whole;
+            advise(reader, reader->position, reader->readahead);
+            continue;
+        }
+        if (fill_window(reader) == SIFS_FAILURE)
+        {
+            // SIFS_errno set in SIFS_readextents()
+            return SIFS_FAILURE;
+        }
+    }
+    if (nread != NULL)
+    {
+        *nread = done;
+    }
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// finish reading a file opened with SIFS_ropen()
+void SIFS_rclose(SIFS_READER *reader)
+{
+    if (reader == NULL)
+    {
+        return;
+    }
+    free(reader->window);
+    free(reader);
+}
@@ -1,17 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include "sifsutils.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-// read the contents of an existing file from an existing volume
-int SIFS_readfile(const char *volumename, const char *pathname,
-		  void **data, size_t *nbytes)
+int SIFS_getfiledata(SIFS_VOLUME* volume, const char* pathname, SIFS_EXTENTLIST* extents, size_t* length)
 {
-    if (volumename == NULL || pathname == NULL || data == NULL)
-    {
-        SIFS_errno = SIFS_EINVAL;
-        return SIFS_FAILURE;
-    }
-
     size_t count;
     char** result = strsplit(pathname, SIFS_DIR_DELIMITER, &count);
     if (result == NULL)
@@ -21,45 +19,249 @@ int SIFS_readfile(const char *volumename, const char *pathname,
     }
 
     // Find the fileblock that the pathname references
-    SIFS_FILEBLOCK* fileblock = SIFS_getfile(volumename, result, count, NULL);
+    SIFS_FILEBLOCK* fileblock = SIFS_getfile(volume, result, count, NULL);
+    freesplit(result);
     if (fileblock == NULL)
     {
         // SIFS_errno set in SIFS_getfile()
-        freesplit(result);
+        return SIFS_FAILURE;
+    }
+    SIFS_getextents(volume, fileblock, extents);
+    *length = fileblock->length;
+    SIFS_releaseblock(volume, fileblock);
+    return SIFS_SUCCESS;
+}
+
+// read the contents of an existing file from an existing volume
+int SIFS_vreadfile(SIFS_VOLUME *volume, const char *pathname,
+		   void **data, size_t *nbytes)
+{
+    if (volume == NULL || pathname == NULL || data == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+
+    SIFS_EXTENTLIST extents;
+    size_t length;
+    if (SIFS_getfiledata(volume, pathname, &extents, &length) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_getfiledata()
         return SIFS_FAILURE;
     }
 
-    // Allocate enough space to read the contents of the file
-    size_t length = fileblock->length;
+    // Allocate enough space to read the contents of the file and read them straight into it
     char* buffer = (char*)malloc(length);
     if (buffer == NULL)
     {
-        freesplit(result);
-        free(fileblock);
         SIFS_errno = SIFS_ENOMEM;
         return SIFS_FAILURE;
     }
-    SIFS_VOLUME_HEADER header;
-    if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
+    if (SIFS_readextents(volume, &extents, 0, buffer, length) == SIFS_FAILURE)
     {
-        // SIFS_errno set in SIFS_getvolumeheader()
+        // SIFS_errno set in SIFS_readextents()
         free(buffer);
-        freesplit(result);
-        free(fileblock);
         return SIFS_FAILURE;
     }
-    // Get a pointer to the data
-    void* datablock = SIFS_getblocks(volumename, fileblock->firstblockID, SIFS_calcnblocks(&header, length));
-    memcpy(buffer, datablock, length);
     *data = buffer;
     if (nbytes != NULL)
     {
         *nbytes = length;
     }
 
-    freesplit(result);
-    free(datablock);
-    free(fileblock);
     SIFS_errno = SIFS_EOK;
     return SIFS_SUCCESS;
 }
+
+// read the contents of an existing file into a buffer provided by the caller
+int SIFS_readfile_into(SIFS_VOLUME *volume, const char *pathname,
+		       void *buffer, size_t capacity, size_t *nbytes)
+{
+    if (volume == NULL || pathname == NULL || (buffer == NULL && capacity > 0))
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+
+    SIFS_EXTENTLIST extents;
+    size_t length;
+    if (SIFS_getfiledata(volume, pathname, &extents, &length) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_getfiledata()
+        return SIFS_FAILURE;
+    }
+    // Report the required size so that the caller can retry with a larger buffer
+    if (nbytes != NULL)
+    {
+        *nbytes = length;
+    }
+    if (length > capacity)
+    {
+        SIFS_errno = SIFS_ETOOSMALL;
+        return SIFS_FAILURE;
+    }
+    if (SIFS_readextents(volume, &extents, 0, buffer, length) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_readextents()
+        return SIFS_FAILURE;
+    }
+
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// read part of the contents of an existing file, only the blocks holding that part are read
+int SIFS_readrange(SIFS_VOLUME *volume, const char *pathname, size_t offset,
+		   void *buffer, size_t length, size_t *nbytes)
+{
+    if (volume == NULL || pathname == NULL || (buffer == NULL && length > 0))
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+
+    SIFS_EXTENTLIST extents;
+    size_t filelength;
+    if (SIFS_getfiledata(volume, pathname, &extents, &filelength) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_getfiledata()
+        return SIFS_FAILURE;
+    }
+    // The range is clipped to the end of the file
+    if (offset >= filelength)
+    {
+        length = 0;
+    }
+    else if (length > filelength - offset)
+    {
+        length = filelength - offset;
+    }
+    if (nbytes != NULL)
+    {
+        *nbytes = length;
+    }
+    if (SIFS_readextents(volume, &extents, offset, buffer, length) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_readextents()
+        return SIFS_FAILURE;
+    }
+
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// get a read-only view of the contents of an existing file without copying them
+int SIFS_mapfile(SIFS_VOLUME *volume, const char *pathname,
+		 const void **data, size_t *nbytes)
+{
+    if (volume == NULL || pathname == NULL || data == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+
+    SIFS_EXTENTLIST extents;
+    size_t length;
+    if (SIFS_getfiledata(volume, pathname, &extents, &length) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_getfiledata()
+        return SIFS_FAILURE;
+    }
+    size_t offset = volume->blockoffset + volume->header.blocksize * extents.extents[0].start;
+
+    if (extents.nextents > 1 || extents.magic == SIFS_CHUNKLIST_MAGIC)
+    {
+        // The data is split over several runs or chunks, so the view is a copy in memory of its own, released the same way
+        char* view = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (view == MAP_FAILED)
+        {
+            SIFS_errno = SIFS_ENOMEM;
+            return SIFS_FAILURE;
+        }
+        if (SIFS_readextents(volume, &extents, 0, view, length) == SIFS_FAILURE)
+        {
+            // SIFS_errno set in SIFS_readextents()
+            munmap(view, length);
+            return SIFS_FAILURE;
+        }
+        mprotect(view, length, PROT_READ);
+        *data = view;
+    }
+    else if (volume->map != NULL || length == 0)
+    {
+        // A mapped volume already holds the data in place, an empty file has nothing to map
+        *data = (volume->map != NULL) ? volume->map + offset : NULL;
+    }
+    else
+    {
+        // The view reads the volume file directly, so blocks still dirty in the cache must reach it first
+        if (volume->cache != NULL && SIFS_cacheflush(volume) == SIFS_FAILURE)
+        {
+            SIFS_errno = SIFS_ENOTVOL;
+            return SIFS_FAILURE;
+        }
+        // mmap() requires a page aligned offset, map from the start of the page holding the data
+        size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t delta = offset % pagesize;
+        char* view = mmap(NULL, length + delta, PROT_READ, MAP_SHARED, volume->fd, (off_t)(offset - delta));
+        if (view == MAP_FAILED)
+        {
+            SIFS_errno = SIFS_ENOMEM;
+            return SIFS_FAILURE;
+        }
+        *data = view + delta;
+    }
+    if (nbytes != NULL)
+    {
+        *nbytes = length;
+    }
+
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// release a view returned by SIFS_mapfile()
+int SIFS_unmapfile(SIFS_VOLUME *volume, const void *data, size_t nbytes)
+{
+    if (volume == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    // Views into a mapped volume are owned by the volume
+    const char* ptr = (const char*)data;
+    if (ptr == NULL || (volume->map != NULL && ptr >= volume->map && ptr < volume->map + volume->maplength))
+    {
+        SIFS_errno = SIFS_EOK;
+        return SIFS_SUCCESS;
+    }
+    // The mapping starts at the beginning of the page holding the data
+    size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t delta = (uintptr_t)ptr % pagesize;
+    if (munmap((void*)(ptr - delta), nbytes + delta) != 0)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// read the contents of an existing file from an existing volume, opening the volume only for the duration of the call
+int SIFS_readfile(const char *volumename, const char *pathname,
+		  void **data, size_t *nbytes)
+{
+    if (volumename == NULL || pathname == NULL || data == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vreadfile(volume, pathname, data, nbytes);
+    return SIFS_closeafter(volume, result);
+}
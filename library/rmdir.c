@@ -3,13 +3,18 @@
 #include <time.h>
 
 // remove an existing directory from an existing volume
-int SIFS_rmdir(const char *volumename, const char *pathname)
+int SIFS_vrmdir(SIFS_VOLUME *volume, const char *pathname)
 {
-    if (volumename == NULL || pathname == NULL || strlen(pathname) == 0)
+    if (volume == NULL || pathname == NULL || strlen(pathname) == 0)
     {
         SIFS_errno = SIFS_EINVAL;
         return SIFS_FAILURE;
     }
+    if (!volume->writable)
+    {
+        SIFS_errno = SIFS_EROFS;
+        return SIFS_FAILURE;
+    }
 
     size_t count;
     char** result = strsplit(pathname, SIFS_DIR_DELIMITER, &count);
@@ -29,30 +34,76 @@ int SIFS_rmdir(const char *volumename, const char *pathname)
 
     // Get the parent directory
     SIFS_BLOCKID dirblockId;
-    SIFS_DIRBLOCK* dir = SIFS_getdir(volumename, result, count - 1, &dirblockId);
+    SIFS_DIRBLOCK* dir = SIFS_getdir(volume, result, count - 1, &dirblockId);
     if (dir == NULL)
     {
         // SIFS_errno set in SIFS_getdir()
         freesplit(result);
         return SIFS_FAILURE;
     }
+    int index = -1;
+    SIFS_DIRBLOCK* block = NULL;
+    // A cached entry only needs to be found among the entries of the parent directory
+    SIFS_BLOCKID blockId;
+    if (SIFS_dentrylookup(volume, dirblockId, dirname, &blockId, NULL) == SIFS_DIR)
+    {
+        for (int i = 0; i < dir->nentries && index == -1; i++)
+        {
+            if (dir->entries[i].blockID == blockId)
+            {
+                index = i;
+                block = (SIFS_DIRBLOCK*)SIFS_getblock(volume, blockId);
+            }
+        }
+    }
+    // Otherwise the names kept in the parent directory find it without reading any other block
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, dir);
+    if (index == -1 && names != NULL)
+    {
+        int i = SIFS_finddirname(dir, names, dirname);
+        if (i >= 0 && names->types[i] == SIFS_DIR)
+        {
+            index = i;
+            block = (SIFS_DIRBLOCK*)SIFS_getblock(volume, dir->entries[i].blockID);
+        }
+    }
+    if (index != -1 && block == NULL)
+    {
+        // SIFS_errno set in SIFS_getblock()
+        freesplit(result);
+        SIFS_releaseblock(volume, dir);
+        return SIFS_FAILURE;
+    }
     // Check whether the parent directory has any entry named dirname (files or directories)
-    if (!SIFS_hasentry(volumename, dir, dirname))
+    bool found = true;
+    if (index == -1 && SIFS_hasentry(volume, dir, dirname, &found) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_hasentry()
+        freesplit(result);
+        SIFS_releaseblock(volume, dir);
+        return SIFS_FAILURE;
+    }
+    if (!found)
     {
         freesplit(result);
-        free(dir);
+        SIFS_releaseblock(volume, dir);
         SIFS_errno = SIFS_ENOENT;
         return SIFS_FAILURE;
     }
-    int index = -1;
-    SIFS_DIRBLOCK* block = NULL;
     // Search through all directory entries to find the directory
-    for (int i = 0; i < dir->nentries; i++)
+    for (int i = 0; i < dir->nentries && index == -1 && names == NULL; i++)
     {
-        SIFS_BIT type = SIFS_getblocktype(volumename, dir->entries[i].blockID);
+        SIFS_BIT type = SIFS_getblocktype(volume, dir->entries[i].blockID);
         if (type == SIFS_DIR)
         {
-            SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)SIFS_getblock(volumename, dir->entries[i].blockID);
+            SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)SIFS_getblock(volume, dir->entries[i].blockID);
+            if (dirblock == NULL)
+            {
+                // SIFS_errno set in SIFS_getblock()
+                freesplit(result);
+                SIFS_releaseblock(volume, dir);
+                return SIFS_FAILURE;
+            }
             if (strcmp(dirblock->name, dirname) == 0)
             {
                 // Found directory entry, record it and its index
@@ -60,7 +111,7 @@ int SIFS_rmdir(const char *volumename, const char *pathname)
                 block = dirblock;
                 break;
             }
-            free(dirblock);
+            SIFS_releaseblock(volume, dirblock);
         }
     }
     // Failed to find directory entry
@@ -68,7 +119,7 @@ int SIFS_rmdir(const char *volumename, const char *pathname)
     if (index == -1)
     {
         freesplit(result);
-        free(dir);
+        SIFS_releaseblock(volume, dir);
         SIFS_errno = SIFS_ENOTDIR;
         return SIFS_FAILURE;
     }
@@ -76,15 +127,17 @@ int SIFS_rmdir(const char *volumename, const char *pathname)
     if (block->nentries > 0)
     {
         freesplit(result);
-        free(block);
-        free(dir);
+        SIFS_releaseblock(volume, block);
+        SIFS_releaseblock(volume, dir);
         SIFS_errno = SIFS_ENOTEMPTY;
         return SIFS_FAILURE;
     }
-    // Free the directory block
-    SIFS_freeblocks(volumename, dir->entries[index].blockID, 1);
+    // Free the directory block, and forget its entry
+    SIFS_dentryforget(volume, dir->entries[index].blockID);
+    SIFS_freeblocks(volume, dir->entries[index].blockID, 1);
     dir->modtime = time(NULL);
     // Update the directory entries, any entry to the right of the deleted directory needs to be shifted left by 1
+    SIFS_removedirname(volume, dir, index);
     for (int i = index; i < dir->nentries - 1; i++)
     {
         dir->entries[i] = dir->entries[i + 1];
@@ -92,11 +145,29 @@ int SIFS_rmdir(const char *volumename, const char *pathname)
     dir->nentries--;
 
     // Rewrite directory to volume
-    SIFS_updateblock(volumename, dirblockId, dir, 0);
+    SIFS_updateblock(volume, dirblockId, dir, 0);
 
     freesplit(result);
-    free(dir);
-    free(block);
+    SIFS_releaseblock(volume, dir);
+    SIFS_releaseblock(volume, block);
     SIFS_errno = SIFS_EOK;
     return SIFS_SUCCESS;
 }
+
+// remove an existing directory from an existing volume, opening the volume only for the duration of the call
+int SIFS_rmdir(const char *volumename, const char *pathname)
+{
+    if (volumename == NULL || pathname == NULL || strlen(pathname) == 0)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vrmdir(volume, pathname);
+    return SIFS_closeafter(volume, result);
+}
@@ -3,13 +3,18 @@
 #include <stdio.h>
 
 // remove an existing file from an existing volume
-int SIFS_rmfile(const char *volumename, const char *pathname)
+int SIFS_vrmfile(SIFS_VOLUME *volume, const char *pathname)
 {
-    if (volumename == NULL || pathname == NULL || strlen(pathname) == 0)
+    if (volume == NULL || pathname == NULL || strlen(pathname) == 0)
     {
         SIFS_errno = SIFS_EINVAL;
         return SIFS_FAILURE;
     }
+    if (!volume->writable)
+    {
+        SIFS_errno = SIFS_EROFS;
+        return SIFS_FAILURE;
+    }
 
     size_t count;
     char** result = strsplit(pathname, SIFS_DIR_DELIMITER, &count);
@@ -29,7 +34,7 @@ int SIFS_rmfile(const char *volumename, const char *pathname)
     char* filename = result[count - 1];
     // Find the directory that the file should be in
     SIFS_BLOCKID dirblockId;
-    SIFS_DIRBLOCK* dir = SIFS_getdir(volumename, result, count - 1, &dirblockId);
+    SIFS_DIRBLOCK* dir = SIFS_getdir(volume, result, count - 1, &dirblockId);
     if (dir == NULL)
     {
         // Did not find a directory to remove the file from
@@ -38,24 +43,57 @@ int SIFS_rmfile(const char *volumename, const char *pathname)
         return SIFS_FAILURE;
     }
     
+    SIFS_BLOCKID blockId = SIFS_ROOTDIR_BLOCKID;
+    int entryId = -1;
+    int fileIndex = -1;
+    // A cached entry only needs to be found among the entries of the directory
+    uint32_t cachedIndex;
+    if (SIFS_dentrylookup(volume, dirblockId, filename, &blockId, &cachedIndex) == SIFS_FILE)
+    {
+        for (int i = 0; i < dir->nentries && entryId == -1; i++)
+        {
+            if (dir->entries[i].blockID == blockId && dir->entries[i].fileindex == cachedIndex)
+            {
+                entryId = i;
+                fileIndex = cachedIndex;
+            }
+        }
+    }
+    // Otherwise the names kept in the directory find it without reading any other block
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, dir);
+    if (entryId == -1 && names != NULL)
+    {
+        int i = SIFS_finddirname(dir, names, filename);
+        if (i >= 0 && names->types[i] == SIFS_FILE)
+        {
+            entryId = i;
+            blockId = dir->entries[i].blockID;
+            fileIndex = dir->entries[i].fileindex;
+        }
+    }
     // Check whether there is any entry with the filename (either directory or file)
-    if (!SIFS_hasentry(volumename, dir, filename))
+    bool found = true;
+    if (entryId == -1 && SIFS_hasentry(volume, dir, filename, &found) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_hasentry()
+        freesplit(result);
+        SIFS_releaseblock(volume, dir);
+        return SIFS_FAILURE;
+    }
+    if (!found)
     {
         freesplit(result);
-        free(dir);
+        SIFS_releaseblock(volume, dir);
         SIFS_errno = SIFS_ENOENT;
         return SIFS_FAILURE;
     }
-    SIFS_BLOCKID blockId = SIFS_ROOTDIR_BLOCKID;
-    int entryId = -1;
-    int fileIndex = -1;
     // Iterate over all directory entries to find a file entry with filename
-    for (int i = 0; i < dir->nentries; i++)
+    for (int i = 0; i < dir->nentries && entryId == -1 && names == NULL; i++)
     {
-        SIFS_BIT type = SIFS_getblocktype(volumename, dir->entries[i].blockID);
+        SIFS_BIT type = SIFS_getblocktype(volume, dir->entries[i].blockID);
         if (type == SIFS_FILE)
         {
-            SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, dir->entries[i].blockID);
+            SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, dir->entries[i].blockID);
             if (strcmp(fileblock->filenames[dir->entries[i].fileindex], filename) == 0)
             {
                 // Found the file block entry
@@ -63,10 +101,10 @@ int SIFS_rmfile(const char *volumename, const char *pathname)
                 entryId = i;
                 blockId = dir->entries[i].blockID;
                 fileIndex = dir->entries[i].fileindex;
-                free(fileblock);
+                SIFS_releaseblock(volume, fileblock);
                 break;
             }
-            free(fileblock);
+            SIFS_releaseblock(volume, fileblock);
         }
     }
     // Failed to find a file entry, therefore the entry with the same name as filename must be a directory
@@ -74,38 +112,36 @@ int SIFS_rmfile(const char *volumename, const char *pathname)
     if (entryId == -1)
     {
         freesplit(result);
-        free(dir);
+        SIFS_releaseblock(volume, dir);
         SIFS_errno = SIFS_ENOTFILE;
         return SIFS_FAILURE;
     }
-    SIFS_VOLUME_HEADER header;
-    if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
-    {
-        // SIFS_errno set in SIFS_getvolumeheader()
-        free(dir);
-        freesplit(result);
-        return SIFS_FAILURE;
-    }
-    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volumename);
+    // Every name of the fileblock after this one moves, so none of its cached entries are kept
+    SIFS_dentryforget(volume, blockId);
+    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
     // Iterate through all directories in the volume and find those that reference this fileblock
-    for (SIFS_BLOCKID i = 0; i < header.nblocks; i++)
+    SIFS_BLOCKID nvolumeblocks = volume->header.nblocks;
+    for (SIFS_BLOCKID i = SIFS_bitmapfind(bitmap, 0, nvolumeblocks, SIFS_DIR); i < nvolumeblocks;
+        i = SIFS_bitmapfind(bitmap, i + 1, nvolumeblocks, SIFS_DIR))
     {
-        if (bitmap[i] == SIFS_DIR)
+        SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)SIFS_getblock(volume, i);
+        bool updated = false;
+        for (int j = 0; j < dirblock->nentries; j++)
         {
-            SIFS_DIRBLOCK* dirblock = (SIFS_DIRBLOCK*)SIFS_getblock(volumename, i);
-            for (int j = 0; j < dirblock->nentries; j++)
+            // Check if this directory entry references the file we are trying to remove
+            // Only need to decrement the fileindex if its fileindex is greater than the index we are removing (ie. to the right of the file we are removing)
+            if (i != dirblockId && dirblock->entries[j].blockID == blockId && dirblock->entries[j].fileindex > fileIndex)
             {
-                // Check if this directory entry references the file we are trying to remove
-                // Only need to decrement the fileindex if its fileindex is greater than the index we are removing (ie. to the right of the file we are removing)
-                if (i != dirblockId && dirblock->entries[j].blockID == blockId && dirblock->entries[j].fileindex > fileIndex)
-                {
-                    dirblock->entries[j].fileindex--;
-                }
+                dirblock->entries[j].fileindex--;
+                updated = true;
             }
-            // Update the directory and write it back to the volume
-            SIFS_updateblock(volumename, i, dirblock, 0);
-            free(dirblock);
         }
+        if (updated)
+        {
+            // Only write back directories that were modified
+            SIFS_updateblock(volume, i, dirblock, 0);
+        }
+        SIFS_releaseblock(volume, dirblock);
     }
     // Perform the same operations as above on the directory that the file is being removed from
     // The same fileblock could be referenced multiple times within the same directory
@@ -118,7 +154,7 @@ int SIFS_rmfile(const char *volumename, const char *pathname)
     }
     // Get the fileblock that contains the file we are removing
     // Any filename that is right of the one being removed, shift left by 1
-    SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, blockId);
+    SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, blockId);
     for (int i = fileIndex; i < fileblock->nfiles - 1; i++)
     {
         memcpy(fileblock->filenames[i], fileblock->filenames[i + 1], SIFS_MAX_NAME_LENGTH);
@@ -127,18 +163,22 @@ int SIFS_rmfile(const char *volumename, const char *pathname)
     memset(fileblock->filenames[fileblock->nfiles - 1], 0, SIFS_MAX_NAME_LENGTH);
     fileblock->nfiles--;
 
-    // Check whether this was the last file that this fileblock referenced
-    if (fileblock->nfiles <= 0)
+    // Check whether this was the last file that this fileblock referenced, a fileblock of a chain
+    // only frees the data once it is the last of the chain
+    if (fileblock->nfiles <= 0 && !SIFS_leavechain(volume, fileblock, blockId))
     {
         // Free the data blocks and the fileblock
-        SIFS_BLOCKID nblocks = SIFS_calcnblocks(&header, fileblock->length);
-        SIFS_freeblocks(volumename, fileblock->firstblockID, nblocks);
-        SIFS_freeblocks(volumename, blockId, 1);
+        SIFS_EXTENTLIST extents;
+        SIFS_getextents(volume, fileblock, &extents);
+        SIFS_freeextents(volume, &extents);
+        SIFS_hashremove(volume, fileblock->md5, blockId);
+        SIFS_freeblocks(volume, blockId, 1);
     }
     // Rewrite the fileblock back to the volume
-    SIFS_updateblock(volumename, blockId, fileblock, 0);
-    free(fileblock);
+    SIFS_updateblock(volume, blockId, fileblock, 0);
+    SIFS_releaseblock(volume, fileblock);
     // Any entry in the directory that the file is being removed from that is to the right needs to be shifted left by 1
+    SIFS_removedirname(volume, dir, entryId);
     for (int i = entryId; i < dir->nentries - 1; i++)
     {
         dir->entries[i] = dir->entries[i + 1];
@@ -147,11 +187,28 @@ int SIFS_rmfile(const char *volumename, const char *pathname)
     dir->nentries--;
     dir->modtime = time(NULL);
     // Rewrite directory back to volume
-    SIFS_updateblock(volumename, dirblockId, dir, 0);
+    SIFS_updateblock(volume, dirblockId, dir, 0);
 
     freesplit(result);
-    free(dir);
-    free(bitmap);
+    SIFS_releaseblock(volume, dir);
     SIFS_errno = SIFS_EOK;
     return SIFS_SUCCESS;
 }
+
+// remove an existing file from an existing volume, opening the volume only for the duration of the call
+int SIFS_rmfile(const char *volumename, const char *pathname)
+{
+    if (volumename == NULL || pathname == NULL || strlen(pathname) == 0)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vrmfile(volume, pathname);
+    return SIFS_closeafter(volume, result);
+}
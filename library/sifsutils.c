@@ -4,10 +4,8 @@
 
 #include "sifsutils.h"
 #include <string.h>
-#include <stdio.h>
-#include <sys/stat.h>
-#include <sys/types.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 
 char** strsplit(const char* str, char delimiter, size_t* outCount)
 {
@@ -102,48 +100,25 @@ void freesplit(char** strsplitresult)
     free(strsplitresult);
 }
 
-int SIFS_readvolumeptr(const char* volumename, void* data, size_t offset, size_t length)
+int SIFS_readvolumeptr(SIFS_VOLUME* volume, void* data, size_t offset, size_t length)
 {
-    // Read the size of the volume
-    struct stat fStat;
-    if (stat(volumename, &fStat) != 0)
+    // A mapped volume is read straight out of the mapping
+    if (volume->map != NULL)
     {
-        SIFS_errno = SIFS_ENOVOL;
-        return SIFS_FAILURE;
-    }
-    if (fStat.st_size < sizeof(SIFS_VOLUME_HEADER))
-    {
-        SIFS_errno = SIFS_ENOTVOL;
-        return SIFS_FAILURE;
-    }
-    FILE* file = fopen(volumename, "rb");
-    if (file == NULL)
-    {
-        SIFS_errno = SIFS_ENOVOL;
-        return SIFS_FAILURE;
+        memcpy(data, volume->map + offset, length);
+        return SIFS_SUCCESS;
     }
-    // Read the header of the volume (offset 0)
-    SIFS_VOLUME_HEADER header;
-    fread(&header, sizeof(SIFS_VOLUME_HEADER), 1, file);
-    // Read data from the volume at offset
-    fseek(file, offset, SEEK_SET);
-    fread(data, 1, length, file);
-    
-    // Validate whether this file represents a volume by checking that its size is what the header says it should be
-    // A file that does not represent a volume could potentially pass this test, very unlikely
-    size_t expectedLength = header.blocksize * header.nblocks + sizeof(SIFS_VOLUME_HEADER) + sizeof(SIFS_BIT) * header.nblocks;
-    if (fStat.st_size != expectedLength)
+    // Read data from the volume at offset using the handle's file descriptor
+    if (SIFS_preadfull(volume->fd, data, length, offset) == SIFS_FAILURE)
     {
         SIFS_errno = SIFS_ENOTVOL;
-        fclose(file);
         return SIFS_FAILURE;
     }
-    fclose(file);
     return SIFS_SUCCESS;
 }
 
 // Helper function for reading a volume easier
-void* SIFS_readvolume(const char* volumename, size_t offset, size_t length)
+void* SIFS_readvolume(SIFS_VOLUME* volume, size_t offset, size_t length)
 {
     void* data = malloc(length);
     if (data == NULL)
@@ -151,7 +126,7 @@ void* SIFS_readvolume(const char* volumename, size_t offset, size_t length)
         SIFS_errno = SIFS_ENOMEM;
         return NULL;
     }
-    int result = SIFS_readvolumeptr(volumename, data, offset, length);
+    int result = SIFS_readvolumeptr(volume, data, offset, length);
     if (result == SIFS_FAILURE) 
     {
         free(data);
@@ -160,34 +135,51 @@ void* SIFS_readvolume(const char* volumename, size_t offset, size_t length)
     return data;
 }
 
-int SIFS_updatevolume(const char* volumename, size_t offset, const void* data, size_t nbytes)
+int SIFS_updatevolume(SIFS_VOLUME* volume, size_t offset, const void* data, size_t nbytes)
 {
-    // Open volume for reading and writing so that we can modify the existing contents of the volume
-    FILE* file = fopen(volumename, "rb+");
-    if (file == NULL)
+    // The handle's file is opened for reading and writing so that we can modify the existing contents of the volume
+    if (!volume->writable)
     {
+        SIFS_errno = SIFS_EROFS;
         return SIFS_FAILURE;
     }
-    fseek(file, offset, SEEK_SET);
-    fwrite(data, 1, nbytes, file);
-    fclose(file);
-    return SIFS_SUCCESS;
-}
-
-int SIFS_getvolumeheader(const char* volumename, SIFS_VOLUME_HEADER* header)
-{
-    return SIFS_readvolumeptr(volumename, header, 0, sizeof(SIFS_VOLUME_HEADER));
+    if (volume->map != NULL)
+    {
+        // data may already point into the mapping (possibly overlapping the destination)
+        if (volume->map + offset != data)
+        {
+            memmove(volume->map + offset, data, nbytes);
+        }
+        return SIFS_SUCCESS;
+    }
+    return SIFS_pwritefull(volume->fd, data, nbytes, offset);
 }
 
-SIFS_BIT* SIFS_getvolumebitmap(const char* volumename)
+SIFS_BIT* SIFS_getvolumebitmap(SIFS_VOLUME* volume)
 {
-    SIFS_VOLUME_HEADER header;
-    if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
+    // The bitmap stays resident once read, it lives inside the mapping of a mapped volume
+    if (volume->bitmap == NULL && !volume->packed)
     {
-        return NULL;
+        volume->bitmap = (SIFS_BIT*)SIFS_readvolume(volume, volume->bitmapoffset, volume->header.nblocks * sizeof(SIFS_BIT));
     }
-    SIFS_BIT* ptr = (SIFS_BIT*)SIFS_readvolume(volumename, sizeof(SIFS_VOLUME_HEADER), header.nblocks * sizeof(SIFS_BIT));
-    return ptr;
+    else if (volume->bitmap == NULL)
+    {
+        // A packed bitmap is expanded to one entry per block once it has been read
+        unsigned char* packed = (unsigned char*)SIFS_readvolume(volume, volume->bitmapoffset, SIFS_bitmapbytes(volume->header.nblocks, true));
+        SIFS_BIT* bitmap = (SIFS_BIT*)malloc(volume->header.nblocks * sizeof(SIFS_BIT));
+        if (packed != NULL && bitmap != NULL)
+        {
+            SIFS_bitmapunpack(packed, volume->header.nblocks, bitmap);
+            volume->bitmap = bitmap;
+        }
+        else
+        {
+            free(bitmap);
+            SIFS_errno = SIFS_ENOMEM;
+        }
+        free(packed);
+    }
+    return volume->bitmap;
 }
 
 SIFS_BLOCKID SIFS_calcnblocks(SIFS_VOLUME_HEADER* header, size_t nbytes)
@@ -196,60 +188,359 @@ SIFS_BLOCKID SIFS_calcnblocks(SIFS_VOLUME_HEADER* header, size_t nbytes)
     return nblocks;
 }
 
-void SIFS_updatevolumebitmap(const char* volumename, const SIFS_BIT* bitmap, size_t length)
+void SIFS_updatevolumebitmap(SIFS_VOLUME* volume, SIFS_BLOCKID first, SIFS_BLOCKID nblocks)
 {
-    if (length == 0)
+    if (nblocks == 0)
+    {
+        return;
+    }
+    if (volume->bitmapdeferred > 0)
     {
-        SIFS_VOLUME_HEADER header;
-        if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
+        // Remember the extent of the modified entries, they are written by SIFS_endbitmapbatch()
+        if (volume->dirtyfirst >= volume->dirtyend)
         {
-            return;
+            volume->dirtyfirst = first;
+            volume->dirtyend = first + nblocks;
         }
-        length = header.nblocks;
+        else
+        {
+            volume->dirtyfirst = (first < volume->dirtyfirst) ? first : volume->dirtyfirst;
+            volume->dirtyend = (first + nblocks > volume->dirtyend) ? first + nblocks : volume->dirtyend;
+        }
+        return;
+    }
+    if (!volume->packed)
+    {
+        SIFS_updatevolume(volume, volume->bitmapoffset + first * sizeof(SIFS_BIT), volume->bitmap + first, nblocks * sizeof(SIFS_BIT));
+        return;
+    }
+    // Whole bytes of the packed bitmap are written, holding the 4 entries around each end of the range
+    SIFS_BLOCKID start = first & ~(SIFS_BLOCKID)3;
+    SIFS_BLOCKID end = first + nblocks;
+    unsigned char small[1024];
+    size_t nbytes = SIFS_bitmapbytes(end - start, true);
+    unsigned char* packed = (nbytes <= sizeof(small)) ? small : (unsigned char*)malloc(nbytes);
+    if (packed == NULL)
+    {
+        return;
+    }
+    // The entries up to the end of the last byte are resident unless it holds the last entry of the bitmap
+    SIFS_BLOCKID npacked = ((end + 3) & ~(SIFS_BLOCKID)3) - start;
+    if (start + npacked > volume->header.nblocks)
+    {
+        npacked = volume->header.nblocks - start;
+    }
+    SIFS_bitmappack(volume->bitmap, start, npacked, packed);
+    SIFS_updatevolume(volume, volume->bitmapoffset + start / 4, packed, nbytes);
+    if (packed != small)
+    {
+        free(packed);
     }
-    SIFS_updatevolume(volumename, sizeof(SIFS_VOLUME_HEADER), (void*)bitmap, length);
 }
 
-void SIFS_updateblock(const char* volumename, SIFS_BLOCKID blockIndex, const void* data, size_t length)
+void SIFS_initzones(SIFS_VOLUME_EXTHEADER* exthdr, SIFS_BLOCKID nblocks)
 {
-    SIFS_VOLUME_HEADER header;
-    if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
+    exthdr->features |= SIFS_FEATURE_ZONES;
+    exthdr->datazone = nblocks / SIFS_METAZONE_DIVISOR;
+    if (exthdr->datazone <= SIFS_ROOTDIR_BLOCKID + 1)
     {
-        return;
+        exthdr->datazone = (nblocks > SIFS_ROOTDIR_BLOCKID + 2) ? SIFS_ROOTDIR_BLOCKID + 2 : nblocks;
     }
+    exthdr->metacursor = SIFS_ROOTDIR_BLOCKID + 1;
+    exthdr->datacursor = exthdr->datazone;
+}
+
+int SIFS_updateexthdr(SIFS_VOLUME* volume)
+{
+    if (!volume->exthdrdirty)
+    {
+        return SIFS_SUCCESS;
+    }
+    volume->exthdrdirty = false;
+    return SIFS_updatevolume(volume, sizeof(SIFS_VOLUME_HEADER), &volume->exthdr, sizeof(SIFS_VOLUME_EXTHEADER));
+}
+
+void SIFS_beginbitmapbatch(SIFS_VOLUME* volume)
+{
+    volume->bitmapdeferred++;
+}
+
+void SIFS_endbitmapbatch(SIFS_VOLUME* volume)
+{
+    if (--volume->bitmapdeferred == 0 && volume->dirtyfirst < volume->dirtyend)
+    {
+        SIFS_BLOCKID first = volume->dirtyfirst;
+        SIFS_BLOCKID nblocks = volume->dirtyend - first;
+        volume->dirtyfirst = 0;
+        volume->dirtyend = 0;
+        SIFS_updatevolumebitmap(volume, first, nblocks);
+    }
+}
+
+void SIFS_updateblock(SIFS_VOLUME* volume, SIFS_BLOCKID blockIndex, const void* data, size_t length)
+{
     if (length == 0)
     {
-        length = header.blocksize;
+        length = volume->header.blocksize;
+    }
+    // Whole blocks are written back lazily by the cache
+    if (volume->cache != NULL && length == volume->header.blocksize && SIFS_cacheput(volume, blockIndex, data))
+    {
+        return;
+    }
+    size_t offset = volume->blockoffset + blockIndex * volume->header.blocksize;
+    SIFS_updatevolume(volume, offset, data, length);
+    if (volume->cache != NULL)
+    {
+        SIFS_cacheoverlay(volume->cache, blockIndex, (void*)data, length, false);
     }
-    size_t offset = sizeof(SIFS_VOLUME_HEADER) + header.nblocks * sizeof(SIFS_BIT) + blockIndex * header.blocksize;
-    SIFS_updatevolume(volumename, offset, data, length);
 }
 
-void* SIFS_getblock(const char* volumename, SIFS_BLOCKID blockIndex)
+void* SIFS_getblock(SIFS_VOLUME* volume, SIFS_BLOCKID blockIndex)
 {
-    return SIFS_getblocks(volumename, blockIndex, 1);
+    return SIFS_getblocks(volume, blockIndex, 1);
 }
 
-void* SIFS_getblocks(const char* volumename, SIFS_BLOCKID first, SIFS_BLOCKID nblocks)
+void* SIFS_getblocks(SIFS_VOLUME* volume, SIFS_BLOCKID first, SIFS_BLOCKID nblocks)
 {
-    SIFS_VOLUME_HEADER header;
-    if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
+    size_t offset = volume->blockoffset + volume->header.blocksize * first;
+    if (volume->map != NULL)
+    {
+        // Hand out a pointer directly into the mapping, no copy is made
+        return volume->map + offset;
+    }
+    if (volume->cache != NULL && nblocks == 1)
+    {
+        void* ptr = SIFS_cacheget(volume, first);
+        if (ptr != NULL)
+        {
+            return ptr;
+        }
+    }
+    size_t length = volume->header.blocksize * nblocks;
+    void* ptr = malloc(length);
+    if (ptr == NULL)
+    {
+        SIFS_errno = SIFS_ENOMEM;
+        return NULL;
+    }
+    if (SIFS_readblocks(volume, first, ptr, length) == SIFS_FAILURE)
     {
+        free(ptr);
         return NULL;
     }
-    size_t offset = sizeof(SIFS_VOLUME_HEADER) + sizeof(SIFS_BIT) * header.nblocks + header.blocksize * first;
-    void* ptr = SIFS_readvolume(volumename, offset, header.blocksize * nblocks);
     return ptr;
 }
 
-SIFS_DIRBLOCK* SIFS_getrootdir(const char* volumename)
+int SIFS_readblocks(SIFS_VOLUME* volume, SIFS_BLOCKID first, void* data, size_t length)
 {
-    return (SIFS_DIRBLOCK*)SIFS_getblock(volumename, SIFS_ROOTDIR_BLOCKID);
+    size_t offset = volume->blockoffset + volume->header.blocksize * first;
+    if (SIFS_readvolumeptr(volume, data, offset, length) == SIFS_FAILURE)
+    {
+        return SIFS_FAILURE;
+    }
+    if (volume->cache != NULL)
+    {
+        // Blocks modified in the cache have not necessarily reached the volume yet
+        SIFS_cacheoverlay(volume->cache, first, data, length, true);
+    }
+    return SIFS_SUCCESS;
 }
 
-SIFS_DIRBLOCK* SIFS_getdir(const char* volumename, char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId)
+int SIFS_readfilebytes(SIFS_VOLUME* volume, SIFS_BLOCKID firstblockID, size_t offset, void* data, size_t length)
 {
-    SIFS_DIRBLOCK* root = SIFS_getrootdir(volumename);
+    size_t blocksize = volume->header.blocksize;
+    SIFS_BLOCKID first = firstblockID + offset / blocksize;
+    size_t skip = offset % blocksize;
+    char* ptr = (char*)data;
+    if (length == 0)
+    {
+        return SIFS_SUCCESS;
+    }
+    if (skip > 0)
+    {
+        // The range starts part way into a block, copy its tail so that the rest is block aligned
+        size_t n = (length < blocksize - skip) ? length : blocksize - skip;
+        char* block = (char*)SIFS_getblock(volume, first);
+        if (block == NULL)
+        {
+            return SIFS_FAILURE;
+        }
+        memcpy(ptr, block + skip, n);
+        SIFS_releaseblock(volume, block);
+        ptr += n;
+        length -= n;
+        first++;
+    }
+    if (length > 0)
+    {
+        return SIFS_readblocks(volume, first, ptr, length);
+    }
+    return SIFS_SUCCESS;
+}
+
+int SIFS_readextents(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents, size_t offset, void* data, size_t length)
+{
+    if (extents->magic == SIFS_CHUNKLIST_MAGIC)
+    {
+        return SIFS_readchunks(volume, extents, offset, data, length);
+    }
+    size_t blocksize = volume->header.blocksize;
+    char* ptr = (char*)data;
+    for (uint32_t i = 0; i < extents->nextents && length > 0; i++)
+    {
+        // Skip the runs that end before offset
+        size_t extentbytes = (size_t)extents->extents[i].count * blocksize;
+        if (offset >= extentbytes)
+        {
+            offset -= extentbytes;
+            continue;
+        }
+        size_t n = (length < extentbytes - offset) ? length : extentbytes - offset;
+        if (SIFS_readfilebytes(volume, extents->extents[i].start, offset, ptr, n) == SIFS_FAILURE)
+        {
+            return SIFS_FAILURE;
+        }
+        ptr += n;
+        length -= n;
+        offset = 0;
+    }
+    return SIFS_SUCCESS;
+}
+
+void SIFS_writeextents(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents, const void* data, size_t nbytes)
+{
+    size_t blocksize = volume->header.blocksize;
+    const char* ptr = (const char*)data;
+    for (uint32_t i = 0; i < extents->nextents && nbytes > 0; i++)
+    {
+        size_t extentbytes = (size_t)extents->extents[i].count * blocksize;
+        size_t n = (nbytes < extentbytes) ? nbytes : extentbytes;
+        SIFS_updateblock(volume, extents->extents[i].start, ptr, n);
+        ptr += n;
+        nbytes -= n;
+    }
+}
+
+int SIFS_getblocksv(SIFS_VOLUME* volume, const SIFS_BLOCKID* blockIds, void** blocks, size_t n)
+{
+    if (volume->io == NULL)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            blocks[i] = SIFS_getblock(volume, blockIds[i]);
+            if (blocks[i] == NULL)
+            {
+                while (i-- > 0)
+                {
+                    SIFS_releaseblock(volume, blocks[i]);
+                }
+                return SIFS_FAILURE;
+            }
+        }
+        return SIFS_SUCCESS;
+    }
+    size_t blocksize = volume->header.blocksize;
+    struct iovec* iov = (struct iovec*)malloc(sizeof(struct iovec) * (n > 0 ? n : 1));
+    if (iov == NULL)
+    {
+        SIFS_errno = SIFS_ENOMEM;
+        return SIFS_FAILURE;
+    }
+    // Cached blocks are used as they are, the others are all requested before waiting for any of them
+    int result = SIFS_SUCCESS;
+    // A failed read is reported as such unless a buffer could not be allocated
+    int error = SIFS_ENOTVOL;
+    uint32_t outstanding = 0;
+    SIFS_IOCOMPLETION completions[SIFS_IODEPTH];
+    for (size_t i = 0; i < n; i++)
+    {
+        blocks[i] = (volume->cache != NULL) ? SIFS_cachelookup(volume->cache, blockIds[i]) : NULL;
+        if (blocks[i] != NULL)
+        {
+            continue;
+        }
+        blocks[i] = malloc(blocksize);
+        if (blocks[i] == NULL)
+        {
+            error = SIFS_ENOMEM;
+            result = SIFS_FAILURE;
+            break;
+        }
+        iov[i].iov_base = blocks[i];
+        iov[i].iov_len = blocksize;
+        off_t offset = volume->blockoffset + (off_t)blocksize * blockIds[i];
+        while (SIFS_ioprep(volume->io, false, &iov[i], 1, offset, i) == SIFS_FAILURE)
+        {
+            // The engine is full, make room by waiting for earlier reads
+            uint32_t count = SIFS_ioreap(volume->io, completions, SIFS_IODEPTH, 1);
+            for (uint32_t j = 0; j < count; j++)
+            {
+                result = (completions[j].result < 0) ? SIFS_FAILURE : result;
+            }
+            outstanding -= count;
+        }
+        outstanding++;
+    }
+    while (outstanding > 0)
+    {
+        uint32_t count = SIFS_ioreap(volume->io, completions, SIFS_IODEPTH, 1);
+        if (count == 0)
+        {
+            // The kernel stopped answering, the buffers of the reads it still holds can never be freed safely
+            for (size_t i = 0; i < n && blocks[i] != NULL; i++)
+            {
+                if (SIFS_cacheowns(volume->cache, blocks[i]))
+                {
+                    SIFS_cacherelease(volume->cache, blocks[i]);
+                }
+            }
+            free(iov);
+            SIFS_errno = SIFS_ENOTVOL;
+            return SIFS_FAILURE;
+        }
+        for (uint32_t j = 0; j < count; j++)
+        {
+            result = (completions[j].result < 0) ? SIFS_FAILURE : result;
+        }
+        outstanding -= count;
+    }
+    free(iov);
+    if (result == SIFS_FAILURE)
+    {
+        for (size_t i = 0; i < n && blocks[i] != NULL; i++)
+        {
+            SIFS_releaseblock(volume, blocks[i]);
+        }
+        SIFS_errno = error;
+    }
+    return result;
+}
+
+void SIFS_releaseblock(SIFS_VOLUME* volume, void* block)
+{
+    // Pointers into the mapping are owned by the volume, cached blocks are unpinned and copies are owned by the caller
+    char* ptr = (char*)block;
+    if (volume->map != NULL && ptr >= volume->map && ptr < volume->map + volume->maplength)
+    {
+        return;
+    }
+    if (SIFS_cacheowns(volume->cache, block))
+    {
+        SIFS_cacherelease(volume->cache, block);
+        return;
+    }
+    free(block);
+}
+
+SIFS_DIRBLOCK* SIFS_getrootdir(SIFS_VOLUME* volume)
+{
+    return (SIFS_DIRBLOCK*)SIFS_getblock(volume, SIFS_ROOTDIR_BLOCKID);
+}
+
+SIFS_DIRBLOCK* SIFS_getdir(SIFS_VOLUME* volume, char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId)
+{
+    SIFS_DIRBLOCK* root = SIFS_getrootdir(volume);
     if (root == NULL)
     {
         return NULL;
@@ -270,45 +561,99 @@ SIFS_DIRBLOCK* SIFS_getdir(const char* volumename, char** dirnames, size_t dirco
         return root;
     }
     // Recursively search through path to find directory
-    return SIFS_finddir(volumename, root, dirnames, dircount, outBlockId);
+    return SIFS_finddir(volume, root, SIFS_ROOTDIR_BLOCKID, dirnames, dircount, outBlockId);
+}
+
+// Helper function that continues SIFS_finddir() from the directory block found as blockId in dir
+static SIFS_DIRBLOCK* enterdir(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_DIRBLOCK* block, SIFS_BLOCKID blockId,
+    char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId)
+{
+    // If this directory was the last in dirnames (dircount == 1), return this directory block
+    // Else find the next directory using the next dirname in dirnames
+    if (dircount == 1)
+    {
+        if (outBlockId != NULL)
+        {
+            *outBlockId = blockId;
+        }
+        // Free the parent block
+        SIFS_releaseblock(volume, dir);
+        return block;
+    }
+    SIFS_releaseblock(volume, dir);
+    return SIFS_finddir(volume, block, blockId, dirnames + 1, dircount - 1, outBlockId);
 }
 
-SIFS_DIRBLOCK* SIFS_finddir(const char* volumename, SIFS_DIRBLOCK* dir, char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId)
+SIFS_DIRBLOCK* SIFS_finddir(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId, char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId)
 {
+    // A cached entry saves reading the blocks of every entry before it
+    SIFS_BLOCKID blockId;
+    if (SIFS_dentrylookup(volume, dirblockId, dirnames[0], &blockId, NULL) == SIFS_DIR)
+    {
+        SIFS_DIRBLOCK* block = (SIFS_DIRBLOCK*)SIFS_getblock(volume, blockId);
+        if (block == NULL)
+        {
+            // SIFS_errno set in SIFS_getblock()
+            SIFS_releaseblock(volume, dir);
+            return NULL;
+        }
+        if (strcmp(block->name, dirnames[0]) == 0)
+        {
+            return enterdir(volume, dir, block, blockId, dirnames, dircount, outBlockId);
+        }
+        SIFS_releaseblock(volume, block);
+    }
+    // The names kept in the directory block find the entry without reading any other
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, dir);
+    if (names != NULL)
+    {
+        int i = SIFS_finddirname(dir, names, dirnames[0]);
+        if (i >= 0 && names->types[i] == SIFS_DIR)
+        {
+            blockId = dir->entries[i].blockID;
+            SIFS_DIRBLOCK* block = (SIFS_DIRBLOCK*)SIFS_getblock(volume, blockId);
+            if (block == NULL)
+            {
+                // SIFS_errno set in SIFS_getblock()
+                SIFS_releaseblock(volume, dir);
+                return NULL;
+            }
+            SIFS_dentryinsert(volume, dirblockId, dirnames[0], SIFS_DIR, blockId, 0);
+            return enterdir(volume, dir, block, blockId, dirnames, dircount, outBlockId);
+        }
+        SIFS_errno = SIFS_ENOENT;
+        SIFS_releaseblock(volume, dir);
+        return NULL;
+    }
     // Search through the current directory's entries and find one that matches the first directory name (dirnames[0])
     for (int i = 0; i < dir->nentries; i++)
     {
-        SIFS_BIT type = SIFS_getblocktype(volumename, dir->entries[i].blockID);
+        SIFS_BIT type = SIFS_getblocktype(volume, dir->entries[i].blockID);
         if (type == SIFS_DIR)
         {
-            SIFS_DIRBLOCK* block = (SIFS_DIRBLOCK*)SIFS_getblock(volumename, dir->entries[i].blockID);
+            SIFS_DIRBLOCK* block = (SIFS_DIRBLOCK*)SIFS_getblock(volume, dir->entries[i].blockID);
+            if (block == NULL)
+            {
+                // SIFS_errno set in SIFS_getblock()
+                SIFS_releaseblock(volume, dir);
+                return NULL;
+            }
             if (strcmp(block->name, dirnames[0]) == 0)
             {
                 // Found correct directory
-                // If this directory was the last in dirnames (dircount == 1), return this directory block
-                // Else find the next directory using the next dirname in dirnames
-                if (dircount == 1)
-                {
-                    if (outBlockId != NULL)
-                    {
-                        *outBlockId = dir->entries[i].blockID;
-                    }
-                    // Free the parent block
-                    free(dir);
-                    return block;
-                }
-                return SIFS_finddir(volumename, block, dirnames + 1, dircount - 1, outBlockId);
+                SIFS_dentryinsert(volume, dirblockId, block->name, SIFS_DIR, dir->entries[i].blockID, 0);
+                return enterdir(volume, dir, block, dir->entries[i].blockID, dirnames, dircount, outBlockId);
             }
-            free(block);
+            SIFS_releaseblock(volume, block);
         }
     }
     // Failed to find a directory entry with the correct name
     SIFS_errno = SIFS_ENOENT;
-    free(dir);
+    SIFS_releaseblock(volume, dir);
     return NULL;
 }
 
-SIFS_FILEBLOCK* SIFS_getfile(const char* volumename, char** path, size_t count, SIFS_BLOCKID* outFileIndex)
+SIFS_FILEBLOCK* SIFS_getfile(SIFS_VOLUME* volume, char** path, size_t count, SIFS_BLOCKID* outFileIndex)
 {
     if (count == 0)
     {
@@ -317,190 +662,513 @@ SIFS_FILEBLOCK* SIFS_getfile(const char* volumename, char** path, size_t count,
     }
     // Last element in path is the filename, everything before that represents the directory
     // Find the directory from the path
-    SIFS_DIRBLOCK* dir = SIFS_getdir(volumename, path, count - 1, NULL);
+    SIFS_BLOCKID dirblockId;
+    SIFS_DIRBLOCK* dir = SIFS_getdir(volume, path, count - 1, &dirblockId);
     if (dir == NULL)
     {
         // SIFS_errno set in SIFS_getdir()
         return NULL;
     }
     char* filename = path[count - 1];
+    // A cached entry saves reading the blocks of every entry before it
+    SIFS_BLOCKID blockId;
+    uint32_t fileindex;
+    if (SIFS_dentrylookup(volume, dirblockId, filename, &blockId, &fileindex) == SIFS_FILE)
+    {
+        SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, blockId);
+        if (fileblock != NULL && fileindex < fileblock->nfiles && strcmp(fileblock->filenames[fileindex], filename) == 0)
+        {
+            if (outFileIndex != NULL)
+            {
+                *outFileIndex = fileindex;
+            }
+            SIFS_releaseblock(volume, dir);
+            return fileblock;
+        }
+        if (fileblock != NULL)
+        {
+            SIFS_releaseblock(volume, fileblock);
+        }
+    }
+    // The names kept in the directory block find the entry without reading any other
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, dir);
+    if (names != NULL)
+    {
+        int i = SIFS_finddirname(dir, names, filename);
+        SIFS_FILEBLOCK* fileblock = NULL;
+        if (i >= 0 && names->types[i] == SIFS_FILE)
+        {
+            fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, dir->entries[i].blockID);
+            if (fileblock != NULL)
+            {
+                SIFS_dentryinsert(volume, dirblockId, filename, SIFS_FILE, dir->entries[i].blockID, dir->entries[i].fileindex);
+                if (outFileIndex != NULL)
+                {
+                    *outFileIndex = dir->entries[i].fileindex;
+                }
+            }
+        }
+        else
+        {
+            SIFS_errno = (i >= 0) ? SIFS_ENOTFILE : SIFS_ENOENT;
+        }
+        SIFS_releaseblock(volume, dir);
+        return fileblock;
+    }
     // Try to find the file in the directory
     for (int i = 0; i < dir->nentries; i++)
     {
-        SIFS_BIT type = SIFS_getblocktype(volumename, dir->entries[i].blockID);
+        SIFS_BIT type = SIFS_getblocktype(volume, dir->entries[i].blockID);
         if (type == SIFS_FILE)
         {
-            SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, dir->entries[i].blockID);
+            SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, dir->entries[i].blockID);
             if (strcmp(fileblock->filenames[dir->entries[i].fileindex], filename) == 0)
             {
+                SIFS_dentryinsert(volume, dirblockId, filename, SIFS_FILE, dir->entries[i].blockID, dir->entries[i].fileindex);
                 if (outFileIndex != NULL)
                 {
                     *outFileIndex = dir->entries[i].fileindex;
                 }
-                free(dir);
+                SIFS_releaseblock(volume, dir);
                 return fileblock;
             }
-            free(fileblock);
+            SIFS_releaseblock(volume, fileblock);
         }
     }
     // Unable to a find a file with the correct name
     // Test whether the directory has any entry with the correct name (eg. a directory with the filename)
-    if (SIFS_hasentry(volumename, dir, filename))
+    bool found;
+    if (SIFS_hasentry(volume, dir, filename, &found) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_hasentry()
+        SIFS_releaseblock(volume, dir);
+        return NULL;
+    }
+    if (found)
     {
         // The directory contains a directory with the filename
-        free(dir);
+        SIFS_releaseblock(volume, dir);
         SIFS_errno = SIFS_ENOTFILE;
         return NULL;
     }
     // No entry named filename
-    free(dir);
+    SIFS_releaseblock(volume, dir);
     SIFS_errno = SIFS_ENOENT;
     return NULL;
 }
 
-SIFS_BIT SIFS_getblocktype(const char* volumename, SIFS_BLOCKID blockIndex)
+SIFS_BIT SIFS_getblocktype(SIFS_VOLUME* volume, SIFS_BLOCKID blockIndex)
 {
-    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volumename);
-    if (bitmap == NULL)
+    if (volume->bitmap != NULL)
+    {
+        return volume->bitmap[blockIndex];
+    }
+    // Only the requested entry of the bitmap needs to be read
+    SIFS_BIT type;
+    if (volume->packed)
+    {
+        unsigned char packed;
+        if (SIFS_readvolumeptr(volume, &packed, volume->bitmapoffset + blockIndex / 4, 1) == SIFS_FAILURE)
+        {
+            return SIFS_UNUSED;
+        }
+        packed >>= 2 * (blockIndex % 4);
+        SIFS_bitmapunpack(&packed, 1, &type);
+        return type;
+    }
+    if (SIFS_readvolumeptr(volume, &type, volume->bitmapoffset + blockIndex * sizeof(SIFS_BIT), sizeof(SIFS_BIT)) == SIFS_FAILURE)
     {
         return SIFS_UNUSED;
     }
-    SIFS_BIT type = bitmap[blockIndex];
-    free(bitmap);
     return type;
 }
 
-SIFS_BLOCKID SIFS_allocateblocks(const char* volumename, SIFS_BLOCKID nblocks, SIFS_BIT type)
+SIFS_EXTENTS* SIFS_getfreeextents(SIFS_VOLUME* volume)
 {
-    SIFS_VOLUME_HEADER header;
-    if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
+    if (volume->freeextents == NULL)
     {
-        return SIFS_ROOTDIR_BLOCKID;
+        SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
+        if (bitmap != NULL)
+        {
+            volume->freeextents = SIFS_extentscreate(bitmap, volume->header.nblocks);
+        }
+    }
+    return volume->freeextents;
+}
+
+int SIFS_countblocks(SIFS_VOLUME* volume)
+{
+    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
+    if (bitmap == NULL)
+    {
+        return SIFS_FAILURE;
+    }
+    if (!volume->counted)
+    {
+        SIFS_BLOCKID nblocks = volume->header.nblocks;
+        volume->ndirblocks = SIFS_bitmapcount(bitmap, 0, nblocks, SIFS_DIR);
+        volume->nfileblocks = SIFS_bitmapcount(bitmap, 0, nblocks, SIFS_FILE);
+        volume->ndatablocks = SIFS_bitmapcount(bitmap, 0, nblocks, SIFS_DATABLOCK);
+        volume->counted = true;
+    }
+    return SIFS_SUCCESS;
+}
+
+// Helper function that adds nblocks blocks of type to the counts of blocks in use, if they have been counted
+static void addcount(SIFS_VOLUME* volume, SIFS_BIT type, SIFS_BLOCKID nblocks)
+{
+    if (!volume->counted)
+    {
+        return;
+    }
+    if (type == SIFS_DIR)
+    {
+        volume->ndirblocks += nblocks;
+    }
+    else if (type == SIFS_FILE)
+    {
+        volume->nfileblocks += nblocks;
+    }
+    else if (type == SIFS_DATABLOCK)
+    {
+        volume->ndatablocks += nblocks;
+    }
+}
+
+// Helper function that returns the lowest block from from onwards that starts nblocks free blocks, or SIFS_ROOTDIR_BLOCKID
+static SIFS_BLOCKID findfree(SIFS_VOLUME* volume, SIFS_EXTENTS* extents, SIFS_BLOCKID from, SIFS_BLOCKID nblocks)
+{
+    if (extents != NULL)
+    {
+        return SIFS_extentsfind(extents, from, nblocks);
+    }
+    // Searched for in the bitmap if the index could not be built
+    SIFS_BLOCKID first = SIFS_bitmapfindrun(volume->bitmap, from, volume->header.nblocks, nblocks);
+    return (first == volume->header.nblocks) ? SIFS_ROOTDIR_BLOCKID : first;
+}
+
+// Helper function that finds nblocks free blocks for type within its zone, starting at the zone's cursor
+// and wrapping around to the start of the zone, before falling back to the lowest free blocks anywhere
+static SIFS_BLOCKID findzoned(SIFS_VOLUME* volume, SIFS_EXTENTS* extents, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    SIFS_VOLUME_EXTHEADER* exthdr = &volume->exthdr;
+    bool data = (type == SIFS_DATABLOCK);
+    SIFS_BLOCKID zonestart = data ? exthdr->datazone : SIFS_ROOTDIR_BLOCKID + 1;
+    SIFS_BLOCKID zoneend = data ? volume->header.nblocks : exthdr->datazone;
+    SIFS_BLOCKID cursor = data ? exthdr->datacursor : exthdr->metacursor;
+    if (cursor < zonestart || cursor >= zoneend)
+    {
+        cursor = zonestart;
+    }
+    SIFS_BLOCKID first = findfree(volume, extents, cursor, nblocks);
+    if ((first == SIFS_ROOTDIR_BLOCKID || first + nblocks > zoneend) && cursor > zonestart)
+    {
+        first = findfree(volume, extents, zonestart, nblocks);
+    }
+    if (first == SIFS_ROOTDIR_BLOCKID || first + nblocks > zoneend)
+    {
+        // The zone is full, spill over into the rest of the volume
+        return findfree(volume, extents, SIFS_ROOTDIR_BLOCKID + 1, nblocks);
     }
-    if (nblocks > header.nblocks)
+    // Only allocations within the zone move its cursor
+    if (data)
+    {
+        exthdr->datacursor = first + nblocks;
+    }
+    else
+    {
+        exthdr->metacursor = first + nblocks;
+    }
+    volume->exthdrdirty = true;
+    return first;
+}
+
+SIFS_BLOCKID SIFS_allocateblocks(SIFS_VOLUME* volume, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    SIFS_EXTENTS* extents = SIFS_getfreeextents(volume);
+    if (volume->bitmap == NULL || nblocks == 0 || nblocks > volume->header.nblocks)
     {
-        // Tried to allocate too many blocks
         return SIFS_ROOTDIR_BLOCKID;
     }
-    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volumename);
-    // Try to find nblocks of contiguous blocks in the bitmap
-    for (size_t i = SIFS_ROOTDIR_BLOCKID + 1; i < header.nblocks; i++)
+    SIFS_BLOCKID first = SIFS_ROOTDIR_BLOCKID;
+    if (volume->exthdr.features & SIFS_FEATURE_ZONES)
     {
-        if (bitmap[i] == SIFS_UNUSED)
+        first = findzoned(volume, extents, nblocks, type);
+        if (first != SIFS_ROOTDIR_BLOCKID && extents != NULL && !SIFS_extentstakeat(extents, first, nblocks))
         {
-            bool available = true;
-            for (SIFS_BLOCKID j = 1; j < nblocks; j++)
-            {   
-                if (i + j >= header.nblocks)
-                {
-                    // Tried to read past end of bitmap
-                    available = false;
-                    break;
-                }
-                if (bitmap[i + j] != SIFS_UNUSED)
-                {
-                    // Not a contigous section of blocks
-                    available = false;
-                    break;
-                }
-            }
-            if (available)
-            {
-                // Found available blocks successfully
-                // Update the volume bitmap to reflect this allocation
-                // Return the BLOCKID of the first block allocated
-                for (SIFS_BLOCKID j = 0; j < nblocks; j++)
-                {   
-                    bitmap[i + j] = type;
-                }
-                SIFS_updatevolumebitmap(volumename, bitmap, header.nblocks);
-                free(bitmap);
-                return i;
-            }
+            // The blocks were found free, so only memory ran out, the index is rebuilt from the bitmap when next needed
+            SIFS_extentsdestroy(extents);
+            volume->freeextents = NULL;
         }
     }
-    free(bitmap);
-    return SIFS_ROOTDIR_BLOCKID;
+    else if (extents != NULL)
+    {
+        // The lowest run of nblocks contiguous free blocks
+        first = SIFS_extentstake(extents, nblocks);
+    }
+    else
+    {
+        first = findfree(volume, NULL, SIFS_ROOTDIR_BLOCKID + 1, nblocks);
+    }
+    if (first != SIFS_ROOTDIR_BLOCKID)
+    {
+        memset(volume->bitmap + first, type, nblocks);
+        SIFS_updatevolumebitmap(volume, first, nblocks);
+        addcount(volume, type, nblocks);
+    }
+    return first;
+}
+
+bool SIFS_allocateblocksat(SIFS_VOLUME* volume, SIFS_BLOCKID first, SIFS_BLOCKID nblocks, SIFS_BIT type)
+{
+    SIFS_EXTENTS* extents = SIFS_getfreeextents(volume);
+    if (extents == NULL || first > volume->header.nblocks || nblocks > volume->header.nblocks - first)
+    {
+        return false;
+    }
+    if (!SIFS_extentstakeat(extents, first, nblocks))
+    {
+        return false;
+    }
+    memset(volume->bitmap + first, type, nblocks);
+    SIFS_updatevolumebitmap(volume, first, nblocks);
+    addcount(volume, type, nblocks);
+    return true;
 }
 
-void SIFS_freeblocks(const char* volumename, SIFS_BLOCKID firstblock, SIFS_BLOCKID nblocks)
+void SIFS_freeblocks(SIFS_VOLUME* volume, SIFS_BLOCKID firstblock, SIFS_BLOCKID nblocks)
 {
-    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volumename);
+    SIFS_EXTENTS* extents = SIFS_getfreeextents(volume);
+    SIFS_BIT* bitmap = volume->bitmap;
     if (bitmap == NULL)
     {
         return;
     }
-    // Updates the bitmap to reflect deallocation
-    for (SIFS_BLOCKID i = firstblock; i < firstblock + nblocks; i++)
+    // Only blocks that are in use are returned to the index, a block is never free twice
+    SIFS_BLOCKID end = firstblock + nblocks;
+    SIFS_BLOCKID start = SIFS_bitmapskip(bitmap, firstblock, end, SIFS_UNUSED);
+    while (start < end)
+    {
+        SIFS_BLOCKID runend = SIFS_bitmapfind(bitmap, start, end, SIFS_UNUSED);
+        if (volume->counted)
+        {
+            // A run of blocks in use is almost always of one type, but need not be
+            volume->ndirblocks -= SIFS_bitmapcount(bitmap, start, runend, SIFS_DIR);
+            volume->nfileblocks -= SIFS_bitmapcount(bitmap, start, runend, SIFS_FILE);
+            volume->ndatablocks -= SIFS_bitmapcount(bitmap, start, runend, SIFS_DATABLOCK);
+        }
+        memset(bitmap + start, SIFS_UNUSED, runend - start);
+        if (extents != NULL && !SIFS_extentsgive(extents, start, runend - start))
+        {
+            // Out of memory, the index is rebuilt from the bitmap when next needed
+            SIFS_extentsdestroy(extents);
+            volume->freeextents = extents = NULL;
+        }
+        start = SIFS_bitmapskip(bitmap, runend, end, SIFS_UNUSED);
+    }
+    SIFS_updatevolumebitmap(volume, firstblock, nblocks);
+}
+
+int SIFS_allocateextents(SIFS_VOLUME* volume, SIFS_BLOCKID nblocks, SIFS_EXTENTLIST* extents)
+{
+    extents->magic = SIFS_EXTENTLIST_MAGIC;
+    extents->nextents = 0;
+    if (nblocks == 0)
+    {
+        return SIFS_SUCCESS;
+    }
+    SIFS_BLOCKID first = SIFS_allocateblocks(volume, nblocks, SIFS_DATABLOCK);
+    if (first != SIFS_ROOTDIR_BLOCKID)
+    {
+        extents->extents[0].start = first;
+        extents->extents[0].count = nblocks;
+        extents->nextents = 1;
+        return SIFS_SUCCESS;
+    }
+    SIFS_EXTENTS* freeextents = SIFS_getfreeextents(volume);
+    if (!(volume->exthdr.features & SIFS_FEATURE_EXTENTS) || freeextents == NULL)
+    {
+        return SIFS_FAILURE;
+    }
+    // No run is long enough, take the longest runs until there are enough blocks
+    SIFS_beginbitmapbatch(volume);
+    SIFS_BLOCKID remaining = nblocks;
+    while (remaining > 0 && extents->nextents < SIFS_MAX_EXTENTS)
+    {
+        SIFS_BLOCKID n = SIFS_extentslongest(freeextents);
+        n = (n < remaining) ? n : remaining;
+        first = (n > 0) ? SIFS_allocateblocks(volume, n, SIFS_DATABLOCK) : SIFS_ROOTDIR_BLOCKID;
+        if (first == SIFS_ROOTDIR_BLOCKID)
+        {
+            break;
+        }
+        // Runs are kept in the order they are on the volume, so that a defrag joins them back together
+        uint32_t i = extents->nextents++;
+        for (; i > 0 && extents->extents[i - 1].start > first; i--)
+        {
+            extents->extents[i] = extents->extents[i - 1];
+        }
+        extents->extents[i].start = first;
+        extents->extents[i].count = n;
+        remaining -= n;
+        // The index is rebuilt if it ran out of memory
+        freeextents = SIFS_getfreeextents(volume);
+        if (freeextents == NULL)
+        {
+            break;
+        }
+    }
+    if (remaining > 0)
+    {
+        SIFS_freeextents(volume, extents);
+        extents->nextents = 0;
+    }
+    SIFS_endbitmapbatch(volume);
+    return (remaining > 0) ? SIFS_FAILURE : SIFS_SUCCESS;
+}
+
+void SIFS_freeextents(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents)
+{
+    // The chunks are found through the list, so they are dropped before its runs are freed
+    if (extents->magic == SIFS_CHUNKLIST_MAGIC)
+    {
+        SIFS_dropchunks(volume, extents);
+    }
+    for (uint32_t i = 0; i < extents->nextents; i++)
+    {
+        SIFS_freeblocks(volume, extents->extents[i].start, extents->extents[i].count);
+    }
+}
+
+// Helper function that returns where the list of runs of a fileblock is kept, straight after it in the same block
+static SIFS_EXTENTLIST* blockextents(const SIFS_FILEBLOCK* fileblock)
+{
+    return (SIFS_EXTENTLIST*)((char*)fileblock + sizeof(SIFS_FILEBLOCK));
+}
+
+void SIFS_getextents(SIFS_VOLUME* volume, const SIFS_FILEBLOCK* fileblock, SIFS_EXTENTLIST* extents)
+{
+    // Only fileblocks of volumes with the feature are guaranteed to have the rest of their block cleared
+    const SIFS_EXTENTLIST* stored = blockextents(fileblock);
+    // A list of chunks is always stored, even when it is in one run
+    if ((volume->exthdr.features & SIFS_FEATURE_EXTENTS) &&
+        ((stored->magic == SIFS_EXTENTLIST_MAGIC && stored->nextents > 1) ||
+         (stored->magic == SIFS_CHUNKLIST_MAGIC && stored->nextents > 0)) && stored->nextents <= SIFS_MAX_EXTENTS)
+    {
+        memcpy(extents, stored, sizeof(SIFS_EXTENTLIST));
+        return;
+    }
+    SIFS_BLOCKID nblocks = SIFS_calcnblocks(&volume->header, fileblock->length);
+    extents->magic = SIFS_EXTENTLIST_MAGIC;
+    extents->nextents = (nblocks > 0) ? 1 : 0;
+    extents->extents[0].start = fileblock->firstblockID;
+    extents->extents[0].count = nblocks;
+}
+
+void SIFS_setextents(SIFS_VOLUME* volume, SIFS_FILEBLOCK* fileblock, const SIFS_EXTENTLIST* extents)
+{
+    // An empty file references the root directory which is never a data block
+    fileblock->firstblockID = (extents->nextents > 0) ? extents->extents[0].start : SIFS_ROOTDIR_BLOCKID;
+    if (volume->exthdr.features & SIFS_FEATURE_EXTENTS)
     {
-        bitmap[i] = SIFS_UNUSED;
+        // A file in one run is stored in the original way, the block it reuses may still hold an old list
+        SIFS_EXTENTLIST* stored = blockextents(fileblock);
+        if (extents->nextents > 1 || extents->magic == SIFS_CHUNKLIST_MAGIC)
+        {
+            memcpy(stored, extents, sizeof(SIFS_EXTENTLIST));
+            stored->magic = (extents->magic == SIFS_CHUNKLIST_MAGIC) ? SIFS_CHUNKLIST_MAGIC : SIFS_EXTENTLIST_MAGIC;
+        }
+        else
+        {
+            memset(stored, 0, sizeof(SIFS_EXTENTLIST));
+        }
     }
-    SIFS_updatevolumebitmap(volumename, bitmap, 0);
-    free(bitmap);
 }
 
-bool SIFS_hasentry(const char* volumename, SIFS_DIRBLOCK* directory, const char* entryname)
+int SIFS_hasentry(SIFS_VOLUME* volume, SIFS_DIRBLOCK* directory, const char* entryname, bool* found)
 {
+    SIFS_DIRNAMES* names = SIFS_getdirnames(volume, directory);
+    if (names != NULL)
+    {
+        *found = SIFS_finddirname(directory, names, entryname) >= 0;
+        return SIFS_SUCCESS;
+    }
+    // Read every entry's block together rather than one after another
+    SIFS_BLOCKID blockIds[SIFS_MAX_ENTRIES];
+    void* blocks[SIFS_MAX_ENTRIES];
+    for (int i = 0; i < directory->nentries; i++)
+    {
+        blockIds[i] = directory->entries[i].blockID;
+    }
+    if (SIFS_getblocksv(volume, blockIds, blocks, directory->nentries) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_getblocksv()
+        return SIFS_FAILURE;
+    }
     // Tests whether directory has any entry named entryname (file or directory)
+    *found = false;
     for (int i = 0; i < directory->nentries; i++)
     {
-        SIFS_BIT type = SIFS_getblocktype(volumename, directory->entries[i].blockID);
+        SIFS_BIT type = SIFS_getblocktype(volume, directory->entries[i].blockID);
         if (type == SIFS_DIR)
         {
-            SIFS_DIRBLOCK* dir = (SIFS_DIRBLOCK*)SIFS_getblock(volumename, directory->entries[i].blockID);
-            if (strcmp(dir->name, entryname) == 0)
-            {
-                free(dir);
-                return true;
-            }
-            free(dir);
+            SIFS_DIRBLOCK* dir = (SIFS_DIRBLOCK*)blocks[i];
+            *found = *found || strcmp(dir->name, entryname) == 0;
         }
         else if (type == SIFS_FILE)
         {
-            SIFS_FILEBLOCK* file = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, directory->entries[i].blockID);
-            if (strcmp(file->filenames[directory->entries[i].fileindex], entryname) == 0)
-            {
-                free(file);
-                return true;
-            }
-            free(file);
+            SIFS_FILEBLOCK* file = (SIFS_FILEBLOCK*)blocks[i];
+            *found = *found || strcmp(file->filenames[directory->entries[i].fileindex], entryname) == 0;
         }
+        SIFS_releaseblock(volume, blocks[i]);
     }
-    return false;
+    return SIFS_SUCCESS;
 }
 
-SIFS_FILEBLOCK* SIFS_getfileblock(const char* volumename, const void* md5, SIFS_BLOCKID* outBlockid)
+SIFS_FILEBLOCK* SIFS_getfileblock(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID* outBlockid)
 {
-    SIFS_VOLUME_HEADER header;
-    if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
+    // A volume with an index of its fileblocks is never scanned
+    if (volume->exthdr.features & SIFS_FEATURE_HASHINDEX)
     {
-        return NULL;
+        SIFS_BLOCKID blockId;
+        if (!SIFS_hashlookup(volume, md5, &blockId) || blockId >= volume->header.nblocks ||
+            SIFS_getblocktype(volume, blockId) != SIFS_FILE)
+        {
+            return NULL;
+        }
+        SIFS_FILEBLOCK* block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, blockId);
+        if (block != NULL && memcmp(md5, block->md5, MD5_BYTELEN) != 0)
+        {
+            SIFS_releaseblock(volume, block);
+            block = NULL;
+        }
+        if (block != NULL && outBlockid != NULL)
+        {
+            *outBlockid = blockId;
+        }
+        return block;
     }
-    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volumename);
+    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
     if (bitmap == NULL)
     {
         // SIFS_errno set in SIFS_getvolumebitmap()
         return NULL;
     }
-    // Go through all blocks in the volume and find all file blocks
-    for (SIFS_BLOCKID i = 0; i < header.nblocks; i++)
+    // Go through all file blocks in the volume
+    SIFS_BLOCKID nblocks = volume->header.nblocks;
+    for (SIFS_BLOCKID i = SIFS_bitmapfind(bitmap, 0, nblocks, SIFS_FILE); i < nblocks; i = SIFS_bitmapfind(bitmap, i + 1, nblocks, SIFS_FILE))
     {
-        if (bitmap[i] == SIFS_FILE)
+        SIFS_FILEBLOCK* block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, i);
+        // Check if the md5 matches
+        if (memcmp(md5, block->md5, MD5_BYTELEN) == 0)
         {
-            SIFS_FILEBLOCK* block = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, i);
-            // Check if the md5 matches
-            if (memcmp(md5, block->md5, MD5_BYTELEN) == 0)
+            if (outBlockid != NULL)
             {
-                if (outBlockid != NULL)
-                {
-                    *outBlockid = i;
-                }
-                free(bitmap);
-                return block;
+                *outBlockid = i;
             }
-            free(block);
+            return block;
         }
+        SIFS_releaseblock(volume, block);
     }
-    free(bitmap);
     return NULL;
 }
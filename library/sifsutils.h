@@ -1,56 +1,471 @@
 #include "sifs-internal.h"
+#include "xxh128.h"
+#include "blake3.h"
 #include <stdbool.h>
+#include <sys/types.h>
+
+struct iovec;
 
 #define SIFS_DIR_DELIMITER '/'
 
 #define SIFS_SUCCESS     0
 #define SIFS_FAILURE     1
 
+// Largest number of buffers passed to a single pwritev() call
+#define SIFS_MAX_IOVECS             1024
+
+// Number of blocks cached by a newly opened volume, see SIFS_setcachesize()
+#define SIFS_DEFAULT_CACHEBLOCKS    64
+
+// Number of requests the I/O engine of a volume keeps in flight at once
+#define SIFS_IODEPTH                64
+
+// Identifies a volume whose header is followed by a SIFS_VOLUME_EXTHEADER
+#define SIFS_EXTHEADER_MAGIC        "SIFSEXT"
+
+// Revisions of the volume layout recorded in SIFS_VOLUME_EXTHEADER.version
+#define SIFS_FORMAT_PACKED          2   // The bitmap holds 2 bits per block, see SIFS_bitmappack()
+
+// Blocks of volumes made with SIFS_MKVOLUME_PACKED start at a multiple of this many bytes
+#define SIFS_BLOCKALIGN             4096
+
+// Follows the header of every volume not in the original layout, which has no such header
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    // Flags of optional parts of the layout that are in use
+    uint32_t features;
+    // Byte offset of the first block within the volume
+    uint64_t blockoffset;
+    // With SIFS_FEATURE_ZONES, directory and file blocks are kept before datazone and data blocks from it onwards
+    SIFS_BLOCKID datazone;
+    // Where the next search for free blocks of each zone starts
+    SIFS_BLOCKID metacursor;
+    SIFS_BLOCKID datacursor;
+    // With SIFS_FEATURE_HASHINDEX, byte offset and number of the SIFS_HASHBUCKETs after the last block
+    uint64_t hashoffset;
+    uint32_t nhashbuckets;
+    // Hash that identifies a file's contents in the md5 field of its fileblock, one of the SIFS_HASH_* values
+    uint32_t hashalg;
+    char reserved[8];
+} SIFS_VOLUME_EXTHEADER;
+
+// Flags of SIFS_VOLUME_EXTHEADER.features
+#define SIFS_FEATURE_ZONES          0x01    // Metadata and data are allocated from separate zones, each next-fit
+#define SIFS_FEATURE_EXTENTS        0x02    // A file's data may be split over several runs, see SIFS_EXTENTLIST
+#define SIFS_FEATURE_HASHINDEX      0x04    // Fileblocks are found by their md5 through SIFS_HASHBUCKETs
+#define SIFS_FEATURE_CHUNKS         0x08    // Large files are split into chunks shared between files, see SIFS_CHUNK
+#define SIFS_FEATURE_DIRNAMES       0x10    // Each directory block holds the types and names of its entries, see SIFS_DIRNAMES
+#define SIFS_FEATURES_KNOWN         0x1f
+
+// Hashes of SIFS_VOLUME_EXTHEADER.hashalg, volumes in the original layout use md5
+#define SIFS_HASH_MD5               0
+#define SIFS_HASH_XXH128            1   // XXH3-128, in its canonical byte order
+#define SIFS_HASH_BLAKE3            2   // The first MD5_BYTELEN bytes of the BLAKE3 hash
+
+// Fraction of a volume with zones given to directory and file blocks
+#define SIFS_METAZONE_DIVISOR       16
+
+// Identifies a fileblock whose data is split over the runs listed in a SIFS_EXTENTLIST after it
+#define SIFS_EXTENTLIST_MAGIC       0x54584553u
+
+// Largest number of runs a file's data is split over, as many as fit after a SIFS_FILEBLOCK in the smallest block
+#define SIFS_MAX_EXTENTS            26
+
+// A run of count blocks starting at start
+typedef struct
+{
+    SIFS_BLOCKID start;
+    SIFS_BLOCKID count;
+} SIFS_EXTENT;
+
+// Where the data of a file is, in order, a file with all of its data in one run needs nothing beyond its SIFS_FILEBLOCK
+// With SIFS_FEATURE_EXTENTS, the list of a file split over several runs is stored straight after its SIFS_FILEBLOCK
+typedef struct
+{
+    uint32_t magic;
+    uint32_t nextents;
+    SIFS_EXTENT extents[SIFS_MAX_EXTENTS];
+} SIFS_EXTENTLIST;
+
+// Identifies a fileblock whose runs hold the list of chunks of its data, not the data itself
+#define SIFS_CHUNKLIST_MAGIC        0x4b4e4843u
+
+// With SIFS_FEATURE_CHUNKS, files of at least SIFS_CHUNKED_MINFILE bytes are split where a rolling hash of their last
+// 64 bytes has its top SIFS_CHUNK_MASKBITS bits clear, into chunks of SIFS_CHUNK_MIN to SIFS_CHUNK_MAX bytes
+#define SIFS_CHUNK_MIN              (16 * 1024)
+#define SIFS_CHUNK_MAX              (128 * 1024)
+#define SIFS_CHUNK_MASKBITS         14
+#define SIFS_CHUNKED_MINFILE        (2 * SIFS_CHUNK_MIN)
+
+// One chunk of a file split into chunks, the list of them starts with their number (a uint64_t)
+// Each chunk is held by a fileblock of its own with no names, whose nfiles counts the lists that include it,
+// and whose md5 is the digest of the chunk with every bit inverted so that it never names a whole file
+typedef struct
+{
+    unsigned char md5[MD5_BYTELEN];
+    // Offset within the file of the byte after the chunk
+    uint64_t end;
+} SIFS_CHUNK;
+
+// With SIFS_FEATURE_DIRNAMES, the type and name of each entry of a directory are kept straight after its SIFS_DIRBLOCK,
+// so that an entry is found by name without reading the blocks of the others. This fits in the smallest block
+#define SIFS_DIRNAMES_MAGIC         0x4d414e44u
+typedef struct
+{
+    uint32_t magic;
+    SIFS_BIT types[SIFS_MAX_ENTRIES];
+    // Only a name of SIFS_MAX_NAME_LENGTH - 1 characters has no null byte
+    char names[SIFS_MAX_ENTRIES][SIFS_MAX_NAME_LENGTH - 1];
+} SIFS_DIRNAMES;
+
+// Identifies the last name of a fileblock that holds the link of a chain of fileblocks instead, see SIFS_NAMELINK
+#define SIFS_NAMELINK_MAGIC         0x4e49414cu
+
+// Contents with more names than fit in one fileblock are held by a chain of fileblocks, each a copy of the first
+// (the one found by md5, which owns the data) with names of its own, linked through the last name of each.
+// That name is never an empty string, so this record starts with a null byte
+typedef struct
+{
+    char empty[4];
+    uint32_t magic;
+    // The first fileblock of the chain, and the next one or SIFS_ROOTDIR_BLOCKID at the end
+    SIFS_BLOCKID head;
+    SIFS_BLOCKID next;
+} SIFS_NAMELINK;
+
+// Number of fileblocks held by each bucket of the index of fileblocks by md5, as many as fit in a page
+#define SIFS_HASHBUCKET_SLOTS       203
+#define SIFS_HASHBUCKET_BYTES       4096
+
+// A bucket of the index of fileblocks by md5, a fileblock is held by the bucket its md5 selects
+// or, if that is full, by the first bucket after it with room
+typedef struct
+{
+    // Number of fileblocks held after this bucket because it, and any buckets before it, were full
+    uint32_t overflow;
+    uint32_t nentries;
+    struct
+    {
+        unsigned char md5[MD5_BYTELEN];
+        SIFS_BLOCKID blockID;
+    } entries[SIFS_HASHBUCKET_SLOTS];
+} SIFS_HASHBUCKET;
+
+// Number of powers of two that free runs are counted by, see SIFS_extentshistogram()
+#define SIFS_EXTENT_BUCKETS         SIFS_STAT_BUCKETS
+
+typedef struct SIFS_CACHE SIFS_CACHE;
+typedef struct SIFS_IOENGINE SIFS_IOENGINE;
+typedef struct SIFS_EXTENTS SIFS_EXTENTS;
+typedef struct SIFS_DENTRIES SIFS_DENTRIES;
+
+// The outcome of a request made with SIFS_ioprep()
+typedef struct
+{
+    uint64_t tag;
+    // Number of bytes transferred (always the whole request), or -1 on failure
+    ssize_t result;
+} SIFS_IOCOMPLETION;
+
+// An open volume, see SIFS_open()
+struct SIFS_VOLUME
+{
+    // The volume's file descriptor, opened once for the lifetime of the handle
+    int fd;
+    // False if the volume could only be opened for reading
+    bool writable;
+    // Copy of the volume's header, read and validated when the volume was opened
+    SIFS_VOLUME_HEADER header;
+    // Copy of the extended header, all zeroes for a volume in the original layout
+    SIFS_VOLUME_EXTHEADER exthdr;
+    // True if the allocation cursors in exthdr have moved since it was last written
+    bool exthdrdirty;
+    // True if the bitmap is stored with 2 bits per block, it is always resident with one SIFS_BIT per block
+    bool packed;
+    // Byte offsets of the bitmap and the first block within the volume
+    size_t bitmapoffset;
+    size_t blockoffset;
+    // Resident bitmap, NULL until first requested with SIFS_getvolumebitmap()
+    SIFS_BIT* bitmap;
+    // While greater than 0, writes of the resident bitmap are held back until SIFS_endbitmapbatch()
+    int bitmapdeferred;
+    // Entries of the resident bitmap from dirtyfirst to dirtyend were modified while writes were held back
+    SIFS_BLOCKID dirtyfirst;
+    SIFS_BLOCKID dirtyend;
+    // Index of the free runs of blocks in the resident bitmap, NULL until first needed by the allocator
+    SIFS_EXTENTS* freeextents;
+    // Number of blocks of each type in use, counted from the resident bitmap when first needed by SIFS_vstatvol()
+    // and kept up to date by the allocator from then on
+    bool counted;
+    SIFS_BLOCKID ndirblocks;
+    SIFS_BLOCKID nfileblocks;
+    SIFS_BLOCKID ndatablocks;
+    // The whole volume when opened with SIFS_OPEN_MMAP, otherwise NULL
+    char* map;
+    size_t maplength;
+    // Write-back cache of single blocks, NULL for mapped volumes or when disabled
+    SIFS_CACHE* cache;
+    // Engine that issues independent block reads and writes together, NULL for mapped volumes
+    SIFS_IOENGINE* io;
+    // Cache of directory entries by parent directory and name, NULL until the first entry is found
+    SIFS_DENTRIES* dentries;
+    // Files started with SIFS_wopen() and not yet committed or abandoned, their reserved blocks have no fileblock yet
+    SIFS_WRITER* writers;
+};
+
+// Closes a volume opened for one name-based call that returned result, returning what that call should
+// Keeps the SIFS_errno of a failed call, a successful one fails if the volume could not be closed
+extern int SIFS_closeafter(SIFS_VOLUME* volume, int result);
+
 // Splits str based on delimiter into a vector of strings that do not include the delimiter (free with freesplit())
 extern char** strsplit(const char* str, char delimiter, size_t* outCount);
 // Correctly frees the result from strsplit
 extern void freesplit(char** strsplitresult);
 
+// Reads exactly length bytes at offset, retrying interrupted and short reads
+extern int SIFS_preadfull(int fd, void* data, size_t length, off_t offset);
+// Writes exactly length bytes at offset, retrying interrupted and short writes
+extern int SIFS_pwritefull(int fd, const void* data, size_t length, off_t offset);
+// Gathers iovcnt buffers into one positional write, retrying interrupted and short writes (iov is modified)
+extern int SIFS_pwritevfull(int fd, struct iovec* iov, int iovcnt, off_t offset);
+
+// Creates an I/O engine for fd with room for depth requests, using io_uring if useuring is true and it is available
+// Otherwise requests are performed synchronously with pread() and pwrite() as they are prepared
+extern SIFS_IOENGINE* SIFS_iocreate(int fd, uint32_t depth, bool useuring);
+// Waits for requests still in flight and frees the engine
+extern void SIFS_iodestroy(SIFS_IOENGINE* engine);
+// Returns true if the engine submits its requests through io_uring
+extern bool SIFS_iouring(SIFS_IOENGINE* engine);
+// Returns the number of requests that can be outstanding at once
+extern uint32_t SIFS_iodepth(SIFS_IOENGINE* engine);
+// Prepares a read into, or write from, iovcnt buffers at offset, returns SIFS_FAILURE if completions must be reaped first
+// The buffers and iov itself must stay valid until the request's completion is reaped
+extern int SIFS_ioprep(SIFS_IOENGINE* engine, bool write, const struct iovec* iov, int iovcnt, off_t offset, uint64_t tag);
+// Hands every prepared request to the kernel in one system call
+extern int SIFS_iosubmit(SIFS_IOENGINE* engine);
+// Submits prepared requests and collects between min and max completions, returns the number collected
+extern uint32_t SIFS_ioreap(SIFS_IOENGINE* engine, SIFS_IOCOMPLETION* completions, uint32_t max, uint32_t min);
+
+// Returns the first entry of bitmap from from onwards that is of type, or nblocks if there is none
+extern SIFS_BLOCKID SIFS_bitmapfind(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type);
+// Returns the first entry of bitmap from from onwards that is not of type, or nblocks if there is none
+extern SIFS_BLOCKID SIFS_bitmapskip(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type);
+// Returns the number of entries of bitmap from from to nblocks that are of type
+extern SIFS_BLOCKID SIFS_bitmapcount(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BIT type);
+// Returns the start of the first run of length unused entries from from onwards, or nblocks if there is none
+extern SIFS_BLOCKID SIFS_bitmapfindrun(const SIFS_BIT* bitmap, SIFS_BLOCKID from, SIFS_BLOCKID nblocks, SIFS_BLOCKID length);
+
+// Stores entries first to first + nblocks of bitmap (first a multiple of 4) with 2 bits each into (nblocks + 3) / 4 bytes
+extern void SIFS_bitmappack(const SIFS_BIT* bitmap, SIFS_BLOCKID first, SIFS_BLOCKID nblocks, unsigned char* packed);
+// Expands nblocks entries stored with 2 bits each in packed into one SIFS_BIT per block
+extern void SIFS_bitmapunpack(const unsigned char* packed, SIFS_BLOCKID nblocks, SIFS_BIT* bitmap);
+// Returns the number of bytes holding the bitmap of nblocks blocks in the given layout
+extern size_t SIFS_bitmapbytes(SIFS_BLOCKID nblocks, bool packed);
+
+// Builds an index of the free runs of blocks in bitmap, returns NULL if out of memory
+extern SIFS_EXTENTS* SIFS_extentscreate(const SIFS_BIT* bitmap, SIFS_BLOCKID nblocks);
+extern void SIFS_extentsdestroy(SIFS_EXTENTS* extents);
+// Removes nblocks from the start of the lowest run at least that long, returns its first block or SIFS_ROOTDIR_BLOCKID
+extern SIFS_BLOCKID SIFS_extentstake(SIFS_EXTENTS* extents, SIFS_BLOCKID nblocks);
+// Returns the lowest block from from onwards that starts nblocks free blocks, or SIFS_ROOTDIR_BLOCKID if there is none
+extern SIFS_BLOCKID SIFS_extentsfind(SIFS_EXTENTS* extents, SIFS_BLOCKID from, SIFS_BLOCKID nblocks);
+// Removes blocks first to first + nblocks, returns false if any of them is not free or out of memory
+extern bool SIFS_extentstakeat(SIFS_EXTENTS* extents, SIFS_BLOCKID first, SIFS_BLOCKID nblocks);
+// Adds blocks first to first + nblocks, joining them with neighbouring runs, returns false if out of memory
+extern bool SIFS_extentsgive(SIFS_EXTENTS* extents, SIFS_BLOCKID first, SIFS_BLOCKID nblocks);
+// Returns the length of the longest run, 0 if there are none
+extern SIFS_BLOCKID SIFS_extentslongest(SIFS_EXTENTS* extents);
+// Reads the number of runs, and into histogram[i] the number of runs of 2^i to 2^(i+1) - 1 blocks
+extern void SIFS_extentshistogram(SIFS_EXTENTS* extents, uint32_t* nruns, uint32_t* histogram);
+
 // Reads the contents of the volume into data, returns SIFS_FAILURE on failure
-extern int SIFS_readvolumeptr(const char* volumename, void* data, size_t offset, size_t length);
+extern int SIFS_readvolumeptr(SIFS_VOLUME* volume, void* data, size_t offset, size_t length);
 // Returns pointer to volume contents or NULL if it does not exist.
 // Pointer should be freed when finished with
-extern void* SIFS_readvolume(const char* volumename, size_t offset, size_t length);
+extern void* SIFS_readvolume(SIFS_VOLUME* volume, size_t offset, size_t length);
 // Updates volume's contents
-extern int SIFS_updatevolume(const char* volumename, size_t offset, const void* data, size_t nbytes);
+extern int SIFS_updatevolume(SIFS_VOLUME* volume, size_t offset, const void* data, size_t nbytes);
 
-// Returns the header of the volume, returns SIFS_FAILURE on failure
-extern int SIFS_getvolumeheader(const char* volumename, SIFS_VOLUME_HEADER* header);
 // Returns a pointer to the beginning of the bitmap for the volume
-extern SIFS_BIT* SIFS_getvolumebitmap(const char* volumename);
+// The bitmap is owned by the volume and must not be freed
+extern SIFS_BIT* SIFS_getvolumebitmap(SIFS_VOLUME* volume);
+// Fills in the zones of a new extended header for a volume of nblocks blocks
+extern void SIFS_initzones(SIFS_VOLUME_EXTHEADER* exthdr, SIFS_BLOCKID nblocks);
+// Writes the extended header back into the volume if its allocation cursors have moved
+extern int SIFS_updateexthdr(SIFS_VOLUME* volume);
 // Calculates the number of blocks required to represent nbytes
 extern SIFS_BLOCKID SIFS_calcnblocks(SIFS_VOLUME_HEADER* header, size_t nbytes);
 
-// Rewrites the bitmap back into the volume
-extern void SIFS_updatevolumebitmap(const char* volumename, const SIFS_BIT* bitmap, size_t length);
+// Writes entries first to first + nblocks of the resident bitmap back into the volume
+extern void SIFS_updatevolumebitmap(SIFS_VOLUME* volume, SIFS_BLOCKID first, SIFS_BLOCKID nblocks);
+// Holds back writes of the resident bitmap so that many allocations are written at once
+extern void SIFS_beginbitmapbatch(SIFS_VOLUME* volume);
+// Writes the resident bitmap if it was modified since the matching SIFS_beginbitmapbatch()
+extern void SIFS_endbitmapbatch(SIFS_VOLUME* volume);
 // Rewrites a block back into the volume
-extern void SIFS_updateblock(const char* volumename, SIFS_BLOCKID blockId, const void* data, size_t length);
+extern void SIFS_updateblock(SIFS_VOLUME* volume, SIFS_BLOCKID blockId, const void* data, size_t length);
 
 // Returns a pointer to the beginning of block
-extern void* SIFS_getblock(const char* volumename, SIFS_BLOCKID blockIndex);
+// Every block returned by the functions below must be released with SIFS_releaseblock()
+extern void* SIFS_getblock(SIFS_VOLUME* volume, SIFS_BLOCKID blockIndex);
 // Returns a pointer to the beginning of a set of contiguous blocks
-extern void* SIFS_getblocks(const char* volumename, SIFS_BLOCKID first, SIFS_BLOCKID nblocks);
+extern void* SIFS_getblocks(SIFS_VOLUME* volume, SIFS_BLOCKID first, SIFS_BLOCKID nblocks);
+// Copies length bytes starting at the beginning of block first into data, including blocks not yet written back by the cache
+extern int SIFS_readblocks(SIFS_VOLUME* volume, SIFS_BLOCKID first, void* data, size_t length);
+// Copies length bytes starting offset bytes into the data of a file that starts at block firstblockID into data
+extern int SIFS_readfilebytes(SIFS_VOLUME* volume, SIFS_BLOCKID firstblockID, size_t offset, void* data, size_t length);
+// Same as SIFS_readfilebytes() for a file whose data is in the runs of extents, or in the chunks listed in them
+extern int SIFS_readextents(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents, size_t offset, void* data, size_t length);
+// Writes nbytes of data into the runs of extents, one after another
+extern void SIFS_writeextents(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents, const void* data, size_t nbytes);
+// Gets n independent blocks at once, reading the ones that are not cached together
+// Every block must be released with SIFS_releaseblock(), returns SIFS_FAILURE (with no blocks to release) on failure
+extern int SIFS_getblocksv(SIFS_VOLUME* volume, const SIFS_BLOCKID* blockIds, void** blocks, size_t n);
+// Releases a block returned by SIFS_getblock(), SIFS_getblocks() or any of the lookups below
+extern void SIFS_releaseblock(SIFS_VOLUME* volume, void* block);
 // Gets the root directory from volume
-extern SIFS_DIRBLOCK* SIFS_getrootdir(const char* volumename);
+extern SIFS_DIRBLOCK* SIFS_getrootdir(SIFS_VOLUME* volume);
 // Gets the directory from volume, use "" or NULL for root directory
-extern SIFS_DIRBLOCK* SIFS_getdir(const char* volumename, char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId);
+extern SIFS_DIRBLOCK* SIFS_getdir(SIFS_VOLUME* volume, char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId);
 // Recursively search directories
-extern SIFS_DIRBLOCK* SIFS_finddir(const char* volumename, SIFS_DIRBLOCK* dir, char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId);
+extern SIFS_DIRBLOCK* SIFS_finddir(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId, char** dirnames, size_t dircount, SIFS_BLOCKID* outBlockId);
 // Gets the frile from the volume
-extern SIFS_FILEBLOCK* SIFS_getfile(const char* volumename, char** path, size_t count, SIFS_BLOCKID* outFileIndex);
+extern SIFS_FILEBLOCK* SIFS_getfile(SIFS_VOLUME* volume, char** path, size_t count, SIFS_BLOCKID* outFileIndex);
 // Finds the type of a block
-extern SIFS_BIT SIFS_getblocktype(const char* volumename, SIFS_BLOCKID blockIndex);
+extern SIFS_BIT SIFS_getblocktype(SIFS_VOLUME* volume, SIFS_BLOCKID blockIndex);
+// Returns the index of the volume's free runs of blocks, building it when first needed, or NULL if out of memory
+extern SIFS_EXTENTS* SIFS_getfreeextents(SIFS_VOLUME* volume);
+// Counts the blocks of each type in use if they have not been counted yet
+extern int SIFS_countblocks(SIFS_VOLUME* volume);
 // Returns index to first block id, returns SIFS_ROOTDIR_BLOCKID on failure
-extern SIFS_BLOCKID SIFS_allocateblocks(const char* volumename, SIFS_BLOCKID nblocks, SIFS_BIT type);
+extern SIFS_BLOCKID SIFS_allocateblocks(SIFS_VOLUME* volume, SIFS_BLOCKID nblocks, SIFS_BIT type);
+// Allocates exactly the blocks first to first + nblocks, returns false if any of them is in use
+extern bool SIFS_allocateblocksat(SIFS_VOLUME* volume, SIFS_BLOCKID first, SIFS_BLOCKID nblocks, SIFS_BIT type);
 // Frees previously allocated blocks
-extern void SIFS_freeblocks(const char* volumename, SIFS_BLOCKID firstblock, SIFS_BLOCKID nblocks);
+extern void SIFS_freeblocks(SIFS_VOLUME* volume, SIFS_BLOCKID firstblock, SIFS_BLOCKID nblocks);
+// Allocates nblocks data blocks in one run, or with SIFS_FEATURE_EXTENTS in as few runs as possible if there is no such run
+extern int SIFS_allocateextents(SIFS_VOLUME* volume, SIFS_BLOCKID nblocks, SIFS_EXTENTLIST* extents);
+// Frees every run of extents, and drops the chunks listed in them if they hold a list of chunks
+extern void SIFS_freeextents(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents);
+// Finds the runs holding the data of a fileblock, a file stored in the original way has one run (none if it is empty)
+extern void SIFS_getextents(SIFS_VOLUME* volume, const SIFS_FILEBLOCK* fileblock, SIFS_EXTENTLIST* extents);
+// Records the runs holding the data of a fileblock, which must have been returned by SIFS_getblock()
+extern void SIFS_setextents(SIFS_VOLUME* volume, SIFS_FILEBLOCK* fileblock, const SIFS_EXTENTLIST* extents);
+
+// Returns the number of buckets of the index of a volume of nblocks blocks, enough to hold a fileblock for every other block
+extern uint32_t SIFS_hashbuckets(SIFS_BLOCKID nblocks);
+// Looks up the fileblock with the given md5 in the index, returns false if there is none
+extern bool SIFS_hashlookup(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID* outBlockId);
+// Adds a new fileblock to the index
+extern int SIFS_hashinsert(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID blockId);
+// Removes a fileblock that is being freed from the index
+extern int SIFS_hashremove(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID blockId);
+// Records that a fileblock was moved from blockId to newBlockId
+extern int SIFS_hashmove(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID blockId, SIFS_BLOCKID newBlockId);
+
+// Returns the first fileblock of the chain that the fileblock blockId is in, blockId itself if it is not in one
+extern SIFS_BLOCKID SIFS_chainhead(const SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId);
+// Returns the fileblock of the chain of block (found by md5 as blockId) with room for another name, adding one if all
+// are full, and updates blockId. block is released if another fileblock is returned, or NULL if the volume is full
+// The entry of dir (not yet written back) is updated if the last name of the first fileblock moves to make way for the link
+extern SIFS_FILEBLOCK* SIFS_namesblock(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId,
+    SIFS_FILEBLOCK* block, SIFS_BLOCKID* blockId);
+// Takes a fileblock that has no names left out of its chain, returns false if it is not in one and owns its data
+extern bool SIFS_leavechain(SIFS_VOLUME* volume, SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId);
+// Records in the chain of a fileblock that it moved from blockId to newBlockId
+extern void SIFS_movechain(SIFS_VOLUME* volume, SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId, SIFS_BLOCKID newBlockId);
+// Copies where the data of a fileblock is to the rest of its chain
+extern void SIFS_syncchain(SIFS_VOLUME* volume, const SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId);
+
+// Returns true if a new file of nbytes added to volume is split into chunks
+extern bool SIFS_ischunked(SIFS_VOLUME* volume, size_t nbytes);
+// Stores nbytes of data as chunks, sharing those already stored, and their list in runs recorded in extents
+extern int SIFS_writechunks(SIFS_VOLUME* volume, const void* data, size_t nbytes, SIFS_EXTENTLIST* extents);
+// Same as SIFS_readextents() for a file whose list of chunks is in the runs of extents
+extern int SIFS_readchunks(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents, size_t offset, void* data, size_t length);
+// Drops the chunks listed in the runs of extents, freeing those no other list includes
+extern void SIFS_dropchunks(SIFS_VOLUME* volume, const SIFS_EXTENTLIST* extents);
 
-// Returns true if the given directory has entryname as an entry (either file or directory)
-extern bool SIFS_hasentry(const char* volumename, SIFS_DIRBLOCK* directory, const char* entryname);
+// Digest of a file's contents with the hash of the volume it is added to, kept in the md5 field of its fileblock
+typedef struct
+{
+    uint32_t hashalg;
+    union
+    {
+        MD5_CTX md5;
+        XXH128_CTX xxh128;
+        BLAKE3_CTX blake3;
+    } ctx;
+} SIFS_DIGEST_CTX;
+
+// Starts an incremental digest with the hash of the volume
+extern void SIFS_digestinit(SIFS_VOLUME* volume, SIFS_DIGEST_CTX* ctx);
+// Adds nbytes of data to an incremental digest
+extern void SIFS_digestupdate(SIFS_DIGEST_CTX* ctx, const void* data, size_t nbytes);
+// Finishes an incremental digest, leaving MD5_BYTELEN bytes in digest
+extern void SIFS_digestfinal(SIFS_DIGEST_CTX* ctx, void* digest);
+// Calculates the digest of a buffer with the hash of the volume
+extern void SIFS_digestbuffer(SIFS_VOLUME* volume, const void* data, size_t nbytes, void* digest);
+// Calculates the digests of n buffers with the hash of the volume, leaving the one of inputs[i] in digests[i]
+extern void SIFS_digestbuffers(SIFS_VOLUME* volume, size_t n, const void* const inputs[], const size_t lens[], void* const digests[]);
+
+// Returns the names kept after the directory block dir, NULL if the volume does not keep them
+extern SIFS_DIRNAMES* SIFS_getdirnames(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir);
+// Returns the index of the entry of dir named name, -1 if there is none
+extern int SIFS_finddirname(const SIFS_DIRBLOCK* dir, const SIFS_DIRNAMES* names, const char* name);
+// Starts the empty names of a new directory block, if the volume keeps them
+extern void SIFS_initdirnames(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir);
+// Records the type and name of the entry just added to the end of dir
+extern void SIFS_adddirname(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BIT type, const char* name);
+// Removes the name of entry index of dir, before nentries is decremented
+extern void SIFS_removedirname(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, uint32_t index);
+// Copies the name of entry index into name, which must hold SIFS_MAX_NAME_LENGTH bytes
+extern void SIFS_copydirname(const SIFS_DIRNAMES* names, uint32_t index, char* name);
+
+// Returns the type of the cached entry name of the directory parentId and sets blockId (and fileindex for a file),
+// SIFS_UNUSED if it is not cached
+extern SIFS_BIT SIFS_dentrylookup(SIFS_VOLUME* volume, SIFS_BLOCKID parentId, const char* name, SIFS_BLOCKID* blockId, uint32_t* fileindex);
+// Caches an entry of the directory parentId that exists on the volume
+extern void SIFS_dentryinsert(SIFS_VOLUME* volume, SIFS_BLOCKID parentId, const char* name, SIFS_BIT type, SIFS_BLOCKID blockId, uint32_t fileindex);
+// Forgets every cached entry that references the block blockId or is in the directory blockId
+extern void SIFS_dentryforget(SIFS_VOLUME* volume, SIFS_BLOCKID blockId);
+// Forgets every cached entry, after blocks are moved
+extern void SIFS_dentryclear(SIFS_VOLUME* volume);
+
+// Sets found to whether the given directory has entryname as an entry (either file or directory)
+// Fails, setting SIFS_errno, if the blocks of the entries could not be read
+extern int SIFS_hasentry(SIFS_VOLUME* volume, SIFS_DIRBLOCK* directory, const char* entryname, bool* found);
 // Returns a pointer to a file block only if it already exists (ie. has the same md5)
-extern SIFS_FILEBLOCK* SIFS_getfileblock(const char* volumename, const void* md5, SIFS_BLOCKID* outBlockId);
+extern SIFS_FILEBLOCK* SIFS_getfileblock(SIFS_VOLUME* volume, const void* md5, SIFS_BLOCKID* outBlockId);
+// Finds the runs holding the data and the length of the file that pathname references
+extern int SIFS_getfiledata(SIFS_VOLUME* volume, const char* pathname, SIFS_EXTENTLIST* extents, size_t* length);
+// Gets the directory that a new file named by pathname would be added to, checking that the file can be added
+// The file's name is copied into filename, which must hold SIFS_MAX_NAME_LENGTH bytes
+extern SIFS_DIRBLOCK* SIFS_getparentdir(SIFS_VOLUME* volume, const char* pathname, char* filename, SIFS_BLOCKID* outBlockId);
+// Adds filename to the names of a fileblock and an entry for it to dir, then rewrites both blocks
+extern void SIFS_addfilename(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId, SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId, const char* filename);
+
+// Creates a cache holding capacity blocks of blocksize bytes, returns NULL if capacity is 0 or on failure
+extern SIFS_CACHE* SIFS_cachecreate(size_t blocksize, uint32_t capacity);
+// Frees a cache without writing back its dirty blocks (see SIFS_cacheflush())
+extern void SIFS_cachedestroy(SIFS_CACHE* cache);
+// Returns true if ptr is a block handed out by the cache
+extern bool SIFS_cacheowns(SIFS_CACHE* cache, const void* ptr);
+// Returns a pinned pointer to the cached copy of a block, reading it on a miss
+// Returns NULL if every cache entry is pinned or the read fails
+extern void* SIFS_cacheget(SIFS_VOLUME* volume, SIFS_BLOCKID blockId);
+// Returns a pinned pointer to the cached copy of a block, or NULL without reading it if it is not cached
+extern void* SIFS_cachelookup(SIFS_CACHE* cache, SIFS_BLOCKID blockId);
+// Unpins a block returned by SIFS_cacheget()
+extern void SIFS_cacherelease(SIFS_CACHE* cache, void* block);
+// Replaces the cached copy of a whole block and marks it dirty, returns false if the block could not be cached
+extern bool SIFS_cacheput(SIFS_VOLUME* volume, SIFS_BLOCKID blockId, const void* data);
+// Keeps the cache coherent with length bytes of data that start at block first and bypass the cache
+// fromcache copies dirty cached blocks into data, otherwise cached blocks are refreshed from data
+extern void SIFS_cacheoverlay(SIFS_CACHE* cache, SIFS_BLOCKID first, void* data, size_t length, bool fromcache);
+// Writes every dirty block back to the volume
+extern int SIFS_cacheflush(SIFS_VOLUME* volume);
+// Reads the hit and miss counters of the cache
+extern void SIFS_cachecounters(SIFS_CACHE* cache, uint64_t* hits, uint64_t* misses);
@@ -0,0 +1,55 @@
+#include "sifsutils.h"
+#include <string.h>
+
+// report how many blocks of an existing volume are free and used, and how the free blocks are split
+int SIFS_vstatvol(SIFS_VOLUME *volume, SIFS_STATVOL *stat)
+{
+    if (volume == NULL || stat == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    // The bitmap is only examined the first time, from then on the allocator keeps both up to date
+    if (SIFS_countblocks(volume) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in SIFS_getvolumebitmap()
+        return SIFS_FAILURE;
+    }
+    SIFS_EXTENTS* extents = SIFS_getfreeextents(volume);
+    if (extents == NULL)
+    {
+        SIFS_errno = SIFS_ENOMEM;
+        return SIFS_FAILURE;
+    }
+
+    memset(stat, 0, sizeof(SIFS_STATVOL));
+    stat->blocksize = volume->header.blocksize;
+    stat->nblocks = volume->header.nblocks;
+    stat->ndirblocks = volume->ndirblocks;
+    stat->nfileblocks = volume->nfileblocks;
+    stat->ndatablocks = volume->ndatablocks;
+    stat->nfree = stat->nblocks - stat->ndirblocks - stat->nfileblocks - stat->ndatablocks;
+    stat->largestfree = SIFS_extentslongest(extents);
+    SIFS_extentshistogram(extents, &stat->nfreeruns, stat->histogram);
+
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// report how the blocks of an existing volume are used, opening the volume only for the duration of the call
+int SIFS_statvol(const char *volumename, SIFS_STATVOL *stat)
+{
+    if (volumename == NULL || stat == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vstatvol(volume, stat);
+    return SIFS_closeafter(volume, result);
+}
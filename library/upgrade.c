@@ -0,0 +1,228 @@
+#define _DEFAULT_SOURCE
+
+#include "sifsutils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Helper function that moves the nblocks blocks at from to to, where the two ranges may overlap
+// Only volumes too small to hold the extended header and packed bitmap in place of their bitmap have
+// their blocks moved, so all of them are read at once
+static int move_blocks(int fd, off_t from, off_t to, size_t nbytes)
+{
+    char* blocks = (char*)malloc(nbytes);
+    if (blocks == NULL)
+    {
+        SIFS_errno = SIFS_ENOMEM;
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_preadfull(fd, blocks, nbytes, from);
+    if (result == SIFS_SUCCESS)
+    {
+        result = SIFS_pwritefull(fd, blocks, nbytes, to);
+    }
+    free(blocks);
+    return result;
+}
+
+// Helper function that adds every fileblock of a volume, just converted, to its empty index of fileblocks by md5
+static int index_fileblocks(const char* volumename)
+{
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        return SIFS_FAILURE;
+    }
+    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
+    int result = (bitmap != NULL) ? SIFS_SUCCESS : SIFS_FAILURE;
+    SIFS_BLOCKID nblocks = volume->header.nblocks;
+    for (SIFS_BLOCKID i = (bitmap != NULL) ? SIFS_bitmapfind(bitmap, 0, nblocks, SIFS_FILE) : nblocks;
+        i < nblocks && result == SIFS_SUCCESS; i = SIFS_bitmapfind(bitmap, i + 1, nblocks, SIFS_FILE))
+    {
+        SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, i);
+        if (fileblock == NULL)
+        {
+            result = SIFS_FAILURE;
+            break;
+        }
+        // Only the first fileblock of a chain is found by md5
+        if (SIFS_chainhead(fileblock, i) == i)
+        {
+            result = SIFS_hashinsert(volume, fileblock->md5, i);
+        }
+        SIFS_releaseblock(volume, fileblock);
+    }
+    return SIFS_closeafter(volume, result);
+}
+
+// Helper function that keeps the types and names of the entries of every directory of a packed volume in its block,
+// unless the volume already does
+static int name_directories(const char* volumename)
+{
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        return SIFS_FAILURE;
+    }
+    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
+    int result = (bitmap != NULL) ? SIFS_SUCCESS : SIFS_FAILURE;
+    SIFS_BLOCKID nblocks = volume->header.nblocks;
+    bool named = (volume->exthdr.features & SIFS_FEATURE_DIRNAMES) != 0;
+    for (SIFS_BLOCKID i = (bitmap != NULL && !named) ? SIFS_bitmapfind(bitmap, 0, nblocks, SIFS_DIR) : nblocks;
+        i < nblocks && result == SIFS_SUCCESS; i = SIFS_bitmapfind(bitmap, i + 1, nblocks, SIFS_DIR))
+    {
+        SIFS_DIRBLOCK* dir = (SIFS_DIRBLOCK*)SIFS_getblock(volume, i);
+        if (dir == NULL)
+        {
+            result = SIFS_FAILURE;
+            break;
+        }
+        SIFS_DIRNAMES names;
+        memset(&names, 0, sizeof(names));
+        names.magic = SIFS_DIRNAMES_MAGIC;
+        for (uint32_t j = 0; j < dir->nentries && result == SIFS_SUCCESS; j++)
+        {
+            void* block = SIFS_getblock(volume, dir->entries[j].blockID);
+            if (block == NULL)
+            {
+                result = SIFS_FAILURE;
+                break;
+            }
+            names.types[j] = bitmap[dir->entries[j].blockID];
+            const char* name = (names.types[j] == SIFS_DIR) ? ((SIFS_DIRBLOCK*)block)->name :
+                ((SIFS_FILEBLOCK*)block)->filenames[dir->entries[j].fileindex];
+            size_t length = strlen(name);
+            memcpy(names.names[j], name, (length < SIFS_MAX_NAME_LENGTH - 1) ? length : SIFS_MAX_NAME_LENGTH - 1);
+            SIFS_releaseblock(volume, block);
+        }
+        memcpy((char*)dir + sizeof(SIFS_DIRBLOCK), &names, sizeof(names));
+        if (result == SIFS_SUCCESS)
+        {
+            SIFS_updateblock(volume, i, dir, 0);
+        }
+        SIFS_releaseblock(volume, dir);
+    }
+    // The names are only looked for once every directory holds them
+    if (result == SIFS_SUCCESS && !named)
+    {
+        volume->exthdr.features |= SIFS_FEATURE_DIRNAMES;
+        volume->exthdrdirty = true;
+    }
+    return SIFS_closeafter(volume, result);
+}
+
+// convert a volume in the original layout to one with a packed bitmap
+int SIFS_upgradevolume(const char *volumename)
+{
+    if (volumename == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    int fd = open(volumename, O_RDWR);
+    if (fd < 0)
+    {
+        SIFS_errno = (errno == EISDIR) ? SIFS_ENOTVOL : SIFS_ENOVOL;
+        return SIFS_FAILURE;
+    }
+    // Only a volume that is already packed is accepted without the original layout's size
+    SIFS_VOLUME_HEADER header;
+    SIFS_VOLUME_EXTHEADER exthdr;
+    struct stat fStat;
+    if (fstat(fd, &fStat) != 0 || SIFS_preadfull(fd, &header, sizeof(header), 0) == SIFS_FAILURE)
+    {
+        close(fd);
+        SIFS_errno = SIFS_ENOTVOL;
+        return SIFS_FAILURE;
+    }
+    if (SIFS_preadfull(fd, &exthdr, sizeof(exthdr), sizeof(header)) == SIFS_SUCCESS &&
+        memcmp(exthdr.magic, SIFS_EXTHEADER_MAGIC, sizeof(SIFS_EXTHEADER_MAGIC)) == 0)
+    {
+        close(fd);
+        // A packed volume made before directories kept the names of their entries only gains them
+        if (exthdr.version != SIFS_FORMAT_PACKED || name_directories(volumename) == SIFS_FAILURE)
+        {
+            SIFS_errno = SIFS_ENOTVOL;
+            return SIFS_FAILURE;
+        }
+        SIFS_errno = SIFS_EOK;
+        return SIFS_SUCCESS;
+    }
+    size_t oldblockoffset = sizeof(header) + SIFS_bitmapbytes(header.nblocks, false);
+    size_t blockbytes = header.blocksize * header.nblocks;
+    if (header.blocksize < SIFS_MIN_BLOCKSIZE || fStat.st_size != oldblockoffset + blockbytes)
+    {
+        close(fd);
+        SIFS_errno = SIFS_ENOTVOL;
+        return SIFS_FAILURE;
+    }
+
+    SIFS_BIT* bitmap = (SIFS_BIT*)malloc(header.nblocks * sizeof(SIFS_BIT));
+    unsigned char* packed = (unsigned char*)malloc(SIFS_bitmapbytes(header.nblocks, true));
+    if (bitmap == NULL || packed == NULL)
+    {
+        free(bitmap);
+        free(packed);
+        close(fd);
+        SIFS_errno = SIFS_ENOMEM;
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_preadfull(fd, bitmap, header.nblocks * sizeof(SIFS_BIT), sizeof(header));
+    SIFS_bitmappack(bitmap, 0, header.nblocks, packed);
+
+    // The blocks stay where they are unless the extended header and packed bitmap do not fit before them
+    memset(&exthdr, 0, sizeof(exthdr));
+    memcpy(exthdr.magic, SIFS_EXTHEADER_MAGIC, sizeof(SIFS_EXTHEADER_MAGIC));
+    exthdr.version = SIFS_FORMAT_PACKED;
+    SIFS_initzones(&exthdr, header.nblocks);
+    exthdr.features |= SIFS_FEATURE_EXTENTS | SIFS_FEATURE_HASHINDEX;
+    exthdr.blockoffset = sizeof(header) + sizeof(exthdr) + SIFS_bitmapbytes(header.nblocks, true);
+    if (exthdr.blockoffset <= oldblockoffset)
+    {
+        exthdr.blockoffset = oldblockoffset;
+    }
+    else if (result == SIFS_SUCCESS)
+    {
+        result = move_blocks(fd, oldblockoffset, exthdr.blockoffset, blockbytes);
+    }
+    // The index of fileblocks by md5 is added after the last block, and filled in once the volume can be opened
+    exthdr.hashoffset = exthdr.blockoffset + blockbytes;
+    exthdr.nhashbuckets = SIFS_hashbuckets(header.nblocks);
+    if (result == SIFS_SUCCESS &&
+        ftruncate(fd, (off_t)(exthdr.hashoffset + (uint64_t)exthdr.nhashbuckets * SIFS_HASHBUCKET_BYTES)) != 0)
+    {
+        result = SIFS_FAILURE;
+    }
+    // A list of runs is only looked for after fileblocks of volumes with the feature, which must not hold stale bytes there
+    SIFS_EXTENTLIST noextents;
+    memset(&noextents, 0, sizeof(noextents));
+    for (SIFS_BLOCKID i = SIFS_bitmapfind(bitmap, 0, header.nblocks, SIFS_FILE); i < header.nblocks && result == SIFS_SUCCESS;
+        i = SIFS_bitmapfind(bitmap, i + 1, header.nblocks, SIFS_FILE))
+    {
+        off_t offset = (off_t)(exthdr.blockoffset + (size_t)i * header.blocksize + sizeof(SIFS_FILEBLOCK));
+        result = SIFS_pwritefull(fd, &noextents, sizeof(noextents), offset);
+    }
+    // The volume is not usable in either layout if this is interrupted
+    if (result == SIFS_SUCCESS)
+    {
+        struct iovec iov[2];
+        iov[0].iov_base = &exthdr;
+        iov[0].iov_len = sizeof(exthdr);
+        iov[1].iov_base = packed;
+        iov[1].iov_len = SIFS_bitmapbytes(header.nblocks, true);
+        result = SIFS_pwritevfull(fd, iov, 2, sizeof(header));
+    }
+    free(bitmap);
+    free(packed);
+    if (close(fd) != 0 || result == SIFS_FAILURE || index_fileblocks(volumename) == SIFS_FAILURE ||
+        name_directories(volumename) == SIFS_FAILURE)
+    {
+        SIFS_errno = SIFS_ENOTVOL;
+        return SIFS_FAILURE;
+    }
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
@@ -0,0 +1,310 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "sifsutils.h"
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+// open an existing volume
+SIFS_VOLUME* SIFS_open(const char *volumename)
+{
+    return SIFS_openvolume(volumename, 0);
+}
+
+// open an existing volume, choosing how it is accessed with flags
+SIFS_VOLUME* SIFS_openvolume(const char *volumename, int flags)
+{
+    if (volumename == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return NULL;
+    }
+
+    // Open for reading and writing so that the handle can be used by every operation,
+    // fall back to reading only if the volume is not writable
+    bool writable = true;
+    int fd = open(volumename, O_RDWR);
+    if (fd < 0 && (errno == EACCES || errno == EROFS))
+    {
+        writable = false;
+        fd = open(volumename, O_RDONLY);
+    }
+    if (fd < 0)
+    {
+        SIFS_errno = (errno == EISDIR) ? SIFS_ENOTVOL : SIFS_ENOVOL;
+        return NULL;
+    }
+    // Read the size of the volume
+    struct stat fStat;
+    if (fstat(fd, &fStat) != 0 || !S_ISREG(fStat.st_mode))
+    {
+        close(fd);
+        SIFS_errno = SIFS_ENOTVOL;
+        return NULL;
+    }
+    SIFS_VOLUME* volume = (SIFS_VOLUME*)malloc(sizeof(SIFS_VOLUME));
+    if (volume == NULL)
+    {
+        close(fd);
+        SIFS_errno = SIFS_ENOMEM;
+        return NULL;
+    }
+    volume->fd = fd;
+    volume->writable = writable;
+    // Read the header of the volume (offset 0), it stays resident for the lifetime of the handle
+    if (fStat.st_size < sizeof(SIFS_VOLUME_HEADER) ||
+        SIFS_preadfull(fd, &volume->header, sizeof(SIFS_VOLUME_HEADER), 0) == SIFS_FAILURE)
+    {
+        close(fd);
+        free(volume);
+        SIFS_errno = SIFS_ENOTVOL;
+        return NULL;
+    }
+    volume->bitmapoffset = sizeof(SIFS_VOLUME_HEADER);
+    volume->blockoffset = volume->bitmapoffset + sizeof(SIFS_BIT) * volume->header.nblocks;
+    volume->packed = false;
+    memset(&volume->exthdr, 0, sizeof(SIFS_VOLUME_EXTHEADER));
+    volume->exthdrdirty = false;
+    // The bitmap of a volume in the original layout starts with the root directory's entry, never the magic
+    SIFS_VOLUME_EXTHEADER exthdr;
+    if (fStat.st_size >= sizeof(SIFS_VOLUME_HEADER) + sizeof(SIFS_VOLUME_EXTHEADER) &&
+        SIFS_preadfull(fd, &exthdr, sizeof(SIFS_VOLUME_EXTHEADER), sizeof(SIFS_VOLUME_HEADER)) == SIFS_SUCCESS &&
+        memcmp(exthdr.magic, SIFS_EXTHEADER_MAGIC, sizeof(SIFS_EXTHEADER_MAGIC)) == 0)
+    {
+        volume->exthdr = exthdr;
+        volume->packed = true;
+        volume->bitmapoffset = sizeof(SIFS_VOLUME_HEADER) + sizeof(SIFS_VOLUME_EXTHEADER);
+        volume->blockoffset = volume->exthdr.blockoffset;
+        // Refuse revisions of the layout, features and hashes this library does not know, and blocks that overlap the bitmap
+        if (volume->exthdr.version != SIFS_FORMAT_PACKED || (volume->exthdr.features & ~SIFS_FEATURES_KNOWN) ||
+            volume->exthdr.hashalg > SIFS_HASH_BLAKE3 ||
+            volume->blockoffset < volume->bitmapoffset + SIFS_bitmapbytes(volume->header.nblocks, true))
+        {
+            close(fd);
+            free(volume);
+            SIFS_errno = SIFS_ENOTVOL;
+            return NULL;
+        }
+    }
+    volume->bitmap = NULL;
+    volume->bitmapdeferred = 0;
+    volume->dirtyfirst = 0;
+    volume->dirtyend = 0;
+    volume->freeextents = NULL;
+    volume->counted = false;
+    volume->map = NULL;
+    volume->maplength = 0;
+    volume->cache = NULL;
+    volume->io = NULL;
+    volume->dentries = NULL;
+    volume->writers = NULL;
+
+    // Validate whether this file represents a volume by checking that its size is what the header says it should be
+    // A file that does not represent a volume could potentially pass this test, very unlikely
+    size_t expectedLength = volume->blockoffset + volume->header.blocksize * volume->header.nblocks;
+    bool validindex = true;
+    if (volume->exthdr.features & SIFS_FEATURE_HASHINDEX)
+    {
+        // The index of fileblocks by md5 follows the last block
+        validindex = volume->exthdr.hashoffset == expectedLength && volume->exthdr.nhashbuckets > 0;
+        expectedLength += (size_t)volume->exthdr.nhashbuckets * SIFS_HASHBUCKET_BYTES;
+    }
+    if (volume->header.blocksize < SIFS_MIN_BLOCKSIZE || !validindex || fStat.st_size != expectedLength)
+    {
+        close(fd);
+        free(volume);
+        SIFS_errno = SIFS_ENOTVOL;
+        return NULL;
+    }
+
+    if (flags & SIFS_OPEN_MMAP)
+    {
+        // Map the whole volume, a volume that cannot be written is mapped privately so that
+        // in-place modifications never reach the file (SIFS_updatevolume() still refuses them)
+        int prot = PROT_READ | PROT_WRITE;
+        int share = volume->writable ? MAP_SHARED : MAP_PRIVATE;
+        void* map = mmap(NULL, expectedLength, prot, share, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            free(volume);
+            SIFS_errno = SIFS_ENOMEM;
+            return NULL;
+        }
+        volume->map = (char*)map;
+        volume->maplength = expectedLength;
+        if (!volume->packed)
+        {
+            volume->bitmap = (SIFS_BIT*)(volume->map + volume->bitmapoffset);
+        }
+    }
+    else
+    {
+        // Failing to create the cache is not fatal, blocks are then always read from the volume
+        volume->cache = SIFS_cachecreate(volume->header.blocksize, SIFS_DEFAULT_CACHEBLOCKS);
+        // The same goes for the I/O engine, which falls back to pread() if io_uring is unavailable
+        volume->io = SIFS_iocreate(fd, SIFS_IODEPTH, (flags & SIFS_OPEN_URING) != 0);
+    }
+    return volume;
+}
+
+// change the number of blocks cached by an open volume, 0 disables the cache
+int SIFS_setcachesize(SIFS_VOLUME *volume, uint32_t nblocks)
+{
+    if (volume == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    // Mapped volumes are never cached
+    if (volume->map != NULL)
+    {
+        SIFS_errno = SIFS_EOK;
+        return SIFS_SUCCESS;
+    }
+    SIFS_CACHE* cache = NULL;
+    if (nblocks > 0)
+    {
+        cache = SIFS_cachecreate(volume->header.blocksize, nblocks);
+        if (cache == NULL)
+        {
+            SIFS_errno = SIFS_ENOMEM;
+            return SIFS_FAILURE;
+        }
+    }
+    // Write back everything held by the old cache before replacing it, keeping it if that fails
+    if (volume->cache != NULL)
+    {
+        if (SIFS_cacheflush(volume) == SIFS_FAILURE)
+        {
+            SIFS_cachedestroy(cache);
+            SIFS_errno = volume->writable ? SIFS_EIO : SIFS_EROFS;
+            return SIFS_FAILURE;
+        }
+        SIFS_cachedestroy(volume->cache);
+    }
+    volume->cache = cache;
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// report the hit and miss counters of an open volume's cache
+int SIFS_cachestats(SIFS_VOLUME *volume, uint64_t *hits, uint64_t *misses)
+{
+    if (volume == NULL || hits == NULL || misses == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    *hits = 0;
+    *misses = 0;
+    if (volume->cache != NULL)
+    {
+        SIFS_cachecounters(volume->cache, hits, misses);
+    }
+    return SIFS_SUCCESS;
+}
+
+// write every modification held by the handle into the volume's file
+static int flush_volume(SIFS_VOLUME* volume)
+{
+    // The allocation cursors are only hints, they are written with everything else rather than as they move
+    int result = SIFS_updateexthdr(volume);
+    if (volume->cache != NULL && SIFS_cacheflush(volume) == SIFS_FAILURE)
+    {
+        result = SIFS_FAILURE;
+    }
+    if (result == SIFS_FAILURE)
+    {
+        // Nothing reaches a read-only volume, only modifications can fail to
+        SIFS_errno = volume->writable ? SIFS_EIO : SIFS_EROFS;
+    }
+    return result;
+}
+
+// flush all modifications made through the handle to disk
+int SIFS_sync(SIFS_VOLUME *volume)
+{
+    if (volume == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    int result = flush_volume(volume);
+    if (volume->writable)
+    {
+        bool synced = (volume->map != NULL) ? msync(volume->map, volume->maplength, MS_SYNC) == 0 : fdatasync(volume->fd) == 0;
+        if (!synced)
+        {
+            SIFS_errno = SIFS_EIO;
+            result = SIFS_FAILURE;
+        }
+    }
+    if (result == SIFS_SUCCESS)
+    {
+        SIFS_errno = SIFS_EOK;
+    }
+    return result;
+}
+
+// close a volume opened for a single call that returned result, keeping that call's SIFS_errno if it failed
+int SIFS_closeafter(SIFS_VOLUME* volume, int result)
+{
+    int error = SIFS_errno;
+    if (SIFS_close(volume) == SIFS_FAILURE && result == SIFS_SUCCESS)
+    {
+        // SIFS_errno set in SIFS_close()
+        return SIFS_FAILURE;
+    }
+    SIFS_errno = error;
+    return result;
+}
+
+// close a volume previously opened with SIFS_open()
+int SIFS_close(SIFS_VOLUME *volume)
+{
+    if (volume == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    // Files still being written are abandoned, nothing would ever own the blocks reserved for them
+    while (volume->writers != NULL)
+    {
+        SIFS_wabort(volume->writers);
+    }
+    // Like close(2), closing makes every modification visible to other users of the volume
+    // but does not wait for it to reach the disk, see SIFS_sync()
+    int result = flush_volume(volume);
+    SIFS_extentsdestroy(volume->freeextents);
+    SIFS_dentryclear(volume);
+    // Only the bitmap of a mapped volume in the original layout lives inside the mapping
+    if (volume->map == NULL || volume->packed)
+    {
+        free(volume->bitmap);
+    }
+    if (volume->map != NULL)
+    {
+        munmap(volume->map, volume->maplength);
+    }
+    else
+    {
+        SIFS_cachedestroy(volume->cache);
+        SIFS_iodestroy(volume->io);
+    }
+    if (close(volume->fd) != 0 && result == SIFS_SUCCESS)
+    {
+        SIFS_errno = SIFS_EIO;
+        result = SIFS_FAILURE;
+    }
+    free(volume);
+    if (result == SIFS_SUCCESS)
+    {
+        SIFS_errno = SIFS_EOK;
+    }
+    return result;
+}
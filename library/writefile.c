@@ -2,149 +2,183 @@
 #include <string.h>
 #include <stdio.h>
 
-// add a copy of a new file to an existing volume
-int SIFS_writefile(const char *volumename, const char *pathname,
-		   void *data, size_t nbytes)
+SIFS_DIRBLOCK* SIFS_getparentdir(SIFS_VOLUME* volume, const char* pathname, char* filename, SIFS_BLOCKID* outBlockId)
 {
-    if (volumename == NULL || pathname == NULL || data == NULL || strlen(pathname) == 0)
-    {
-        SIFS_errno = SIFS_EINVAL;
-        return SIFS_FAILURE;
-    }
-
     size_t count;
     char** result = strsplit(pathname, SIFS_DIR_DELIMITER, &count);
     if (result == NULL)
     {
         SIFS_errno = SIFS_ENOMEM;
-        return SIFS_FAILURE;
+        return NULL;
     }
     if (count == 0)
     {
         SIFS_errno = SIFS_EINVAL;
         freesplit(result);
-        return SIFS_FAILURE;
+        return NULL;
     }
 
-    char* filename = result[count - 1];
-    size_t filenameLength = strlen(filename);
+    size_t filenameLength = strlen(result[count - 1]);
     if (filenameLength == 0 || filenameLength >= SIFS_MAX_NAME_LENGTH)
     {
         freesplit(result);
         SIFS_errno = SIFS_EINVAL;
-        return SIFS_FAILURE;
+        return NULL;
     }
+    // Set the whole name to 0s so that it can be copied into a fileblock as is
+    memset(filename, 0, SIFS_MAX_NAME_LENGTH);
+    memcpy(filename, result[count - 1], filenameLength);
     // Find directory to place file in
-    SIFS_BLOCKID dirblockId;
-    SIFS_DIRBLOCK* dir = SIFS_getdir(volumename, result, count - 1, &dirblockId);
+    SIFS_DIRBLOCK* dir = SIFS_getdir(volume, result, count - 1, outBlockId);
+    freesplit(result);
     if (dir == NULL)
     {
-        freesplit(result);
-        return SIFS_FAILURE;
+        return NULL;
     }
     // Check if dir has enough entries to add a new file
     if (dir->nentries >= SIFS_MAX_ENTRIES)
     {
-        freesplit(result);
-        free(dir);
+        SIFS_releaseblock(volume, dir);
         SIFS_errno = SIFS_EMAXENTRY;
-        return SIFS_FAILURE;
+        return NULL;
     }
     // Check if the dir already has an entry with the same name (directory or file)
-    if (SIFS_hasentry(volumename, dir, filename))
+    bool found;
+    if (SIFS_hasentry(volume, dir, filename, &found) == SIFS_FAILURE)
     {
-        freesplit(result);
-        free(dir);
+        // SIFS_errno set in SIFS_hasentry()
+        SIFS_releaseblock(volume, dir);
+        return NULL;
+    }
+    if (found)
+    {
+        SIFS_releaseblock(volume, dir);
         SIFS_errno = SIFS_EEXIST;
+        return NULL;
+    }
+    return dir;
+}
+
+void SIFS_addfilename(SIFS_VOLUME* volume, SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId, SIFS_FILEBLOCK* block, SIFS_BLOCKID blockId, const char* filename)
+{
+    // Copy filename into correct spot, including its padding (the slot could hold the name of a previous file)
+    memcpy(block->filenames[block->nfiles++], filename, SIFS_MAX_NAME_LENGTH);
+    // Update the entries in the parent directory
+    dir->entries[dir->nentries].blockID = blockId;
+    dir->entries[dir->nentries++].fileindex = block->nfiles - 1;
+    SIFS_adddirname(volume, dir, SIFS_FILE, filename);
+    dir->modtime = time(NULL);
+    SIFS_dentryinsert(volume, dirblockId, filename, SIFS_FILE, blockId, block->nfiles - 1);
+
+    // Rewrite the parent directory to the volume
+    SIFS_updateblock(volume, dirblockId, dir, 0);
+    // Rewrite the fileblock to the volume
+    SIFS_updateblock(volume, blockId, block, 0);
+}
+
+// add a copy of a new file to an existing volume
+int SIFS_vwritefile(SIFS_VOLUME *volume, const char *pathname,
+		    void *data, size_t nbytes)
+{
+    if (volume == NULL || pathname == NULL || data == NULL || strlen(pathname) == 0)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    if (!volume->writable)
+    {
+        SIFS_errno = SIFS_EROFS;
+        return SIFS_FAILURE;
+    }
+
+    char filename[SIFS_MAX_NAME_LENGTH];
+    SIFS_BLOCKID dirblockId;
+    SIFS_DIRBLOCK* dir = SIFS_getparentdir(volume, pathname, filename, &dirblockId);
+    if (dir == NULL)
+    {
+        // SIFS_errno set in SIFS_getparentdir()
         return SIFS_FAILURE;
     }
     
-    // Calculate the md5 for the given data
+    // Calculate the md5 (or other hash the volume uses) for the given data
     unsigned char md5[MD5_BYTELEN];
-    MD5_buffer(data, nbytes, md5);
+    SIFS_digestbuffer(volume, data, nbytes, md5);
     // Try to find a file block with the same md5 (only storing the contents of file once)
     SIFS_BLOCKID blockId;
-    SIFS_FILEBLOCK* block = SIFS_getfileblock(volumename, md5, &blockId);
+    SIFS_FILEBLOCK* block = SIFS_getfileblock(volume, md5, &blockId);
     if (block != NULL)
     {
-        // Found a fileblock with the same md5, ensure that it has enough remaining filenames to create a new one
-        if (block->nfiles >= SIFS_MAX_ENTRIES)
+        // Found a fileblock with the same md5, find one of its chain with room for another name
+        block = SIFS_namesblock(volume, dir, dirblockId, block, &blockId);
+        if (block == NULL)
         {
-            freesplit(result);
-            free(dir);
-            free(block);
-            SIFS_errno = SIFS_EMAXENTRY;
+            // SIFS_errno set in SIFS_namesblock()
+            SIFS_releaseblock(volume, dir);
             return SIFS_FAILURE;
         }
     }
     else
     {
         // No fileblock with the same md5, create a new one
-        SIFS_VOLUME_HEADER header;
-        if (SIFS_getvolumeheader(volumename, &header) == SIFS_FAILURE)
-        {
-            // SIFS_errno set in SIFS_getvolumeheader()
-            freesplit(result);
-            free(dir);
-            free(block);
-            return SIFS_FAILURE;
-        }
-        SIFS_BLOCKID nblocks = SIFS_calcnblocks(&header, nbytes);
-        // Allocate a block to store the file metadata as well as enough blocks to fit the file's data
-        SIFS_BLOCKID fileblockId = SIFS_allocateblocks(volumename, 1, SIFS_FILE);
-        SIFS_BLOCKID datablockId = SIFS_allocateblocks(volumename, nblocks, SIFS_DATABLOCK);
+        SIFS_BLOCKID nblocks = SIFS_calcnblocks(&volume->header, nbytes);
+        // Allocate a block to store the file metadata as well as enough blocks to fit the file's data,
+        // or with chunks, store those not already on the volume and the list of them
+        SIFS_EXTENTLIST extents;
+        bool chunked = SIFS_ischunked(volume, nbytes);
+        SIFS_BLOCKID fileblockId = SIFS_allocateblocks(volume, 1, SIFS_FILE);
         // Check whether either allocation failed
-        if (fileblockId == SIFS_ROOTDIR_BLOCKID || datablockId == SIFS_ROOTDIR_BLOCKID)
+        if (fileblockId == SIFS_ROOTDIR_BLOCKID ||
+            (chunked ? SIFS_writechunks(volume, data, nbytes, &extents) : SIFS_allocateextents(volume, nblocks, &extents)) == SIFS_FAILURE)
         {
-            freesplit(result);
-            free(dir);
+            SIFS_releaseblock(volume, dir);
             SIFS_errno = SIFS_ENOSPC;
             if (fileblockId != SIFS_ROOTDIR_BLOCKID)
             {
-                SIFS_freeblocks(volumename, fileblockId, 1);
-            }
-            if (datablockId != SIFS_ROOTDIR_BLOCKID)
-            {
-                SIFS_freeblocks(volumename, datablockId, nblocks);
+                SIFS_freeblocks(volume, fileblockId, 1);
             }
             return SIFS_FAILURE;
         }
         // Setup fileblock metadata
-        SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volumename, fileblockId);
+        SIFS_FILEBLOCK* fileblock = (SIFS_FILEBLOCK*)SIFS_getblock(volume, fileblockId);
         fileblock->modtime = time(NULL);
         memcpy(fileblock->md5, md5, MD5_BYTELEN);
         fileblock->length = nbytes;
-        fileblock->firstblockID = datablockId;
+        SIFS_setextents(volume, fileblock, &extents);
+        // The block could still hold the names, and the link of a chain, of a previous fileblock
         fileblock->nfiles = 0;
+        memset(fileblock->filenames, 0, sizeof(fileblock->filenames));
         block = fileblock;
         blockId = fileblockId;
-        if (nblocks > 0)
+        // Write the data straight into the datablocks, there is no need to read them first
+        if (!chunked)
         {
-            // Get a pointer to the data to write to and copy data into them
-            void* dataPtr = SIFS_getblocks(volumename, datablockId, nblocks);
-            memcpy(dataPtr, data, nbytes);
-            // Write the datablocks back into the volume
-            SIFS_updateblock(volumename, datablockId, dataPtr, nbytes);
-            free(dataPtr);
+            SIFS_writeextents(volume, &extents, data, nbytes);
         }
+        SIFS_hashinsert(volume, md5, fileblockId);
     }
-    // Set the filename that we are about to write to to 0s (could be in the same place a data from a previous file and therefore not null terminated correctly)
-    // Copy filename into correct spot
-    memset(block->filenames[block->nfiles], 0, SIFS_MAX_NAME_LENGTH);
-    memcpy(block->filenames[block->nfiles++], filename, filenameLength);
-    // Update the entries in the parent directory
-    dir->entries[dir->nentries].blockID = blockId;
-    dir->entries[dir->nentries++].fileindex = block->nfiles - 1;
-    dir->modtime = time(NULL);
+    SIFS_addfilename(volume, dir, dirblockId, block, blockId, filename);
 
-    // Rewrite the parent directory to the volume
-    SIFS_updateblock(volumename, dirblockId, dir, 0);
-    // Rewrite the fileblock to the volume
-    SIFS_updateblock(volumename, blockId, block, 0);
-
-    freesplit(result);
-    free(dir);
-    free(block);
+    SIFS_releaseblock(volume, dir);
+    SIFS_releaseblock(volume, block);
     SIFS_errno = SIFS_EOK;
     return SIFS_SUCCESS;
 }
+
+// add a copy of a new file to an existing volume, opening the volume only for the duration of the call
+int SIFS_writefile(const char *volumename, const char *pathname,
+		   void *data, size_t nbytes)
+{
+    if (volumename == NULL || pathname == NULL || data == NULL || strlen(pathname) == 0)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = SIFS_open(volumename);
+    if (volume == NULL)
+    {
+        // SIFS_errno set in SIFS_open()
+        return SIFS_FAILURE;
+    }
+    int result = SIFS_vwritefile(volume, pathname, data, nbytes);
+    return SIFS_closeafter(volume, result);
+}
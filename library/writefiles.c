@@ -0,0 +1,385 @@
+#include "sifsutils.h"
+#include <string.h>
+#include <stdio.h>
+
+// What is known about one file of a batch before it is added
+typedef struct
+{
+    // Index of the file's request
+    size_t index;
+    // Pathname of the parent directory with empty components removed, "" for the root directory
+    char* parent;
+    char filename[SIFS_MAX_NAME_LENGTH];
+    unsigned char md5[MD5_BYTELEN];
+    // Fileblock already holding the file's contents, SIFS_ROOTDIR_BLOCKID if there is none yet
+    SIFS_BLOCKID fileblockId;
+} SIFS_BATCHFILE;
+
+static int compare_md5(const void* a, const void* b)
+{
+    const SIFS_BATCHFILE* x = *(const SIFS_BATCHFILE**)a;
+    const SIFS_BATCHFILE* y = *(const SIFS_BATCHFILE**)b;
+    return memcmp(x->md5, y->md5, MD5_BYTELEN);
+}
+
+static int compare_parent(const void* a, const void* b)
+{
+    const SIFS_BATCHFILE* x = *(const SIFS_BATCHFILE**)a;
+    const SIFS_BATCHFILE* y = *(const SIFS_BATCHFILE**)b;
+    int result = strcmp(x->parent, y->parent);
+    if (result == 0)
+    {
+        // Keep the order of the requests within a directory, the first of two files with the same name wins
+        result = (x->index > y->index) - (x->index < y->index);
+    }
+    return result;
+}
+
+// Helper function that calculates the md5 of every file, many files at once in the lanes of the
+// processor's vector registers, or one at a time if there is no memory to describe them all
+static void hash_files(SIFS_VOLUME* volume, const SIFS_WRITE_REQ* reqs, SIFS_BATCHFILE** files, size_t nfiles)
+{
+    const void** inputs = (const void**)malloc(sizeof(void*) * (nfiles > 0 ? nfiles : 1));
+    size_t* lens = (size_t*)malloc(sizeof(size_t) * (nfiles > 0 ? nfiles : 1));
+    void** md5s = (void**)malloc(sizeof(void*) * (nfiles > 0 ? nfiles : 1));
+    if (inputs == NULL || lens == NULL || md5s == NULL)
+    {
+        for (size_t i = 0; i < nfiles; i++)
+        {
+            const SIFS_WRITE_REQ* req = &reqs[files[i]->index];
+            SIFS_digestbuffer(volume, req->data, req->nbytes, files[i]->md5);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < nfiles; i++)
+        {
+            inputs[i] = reqs[files[i]->index].data;
+            lens[i] = reqs[files[i]->index].nbytes;
+            md5s[i] = files[i]->md5;
+        }
+        SIFS_digestbuffers(volume, nfiles, inputs, lens, md5s);
+    }
+    free(inputs);
+    free(lens);
+    free(md5s);
+}
+
+// Helper function that splits the pathname of a request into its parent directory and file name
+static int parse_pathname(const SIFS_WRITE_REQ* req, SIFS_BATCHFILE* file)
+{
+    if (req->pathname == NULL || req->data == NULL || strlen(req->pathname) == 0)
+    {
+        return SIFS_EINVAL;
+    }
+    size_t count;
+    char** result = strsplit(req->pathname, SIFS_DIR_DELIMITER, &count);
+    if (result == NULL)
+    {
+        return SIFS_ENOMEM;
+    }
+    size_t filenameLength = (count == 0) ? 0 : strlen(result[count - 1]);
+    if (filenameLength == 0 || filenameLength >= SIFS_MAX_NAME_LENGTH)
+    {
+        freesplit(result);
+        return SIFS_EINVAL;
+    }
+    memset(file->filename, 0, SIFS_MAX_NAME_LENGTH);
+    memcpy(file->filename, result[count - 1], filenameLength);
+
+    // Rebuild the parent's pathname so that every way of naming a directory groups together
+    file->parent = (char*)malloc(strlen(req->pathname) + 1);
+    if (file->parent == NULL)
+    {
+        freesplit(result);
+        return SIFS_ENOMEM;
+    }
+    file->parent[0] = '\0';
+    for (size_t i = 0; i < count - 1; i++)
+    {
+        // "." is an alias for the root directory at the start of a pathname
+        if (i == 0 && strcmp(result[i], ".") == 0)
+        {
+            continue;
+        }
+        if (file->parent[0] != '\0')
+        {
+            strcat(file->parent, "/");
+        }
+        strcat(file->parent, result[i]);
+    }
+    freesplit(result);
+    return SIFS_EOK;
+}
+
+// Helper function that finds, in one pass over the volume, the fileblocks already holding the contents of the files
+static void find_fileblocks(SIFS_VOLUME* volume, SIFS_BATCHFILE** bymd5, size_t nfiles)
+{
+    SIFS_BIT* bitmap = SIFS_getvolumebitmap(volume);
+    if (bitmap == NULL || nfiles == 0)
+    {
+        return;
+    }
+    if (volume->exthdr.features & SIFS_FEATURE_HASHINDEX)
+    {
+        // Each distinct md5 is looked up in the index instead
+        for (size_t i = 0; i < nfiles; i++)
+        {
+            if (i > 0 && compare_md5(&bymd5[i - 1], &bymd5[i]) == 0)
+            {
+                bymd5[i]->fileblockId = bymd5[i - 1]->fileblockId;
+                continue;
+            }
+            SIFS_BLOCKID blockId;
+            SIFS_FILEBLOCK* block = SIFS_getfileblock(volume, bymd5[i]->md5, &blockId);
+            if (block != NULL)
+            {
+                bymd5[i]->fileblockId = blockId;
+                SIFS_releaseblock(volume, block);
+            }
+        }
+        return;
+    }
+    SIFS_BLOCKID nblocks = volume->header.nblocks;
+    for (SIFS_BLOCKID i = SIFS_bitmapfind(bitmap, 0, nblocks, SIFS_FILE); i < nblocks; i = SIFS_bitmapfind(bitmap, i + 1, nblocks, SIFS_FILE))
+    {
+        SIFS_FILEBLOCK* block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, i);
+        if (block == NULL)
+        {
+            continue;
+        }
+        SIFS_BATCHFILE key;
+        SIFS_BATCHFILE* keyptr = &key;
+        memcpy(key.md5, block->md5, MD5_BYTELEN);
+        SIFS_releaseblock(volume, block);
+        SIFS_BATCHFILE** match = (SIFS_BATCHFILE**)bsearch(&keyptr, bymd5, nfiles, sizeof(SIFS_BATCHFILE*), compare_md5);
+        if (match == NULL)
+        {
+            continue;
+        }
+        // Like SIFS_getfileblock(), the first fileblock with the same md5 is used
+        while (match > bymd5 && compare_md5(match - 1, &keyptr) == 0)
+        {
+            match--;
+        }
+        for ( ; match < bymd5 + nfiles && compare_md5(match, &keyptr) == 0; match++)
+        {
+            if ((*match)->fileblockId == SIFS_ROOTDIR_BLOCKID)
+            {
+                (*match)->fileblockId = i;
+            }
+        }
+    }
+}
+
+// Helper function that records a new fileblock for every later file of the batch with the same contents
+static void share_fileblock(SIFS_BATCHFILE** bymd5, size_t nfiles, SIFS_BATCHFILE* file)
+{
+    SIFS_BATCHFILE** match = (SIFS_BATCHFILE**)bsearch(&file, bymd5, nfiles, sizeof(SIFS_BATCHFILE*), compare_md5);
+    while (match > bymd5 && compare_md5(match - 1, &file) == 0)
+    {
+        match--;
+    }
+    for ( ; match != NULL && match < bymd5 + nfiles && compare_md5(match, &file) == 0; match++)
+    {
+        (*match)->fileblockId = file->fileblockId;
+    }
+}
+
+// Helper function that adds one file of the batch to the already resolved parent directory dir
+static int add_file(SIFS_VOLUME* volume, const SIFS_WRITE_REQ* req, SIFS_BATCHFILE* file,
+    SIFS_DIRBLOCK* dir, SIFS_BLOCKID dirblockId, SIFS_BATCHFILE** bymd5, size_t nfiles)
+{
+    // Check if dir has enough entries to add a new file
+    if (dir->nentries >= SIFS_MAX_ENTRIES)
+    {
+        return SIFS_EMAXENTRY;
+    }
+    // Check if the dir already has an entry with the same name (directory or file)
+    bool found;
+    if (SIFS_hasentry(volume, dir, file->filename, &found) == SIFS_FAILURE)
+    {
+        return SIFS_errno;
+    }
+    if (found)
+    {
+        return SIFS_EEXIST;
+    }
+
+    SIFS_FILEBLOCK* block;
+    SIFS_BLOCKID blockId = file->fileblockId;
+    if (blockId != SIFS_ROOTDIR_BLOCKID)
+    {
+        // The contents are already stored, find a fileblock of their chain with room for another name
+        block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, blockId);
+        if (block == NULL)
+        {
+            return SIFS_errno;
+        }
+        block = SIFS_namesblock(volume, dir, dirblockId, block, &blockId);
+        if (block == NULL)
+        {
+            return SIFS_errno;
+        }
+    }
+    else
+    {
+        // Allocate a block to store the file metadata as well as enough blocks to fit the file's data,
+        // or with chunks, store those not already on the volume and the list of them
+        SIFS_BLOCKID nblocks = SIFS_calcnblocks(&volume->header, req->nbytes);
+        bool chunked = SIFS_ischunked(volume, req->nbytes);
+        SIFS_BLOCKID fileblockId = SIFS_allocateblocks(volume, 1, SIFS_FILE);
+        SIFS_EXTENTLIST extents;
+        if (fileblockId == SIFS_ROOTDIR_BLOCKID ||
+            (chunked ? SIFS_writechunks(volume, req->data, req->nbytes, &extents) : SIFS_allocateextents(volume, nblocks, &extents)) == SIFS_FAILURE)
+        {
+            if (fileblockId != SIFS_ROOTDIR_BLOCKID)
+            {
+                SIFS_freeblocks(volume, fileblockId, 1);
+            }
+            return SIFS_ENOSPC;
+        }
+        block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, fileblockId);
+        if (block == NULL)
+        {
+            SIFS_freeextents(volume, &extents);
+            return SIFS_errno;
+        }
+        block->modtime = time(NULL);
+        memcpy(block->md5, file->md5, MD5_BYTELEN);
+        block->length = req->nbytes;
+        SIFS_setextents(volume, block, &extents);
+        // The block could still hold the names, and the link of a chain, of a previous fileblock
+        block->nfiles = 0;
+        memset(block->filenames, 0, sizeof(block->filenames));
+        if (!chunked)
+        {
+            SIFS_writeextents(volume, &extents, req->data, req->nbytes);
+        }
+        SIFS_hashinsert(volume, file->md5, fileblockId);
+        // Later files of the batch with the same contents share this fileblock
+        file->fileblockId = fileblockId;
+        share_fileblock(bymd5, nfiles, file);
+        blockId = fileblockId;
+    }
+
+    // The directory is only written back once every file of its group has been added
+    memcpy(block->filenames[block->nfiles++], file->filename, SIFS_MAX_NAME_LENGTH);
+    dir->entries[dir->nentries].blockID = blockId;
+    dir->entries[dir->nentries++].fileindex = block->nfiles - 1;
+    SIFS_adddirname(volume, dir, SIFS_FILE, file->filename);
+    SIFS_dentryinsert(volume, dirblockId, file->filename, SIFS_FILE, blockId, block->nfiles - 1);
+    SIFS_updateblock(volume, blockId, block, 0);
+    SIFS_releaseblock(volume, block);
+    return SIFS_EOK;
+}
+
+// add copies of many new files to an existing volume
+int SIFS_writefiles(SIFS_VOLUME *volume, const SIFS_WRITE_REQ *reqs, size_t nreqs, int *errors)
+{
+    if (volume == NULL || (reqs == NULL && nreqs > 0))
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    if (!volume->writable)
+    {
+        SIFS_errno = SIFS_EROFS;
+        return SIFS_FAILURE;
+    }
+
+    SIFS_BATCHFILE* files = (SIFS_BATCHFILE*)calloc(nreqs > 0 ? nreqs : 1, sizeof(SIFS_BATCHFILE));
+    SIFS_BATCHFILE** bymd5 = (SIFS_BATCHFILE**)malloc(sizeof(SIFS_BATCHFILE*) * (nreqs > 0 ? nreqs : 1));
+    SIFS_BATCHFILE** byparent = (SIFS_BATCHFILE**)malloc(sizeof(SIFS_BATCHFILE*) * (nreqs > 0 ? nreqs : 1));
+    int* status = (int*)malloc(sizeof(int) * (nreqs > 0 ? nreqs : 1));
+    if (files == NULL || bymd5 == NULL || byparent == NULL || status == NULL)
+    {
+        free(files);
+        free(bymd5);
+        free(byparent);
+        free(status);
+        SIFS_errno = SIFS_ENOMEM;
+        return SIFS_FAILURE;
+    }
+
+    // Split every pathname up front
+    size_t nfiles = 0;
+    for (size_t i = 0; i < nreqs; i++)
+    {
+        SIFS_BATCHFILE* file = &files[i];
+        file->index = i;
+        file->fileblockId = SIFS_ROOTDIR_BLOCKID;
+        status[i] = parse_pathname(&reqs[i], file);
+        if (status[i] == SIFS_EOK)
+        {
+            bymd5[nfiles] = file;
+            byparent[nfiles++] = file;
+        }
+    }
+    hash_files(volume, reqs, bymd5, nfiles);
+    qsort(bymd5, nfiles, sizeof(SIFS_BATCHFILE*), compare_md5);
+    qsort(byparent, nfiles, sizeof(SIFS_BATCHFILE*), compare_parent);
+    find_fileblocks(volume, bymd5, nfiles);
+
+    // Every allocation of the batch reaches the volume's bitmap in one write
+    SIFS_beginbitmapbatch(volume);
+    for (size_t first = 0; first < nfiles; )
+    {
+        // Find the files that share a parent directory
+        size_t last = first + 1;
+        while (last < nfiles && strcmp(byparent[last]->parent, byparent[first]->parent) == 0)
+        {
+            last++;
+        }
+        size_t count;
+        char** result = strsplit(byparent[first]->parent, SIFS_DIR_DELIMITER, &count);
+        SIFS_BLOCKID dirblockId;
+        SIFS_DIRBLOCK* dir = (result == NULL) ? NULL : SIFS_getdir(volume, result, count, &dirblockId);
+        int error = (result == NULL) ? SIFS_ENOMEM : SIFS_errno;
+        if (result != NULL)
+        {
+            freesplit(result);
+        }
+
+        bool updated = false;
+        for (size_t i = first; i < last; i++)
+        {
+            SIFS_BATCHFILE* file = byparent[i];
+            status[file->index] = (dir == NULL) ? error : add_file(volume, &reqs[file->index], file, dir, dirblockId, bymd5, nfiles);
+            updated = updated || status[file->index] == SIFS_EOK;
+        }
+        if (updated)
+        {
+            dir->modtime = time(NULL);
+            SIFS_updateblock(volume, dirblockId, dir, 0);
+        }
+        if (dir != NULL)
+        {
+            SIFS_releaseblock(volume, dir);
+        }
+        first = last;
+    }
+    SIFS_endbitmapbatch(volume);
+
+    // Report the error of the first request that failed
+    int result = SIFS_SUCCESS;
+    SIFS_errno = SIFS_EOK;
+    for (size_t i = 0; i < nreqs; i++)
+    {
+        if (errors != NULL)
+        {
+            errors[i] = status[i];
+        }
+        if (status[i] != SIFS_EOK && result == SIFS_SUCCESS)
+        {
+            result = SIFS_FAILURE;
+            SIFS_errno = status[i];
+        }
+        free(files[i].parent);
+    }
+    free(files);
+    free(bymd5);
+    free(byparent);
+    free(status);
+    return result;
+}
@@ -0,0 +1,351 @@
+#include "sifsutils.h"
+#include <string.h>
+#include <stdio.h>
+
+// Largest number of blocks copied at once when a writer's data has to be moved
+#define SIFS_WRITER_COPYBLOCKS  64
+
+// A file being added to a volume in pieces, see SIFS_wopen()
+struct SIFS_WRITER
+{
+    SIFS_VOLUME* volume;
+    // Copy of the pathname the file will be added as
+    char* pathname;
+    // Digest of every byte written so far
+    SIFS_DIGEST_CTX md5;
+    // Number of bytes written so far, every whole block among them has already reached the volume
+    size_t length;
+    // Contiguous data blocks reserved for the file, the file's data always starts at firstblockID
+    SIFS_BLOCKID firstblockID;
+    SIFS_BLOCKID nreserved;
+    // The last, partially filled block of the file (length % blocksize bytes)
+    char* buffer;
+    // Neighbours in the list of the volume's open writers
+    SIFS_WRITER* prev;
+    SIFS_WRITER* next;
+};
+
+// Helper function that removes writer from its volume's list of open writers and frees it
+static void free_writer(SIFS_WRITER* writer)
+{
+    if (writer->prev != NULL)
+    {
+        writer->prev->next = writer->next;
+    }
+    else
+    {
+        writer->volume->writers = writer->next;
+    }
+    if (writer->next != NULL)
+    {
+        writer->next->prev = writer->prev;
+    }
+    free(writer->pathname);
+    free(writer->buffer);
+    free(writer);
+}
+
+// Helper function that moves the blocks already written by writer to a new run of nblocks blocks
+static bool reserve_elsewhere(SIFS_WRITER* writer, SIFS_BLOCKID nblocks)
+{
+    SIFS_VOLUME* volume = writer->volume;
+    SIFS_BLOCKID blockId = SIFS_allocateblocks(volume, nblocks, SIFS_DATABLOCK);
+    if (blockId == SIFS_ROOTDIR_BLOCKID)
+    {
+        return false;
+    }
+    // Only whole blocks have been written, the partial block is still in the writer's buffer
+    SIFS_BLOCKID nwritten = writer->length / volume->header.blocksize;
+    if (nwritten > 0)
+    {
+        SIFS_BLOCKID chunk = (nwritten < SIFS_WRITER_COPYBLOCKS) ? nwritten : SIFS_WRITER_COPYBLOCKS;
+        char* copy = (char*)malloc(chunk * volume->header.blocksize);
+        if (copy == NULL)
+        {
+            SIFS_freeblocks(volume, blockId, nblocks);
+            return false;
+        }
+        for (SIFS_BLOCKID i = 0; i < nwritten; i += chunk)
+        {
+            SIFS_BLOCKID n = (nwritten - i < chunk) ? nwritten - i : chunk;
+            SIFS_readblocks(volume, writer->firstblockID + i, copy, n * volume->header.blocksize);
+            SIFS_updateblock(volume, blockId + i, copy, n * volume->header.blocksize);
+        }
+        free(copy);
+    }
+    if (writer->nreserved > 0)
+    {
+        SIFS_freeblocks(volume, writer->firstblockID, writer->nreserved);
+    }
+    writer->firstblockID = blockId;
+    writer->nreserved = nblocks;
+    return true;
+}
+
+// Helper function that makes sure enough contiguous blocks are reserved for writer to hold nbytes
+static int reserve(SIFS_WRITER* writer, size_t nbytes)
+{
+    if (nbytes / writer->volume->header.blocksize >= writer->volume->header.nblocks)
+    {
+        SIFS_errno = SIFS_ENOSPC;
+        return SIFS_FAILURE;
+    }
+    SIFS_BLOCKID nblocks = SIFS_calcnblocks(&writer->volume->header, nbytes);
+    if (nblocks <= writer->nreserved)
+    {
+        return SIFS_SUCCESS;
+    }
+    // Grow geometrically so that a file written without a size hint is only moved a few times
+    SIFS_BLOCKID wanted = nblocks;
+    if (writer->nreserved <= writer->volume->header.nblocks / 2 && 2 * writer->nreserved > wanted)
+    {
+        wanted = 2 * writer->nreserved;
+    }
+    SIFS_BLOCKID end = writer->firstblockID + writer->nreserved;
+    if (writer->nreserved > 0)
+    {
+        // Extending the current run in place avoids moving what was already written
+        if (SIFS_allocateblocksat(writer->volume, end, wanted - writer->nreserved, SIFS_DATABLOCK))
+        {
+            writer->nreserved = wanted;
+            return SIFS_SUCCESS;
+        }
+        if (wanted > nblocks && SIFS_allocateblocksat(writer->volume, end, nblocks - writer->nreserved, SIFS_DATABLOCK))
+        {
+            writer->nreserved = nblocks;
+            return SIFS_SUCCESS;
+        }
+    }
+    if (reserve_elsewhere(writer, wanted) || (wanted > nblocks && reserve_elsewhere(writer, nblocks)))
+    {
+        return SIFS_SUCCESS;
+    }
+    SIFS_errno = SIFS_ENOSPC;
+    return SIFS_FAILURE;
+}
+
+// start adding a new file to an existing volume, its contents are supplied with SIFS_wwrite()
+SIFS_WRITER* SIFS_wopen(SIFS_VOLUME *volume, const char *pathname, size_t sizehint)
+{
+    if (volume == NULL || pathname == NULL || strlen(pathname) == 0)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return NULL;
+    }
+    if (!volume->writable)
+    {
+        SIFS_errno = SIFS_EROFS;
+        return NULL;
+    }
+    // Fail early if the file could never be added, SIFS_wcommit() checks again
+    char filename[SIFS_MAX_NAME_LENGTH];
+    SIFS_DIRBLOCK* dir = SIFS_getparentdir(volume, pathname, filename, NULL);
+    if (dir == NULL)
+    {
+        // SIFS_errno set in SIFS_getparentdir()
+        return NULL;
+    }
+    SIFS_releaseblock(volume, dir);
+
+    SIFS_WRITER* writer = (SIFS_WRITER*)malloc(sizeof(SIFS_WRITER));
+    if (writer == NULL)
+    {
+        SIFS_errno = SIFS_ENOMEM;
+        return NULL;
+    }
+    writer->volume = volume;
+    writer->pathname = (char*)malloc(strlen(pathname) + 1);
+    writer->buffer = (char*)malloc(volume->header.blocksize);
+    if (writer->pathname == NULL || writer->buffer == NULL)
+    {
+        free(writer->pathname);
+        free(writer->buffer);
+        free(writer);
+        SIFS_errno = SIFS_ENOMEM;
+        return NULL;
+    }
+    strcpy(writer->pathname, pathname);
+    SIFS_digestinit(volume, &writer->md5);
+    writer->length = 0;
+    writer->firstblockID = SIFS_ROOTDIR_BLOCKID;
+    writer->nreserved = 0;
+    writer->prev = NULL;
+    writer->next = volume->writers;
+    if (volume->writers != NULL)
+    {
+        volume->writers->prev = writer;
+    }
+    volume->writers = writer;
+
+    // Reserve the expected size up front so that the data never has to be moved
+    if (reserve(writer, sizehint) == SIFS_FAILURE)
+    {
+        SIFS_wabort(writer);
+        SIFS_errno = SIFS_ENOSPC;
+        return NULL;
+    }
+    SIFS_errno = SIFS_EOK;
+    return writer;
+}
+
+// append nbytes of data to a file started with SIFS_wopen()
+int SIFS_wwrite(SIFS_WRITER *writer, const void *data, size_t nbytes)
+{
+    if (writer == NULL || (data == NULL && nbytes > 0))
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    if (nbytes == 0)
+    {
+        SIFS_errno = SIFS_EOK;
+        return SIFS_SUCCESS;
+    }
+    SIFS_VOLUME* volume = writer->volume;
+    size_t blocksize = volume->header.blocksize;
+    if (reserve(writer, writer->length + nbytes) == SIFS_FAILURE)
+    {
+        // SIFS_errno set in reserve()
+        return SIFS_FAILURE;
+    }
+    SIFS_digestupdate(&writer->md5, data, nbytes);
+
+    const char* ptr = (const char*)data;
+    // Top up the partially filled last block first
+    size_t used = writer->length % blocksize;
+    if (used > 0)
+    {
+        size_t n = (nbytes < blocksize - used) ? nbytes : blocksize - used;
+        memcpy(writer->buffer + used, ptr, n);
+        writer->length += n;
+        ptr += n;
+        nbytes -= n;
+        if (used + n < blocksize)
+        {
+            SIFS_errno = SIFS_EOK;
+            return SIFS_SUCCESS;
+        }
+        SIFS_updateblock(volume, writer->firstblockID + writer->length / blocksize - 1, writer->buffer, blocksize);
+    }
+    // Whole blocks are written straight from the caller's data
+    size_t whole = nbytes - nbytes % blocksize;
+    if (whole > 0)
+    {
+        SIFS_updateblock(volume, writer->firstblockID + writer->length / blocksize, ptr, whole);
+        writer->length += whole;
+        ptr += whole;
+        nbytes -= whole;
+    }
+    // Keep what is left until the block is filled or the file committed
+    memcpy(writer->buffer, ptr, nbytes);
+    writer->length += nbytes;
+
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// finish adding a file started with SIFS_wopen(), the writer is freed whether or not this succeeds
+int SIFS_wcommit(SIFS_WRITER *writer)
+{
+    if (writer == NULL)
+    {
+        SIFS_errno = SIFS_EINVAL;
+        return SIFS_FAILURE;
+    }
+    SIFS_VOLUME* volume = writer->volume;
+
+    char filename[SIFS_MAX_NAME_LENGTH];
+    SIFS_BLOCKID dirblockId;
+    SIFS_DIRBLOCK* dir = SIFS_getparentdir(volume, writer->pathname, filename, &dirblockId);
+    if (dir == NULL)
+    {
+        // SIFS_errno set in SIFS_getparentdir()
+        int error = SIFS_errno;
+        SIFS_wabort(writer);
+        SIFS_errno = error;
+        return SIFS_FAILURE;
+    }
+
+    unsigned char md5[MD5_BYTELEN];
+    SIFS_digestfinal(&writer->md5, md5);
+    SIFS_BLOCKID nblocks = SIFS_calcnblocks(&volume->header, writer->length);
+    // Try to find a file block with the same md5 (only storing the contents of file once)
+    SIFS_BLOCKID blockId;
+    SIFS_FILEBLOCK* block = SIFS_getfileblock(volume, md5, &blockId);
+    if (block != NULL)
+    {
+        // Found a fileblock with the same md5, find one of its chain with room for another name
+        block = SIFS_namesblock(volume, dir, dirblockId, block, &blockId);
+        if (block == NULL)
+        {
+            // SIFS_errno set in SIFS_namesblock()
+            int error = SIFS_errno;
+            SIFS_releaseblock(volume, dir);
+            SIFS_wabort(writer);
+            SIFS_errno = error;
+            return SIFS_FAILURE;
+        }
+        // The contents are already stored, discard the blocks written speculatively
+        if (writer->nreserved > 0)
+        {
+            SIFS_freeblocks(volume, writer->firstblockID, writer->nreserved);
+        }
+    }
+    else
+    {
+        SIFS_BLOCKID fileblockId = SIFS_allocateblocks(volume, 1, SIFS_FILE);
+        if (fileblockId == SIFS_ROOTDIR_BLOCKID)
+        {
+            SIFS_releaseblock(volume, dir);
+            SIFS_wabort(writer);
+            SIFS_errno = SIFS_ENOSPC;
+            return SIFS_FAILURE;
+        }
+        // Write the partially filled last block and give back any blocks reserved beyond the end of the file
+        if (writer->length % volume->header.blocksize > 0)
+        {
+            SIFS_updateblock(volume, writer->firstblockID + nblocks - 1, writer->buffer, writer->length % volume->header.blocksize);
+        }
+        if (writer->nreserved > nblocks)
+        {
+            SIFS_freeblocks(volume, writer->firstblockID + nblocks, writer->nreserved - nblocks);
+        }
+        // Setup fileblock metadata, the data written so far is always in one run
+        SIFS_EXTENTLIST extents;
+        extents.magic = SIFS_EXTENTLIST_MAGIC;
+        extents.nextents = (nblocks > 0) ? 1 : 0;
+        extents.extents[0].start = writer->firstblockID;
+        extents.extents[0].count = nblocks;
+        block = (SIFS_FILEBLOCK*)SIFS_getblock(volume, fileblockId);
+        block->modtime = time(NULL);
+        memcpy(block->md5, md5, MD5_BYTELEN);
+        block->length = writer->length;
+        SIFS_setextents(volume, block, &extents);
+        SIFS_hashinsert(volume, md5, fileblockId);
+        // The block could still hold the names, and the link of a chain, of a previous fileblock
+        block->nfiles = 0;
+        memset(block->filenames, 0, sizeof(block->filenames));
+        blockId = fileblockId;
+    }
+    SIFS_addfilename(volume, dir, dirblockId, block, blockId, filename);
+
+    SIFS_releaseblock(volume, dir);
+    SIFS_releaseblock(volume, block);
+    free_writer(writer);
+    SIFS_errno = SIFS_EOK;
+    return SIFS_SUCCESS;
+}
+
+// abandon a file started with SIFS_wopen(), releasing the blocks reserved for it
+void SIFS_wabort(SIFS_WRITER *writer)
+{
+    if (writer == NULL)
+    {
+        return;
+    }
+    if (writer->nreserved > 0)
+    {
+        SIFS_freeblocks(writer->volume, writer->firstblockID, writer->nreserved);
+    }
+    free_writer(writer);
+}
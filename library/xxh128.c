@@ -0,0 +1,359 @@
+//  XXH3-128, FOLLOWING THE REFERENCE IMPLEMENTATION'S SCALAR CODE PATH
+//  (https://github.com/Cyan4973/xxHash, BSD 2-CLAUSE LICENSE)
+
+#include "xxh128.h"
+
+#include <string.h>
+
+#define	PRIME32_1	0x9E3779B1U
+#define	PRIME32_2	0x85EBCA77U
+#define	PRIME32_3	0xC2B2AE3DU
+#define	PRIME64_1	0x9E3779B185EBCA87ULL
+#define	PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define	PRIME64_3	0x165667B19E3779F9ULL
+#define	PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define	PRIME64_5	0x27D4EB2F165667C5ULL
+#define	PRIME_MX1	0x165667919E3779F9ULL
+#define	PRIME_MX2	0x9FB21C651E98DF25ULL
+
+#define	SECRET_SIZE	192
+#define	STRIPE_LEN	64
+#define	SECRET_CONSUME_RATE	8
+#define	STRIPES_PER_BLOCK	((SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE)
+#define	MIDSIZE_MAX	240
+
+//  THE DEFAULT SECRET, TAKEN FROM FARSH
+static const uint8_t secret[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+typedef struct {
+    uint64_t	low;
+    uint64_t	high;
+} Hash128;
+
+//  --------------------------------------------------------------------------
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	   ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    return (uint64_t)read32(p) | ((uint64_t)read32(p + 4) << 32);
+}
+
+static inline uint32_t swap32(uint32_t x)
+{
+    return (x << 24) | ((x << 8) & 0x00ff0000) | ((x >> 8) & 0x0000ff00) | (x >> 24);
+}
+
+static inline uint64_t swap64(uint64_t x)
+{
+    return ((uint64_t)swap32((uint32_t)x) << 32) | swap32((uint32_t)(x >> 32));
+}
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+//  THE FULL 128-BIT PRODUCT OF TWO 64-BIT NUMBERS, FROM FOUR 32-BIT PRODUCTS
+static Hash128 mult64to128(uint64_t lhs, uint64_t rhs)
+{
+    uint64_t lo_lo	= (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+    uint64_t hi_lo	= (lhs >> 32) * (rhs & 0xFFFFFFFF);
+    uint64_t lo_hi	= (lhs & 0xFFFFFFFF) * (rhs >> 32);
+    uint64_t hi_hi	= (lhs >> 32) * (rhs >> 32);
+    uint64_t cross	= (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    Hash128 r;
+
+    r.high	= (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    r.low	= (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return r;
+}
+
+static inline uint64_t mul128_fold64(uint64_t lhs, uint64_t rhs)
+{
+    Hash128 product = mult64to128(lhs, rhs);
+
+    return product.low ^ product.high;
+}
+
+static inline uint64_t xorshift64(uint64_t v, int shift)
+{
+    return v ^ (v >> shift);
+}
+
+static uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t avalanche(uint64_t h)
+{
+    h = xorshift64(h, 37);
+    h *= PRIME_MX1;
+    return xorshift64(h, 32);
+}
+
+static inline uint64_t mix16B(const uint8_t *input, const uint8_t *key)
+{
+    return mul128_fold64(read64(input) ^ read64(key), read64(input + 8) ^ read64(key + 8));
+}
+
+static inline Hash128 mix32B(Hash128 acc, const uint8_t *in1, const uint8_t *in2, const uint8_t *key)
+{
+    acc.low	+= mix16B(in1, key);
+    acc.low	^= read64(in2) + read64(in2 + 8);
+    acc.high	+= mix16B(in2, key + 16);
+    acc.high	^= read64(in1) + read64(in1 + 8);
+    return acc;
+}
+
+//  --------------------------------------------------------------------------
+
+//  INPUTS OF UP TO 240 BYTES ARE HASHED IN ONE GO, BY ONE OF FOUR RECIPES
+static Hash128 hash_short(const uint8_t *input, size_t len)
+{
+    Hash128 h;
+
+    if(len == 0) {
+	h.low	= xxh64_avalanche(read64(secret + 64) ^ read64(secret + 72));
+	h.high	= xxh64_avalanche(read64(secret + 80) ^ read64(secret + 88));
+    }
+    else if(len <= 3) {
+	uint32_t combinedl = ((uint32_t)input[0] << 16) | ((uint32_t)input[len >> 1] << 24) |
+			     (uint32_t)input[len - 1] | ((uint32_t)len << 8);
+	uint32_t combinedh = rotl32(swap32(combinedl), 13);
+
+	h.low	= xxh64_avalanche((uint64_t)combinedl ^ (uint64_t)(read32(secret) ^ read32(secret + 4)));
+	h.high	= xxh64_avalanche((uint64_t)combinedh ^ (uint64_t)(read32(secret + 8) ^ read32(secret + 12)));
+    }
+    else if(len <= 8) {
+	uint64_t input64 = read32(input) + ((uint64_t)read32(input + len - 4) << 32);
+	uint64_t keyed	 = input64 ^ (read64(secret + 16) ^ read64(secret + 24));
+
+	h		= mult64to128(keyed, PRIME64_1 + (len << 2));
+	h.high		+= h.low << 1;
+	h.low		^= h.high >> 3;
+	h.low		= xorshift64(h.low, 35);
+	h.low		*= PRIME_MX2;
+	h.low		= xorshift64(h.low, 28);
+	h.high		= avalanche(h.high);
+    }
+    else if(len <= 16) {
+	uint64_t bitflipl = read64(secret + 32) ^ read64(secret + 40);
+	uint64_t bitfliph = read64(secret + 48) ^ read64(secret + 56);
+	uint64_t inputlo  = read64(input);
+	uint64_t inputhi  = read64(input + len - 8) ^ bitfliph;
+	Hash128 m	  = mult64to128(inputlo ^ read64(input + len - 8) ^ bitflipl, PRIME64_1);
+
+	m.low		+= (uint64_t)(len - 1) << 54;
+	m.high		+= inputhi + (uint64_t)(uint32_t)inputhi * (PRIME32_2 - 1);
+	m.low		^= swap64(m.high);
+	h		= mult64to128(m.low, PRIME64_2);
+	h.high		+= m.high * PRIME64_2;
+	h.low		= avalanche(h.low);
+	h.high		= avalanche(h.high);
+    }
+    else {
+	Hash128 acc;
+
+	acc.low		= len * PRIME64_1;
+	acc.high	= 0;
+	if(len <= 128) {
+	    for(int i = (int)(len - 1) / 32 ; i >= 0 ; i--)
+		acc	= mix32B(acc, input + 16*i, input + len - 16*(i + 1), secret + 32*i);
+	}
+	else {
+	    for(size_t i = 32 ; i < 160 ; i += 32)
+		acc	= mix32B(acc, input + i - 32, input + i - 16, secret + i - 32);
+	    acc.low	= avalanche(acc.low);
+	    acc.high	= avalanche(acc.high);
+	    for(size_t i = 160 ; i <= len ; i += 32)
+		acc	= mix32B(acc, input + i - 32, input + i - 16, secret + 3 + i - 160);
+	    acc	= mix32B(acc, input + len - 16, input + len - 32, secret + 136 - 17 - 16);
+	}
+	h.low	= avalanche(acc.low + acc.high);
+	h.high	= 0 - avalanche(acc.low * PRIME64_1 + acc.high * PRIME64_4 + len * PRIME64_2);
+    }
+    return h;
+}
+
+//  --------------------------------------------------------------------------
+
+//  LONGER INPUTS ARE ACCUMULATED 64-BYTE STRIPE BY STRIPE INTO 8 LANES,
+//  WHICH ARE SCRAMBLED AFTER EVERY BLOCK OF 16 STRIPES
+static void accumulate_stripe(uint64_t acc[8], const uint8_t *stripe, const uint8_t *key)
+{
+    for(int i=0 ; i<8 ; i++) {
+	uint64_t value	= read64(stripe + 8*i);
+	uint64_t keyed	= value ^ read64(key + 8*i);
+
+	acc[i ^ 1]	+= value;
+	acc[i]		+= (keyed & 0xFFFFFFFF) * (keyed >> 32);
+    }
+}
+
+static void scramble(uint64_t acc[8])
+{
+    const uint8_t *key = secret + SECRET_SIZE - STRIPE_LEN;
+
+    for(int i=0 ; i<8 ; i++) {
+	uint64_t a	= xorshift64(acc[i], 47) ^ read64(key + 8*i);
+
+	acc[i]		= a * PRIME32_1;
+    }
+}
+
+static uint64_t merge(const uint64_t acc[8], const uint8_t *key, uint64_t start)
+{
+    for(int i=0 ; i<4 ; i++)
+	start	+= mul128_fold64(acc[2*i] ^ read64(key + 16*i), acc[2*i + 1] ^ read64(key + 16*i + 8));
+    return avalanche(start);
+}
+
+//  ACCUMULATE ONE STRIPE THAT IS FOLLOWED BY MORE INPUT
+static void consume_stripe(XXH128_CTX *ctx, const uint8_t *stripe)
+{
+    accumulate_stripe(ctx->acc, stripe, secret + ctx->nstripes * SECRET_CONSUME_RATE);
+    if(++ctx->nstripes == STRIPES_PER_BLOCK) {
+	scramble(ctx->acc);
+	ctx->nstripes	= 0;
+    }
+}
+
+//  THE HASH IS WRITTEN HIGH HALF FIRST, EACH HALF MOST SIGNIFICANT BYTE FIRST
+static void *canonical(Hash128 h, void *xxh_result)
+{
+    uint8_t *res	= (uint8_t *)xxh_result;
+
+    for(int i=0 ; i<8 ; i++) {
+	res[i]		= (uint8_t)(h.high >> (56 - 8*i));
+	res[8 + i]	= (uint8_t)(h.low >> (56 - 8*i));
+    }
+    return xxh_result;
+}
+
+//  --------------------------------------------------------------------------
+
+//  START AN INCREMENTAL HASH
+void XXH128_init(XXH128_CTX *ctx)
+{
+    static const uint64_t init[8] = { PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+				      PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1 };
+
+    memcpy(ctx->acc, init, sizeof(init));
+    ctx->length		= 0;
+    ctx->nstripes	= 0;
+    ctx->nbuffered	= 0;
+    ctx->islong		= false;
+}
+
+//  ADD len BYTES OF input TO AN INCREMENTAL HASH
+void XXH128_update(XXH128_CTX *ctx, const void *input, size_t len)
+{
+    const uint8_t *in	= (const uint8_t *)input;
+
+    ctx->length	+= len;
+//  SHORT INPUTS ARE HASHED IN ONE GO BY XXH128_final(), SO ARE KEPT WHOLE
+    if(!ctx->islong && ctx->length <= MIDSIZE_MAX) {
+	memcpy(ctx->buffer + ctx->nbuffered, in, len);
+	ctx->nbuffered	+= len;
+	return;
+    }
+    ctx->islong	= true;
+
+//  A STRIPE IS ONLY ACCUMULATED ONCE SOME INPUT FOLLOWS IT, THE LAST ONE IS DIFFERENT
+//  FIRST THE BUFFERED BYTES ARE MADE UP TO WHOLE STRIPES
+    size_t n	= (STRIPE_LEN - ctx->nbuffered % STRIPE_LEN) % STRIPE_LEN;
+
+    n	= (n < len) ? n : len;
+    memcpy(ctx->buffer + ctx->nbuffered, in, n);
+    ctx->nbuffered	+= n;
+    in		+= n;
+    len		-= n;
+
+    size_t offset	= 0;
+
+    while(offset + STRIPE_LEN <= ctx->nbuffered && (offset + STRIPE_LEN < ctx->nbuffered || len > 0)) {
+	consume_stripe(ctx, ctx->buffer + offset);
+	offset	+= STRIPE_LEN;
+    }
+    if(offset < ctx->nbuffered) {
+//  THE INPUT ENDED WITHIN THE BUFFER, KEEP THE STRIPE BEFORE WHAT IS LEFT
+	if(offset > 0) {
+	    memcpy(ctx->laststripe, ctx->buffer + offset - STRIPE_LEN, STRIPE_LEN);
+	    memmove(ctx->buffer, ctx->buffer + offset, ctx->nbuffered - offset);
+	}
+	ctx->nbuffered	-= offset;
+	return;
+    }
+    if(offset > 0)
+	memcpy(ctx->laststripe, ctx->buffer + offset - STRIPE_LEN, STRIPE_LEN);
+
+//  THEN WHOLE STRIPES OF THE INPUT ARE ACCUMULATED IN PLACE
+    while(len > STRIPE_LEN) {
+	consume_stripe(ctx, in);
+	in	+= STRIPE_LEN;
+	len	-= STRIPE_LEN;
+	if(len <= STRIPE_LEN)
+	    memcpy(ctx->laststripe, in - STRIPE_LEN, STRIPE_LEN);
+    }
+    memcpy(ctx->buffer, in, len);
+    ctx->nbuffered	= len;
+}
+
+//  FINISH AN INCREMENTAL HASH, LEAVE RESULT IN xxh_result
+void *XXH128_final(XXH128_CTX *ctx, void *xxh_result)
+{
+    if(!ctx->islong)
+	return canonical(hash_short(ctx->buffer, ctx->nbuffered), xxh_result);
+
+//  THE LAST STRIPE IS THE LAST 64 BYTES OF INPUT, WHICH MAY OVERLAP THE ONE BEFORE
+    uint8_t	last[STRIPE_LEN];
+    uint64_t	acc[8];
+    size_t	n	= ctx->nbuffered;
+    Hash128	h;
+
+    memcpy(last, ctx->laststripe + n, STRIPE_LEN - n);
+    memcpy(last + STRIPE_LEN - n, ctx->buffer, n);
+    memcpy(acc, ctx->acc, sizeof(acc));
+    accumulate_stripe(acc, last, secret + SECRET_SIZE - STRIPE_LEN - 7);
+    h.low	= merge(acc, secret + 11, ctx->length * PRIME64_1);
+    h.high	= merge(acc, secret + SECRET_SIZE - 64 - 11, ~(ctx->length * PRIME64_2));
+    return canonical(h, xxh_result);
+}
+
+//  CALCULATE THE XXH3-128 HASH OF input BUFFER, LEAVE RESULT IN xxh_result
+void *XXH128_buffer(const void *input, size_t len, void *xxh_result)
+{
+    XXH128_CTX ctx;
+
+    if(len <= MIDSIZE_MAX)
+	return canonical(hash_short((const uint8_t *)input, len), xxh_result);
+    XXH128_init(&ctx);
+    XXH128_update(&ctx, input, len);
+    return XXH128_final(&ctx, xxh_result);
+}
+
+//  vim: ts=8 sw=4
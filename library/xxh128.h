@@ -0,0 +1,32 @@
+//  XXH3-128, THE 128-BIT VARIANT OF THE XXH3 NON-CRYPTOGRAPHIC HASH
+//  (https://github.com/Cyan4973/xxHash), WITH ITS DEFAULT SECRET AND NO SEED
+
+#include <stdlib.h>		// defines  size_t
+#include <stdint.h>
+#include <stdbool.h>
+
+#define XXH128_BYTELEN  16
+
+//  CALCULATE THE XXH3-128 HASH OF input BUFFER, LEAVE RESULT IN xxh_result
+//  THE RESULT IS THE CANONICAL FORM: HIGH 64 BITS THEN LOW 64 BITS, MOST SIGNIFICANT BYTE FIRST
+extern  void    *XXH128_buffer(const void *input, size_t len, void *xxh_result);
+
+//  STATE OF AN INCREMENTAL HASH, FOR INPUT THAT IS NOT IN ONE BUFFER
+typedef struct {
+    uint64_t		acc[8];
+    uint64_t		length;		// bytes added so far
+    size_t		nstripes;	// stripes accumulated since the last scramble
+    size_t		nbuffered;
+    bool		islong;		// more than 240 bytes, stripes are being accumulated
+    unsigned char	buffer[256];	// every byte while short, then the bytes not yet accumulated
+    unsigned char	laststripe[64];	// the stripe accumulated last
+} XXH128_CTX;
+
+//  START AN INCREMENTAL HASH
+extern  void    XXH128_init(XXH128_CTX *ctx);
+
+//  ADD len BYTES OF input TO AN INCREMENTAL HASH
+extern  void    XXH128_update(XXH128_CTX *ctx, const void *input, size_t len);
+
+//  FINISH AN INCREMENTAL HASH, LEAVE RESULT IN xxh_result
+extern  void    *XXH128_final(XXH128_CTX *ctx, void *xxh_result);
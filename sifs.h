@@ -1,3 +1,6 @@
+#ifndef SIFS_H
+#define SIFS_H
+
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
@@ -11,6 +14,22 @@
 //  MAKE A NEW VOLUME
 extern	int SIFS_mkvolume(const char *volumename, size_t blocksize, uint32_t nblocks);
 
+//  MAKE A NEW VOLUME, flags IS ZERO OR MORE OF THE SIFS_MKVOLUME_* FLAGS BELOW.
+//  ONLY THE HEADER, BITMAP AND ROOT DIRECTORY ARE WRITTEN, THE UNUSED BLOCKS
+//  ARE LEFT AS A HOLE IN THE FILE UNLESS THEY ARE PREALLOCATED
+extern	int SIFS_makevolume(const char *volumename, size_t blocksize, uint32_t nblocks, int flags);
+
+#define	SIFS_MKVOLUME_PREALLOCATE	0x01	// Reserve disk space for every block when the volume is made
+#define	SIFS_MKVOLUME_PACKED	0x02	// Store the bitmap with 2 bits per block, see SIFS_upgradevolume()
+#define	SIFS_MKVOLUME_XXH128	0x04	// Find identical files by their XXH3-128 hash, not md5 (implies PACKED)
+#define	SIFS_MKVOLUME_BLAKE3	0x08	// Find identical files by their BLAKE3 hash, not md5 (implies PACKED)
+#define	SIFS_MKVOLUME_CHUNKED	0x10	// Split large files where their contents allow, storing each piece once (implies PACKED)
+
+//  CONVERT AN EXISTING VOLUME IN THE ORIGINAL LAYOUT TO ONE WHOSE BITMAP
+//  IS STORED WITH 2 BITS PER BLOCK. THE VOLUME MUST NOT BE OPEN ELSEWHERE
+//  A PACKED VOLUME WHOSE DIRECTORIES DO NOT YET HOLD THE NAMES OF THEIR ENTRIES IS GIVEN THEM
+extern	int SIFS_upgradevolume(const char *volumename);
+
 //  MAKE A NEW DIRECTORY WITHIN AN EXISTING VOLUME
 extern	int SIFS_mkdir(const char *volumename, const char *pathname);
 
@@ -40,6 +59,163 @@ extern	int SIFS_fileinfo(const char *volumename, const char *pathname,
 extern	int SIFS_defrag(const char *volumename);
 
 
+//  AN OPEN HANDLE TO AN EXISTING VOLUME.
+//  THE VOLUME IS VALIDATED ONCE WHEN IT IS OPENED, AND ITS HEADER AND
+//  OPEN FILE STAY RESIDENT UNTIL THE HANDLE IS CLOSED
+typedef struct SIFS_VOLUME	SIFS_VOLUME;
+
+//  OPEN AN EXISTING VOLUME, RETURNS NULL AND SETS SIFS_errno ON FAILURE.
+//  A VOLUME THAT CANNOT BE WRITTEN IS OPENED FOR READING ONLY, AND EVERY
+//  FUNCTION THAT WOULD MODIFY IT THROUGH THE HANDLE FAILS WITH SIFS_EROFS
+extern	SIFS_VOLUME *SIFS_open(const char *volumename);
+
+//  OPEN AN EXISTING VOLUME, flags IS ZERO OR MORE OF THE SIFS_OPEN_* FLAGS BELOW
+extern	SIFS_VOLUME *SIFS_openvolume(const char *volumename, int flags);
+
+#define	SIFS_OPEN_MMAP	0x01	// Memory-map the volume, blocks are accessed in place
+#define	SIFS_OPEN_URING	0x02	// Issue independent block reads and writes together with io_uring, if available
+
+//  FLUSH ALL MODIFICATIONS MADE THROUGH AN OPEN VOLUME TO DISK
+extern	int SIFS_sync(SIFS_VOLUME *volume);
+
+//  SET THE NUMBER OF BLOCKS KEPT IN AN OPEN VOLUME'S WRITE-BACK CACHE, 0 DISABLES IT
+extern	int SIFS_setcachesize(SIFS_VOLUME *volume, uint32_t nblocks);
+
+//  REPORT HOW MANY BLOCK LOOKUPS WERE SERVED FROM AND MISSED THE CACHE
+extern	int SIFS_cachestats(SIFS_VOLUME *volume, uint64_t *hits, uint64_t *misses);
+
+//  FLUSH AND CLOSE A VOLUME PREVIOUSLY OPENED WITH SIFS_open().
+//  ANY SIFS_WRITER STILL OPEN ON THE VOLUME IS ABANDONED AS IF BY SIFS_wabort()
+extern	int SIFS_close(SIFS_VOLUME *volume);
+
+//  EACH OF THE FOLLOWING BEHAVES EXACTLY AS ITS NAME-BASED COUNTERPART ABOVE,
+//  BUT OPERATES ON A VOLUME ALREADY OPENED WITH SIFS_open()
+extern	int SIFS_vmkdir(SIFS_VOLUME *volume, const char *pathname);
+
+extern	int SIFS_vrmdir(SIFS_VOLUME *volume, const char *pathname);
+
+extern	int SIFS_vwritefile(SIFS_VOLUME *volume, const char *pathname,
+			    void *data, size_t nbytes);
+
+extern	int SIFS_vreadfile(SIFS_VOLUME *volume, const char *pathname,
+			   void **data, size_t *nbytes);
+
+extern	int SIFS_vrmfile(SIFS_VOLUME *volume, const char *pathname);
+
+extern	int SIFS_vdirinfo(SIFS_VOLUME *volume, const char *pathname,
+			  char ***entrynames, uint32_t *nentries, time_t *modtime);
+
+extern	int SIFS_vfileinfo(SIFS_VOLUME *volume, const char *pathname,
+			   size_t *length, time_t *modtime);
+
+extern	int SIFS_vdefrag(SIFS_VOLUME *volume);
+
+//  ONE FILE TO BE ADDED BY SIFS_writefiles()
+typedef struct {
+    const char		*pathname;
+    const void		*data;
+    size_t		nbytes;
+} SIFS_WRITE_REQ;
+
+//  ADD COPIES OF nreqs NEW FILES TO AN OPEN VOLUME, AS IF BY SIFS_vwritefile() FOR EACH OF THEM.
+//  EACH FILE IS ADDED OR FAILS ON ITS OWN, IF errors IS NOT NULL errors[i] IS SET TO THE
+//  SIFS_errno OF reqs[i] (SIFS_EOK IF IT WAS ADDED). ON FAILURE SIFS_errno DESCRIBES THE FIRST FAILED REQUEST
+extern	int SIFS_writefiles(SIFS_VOLUME *volume, const SIFS_WRITE_REQ *reqs, size_t nreqs, int *errors);
+
+//  READ THE CONTENTS OF AN EXISTING FILE INTO A BUFFER OF capacity BYTES.
+//  nbytes IS ALWAYS SET TO THE FILE'S LENGTH, SIFS_ETOOSMALL IS REPORTED IF IT DOES NOT FIT
+extern	int SIFS_readfile_into(SIFS_VOLUME *volume, const char *pathname,
+			       void *buffer, size_t capacity, size_t *nbytes);
+
+//  READ UP TO length BYTES OF AN EXISTING FILE, STARTING offset BYTES INTO IT.
+//  ONLY THE BLOCKS HOLDING THOSE BYTES ARE READ. nbytes IS SET TO THE NUMBER OF BYTES READ,
+//  WHICH IS LESS THAN length AT THE END OF THE FILE
+extern	int SIFS_readrange(SIFS_VOLUME *volume, const char *pathname, size_t offset,
+			   void *buffer, size_t length, size_t *nbytes);
+
+//  AN EXISTING FILE BEING READ FROM START TO END, READING AHEAD OF THE CALLER
+typedef struct SIFS_READER	SIFS_READER;
+
+//  START READING AN EXISTING FILE, readahead IS THE NUMBER OF BYTES READ AT ONCE (0 FOR A DEFAULT).
+//  RETURNS NULL AND SETS SIFS_errno ON FAILURE
+extern	SIFS_READER *SIFS_ropen(SIFS_VOLUME *volume, const char *pathname, size_t readahead);
+
+//  READ THE NEXT nbytes OF THE FILE INTO data, nread IS SET TO 0 AT THE END OF THE FILE
+extern	int SIFS_rread(SIFS_READER *reader, void *data, size_t nbytes, size_t *nread);
+
+//  FINISH READING THE FILE AND FREE THE READER
+extern	void SIFS_rclose(SIFS_READER *reader);
+
+//  GET A READ-ONLY VIEW OF THE CONTENTS OF AN EXISTING FILE WITHOUT COPYING THEM.
+//  THE VIEW MUST BE RELEASED WITH SIFS_unmapfile() BEFORE THE VOLUME IS CLOSED,
+//  AND ITS CONTENTS ARE UNDEFINED ONCE THE FILE IS REMOVED OR THE VOLUME DEFRAGMENTED
+extern	int SIFS_mapfile(SIFS_VOLUME *volume, const char *pathname,
+			 const void **data, size_t *nbytes);
+
+extern	int SIFS_unmapfile(SIFS_VOLUME *volume, const void *data, size_t nbytes);
+
+//  A FILE BEING ADDED TO AN OPEN VOLUME IN PIECES, FOR CONTENTS TOO LARGE TO HOLD IN MEMORY
+typedef struct SIFS_WRITER	SIFS_WRITER;
+
+//  START ADDING A NEW FILE, sizehint (WHICH MAY BE 0) IS THE EXPECTED LENGTH OF ITS CONTENTS.
+//  RETURNS NULL AND SETS SIFS_errno ON FAILURE. EVERY WRITER MUST BE COMMITTED OR ABANDONED
+//  BEFORE THE VOLUME IS DEFRAGMENTED (WHICH FAILS WITH SIFS_EBUSY), AND ONE STILL OPEN WHEN
+//  THE VOLUME IS CLOSED IS ABANDONED AND FREED BY SIFS_close()
+extern	SIFS_WRITER *SIFS_wopen(SIFS_VOLUME *volume, const char *pathname, size_t sizehint);
+
+//  APPEND nbytes OF data TO THE CONTENTS OF THE FILE
+extern	int SIFS_wwrite(SIFS_WRITER *writer, const void *data, size_t nbytes);
+
+//  ADD THE FILE TO THE VOLUME, STORING ITS CONTENTS ONLY IF NO IDENTICAL FILE EXISTS.
+//  THE WRITER IS FREED WHETHER OR NOT THE FILE COULD BE ADDED
+extern	int SIFS_wcommit(SIFS_WRITER *writer);
+
+//  ABANDON THE FILE AND FREE THE WRITER
+extern	void SIFS_wabort(SIFS_WRITER *writer);
+
+
+//  HOW THE BLOCKS OF A VOLUME ARE USED, SEE SIFS_statvol()
+#define	SIFS_STAT_BUCKETS	32
+
+typedef struct {
+    size_t		blocksize;
+    uint32_t		nblocks;	// every block of the volume
+    uint32_t		nfree;
+    uint32_t		ndirblocks;	// including the root directory
+    uint32_t		nfileblocks;
+    uint32_t		ndatablocks;
+
+    uint32_t		largestfree;	// blocks in the longest run of free blocks
+    uint32_t		nfreeruns;
+    uint32_t		histogram[SIFS_STAT_BUCKETS];	// [i] runs of free blocks of 2^i to 2^(i+1) - 1 blocks
+} SIFS_STATVOL;
+
+//  REPORT HOW MANY BLOCKS OF AN EXISTING VOLUME ARE FREE AND USED, AND HOW THE FREE BLOCKS ARE SPLIT.
+//  THE COUNTS ARE KEPT UP TO DATE AS BLOCKS ARE ALLOCATED AND FREED, SO AN OPEN VOLUME
+//  ONLY EXAMINES ITS BITMAP THE FIRST TIME IT IS ASKED
+extern	int SIFS_statvol(const char *volumename, SIFS_STATVOL *stat);
+
+extern	int SIFS_vstatvol(SIFS_VOLUME *volume, SIFS_STATVOL *stat);
+
+
+//  ONE ENTRY OF A DIRECTORY, SEE SIFS_readdir()
+typedef struct {
+    const char		*name;		// held in the same allocation as the entries
+    char		type;		// 'd' for a directory, 'f' for a file
+    size_t		length;		// of a file's contents, or the number of entries of a directory
+    time_t		modtime;
+    uint32_t		blockID;	// of the directory, or of the file's block
+} SIFS_DIRENT;
+
+//  LIST EVERY ENTRY OF A REQUESTED DIRECTORY WITH ITS TYPE, LENGTH AND MODIFICATION TIME IN ONE PASS.
+//  *entries IS A SINGLE ALLOCATION HOLDING ALL nentries ENTRIES AND THEIR NAMES, RELEASED WITH ONE free()
+extern	int SIFS_readdir(const char *volumename, const char *pathname,
+			 SIFS_DIRENT **entries, uint32_t *nentries);
+
+extern	int SIFS_vreaddir(SIFS_VOLUME *volume, const char *pathname,
+			  SIFS_DIRENT **entries, uint32_t *nentries);
+
+
 //  ON SUCCESS, EACH OF THE ABOVE FUNCTIONS RETURN 0.
 //  ON FAILURE, EACH FUNCTION RETURNS 1 AND SETS SIFS_errno
 extern	int		SIFS_errno;
@@ -58,6 +234,10 @@ extern	int		SIFS_errno;
 #define	SIFS_ENOMEM	11	// Memory allocation failed
 #define	SIFS_ENOTYET	12	// Not yet implemented
 #define SIFS_ENOTEMPTY	13 // Directory not empty
+#define	SIFS_ETOOSMALL	14	// Buffer too small
+#define	SIFS_EROFS	15	// Volume is read-only
+#define	SIFS_EBUSY	16	// Volume has files still being written
+#define	SIFS_EIO	17	// Volume could not be written
 
 
 //  THE FUNCTION SIFS_perror() PRODUCES A MESSAGE ON THE STANDARD ERROR OUTPUT,
@@ -65,3 +245,4 @@ extern	int		SIFS_errno;
 //  IF PROVIDED WITH A NON-NULL PREFIX, IT IS PRINTED BEFORE THE MESSAGE
 extern	void		SIFS_perror(const char *prefix);
 
+#endif
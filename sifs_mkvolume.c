@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "sifs.h"
 
 //  Written by Chris.McDonald@uwa.edu.au, September 2019
@@ -7,8 +8,12 @@
 //  REPORT HOW THIS PROGRAM SHOULD BE INVOKED
 void usage(char *progname)
 {
-    fprintf(stderr, "Usage: %s volumename blocksize nblocks\n", progname);
-    fprintf(stderr, "or     %s blocksize nblocks\n", progname);
+    fprintf(stderr, "Usage: %s [-p] [-x | -b] [-c] volumename blocksize nblocks\n", progname);
+    fprintf(stderr, "or     %s [-p] [-x | -b] [-c] blocksize nblocks\n", progname);
+    fprintf(stderr, "where  -p reserves disk space for every block\n");
+    fprintf(stderr, "       -x finds identical files by their XXH3-128 hash\n");
+    fprintf(stderr, "       -b finds identical files by their BLAKE3 hash\n");
+    fprintf(stderr, "       -c stores the parts that large files have in common once\n");
     exit(EXIT_FAILURE);
 }
 
@@ -17,6 +22,29 @@ int main(int argcount, char *argvalue[])
     char	*volumename;    // filename storing the SIFS volume
     size_t	blocksize;
     uint32_t	nblocks;
+    int		flags	= 0;
+
+//  OPTIONAL FIRST ARGUMENTS REQUEST A PREALLOCATED VOLUME, A HASH OTHER THAN md5, OR CHUNKS
+    while(argcount > 1 && argvalue[1][0] == '-') {
+	if(strcmp(argvalue[1], "-p") == 0) {
+	    flags	|= SIFS_MKVOLUME_PREALLOCATE;
+	}
+	else if(strcmp(argvalue[1], "-x") == 0) {
+	    flags	|= SIFS_MKVOLUME_XXH128;
+	}
+	else if(strcmp(argvalue[1], "-b") == 0) {
+	    flags	|= SIFS_MKVOLUME_BLAKE3;
+	}
+	else if(strcmp(argvalue[1], "-c") == 0) {
+	    flags	|= SIFS_MKVOLUME_CHUNKED;
+	}
+	else {
+	    usage(argvalue[0]);
+	}
+	argvalue[1]	= argvalue[0];
+	++argvalue;
+	--argcount;
+    }
 
 //  ATTEMPT TO OBTAIN THE volumename FROM AN ENVIRONMENT VARIABLE
     if(argcount == 3) {
@@ -39,7 +67,7 @@ int main(int argcount, char *argvalue[])
     }
 
 //  ATTEMPT TO CREATE THE NEW VOLUME
-    if(SIFS_mkvolume(volumename, blocksize, nblocks) != 0) {
+    if(SIFS_makevolume(volumename, blocksize, nblocks, flags) != 0) {
 	SIFS_perror(argvalue[0]);
 	exit(EXIT_FAILURE);
     }
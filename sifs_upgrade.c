@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "sifs.h"
+
+//  REPORT HOW THIS PROGRAM SHOULD BE INVOKED
+void usage(char *progname)
+{
+    fprintf(stderr, "Usage: %s volumename\n", progname);
+    fprintf(stderr, "or     %s\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argcount, char *argvalue[])
+{
+    char	*volumename;    // filename storing the SIFS volume
+
+//  ATTEMPT TO OBTAIN THE volumename FROM AN ENVIRONMENT VARIABLE
+    if(argcount == 1) {
+	volumename	= getenv("SIFS_VOLUME");
+	if(volumename == NULL) {
+	    usage(argvalue[0]);
+	}
+    }
+//  ... OR FROM A COMMAND-LINE PARAMETER
+    else if(argcount == 2) {
+	volumename	= argvalue[1];
+    }
+    else {
+	usage(argvalue[0]);
+	exit(EXIT_FAILURE);
+    }
+
+//  ATTEMPT TO STORE THE VOLUME'S BITMAP WITH 2 BITS PER BLOCK
+    if(SIFS_upgradevolume(volumename) != 0) {
+	SIFS_perror(argvalue[0]);
+	exit(EXIT_FAILURE);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -3,9 +3,12 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "sifs.h"
 #include "library/sifs-internal.h"
+#include "library/xxh128.h"
+#include "library/blake3.h"
 
 void test_writefile_EINVAL(void)
 {
@@ -378,6 +381,1331 @@ void test_random(void)
     remove("volume");
 }
 
+void test_volume_handle(void)
+{
+    printf("TESTING volume handle\n");
+    SIFS_mkvolume("volume", 1024, 64);
+    bool passed = true;
+
+    passed = passed && SIFS_open("NOT_A_VOLUME") == NULL && SIFS_errno == SIFS_ENOVOL;
+    // A file that exists but is not the size a volume's header says it should be
+    FILE* fp = fopen("notvolume", "w");
+    passed = passed && fp != NULL && fprintf(fp, "not a volume\n") > 0 && fclose(fp) == 0;
+    passed = passed && SIFS_open("notvolume") == NULL && SIFS_errno == SIFS_ENOTVOL;
+    remove("notvolume");
+
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+
+    int data = 10;
+    passed = passed && SIFS_vmkdir(volume, "Dir") == 0;
+    passed = passed && SIFS_vwritefile(volume, "Dir/File", &data, sizeof(int)) == 0;
+    passed = passed && SIFS_vwritefile(volume, "Dir/File", &data, sizeof(int)) == 1 && SIFS_errno == SIFS_EEXIST;
+
+    void* dataPtr = NULL;
+    size_t nbytes;
+    passed = passed && SIFS_vreadfile(volume, "Dir/File", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(int) && *(int*)dataPtr == data;
+    free(dataPtr);
+    passed = passed && SIFS_vwritefile(volume, "Dir/File", &data, sizeof(int)) == 1;
+    passed = passed && SIFS_sync(volume) == 0 && SIFS_errno == SIFS_EOK;
+    passed = passed && SIFS_vwritefile(volume, "Dir/File", &data, sizeof(int)) == 1;
+    passed = passed && SIFS_close(volume) == 0 && SIFS_errno == SIFS_EOK;
+
+    // Changes made through the handle are visible to the name-based API
+    char** entries = NULL;
+    uint32_t nentries = 0;
+    time_t modtime;
+    passed = passed && SIFS_dirinfo("volume", "Dir", &entries, &nentries, &modtime) == 0;
+    passed = passed && nentries == 1 && strcmp(entries[0], "File") == 0;
+    free_entries(entries, nentries);
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+    remove("volume");
+}
+
+void test_volume_mmap(void)
+{
+    printf("TESTING mapped volume\n");
+    SIFS_mkvolume("volume", 1024, 64);
+    bool passed = true;
+
+    SIFS_VOLUME* volume = SIFS_openvolume("volume", SIFS_OPEN_MMAP);
+    passed = passed && volume != NULL;
+
+    char data[3000];
+    memset(data, 'x', sizeof(data));
+    passed = passed && SIFS_vmkdir(volume, "Dir") == 0;
+    passed = passed && SIFS_vmkdir(volume, "Dir1") == 0;
+    passed = passed && SIFS_vwritefile(volume, "Dir/File", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vwritefile(volume, "Dir1/Copy", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vwritefile(volume, "Small", data, 10) == 0;
+    passed = passed && SIFS_vrmfile(volume, "Dir/File") == 0;
+    passed = passed && SIFS_vrmdir(volume, "Dir") == 0;
+    passed = passed && SIFS_vdefrag(volume) == 0;
+
+    void* dataPtr;
+    size_t nbytes;
+    passed = passed && SIFS_vreadfile(volume, "Dir1/Copy", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(data) && memcmp(dataPtr, data, nbytes) == 0;
+    free(dataPtr);
+    passed = passed && SIFS_sync(volume) == 0;
+    passed = passed && SIFS_close(volume) == 0;
+
+    // The modifications reached the volume file
+    passed = passed && SIFS_readfile("volume", "Small", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == 10 && memcmp(dataPtr, data, nbytes) == 0;
+    free(dataPtr);
+    passed = passed && SIFS_fileinfo("volume", "Dir/File", &nbytes, NULL) == 1 && SIFS_errno == SIFS_ENOENT;
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+    remove("volume");
+}
+
+void test_volume_cache(void)
+{
+    printf("TESTING volume cache\n");
+    SIFS_mkvolume("volume", 1024, 128);
+    bool passed = true;
+
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+    // A tiny cache forces dirty blocks to be evicted and written back
+    passed = passed && SIFS_setcachesize(volume, 2) == 0;
+
+    int data = 10;
+    char dirname[SIFS_MAX_NAME_LENGTH];
+    char filename[2 * SIFS_MAX_NAME_LENGTH];
+    for (int i = 0; i < 8; i++)
+    {
+        sprintf(dirname, "Dir%i", i);
+        passed = passed && SIFS_vmkdir(volume, dirname) == 0;
+        sprintf(filename, "Dir%i/File", i);
+        passed = passed && SIFS_vwritefile(volume, filename, &data, sizeof(int)) == 0;
+    }
+    passed = passed && SIFS_vrmfile(volume, "Dir3/File") == 0;
+
+    uint64_t hits;
+    uint64_t misses;
+    passed = passed && SIFS_cachestats(volume, &hits, &misses) == 0;
+    passed = passed && hits > 0 && misses > 0;
+
+    passed = passed && SIFS_setcachesize(volume, 32) == 0;
+    size_t length;
+    passed = passed && SIFS_vfileinfo(volume, "Dir5/File", &length, NULL) == 0 && length == sizeof(int);
+    passed = passed && SIFS_close(volume) == 0;
+
+    // Every dirty block reached the volume
+    char** entries;
+    uint32_t nentries;
+    time_t modtime;
+    passed = passed && SIFS_dirinfo("volume", "/", &entries, &nentries, &modtime) == 0;
+    passed = passed && nentries == 8 && strcmp(entries[7], "Dir7") == 0;
+    free_entries(entries, nentries);
+    passed = passed && SIFS_dirinfo("volume", "Dir3", &entries, &nentries, &modtime) == 0 && nentries == 0;
+    free_entries(entries, nentries);
+    void* dataPtr;
+    passed = passed && SIFS_readfile("volume", "Dir7/File", &dataPtr, &length) == 0;
+    passed = passed && length == sizeof(int) && *(int*)dataPtr == data;
+    free(dataPtr);
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+    remove("volume");
+}
+
+void test_readfile_views(void)
+{
+    printf("TESTING readfile into buffers and views\n");
+    SIFS_mkvolume("volume", 1024, 64);
+    bool passed = true;
+
+    char data[5000];
+    for (int i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (char)i;
+    }
+    char buffer[sizeof(data)];
+    size_t nbytes;
+    const void* view;
+
+    for (int flags = 0; flags <= SIFS_OPEN_MMAP; flags += SIFS_OPEN_MMAP)
+    {
+        SIFS_VOLUME* volume = SIFS_openvolume("volume", flags);
+        passed = passed && volume != NULL;
+        passed = passed && SIFS_vwritefile(volume, flags ? "Mapped" : "File", data, sizeof(data)) == 0;
+
+        // A buffer that is too small still reports the length of the file
+        passed = passed && SIFS_readfile_into(volume, "File", buffer, 10, &nbytes) == 1 && SIFS_errno == SIFS_ETOOSMALL;
+        passed = passed && nbytes == sizeof(data);
+        passed = passed && SIFS_readfile_into(volume, "File", buffer, sizeof(buffer), &nbytes) == 0;
+        passed = passed && nbytes == sizeof(data) && memcmp(buffer, data, nbytes) == 0;
+        passed = passed && SIFS_readfile_into(volume, "Missing", buffer, sizeof(buffer), &nbytes) == 1 && SIFS_errno == SIFS_ENOENT;
+
+        passed = passed && SIFS_mapfile(volume, flags ? "Mapped" : "File", &view, &nbytes) == 0;
+        passed = passed && nbytes == sizeof(data) && memcmp(view, data, nbytes) == 0;
+        passed = passed && SIFS_unmapfile(volume, view, nbytes) == 0;
+        passed = passed && SIFS_mapfile(volume, "/", &view, &nbytes) == 1 && SIFS_errno == SIFS_ENOTFILE;
+        passed = passed && SIFS_close(volume) == 0;
+    }
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+    remove("volume");
+}
+
+void test_streaming_writer(void)
+{
+    printf("TESTING streaming writer\n");
+    SIFS_mkvolume("volume", 1024, 64);
+    bool passed = true;
+
+    char data[10000];
+    for (int i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (char)(i * 31);
+    }
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+
+    // Written in uneven pieces without a size hint, so the reserved blocks have to grow
+    SIFS_WRITER* writer = SIFS_wopen(volume, "Streamed", 0);
+    passed = passed && writer != NULL;
+    for (size_t offset = 0, n = 1; writer != NULL && offset < sizeof(data); offset += n, n = n * 3 + 7)
+    {
+        n = (n < sizeof(data) - offset) ? n : sizeof(data) - offset;
+        passed = passed && SIFS_wwrite(writer, data + offset, n) == 0;
+    }
+    passed = passed && SIFS_wcommit(writer) == 0;
+
+    void* dataPtr;
+    size_t nbytes;
+    passed = passed && SIFS_vreadfile(volume, "Streamed", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(data) && memcmp(dataPtr, data, nbytes) == 0;
+    free(dataPtr);
+
+    // Identical contents are stored once, the speculative blocks are given back
+    uint32_t nentries;
+    char** entries;
+    time_t modtime;
+    passed = passed && SIFS_vwritefile(volume, "Whole", data, sizeof(data)) == 0;
+    writer = SIFS_wopen(volume, "Copy", sizeof(data));
+    passed = passed && writer != NULL && SIFS_wwrite(writer, data, sizeof(data)) == 0;
+    passed = passed && SIFS_wcommit(writer) == 0;
+    passed = passed && SIFS_vdirinfo(volume, "/", &entries, &nentries, &modtime) == 0 && nentries == 3;
+    free_entries(entries, nentries);
+    // 1 root, 1 fileblock and 10 data blocks are in use, so a 52 block file still fits
+    writer = SIFS_wopen(volume, "Large", 52 * 1024);
+    passed = passed && writer != NULL;
+    SIFS_wabort(writer);
+
+    passed = passed && SIFS_wopen(volume, "Streamed", 0) == NULL && SIFS_errno == SIFS_EEXIST;
+    passed = passed && SIFS_wopen(volume, "Huge", 100 * 1024) == NULL && SIFS_errno == SIFS_ENOSPC;
+
+    // A volume is not defragmented while a writer is open, and closing it abandons the writer
+    passed = passed && SIFS_vrmfile(volume, "Whole") == 0 && SIFS_vrmfile(volume, "Copy") == 0;
+    writer = SIFS_wopen(volume, "Pending", 0);
+    passed = passed && writer != NULL && SIFS_wwrite(writer, data, sizeof(data)) == 0;
+    passed = passed && SIFS_wopen(volume, "Other", 4096) != NULL;
+    passed = passed && SIFS_vdefrag(volume) == 1 && SIFS_errno == SIFS_EBUSY;
+    passed = passed && SIFS_close(volume) == 0;
+    SIFS_STATVOL stat;
+    passed = passed && SIFS_statvol("volume", &stat) == 0 && stat.nfree == 64 - 12;
+    passed = passed && SIFS_rmfile("volume", "Streamed") == 0 && SIFS_defrag("volume") == 0;
+    passed = passed && SIFS_statvol("volume", &stat) == 0 && stat.nfree == 63 && stat.largestfree == 63;
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+    remove("volume");
+}
+
+void test_ranged_reads(void)
+{
+    printf("TESTING ranged and sequential reads\n");
+    SIFS_mkvolume("volume", 1024, 64);
+    bool passed = true;
+
+    char data[20000];
+    for (int i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (char)(i * 13 + i / 1024);
+    }
+    char buffer[sizeof(data)];
+    size_t nbytes;
+
+    for (int flags = 0; flags <= SIFS_OPEN_MMAP; flags += SIFS_OPEN_MMAP)
+    {
+        SIFS_VOLUME* volume = SIFS_openvolume("volume", flags);
+        passed = passed && volume != NULL;
+        if (flags == 0)
+        {
+            passed = passed && SIFS_vwritefile(volume, "File", data, sizeof(data)) == 0;
+        }
+
+        // Ranges inside a block, across blocks and past the end of the file
+        passed = passed && SIFS_readrange(volume, "File", 0, buffer, 100, &nbytes) == 0;
+        passed = passed && nbytes == 100 && memcmp(buffer, data, nbytes) == 0;
+        passed = passed && SIFS_readrange(volume, "File", 1000, buffer, 3000, &nbytes) == 0;
+        passed = passed && nbytes == 3000 && memcmp(buffer, data + 1000, nbytes) == 0;
+        passed = passed && SIFS_readrange(volume, "File", 19000, buffer, 3000, &nbytes) == 0;
+        passed = passed && nbytes == 1000 && memcmp(buffer, data + 19000, nbytes) == 0;
+        passed = passed && SIFS_readrange(volume, "File", 30000, buffer, 10, &nbytes) == 0 && nbytes == 0;
+
+        // A small readahead and uneven reads exercise both the window and the direct reads
+        SIFS_READER* reader = SIFS_ropen(volume, "File", 3000);
+        passed = passed && reader != NULL;
+        size_t offset = 0;
+        size_t n = 1;
+        while (reader != NULL && SIFS_rread(reader, buffer + offset, n, &nbytes) == 0 && nbytes > 0)
+        {
+            offset += nbytes;
+            n = (n * 5 + 3) % 9000;
+            n = (n < sizeof(buffer) - offset) ? n : sizeof(buffer) - offset;
+            n = (n > 0) ? n : 1;
+        }
+        passed = passed && offset == sizeof(data) && memcmp(buffer, data, offset) == 0;
+        SIFS_rclose(reader);
+        passed = passed && SIFS_ropen(volume, "Missing", 0) == NULL && SIFS_errno == SIFS_ENOENT;
+        passed = passed && SIFS_close(volume) == 0;
+    }
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+    remove("volume");
+}
+
+void test_writefiles(void)
+{
+    printf("TESTING batched writes\n");
+    SIFS_mkvolume("volume", 1024, 64);
+    bool passed = true;
+
+    char data[3000];
+    memset(data, 'x', sizeof(data));
+    int value = 10;
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+    passed = passed && SIFS_vmkdir(volume, "Dir") == 0;
+    passed = passed && SIFS_vwritefile(volume, "Dir/Existing", &value, sizeof(int)) == 0;
+
+    SIFS_WRITE_REQ reqs[] = {
+        { "Dir/A", data, sizeof(data) },
+        { "B", data, sizeof(data) },
+        { "Dir/A", &value, sizeof(int) },
+        { "Missing/C", data, 10 },
+        { "./Dir/D", &value, sizeof(int) },
+        { "", data, 10 },
+    };
+    int errors[6];
+    passed = passed && SIFS_writefiles(volume, reqs, 6, errors) == 1 && SIFS_errno == SIFS_EEXIST;
+    passed = passed && errors[0] == SIFS_EOK && errors[1] == SIFS_EOK && errors[2] == SIFS_EEXIST;
+    passed = passed && errors[3] == SIFS_ENOENT && errors[4] == SIFS_EOK && errors[5] == SIFS_EINVAL;
+
+    char** entries;
+    uint32_t nentries;
+    time_t modtime;
+    passed = passed && SIFS_vdirinfo(volume, "Dir", &entries, &nentries, &modtime) == 0 && nentries == 3;
+    free_entries(entries, nentries);
+    void* dataPtr;
+    size_t nbytes;
+    passed = passed && SIFS_vreadfile(volume, "B", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(data) && memcmp(dataPtr, data, nbytes) == 0;
+    free(dataPtr);
+    passed = passed && SIFS_vreadfile(volume, "Dir/D", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(int) && *(int*)dataPtr == value;
+    free(dataPtr);
+    passed = passed && SIFS_close(volume) == 0;
+
+    // The contents of A and B and of Existing and D are each stored once:
+    // root, Dir, 2 fileblocks and 4 data blocks
+    FILE* f = fopen("volume", "rb");
+    SIFS_VOLUME_HEADER header;
+    passed = passed && fread(&header, sizeof(header), 1, f) == 1;
+    int nused = 0;
+    for (uint32_t i = 0; i < header.nblocks; i++)
+    {
+        nused += (fgetc(f) != SIFS_UNUSED);
+    }
+    fclose(f);
+    passed = passed && nused == 8;
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+    remove("volume");
+}
+
+void test_volume_uring(void)
+{
+    printf("TESTING io_uring volume\n");
+    SIFS_mkvolume("volume", 1024, 128);
+    bool passed = true;
+
+    // Falls back to plain reads and writes where io_uring is unavailable
+    SIFS_VOLUME* volume = SIFS_openvolume("volume", SIFS_OPEN_URING);
+    passed = passed && volume != NULL;
+    passed = passed && SIFS_setcachesize(volume, 4) == 0;
+
+    char data[3000];
+    memset(data, 'y', sizeof(data));
+    char name[SIFS_MAX_NAME_LENGTH];
+    for (int i = 0; i < 12; i++)
+    {
+        sprintf(name, "Entry%i", i);
+        if (i % 2 == 0)
+        {
+            passed = passed && SIFS_vmkdir(volume, name) == 0;
+        }
+        else
+        {
+            data[0] = (char)i;
+            passed = passed && SIFS_vwritefile(volume, name, data, sizeof(data)) == 0;
+        }
+    }
+    char** entries;
+    uint32_t nentries;
+    time_t modtime;
+    passed = passed && SIFS_vdirinfo(volume, "/", &entries, &nentries, &modtime) == 0;
+    passed = passed && nentries == 12 && strcmp(entries[11], "Entry11") == 0;
+    free_entries(entries, nentries);
+    passed = passed && SIFS_sync(volume) == 0;
+    passed = passed && SIFS_close(volume) == 0;
+
+    void* dataPtr;
+    size_t length;
+    passed = passed && SIFS_readfile("volume", "Entry7", &dataPtr, &length) == 0;
+    passed = passed && length == sizeof(data) && ((char*)dataPtr)[0] == 7 && ((char*)dataPtr)[2999] == 'y';
+    free(dataPtr);
+    passed = passed && SIFS_dirinfo("volume", "Entry10", &entries, &nentries, &modtime) == 0 && nentries == 0;
+    free_entries(entries, nentries);
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_mkvolume_sparse(void)
+{
+    printf("TESTING sparse mkvolume\n");
+    remove("volume");
+    bool passed = true;
+
+    // 4GB of blocks, of which only the header, bitmap and root directory are written
+    uint32_t nblocks = 1024 * 1024;
+    passed = passed && SIFS_makevolume("volume", 4096, nblocks, 0) == 0;
+    struct stat st;
+    passed = passed && stat("volume", &st) == 0;
+    passed = passed && (size_t)st.st_size == (sizeof(SIFS_VOLUME_HEADER) + nblocks + (size_t)4096 * nblocks);
+    passed = passed && (size_t)st.st_blocks * 512 < 64 * 1024 * 1024;
+    passed = passed && SIFS_makevolume("volume", 4096, nblocks, 0) == 1 && SIFS_errno == SIFS_EEXIST;
+
+    int data = 10;
+    passed = passed && SIFS_mkdir("volume", "Dir") == 0;
+    passed = passed && SIFS_writefile("volume", "Dir/File", &data, sizeof(int)) == 0;
+    void* dataPtr;
+    size_t nbytes;
+    passed = passed && SIFS_readfile("volume", "Dir/File", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(int) && *(int*)dataPtr == data;
+    free(dataPtr);
+    remove("volume");
+
+    // A preallocated volume is otherwise identical
+    passed = passed && SIFS_makevolume("volume", 1024, 64, SIFS_MKVOLUME_PREALLOCATE) == 0;
+    passed = passed && stat("volume", &st) == 0;
+    passed = passed && (size_t)st.st_size == (sizeof(SIFS_VOLUME_HEADER) + 64 + 1024 * 64);
+    passed = passed && SIFS_writefile("volume", "File", &data, sizeof(int)) == 0;
+    remove("volume");
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_allocator_reuse(void)
+{
+    printf("TESTING allocation of freed runs\n");
+    remove("volume");
+    SIFS_mkvolume("volume", 1024, 64);
+    bool passed = true;
+
+    // Six files of 3 data blocks each, each with its own fileblock: blocks 1 to 24
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+    char data[3000];
+    char name[SIFS_MAX_NAME_LENGTH];
+    for (int i = 0; i < 6; i++)
+    {
+        memset(data, 'a' + i, sizeof(data));
+        sprintf(name, "File%i", i);
+        passed = passed && SIFS_vwritefile(volume, name, data, sizeof(data)) == 0;
+    }
+    // Freeing two neighbouring files leaves one run of 8 blocks at block 5
+    passed = passed && SIFS_vrmfile(volume, "File1") == 0;
+    passed = passed && SIFS_vrmfile(volume, "File2") == 0;
+    // 7 blocks of data fit the joined run, its fileblock takes the one block left over
+    char large[7000];
+    memset(large, 'z', sizeof(large));
+    passed = passed && SIFS_vwritefile(volume, "Large", large, sizeof(large)) == 0;
+    passed = passed && SIFS_close(volume) == 0;
+
+    FILE* f = fopen("volume", "rb");
+    SIFS_VOLUME_HEADER header;
+    SIFS_BIT bitmap[64];
+    passed = passed && fread(&header, sizeof(header), 1, f) == 1 && fread(bitmap, 1, 64, f) == 64;
+    fclose(f);
+    passed = passed && bitmap[5] == SIFS_FILE && bitmap[6] == SIFS_DATABLOCK && bitmap[12] == SIFS_DATABLOCK;
+    passed = passed && bitmap[25] == SIFS_UNUSED;
+    void* dataPtr;
+    size_t nbytes;
+    passed = passed && SIFS_readfile("volume", "Large", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(large) && memcmp(dataPtr, large, nbytes) == 0;
+    free(dataPtr);
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_packed_bitmap(void)
+{
+    printf("TESTING packed bitmap\n");
+    remove("volume");
+    bool passed = true;
+
+    passed = passed && SIFS_makevolume("volume", 1024, 256, SIFS_MKVOLUME_PACKED) == 0;
+    char data[3000];
+    memset(data, 'p', sizeof(data));
+    int value = 10;
+    passed = passed && SIFS_mkdir("volume", "Dir") == 0;
+    passed = passed && SIFS_writefile("volume", "Dir/File", data, sizeof(data)) == 0;
+    passed = passed && SIFS_writefile("volume", "Small", &value, sizeof(int)) == 0;
+    passed = passed && SIFS_rmfile("volume", "Small") == 0;
+    SIFS_VOLUME* volume = SIFS_openvolume("volume", SIFS_OPEN_MMAP);
+    passed = passed && volume != NULL && SIFS_vwritefile(volume, "Mapped", &value, sizeof(int)) == 0;
+    passed = passed && SIFS_close(volume) == 0;
+    value = 11;
+    passed = passed && SIFS_writefile("volume", "Next", &value, sizeof(int)) == 0;
+
+    // Directory and file blocks are kept in the first 16 blocks and data blocks after them. Each zone is
+    // allocated next-fit from where the last allocation in it ended, even across opening the volume again,
+    // so Mapped and Next do not reuse the blocks of Small (3 and 19)
+    FILE* f = fopen("volume", "rb");
+    SIFS_VOLUME_HEADER header;
+    char magic[8];
+    unsigned char packed[64];
+    passed = passed && fread(&header, sizeof(header), 1, f) == 1 && fread(magic, 1, 8, f) == 8;
+    passed = passed && fseek(f, sizeof(header) + 64, SEEK_SET) == 0 && fread(packed, 1, 64, f) == 64;
+    fclose(f);
+    passed = passed && memcmp(magic, "SIFSEXT", 8) == 0;
+    passed = passed && packed[0] == (1 | 1 << 2 | 2 << 4) && packed[1] == (2 | 2 << 2) && packed[2] == 0;
+    passed = passed && packed[4] == (3 | 3 << 2 | 3 << 4) && packed[5] == (3 | 3 << 2) && packed[63] == 0;
+
+    void* dataPtr = NULL;
+    size_t nbytes;
+    passed = passed && SIFS_readfile("volume", "Dir/File", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(data) && memcmp(dataPtr, data, nbytes) == 0;
+    free(dataPtr);
+    dataPtr = NULL;
+    passed = passed && SIFS_readfile("volume", "Next", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(int) && *(int*)dataPtr == value;
+    free(dataPtr);
+    dataPtr = NULL;
+    remove("volume");
+
+    // Upgrading a small volume moves its blocks, a larger one keeps them in place
+    for (uint32_t nblocks = 32; nblocks <= 1024; nblocks *= 32)
+    {
+        passed = passed && SIFS_mkvolume("volume", 1024, nblocks) == 0;
+        passed = passed && SIFS_mkdir("volume", "Dir") == 0;
+        passed = passed && SIFS_writefile("volume", "Dir/File", data, sizeof(data)) == 0;
+        passed = passed && SIFS_upgradevolume("volume") == 0 && SIFS_upgradevolume("volume") == 0;
+        passed = passed && SIFS_readfile("volume", "Dir/File", &dataPtr, &nbytes) == 0;
+        passed = passed && nbytes == sizeof(data) && memcmp(dataPtr, data, nbytes) == 0;
+        free(dataPtr);
+        dataPtr = NULL;
+        passed = passed && SIFS_writefile("volume", "Dir/Other", &value, sizeof(int)) == 0;
+        passed = passed && SIFS_defrag("volume") == 0;
+        passed = passed && SIFS_readfile("volume", "Dir/Other", &dataPtr, &nbytes) == 0;
+        passed = passed && nbytes == sizeof(int) && *(int*)dataPtr == value;
+        free(dataPtr);
+        dataPtr = NULL;
+        remove("volume");
+    }
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_extent_files(void)
+{
+    printf("TESTING files split over several runs\n");
+    remove("volume");
+    bool passed = true;
+
+    // Ten files of 20 data blocks each fill blocks 16 to 215, removing every other one leaves runs of
+    // 20 free blocks between them and 40 at the end of the volume
+    passed = passed && SIFS_makevolume("volume", 1024, 256, SIFS_MKVOLUME_PACKED) == 0;
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+    char data[20 * 1024];
+    char name[SIFS_MAX_NAME_LENGTH];
+    for (int i = 0; passed && i < 10; i++)
+    {
+        memset(data, 'a' + i, sizeof(data));
+        sprintf(name, "File%i", i);
+        passed = passed && SIFS_vwritefile(volume, name, data, sizeof(data)) == 0;
+    }
+    for (int i = 0; passed && i < 10; i += 2)
+    {
+        sprintf(name, "File%i", i);
+        passed = passed && SIFS_vrmfile(volume, name) == 0;
+    }
+    // No run holds 100 blocks, the file is split over the run at the end and three of the others
+    size_t length = 100 * 1024 - 10;
+    char* large = (char*)malloc(length);
+    for (size_t i = 0; i < length; i++)
+    {
+        large[i] = (char)(i * 7 + i / 1024);
+    }
+    passed = passed && SIFS_vwritefile(volume, "Large", large, length) == 0;
+
+    void* dataPtr = NULL;
+    size_t nbytes = 0;
+    passed = passed && SIFS_vreadfile(volume, "Large", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == length && memcmp(dataPtr, large, length) == 0;
+    free(dataPtr);
+    dataPtr = NULL;
+    // A range that crosses from one run into the next
+    char range[100];
+    passed = passed && SIFS_readrange(volume, "Large", 20 * 1024 - 50, range, sizeof(range), &nbytes) == 0;
+    passed = passed && nbytes == sizeof(range) && memcmp(range, large + 20 * 1024 - 50, sizeof(range)) == 0;
+    const void* view = NULL;
+    passed = passed && SIFS_mapfile(volume, "Large", &view, &nbytes) == 0;
+    passed = passed && nbytes == length && memcmp(view, large, length) == 0;
+    passed = passed && SIFS_unmapfile(volume, view, nbytes) == 0;
+    SIFS_READER* reader = SIFS_ropen(volume, "Large", 4096);
+    passed = passed && reader != NULL;
+    size_t position = 0;
+    size_t nread = 1;
+    while (passed && nread > 0)
+    {
+        passed = passed && SIFS_rread(reader, data, 3000, &nread) == 0;
+        passed = passed && memcmp(data, large + position, nread) == 0;
+        position += nread;
+    }
+    passed = passed && position == length;
+    SIFS_rclose(reader);
+    passed = passed && SIFS_close(volume) == 0;
+
+    // Defragmenting moves each run, the file reads the same afterwards
+    passed = passed && SIFS_defrag("volume") == 0;
+    passed = passed && SIFS_readfile("volume", "Large", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == length && memcmp(dataPtr, large, length) == 0;
+    free(dataPtr);
+    dataPtr = NULL;
+    passed = passed && SIFS_readfile("volume", "File3", &dataPtr, &nbytes) == 0;
+    memset(data, 'd', sizeof(data));
+    passed = passed && nbytes == sizeof(data) && memcmp(dataPtr, data, nbytes) == 0;
+    free(dataPtr);
+    dataPtr = NULL;
+
+    // Removing the file frees every one of its runs, so all of the data zone is free again
+    passed = passed && SIFS_rmfile("volume", "Large") == 0;
+    for (int i = 1; passed && i < 10; i += 2)
+    {
+        sprintf(name, "File%i", i);
+        passed = passed && SIFS_rmfile("volume", name) == 0;
+    }
+    char* full = (char*)calloc(240, 1024);
+    passed = passed && SIFS_writefile("volume", "Full", full, 240 * 1024) == 0;
+    free(full);
+    free(large);
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_statvol(void)
+{
+    printf("TESTING statvol\n");
+    remove("volume");
+    SIFS_mkvolume("volume", 1024, 64);
+    bool passed = true;
+
+    SIFS_STATVOL stat;
+    passed = passed && SIFS_statvol("volume", &stat) == 0;
+    passed = passed && stat.blocksize == 1024 && stat.nblocks == 64 && stat.nfree == 63 && stat.ndirblocks == 1;
+    passed = passed && stat.largestfree == 63 && stat.nfreeruns == 1 && stat.histogram[5] == 1;
+
+    // Two files of 3 data blocks each take blocks 1 to 8, removing the first frees blocks 1 to 4
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+    char data[3000];
+    memset(data, 's', sizeof(data));
+    passed = passed && SIFS_vwritefile(volume, "First", data, sizeof(data)) == 0;
+    memset(data, 't', sizeof(data));
+    passed = passed && SIFS_vwritefile(volume, "Second", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vstatvol(volume, &stat) == 0;
+    passed = passed && stat.nfree == 55 && stat.nfileblocks == 2 && stat.ndatablocks == 6;
+    passed = passed && SIFS_vrmfile(volume, "First") == 0;
+    passed = passed && SIFS_vmkdir(volume, "Dir") == 0;
+    passed = passed && SIFS_vstatvol(volume, &stat) == 0;
+    passed = passed && stat.nfree == 58 && stat.ndirblocks == 2 && stat.nfileblocks == 1 && stat.ndatablocks == 3;
+    passed = passed && stat.largestfree == 55 && stat.nfreeruns == 2 && stat.histogram[1] == 1 && stat.histogram[5] == 1;
+    passed = passed && SIFS_close(volume) == 0;
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_hash_index(void)
+{
+    printf("TESTING index of files by md5\n");
+    remove("volume");
+    bool passed = true;
+
+    // Twenty files with different contents in each of two directories
+    passed = passed && SIFS_makevolume("volume", 1024, 512, SIFS_MKVOLUME_PACKED) == 0;
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL && SIFS_vmkdir(volume, "A") == 0 && SIFS_vmkdir(volume, "B") == 0;
+    char data[1500];
+    char name[SIFS_MAX_NAME_LENGTH];
+    for (int i = 0; passed && i < 40; i++)
+    {
+        memset(data, i, sizeof(data));
+        sprintf(name, "%s/File%i", (i < 20) ? "A" : "B", i);
+        passed = passed && SIFS_vwritefile(volume, name, data, sizeof(data)) == 0;
+    }
+    // Contents already stored are found through the index
+    SIFS_STATVOL stat;
+    memset(data, 5, sizeof(data));
+    passed = passed && SIFS_vwritefile(volume, "Copy5", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vstatvol(volume, &stat) == 0 && stat.nfileblocks == 40;
+    // Removed files leave the index, and the fileblocks moved by a defrag are found where they now are
+    for (int i = 0; passed && i < 10; i++)
+    {
+        sprintf(name, "A/File%i", i);
+        passed = passed && SIFS_vrmfile(volume, name) == 0;
+    }
+    passed = passed && SIFS_vdefrag(volume) == 0;
+    memset(data, 35, sizeof(data));
+    passed = passed && SIFS_vwritefile(volume, "Copy35", data, sizeof(data)) == 0;
+    memset(data, 3, sizeof(data));
+    passed = passed && SIFS_vwritefile(volume, "Copy3", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vstatvol(volume, &stat) == 0 && stat.nfileblocks == 32;
+    passed = passed && SIFS_close(volume) == 0;
+    void* dataPtr = NULL;
+    size_t nbytes;
+    memset(data, 35, sizeof(data));
+    passed = passed && SIFS_readfile("volume", "Copy35", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == sizeof(data) && memcmp(dataPtr, data, nbytes) == 0;
+    free(dataPtr);
+    dataPtr = NULL;
+    remove("volume");
+
+    // Upgrading a volume adds its existing files to the index
+    passed = passed && SIFS_mkvolume("volume", 1024, 64) == 0;
+    for (int i = 0; passed && i < 3; i++)
+    {
+        memset(data, i, sizeof(data));
+        sprintf(name, "File%i", i);
+        passed = passed && SIFS_writefile("volume", name, data, sizeof(data)) == 0;
+    }
+    passed = passed && SIFS_upgradevolume("volume") == 0;
+    memset(data, 1, sizeof(data));
+    passed = passed && SIFS_writefile("volume", "Copy1", data, sizeof(data)) == 0;
+    passed = passed && SIFS_statvol("volume", &stat) == 0 && stat.nfileblocks == 3;
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_md5_buffers(void)
+{
+    printf("TESTING md5 of many buffers at once\n");
+    bool passed = true;
+
+    // Lengths either side of the 56 and 64 byte padding boundaries, and some much longer ones
+    static char data[20000];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (char)(i * 31 + i / 7);
+    }
+    const void* inputs[40];
+    size_t lens[40];
+    unsigned char md5s[40][MD5_BYTELEN];
+    void* results[40];
+    for (size_t i = 0; i < 40; i++)
+    {
+        inputs[i] = data + i;
+        lens[i] = (i % 4 == 0) ? 500 * i : 50 + i;
+        results[i] = md5s[i];
+    }
+    // Every count of buffers up to 40 uses the narrowest lanes that fit them
+    for (size_t n = 1; n <= 40 && passed; n++)
+    {
+        MD5_buffers(n, inputs, lens, results);
+        for (size_t i = 0; i < n; i++)
+        {
+            unsigned char md5[MD5_BYTELEN];
+            MD5_buffer(inputs[i], lens[i], md5);
+            passed = passed && memcmp(md5, md5s[i], MD5_BYTELEN) == 0;
+        }
+    }
+    inputs[0] = "abc";
+    lens[0] = 3;
+    inputs[1] = "";
+    lens[1] = 0;
+    MD5_buffers(2, inputs, lens, results);
+    passed = passed && strcmp(MD5_format(md5s[0]), "900150983cd24fb0d6963f7d28e17f72") == 0;
+    passed = passed && strcmp(MD5_format(md5s[1]), "d41d8cd98f00b204e9800998ecf8427e") == 0;
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_hash_vectors(void)
+{
+    printf("TESTING XXH3-128 and BLAKE3 against reference values\n");
+    bool passed = true;
+
+    // Reference values from the xxhash and blake3 Python packages, BLAKE3 cut to 16 bytes as volumes store it
+    static char data[5000];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (char)(i * 31 + i / 7);
+    }
+    const char* inputs[] = { "", "abc", data };
+    const size_t lens[] = { 0, 3, sizeof(data) };
+    const char* xxh[] = { "99aa06d3014798d86001c324468d497f", "06b05ab6733a618578af5f94892f3950",
+                          "63261f75ea7350c1250625bfe8f53a5e" };
+    const char* blake3[] = { "af1349b9f5f9a1a6a0404dea36dcc949", "6437b3ac38465133ffb63b75273a8db5",
+                             "ffa9a3a2334a83e03ae558feaaf04c29" };
+    unsigned char digest[MD5_BYTELEN];
+    for (int i = 0; i < 3; i++)
+    {
+        XXH128_buffer(inputs[i], lens[i], digest);
+        passed = passed && strcmp(MD5_format(digest), xxh[i]) == 0;
+        BLAKE3_buffer(inputs[i], lens[i], digest, MD5_BYTELEN);
+        passed = passed && strcmp(MD5_format(digest), blake3[i]) == 0;
+
+        // The same input added in uneven pieces
+        XXH128_CTX xctx;
+        BLAKE3_CTX bctx;
+        XXH128_init(&xctx);
+        BLAKE3_init(&bctx);
+        for (size_t offset = 0, n = 1; offset < lens[i]; offset += n, n = n * 2 + 3)
+        {
+            n = (n < lens[i] - offset) ? n : lens[i] - offset;
+            XXH128_update(&xctx, inputs[i] + offset, n);
+            BLAKE3_update(&bctx, inputs[i] + offset, n);
+        }
+        XXH128_final(&xctx, digest);
+        passed = passed && strcmp(MD5_format(digest), xxh[i]) == 0;
+        BLAKE3_final(&bctx, digest, MD5_BYTELEN);
+        passed = passed && strcmp(MD5_format(digest), blake3[i]) == 0;
+    }
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_volume_hashes(void)
+{
+    printf("TESTING volumes that find identical files by other hashes\n");
+    bool passed = true;
+
+    const int hashes[] = { SIFS_MKVOLUME_PACKED, SIFS_MKVOLUME_XXH128, SIFS_MKVOLUME_BLAKE3 };
+    char data[3000];
+    char name[SIFS_MAX_NAME_LENGTH];
+    for (int h = 0; passed && h < 3; h++)
+    {
+        remove("volume");
+        passed = passed && SIFS_makevolume("volume", 1024, 256, hashes[h]) == 0;
+        SIFS_VOLUME* volume = SIFS_open("volume");
+        passed = passed && volume != NULL;
+        for (int i = 0; passed && i < 8; i++)
+        {
+            memset(data, i, sizeof(data));
+            data[i] = 'x';
+            sprintf(name, "File%i", i);
+            passed = passed && SIFS_vwritefile(volume, name, data, sizeof(data)) == 0;
+        }
+        // The same contents written by a writer and in a batch share the fileblocks already stored
+        memset(data, 2, sizeof(data));
+        data[2] = 'x';
+        SIFS_WRITER* writer = passed ? SIFS_wopen(volume, "Copy2", 0) : NULL;
+        passed = passed && writer != NULL && SIFS_wwrite(writer, data, 1000) == 0 &&
+                 SIFS_wwrite(writer, data + 1000, sizeof(data) - 1000) == 0 && SIFS_wcommit(writer) == 0;
+        char data5[sizeof(data)];
+        memset(data5, 5, sizeof(data5));
+        data5[5] = 'x';
+        SIFS_WRITE_REQ reqs[2] = { { "Copy5", data5, sizeof(data5) }, { "Copy2b", data, sizeof(data) } };
+        passed = passed && SIFS_writefiles(volume, reqs, 2, NULL) == 0;
+        SIFS_STATVOL stat;
+        passed = passed && SIFS_vstatvol(volume, &stat) == 0 && stat.nfileblocks == 8;
+        passed = passed && SIFS_close(volume) == 0;
+        // And are found again after the volume is reopened
+        passed = passed && SIFS_writefile("volume", "Copy5b", data5, sizeof(data5)) == 0;
+        passed = passed && SIFS_statvol("volume", &stat) == 0 && stat.nfileblocks == 8;
+        void* dataPtr = NULL;
+        size_t nbytes;
+        passed = passed && SIFS_readfile("volume", "Copy2b", &dataPtr, &nbytes) == 0;
+        passed = passed && nbytes == sizeof(data) && memcmp(dataPtr, data, nbytes) == 0;
+        free(dataPtr);
+    }
+    remove("volume");
+    // A volume can use only one of them
+    passed = passed && SIFS_makevolume("volume", 1024, 64, SIFS_MKVOLUME_XXH128 | SIFS_MKVOLUME_BLAKE3) != 0 &&
+             SIFS_errno == SIFS_EINVAL;
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_chunked_files(void)
+{
+    printf("TESTING files split into shared chunks\n");
+    remove("volume");
+    bool passed = true;
+
+    // Three versions of a file: the original, one with a line appended and one with bytes inserted part way in
+    size_t length = 400 * 1024;
+    char* v1 = (char*)malloc(length);
+    char* v2 = (char*)malloc(length + 100);
+    char* v3 = (char*)malloc(length + 10);
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < length; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        v1[i] = (char)x;
+    }
+    memcpy(v2, v1, length);
+    memset(v2 + length, '+', 100);
+    memcpy(v3, v1, length / 2);
+    memset(v3 + length / 2, '*', 10);
+    memcpy(v3 + length / 2 + 10, v1 + length / 2, length - length / 2);
+
+    passed = passed && SIFS_makevolume("volume", 1024, 4096, SIFS_MKVOLUME_CHUNKED) == 0;
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+    SIFS_STATVOL stat;
+    passed = passed && SIFS_vwritefile(volume, "v1", v1, length) == 0;
+    passed = passed && SIFS_vstatvol(volume, &stat) == 0;
+    uint32_t first = stat.ndatablocks;
+    // Only the chunks that changed are stored again
+    passed = passed && SIFS_vwritefile(volume, "v2", v2, length + 100) == 0;
+    SIFS_WRITE_REQ req = { "v3", v3, length + 10 };
+    passed = passed && SIFS_writefiles(volume, &req, 1, NULL) == 0;
+    passed = passed && SIFS_vstatvol(volume, &stat) == 0 && stat.ndatablocks < first + first / 2;
+
+    // Every way of reading a file reassembles its chunks
+    void* dataPtr = NULL;
+    size_t nbytes;
+    passed = passed && SIFS_vreadfile(volume, "v3", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == length + 10 && memcmp(dataPtr, v3, nbytes) == 0;
+    free(dataPtr);
+    dataPtr = NULL;
+    char range[70000];
+    passed = passed && SIFS_readrange(volume, "v2", length - 60000, range, sizeof(range), &nbytes) == 0;
+    passed = passed && nbytes == 60100 && memcmp(range, v2 + length - 60000, nbytes) == 0;
+    const void* view = NULL;
+    passed = passed && SIFS_mapfile(volume, "v1", &view, &nbytes) == 0;
+    passed = passed && nbytes == length && memcmp(view, v1, nbytes) == 0;
+    passed = passed && SIFS_unmapfile(volume, view, nbytes) == 0;
+    SIFS_READER* reader = passed ? SIFS_ropen(volume, "v3", 5000) : NULL;
+    passed = passed && reader != NULL;
+    for (size_t done = 0; passed && done < length + 10; )
+    {
+        size_t nread;
+        passed = SIFS_rread(reader, range, 3333, &nread) == 0 && nread > 0 && memcmp(range, v3 + done, nread) == 0;
+        done += nread;
+    }
+    SIFS_rclose(reader);
+
+    // Chunks are freed with the last file that includes them, and found where a defrag moves them
+    passed = passed && SIFS_vrmfile(volume, "v1") == 0 && SIFS_vrmfile(volume, "v3") == 0;
+    passed = passed && SIFS_vdefrag(volume) == 0;
+    passed = passed && SIFS_vreadfile(volume, "v2", &dataPtr, &nbytes) == 0;
+    passed = passed && nbytes == length + 100 && memcmp(dataPtr, v2, nbytes) == 0;
+    free(dataPtr);
+    passed = passed && SIFS_vrmfile(volume, "v2") == 0;
+    passed = passed && SIFS_vstatvol(volume, &stat) == 0 && stat.ndatablocks == 0 && stat.nfileblocks == 0;
+    passed = passed && SIFS_close(volume) == 0;
+    remove("volume");
+    free(v1);
+    free(v2);
+    free(v3);
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_name_chains(void)
+{
+    printf("TESTING names of identical files beyond one fileblock\n");
+    bool passed = true;
+
+    char contents[3000];
+    for (size_t i = 0; i < sizeof(contents); i++)
+    {
+        contents[i] = (char)(i * 7 + i / 256);
+    }
+    // The same contents under 80 names, with each directory written a different way
+    const int flags[] = { 0, SIFS_MKVOLUME_PACKED };
+    for (int v = 0; v < 2; v++)
+    {
+        remove("volume");
+        passed = passed && SIFS_makevolume("volume", 1024, 256, flags[v]) == 0;
+        SIFS_VOLUME* volume = SIFS_open("volume");
+        passed = passed && volume != NULL;
+        char filename[SIFS_MAX_NAME_LENGTH];
+        for (int d = 0; d < 4; d++)
+        {
+            sprintf(filename, "d%i", d);
+            passed = passed && SIFS_vmkdir(volume, filename) == 0;
+        }
+        for (int i = 0; i < 20; i++)
+        {
+            sprintf(filename, "d0/f%i", i);
+            passed = passed && SIFS_vwritefile(volume, filename, contents, sizeof(contents)) == 0;
+            sprintf(filename, "d1/f%i", i);
+            passed = passed && SIFS_vwritefile(volume, filename, contents, sizeof(contents)) == 0;
+        }
+        char names[20][SIFS_MAX_NAME_LENGTH];
+        SIFS_WRITE_REQ reqs[20];
+        for (int i = 0; i < 20; i++)
+        {
+            sprintf(names[i], "d2/f%i", i);
+            reqs[i].pathname = names[i];
+            reqs[i].data = contents;
+            reqs[i].nbytes = sizeof(contents);
+        }
+        passed = passed && SIFS_writefiles(volume, reqs, 20, NULL) == 0;
+        for (int i = 0; passed && i < 20; i++)
+        {
+            sprintf(filename, "d3/f%i", i);
+            SIFS_WRITER* writer = SIFS_wopen(volume, filename, 0);
+            passed = writer != NULL && SIFS_wwrite(writer, contents, sizeof(contents)) == 0 && SIFS_wcommit(writer) == 0;
+        }
+        // One copy of the data, and 23 names in each fileblock of the chain
+        SIFS_STATVOL stat;
+        passed = passed && SIFS_vstatvol(volume, &stat) == 0 && stat.nfileblocks == 4 && stat.ndatablocks == 3;
+
+        // Names are removed from the first fileblock and those after it, with a defrag in between
+        for (int i = 0; i < 20; i++)
+        {
+            sprintf(filename, "d0/f%i", i);
+            passed = passed && SIFS_vrmfile(volume, filename) == 0;
+        }
+        passed = passed && SIFS_vdefrag(volume) == 0;
+        for (int d = 1; d < 4; d++)
+        {
+            for (int i = 0; i < 20; i++)
+            {
+                void* dataPtr = NULL;
+                size_t nbytes;
+                sprintf(filename, "d%i/f%i", d, i);
+                passed = passed && SIFS_vreadfile(volume, filename, &dataPtr, &nbytes) == 0;
+                passed = passed && nbytes == sizeof(contents) && memcmp(dataPtr, contents, nbytes) == 0;
+                free(dataPtr);
+            }
+        }
+        // Names added again fill the room left in the chain
+        passed = passed && SIFS_vwritefile(volume, "d0/again", contents, sizeof(contents)) == 0;
+        passed = passed && SIFS_vstatvol(volume, &stat) == 0 && stat.nfileblocks <= 4 && stat.ndatablocks == 3;
+        passed = passed && SIFS_vrmfile(volume, "d0/again") == 0;
+        for (int d = 3; d > 0; d--)
+        {
+            for (int i = 19; i >= 0; i--)
+            {
+                sprintf(filename, "d%i/f%i", d, i);
+                passed = passed && SIFS_vrmfile(volume, filename) == 0;
+            }
+        }
+        passed = passed && SIFS_vstatvol(volume, &stat) == 0 && stat.nfileblocks == 0 && stat.ndatablocks == 0;
+        passed = passed && SIFS_close(volume) == 0;
+    }
+    remove("volume");
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_dentry_cache(void)
+{
+    printf("TESTING cached directory entries\n");
+    remove("volume");
+    bool passed = SIFS_mkvolume("volume", 1024, 128) == 0;
+    SIFS_VOLUME* volume = SIFS_open("volume");
+    passed = passed && volume != NULL;
+    char data[] = "the same contents";
+    size_t length;
+    time_t modtime;
+
+    // Identical files share a fileblock, removing one moves the names after it
+    passed = passed && SIFS_vmkdir(volume, "a") == 0 && SIFS_vmkdir(volume, "a/b") == 0 && SIFS_vmkdir(volume, "a/b/c") == 0;
+    passed = passed && SIFS_vwritefile(volume, "a/b/c/f1", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vwritefile(volume, "a/b/c/f2", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vwritefile(volume, "a/b/c/f3", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vfileinfo(volume, "a/b/c/f3", &length, &modtime) == 0 && length == sizeof(data);
+    passed = passed && SIFS_vrmfile(volume, "a/b/c/f1") == 0;
+    passed = passed && SIFS_vrmfile(volume, "a/b/c/f2") == 0;
+    passed = passed && SIFS_vfileinfo(volume, "a/b/c/f2", &length, &modtime) == 1 && SIFS_errno == SIFS_ENOENT;
+    passed = passed && SIFS_vfileinfo(volume, "a/b/c/f3", &length, &modtime) == 0 && length == sizeof(data);
+
+    // A directory that is removed and replaced by a file is no longer found as a directory
+    passed = passed && SIFS_vrmfile(volume, "a/b/c/f3") == 0 && SIFS_vrmdir(volume, "a/b/c") == 0;
+    passed = passed && SIFS_vwritefile(volume, "a/b/c", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vwritefile(volume, "a/b/c/f1", data, sizeof(data)) == 1 && SIFS_errno == SIFS_ENOENT;
+    passed = passed && SIFS_vrmfile(volume, "a/b/c") == 0 && SIFS_vmkdir(volume, "a/b/c") == 0;
+    passed = passed && SIFS_vwritefile(volume, "a/b/c/f1", data, sizeof(data)) == 0;
+
+    // Entries are found again after a defrag moves their blocks
+    passed = passed && SIFS_vmkdir(volume, "d") == 0 && SIFS_vrmdir(volume, "a/b/c") == 1;
+    passed = passed && SIFS_vrmfile(volume, "a/b/c/f1") == 0 && SIFS_vrmdir(volume, "a/b/c") == 0;
+    passed = passed && SIFS_vwritefile(volume, "d/f", data, sizeof(data)) == 0;
+    passed = passed && SIFS_vdefrag(volume) == 0;
+    passed = passed && SIFS_vfileinfo(volume, "d/f", &length, &modtime) == 0 && length == sizeof(data);
+    passed = passed && SIFS_vmkdir(volume, "a/b/e") == 0 && SIFS_vrmdir(volume, "a/b/e") == 0;
+    passed = passed && SIFS_close(volume) == 0;
+    remove("volume");
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_directory_names(void)
+{
+    printf("TESTING names of entries kept in directory blocks\n");
+    bool passed = true;
+    int data = 5;
+    const char* longname = "d/a name of thirty-one characters";
+    for (int v = 0; v < 2; v++)
+    {
+        // A packed volume keeps the names from the start, one in the original layout once it is upgraded
+        remove("volume");
+        passed = passed && SIFS_makevolume("volume", 1024, 128, (v == 0) ? SIFS_MKVOLUME_PACKED : 0) == 0;
+        SIFS_VOLUME* volume = SIFS_open("volume");
+        passed = passed && volume != NULL && SIFS_vmkdir(volume, "d") == 0;
+        char pathname[2 * SIFS_MAX_NAME_LENGTH];
+        for (int i = 0; i < 22; i++)
+        {
+            data++;
+            sprintf(pathname, "d/entry%i", i);
+            passed = passed && ((i % 3 == 0) ? SIFS_vmkdir(volume, pathname) : SIFS_vwritefile(volume, pathname, &data, sizeof(int))) == 0;
+        }
+        passed = passed && SIFS_vwritefile(volume, longname, &data, sizeof(int)) == 0;
+        passed = passed && SIFS_vrmfile(volume, "d/entry4") == 0 && SIFS_vrmdir(volume, "d/entry6") == 0;
+        passed = passed && SIFS_close(volume) == 0;
+        passed = passed && (v == 0 || SIFS_upgradevolume("volume") == 0);
+
+        // Finding or listing entries reads the directory blocks on the way, and only the block of an entry found
+        volume = SIFS_open("volume");
+        passed = passed && volume != NULL;
+        uint64_t hits;
+        uint64_t misses;
+        char** entries;
+        uint32_t nentries;
+        time_t modtime;
+        size_t length;
+        passed = passed && SIFS_vdirinfo(volume, "d", &entries, &nentries, &modtime) == 0 && nentries == 21;
+        passed = passed && strcmp(entries[4], "entry5") == 0 && strcmp(entries[20], longname + 2) == 0;
+        free_entries(entries, nentries);
+        passed = passed && SIFS_vfileinfo(volume, longname, &length, &modtime) == 0 && length == sizeof(int);
+        passed = passed && SIFS_cachestats(volume, &hits, &misses) == 0 && misses == 3;
+        passed = passed && SIFS_vfileinfo(volume, "d/entry9", &length, &modtime) == 1 && SIFS_errno == SIFS_ENOTFILE;
+        passed = passed && SIFS_vfileinfo(volume, "d/entry6", &length, &modtime) == 1 && SIFS_errno == SIFS_ENOENT;
+        passed = passed && SIFS_vrmdir(volume, "d/entry5") == 1 && SIFS_errno == SIFS_ENOTDIR;
+        passed = passed && SIFS_vmkdir(volume, "d/entry5") == 1 && SIFS_errno == SIFS_EEXIST;
+        passed = passed && SIFS_vwritefile(volume, "d/entry9/f", &data, sizeof(int)) == 0;
+        passed = passed && SIFS_vrmfile(volume, longname) == 0;
+        passed = passed && SIFS_vdirinfo(volume, "d", &entries, &nentries, &modtime) == 0 && nentries == 20;
+        passed = passed && strcmp(entries[19], "entry21") == 0;
+        free_entries(entries, nentries);
+        passed = passed && SIFS_close(volume) == 0;
+    }
+    remove("volume");
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
+void test_readdir(void)
+{
+    printf("TESTING readdir\n");
+    bool passed = true;
+    char data[3000];
+    memset(data, 'r', sizeof(data));
+    for (int v = 0; v < 2; v++)
+    {
+        remove("volume");
+        passed = passed && SIFS_makevolume("volume", 1024, 64, (v == 0) ? SIFS_MKVOLUME_PACKED : 0) == 0;
+        SIFS_VOLUME* volume = SIFS_open("volume");
+        passed = passed && volume != NULL;
+        passed = passed && SIFS_vmkdir(volume, "d") == 0 && SIFS_vmkdir(volume, "d/sub") == 0;
+        passed = passed && SIFS_vwritefile(volume, "d/sub/x", data, 10) == 0;
+        passed = passed && SIFS_vwritefile(volume, "d/big", data, sizeof(data)) == 0;
+        passed = passed && SIFS_vwritefile(volume, "d/small", data, 10) == 0;
+        passed = passed && SIFS_vwritefile(volume, "d/same", data, sizeof(data)) == 0;
+
+        SIFS_DIRENT* entries = NULL;
+        uint32_t nentries;
+        passed = passed && SIFS_vreaddir(volume, "d", &entries, &nentries) == 0 && nentries == 4;
+        passed = passed && strcmp(entries[0].name, "sub") == 0 && entries[0].type == SIFS_DIR && entries[0].length == 1;
+        passed = passed && strcmp(entries[1].name, "big") == 0 && entries[1].type == SIFS_FILE && entries[1].length == sizeof(data);
+        passed = passed && strcmp(entries[2].name, "small") == 0 && entries[2].length == 10;
+        passed = passed && strcmp(entries[3].name, "same") == 0 && entries[3].blockID == entries[1].blockID;
+        size_t length;
+        time_t modtime;
+        passed = passed && SIFS_vfileinfo(volume, "d/small", &length, &modtime) == 0 && modtime == entries[2].modtime;
+        free(entries);
+        passed = passed && SIFS_vreaddir(volume, "d/sub/x", &entries, &nentries) == 1 && SIFS_errno == SIFS_ENOENT;
+        passed = passed && SIFS_close(volume) == 0;
+
+        entries = NULL;
+        passed = passed && SIFS_readdir("volume", "/", &entries, &nentries) == 0 && nentries == 1;
+        passed = passed && strcmp(entries[0].name, "d") == 0 && entries[0].length == 4;
+        free(entries);
+    }
+    remove("volume");
+
+    if (passed)
+    {
+        printf("TEST PASSED\n");
+    }
+    else
+    {
+        printf("TEST FAILED\n");
+    }
+}
+
 int main(int argc, char** argv)
 {
     printf("TESTING writefile\n");
@@ -396,5 +1724,29 @@ int main(int argc, char** argv)
 
     printf("RANDOM TESTS\n");
     test_random();
+
+    printf("VOLUME HANDLE TESTS\n");
+    test_volume_handle();
+    test_volume_mmap();
+    test_volume_cache();
+    test_readfile_views();
+    test_streaming_writer();
+    test_ranged_reads();
+    test_writefiles();
+    test_volume_uring();
+    test_mkvolume_sparse();
+    test_allocator_reuse();
+    test_packed_bitmap();
+    test_extent_files();
+    test_statvol();
+    test_hash_index();
+    test_md5_buffers();
+    test_hash_vectors();
+    test_volume_hashes();
+    test_chunked_files();
+    test_name_chains();
+    test_dentry_cache();
+    test_directory_names();
+    test_readdir();
     return 0;
 }
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../library/md5.h"
+
+// Compares the throughput of MD5_buffer() with the rounds it replaced, which looked up each
+// step's function, shift and message word through tables, then that of digesting the same
+// bytes as many small files one at a time and with MD5_buffers(). Usage: md5_bench [megabytes]
+
+typedef uint32_t (*DgstFctn)(uint32_t a[]);
+
+static uint32_t f0(uint32_t abcd[]) { return (abcd[1] & abcd[2]) | (~abcd[1] & abcd[3]); }
+static uint32_t f1(uint32_t abcd[]) { return (abcd[3] & abcd[1]) | (~abcd[3] & abcd[2]); }
+static uint32_t f2(uint32_t abcd[]) { return abcd[1] ^ abcd[2] ^ abcd[3]; }
+static uint32_t f3(uint32_t abcd[]) { return abcd[2] ^ (abcd[1] | ~abcd[3]); }
+
+static uint32_t ROL(uint32_t v, int amt)
+{
+	uint32_t msk1 = (1 << amt) - 1;
+	return ((v >> (32 - amt)) & msk1) | ((v << amt) & ~msk1);
+}
+
+static void old_transform(uint32_t result[4], const uint8_t* group)
+{
+	static DgstFctn funcs[] = { &f0, &f1, &f2, &f3 };
+	static int16_t M[] = { 1, 5, 3, 7 };
+	static int16_t O[] = { 0, 1, 5, 0 };
+	static int16_t rots[4][4] = { { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 } };
+	static uint32_t k[64];
+	static int ready = 0;
+
+	if (!ready) {
+		for (int i = 0; i < 64; i++) {
+			k[i] = (uint32_t)(fabs(sin((double)(1 + i))) * 4294967296.0);
+		}
+		ready = 1;
+	}
+	uint32_t w[16];
+	uint32_t abcd[4];
+	memcpy(w, group, 64);
+	memcpy(abcd, result, sizeof(abcd));
+	for (int p = 0; p < 4; p++) {
+		for (int q = 0; q < 16; q++) {
+			int g = (M[p] * q + O[p]) % 16;
+			uint32_t f = abcd[1] + ROL(abcd[0] + funcs[p](abcd) + k[q + 16 * p] + w[g], rots[p][q % 4]);
+			abcd[0] = abcd[3];
+			abcd[3] = abcd[2];
+			abcd[2] = abcd[1];
+			abcd[1] = f;
+		}
+	}
+	for (int p = 0; p < 4; p++) {
+		result[p] += abcd[p];
+	}
+}
+
+// The old digest, padded a group at a time rather than in a copy of the whole message
+static void old_md5(const uint8_t* msg, size_t mlen, uint8_t md5_result[MD5_BYTELEN])
+{
+	uint32_t result[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+	size_t whole = mlen - mlen % 64;
+	for (size_t offset = 0; offset < whole; offset += 64) {
+		old_transform(result, msg + offset);
+	}
+	uint8_t tail[128] = { 0 };
+	size_t rest = mlen - whole;
+	size_t ntail = (rest < 56) ? 64 : 128;
+	memcpy(tail, msg + whole, rest);
+	tail[rest] = 0x80;
+	uint64_t bits = 8 * (uint64_t)mlen;
+	for (int i = 0; i < 8; i++) {
+		tail[ntail - 8 + i] = (uint8_t)(bits >> (8 * i));
+	}
+	for (size_t offset = 0; offset < ntail; offset += 64) {
+		old_transform(result, tail + offset);
+	}
+	memcpy(md5_result, result, MD5_BYTELEN);
+}
+
+static double seconds(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t megabytes = (argc > 1) ? (size_t)atol(argv[1]) : 256;
+	size_t nbytes = megabytes * 1024 * 1024;
+	uint8_t* data = (uint8_t*)malloc(nbytes > 0 ? nbytes : 1);
+	if (data == NULL) {
+		fprintf(stderr, "cannot allocate %zu MB\n", megabytes);
+		return 1;
+	}
+	uint32_t x = 2463534242u;
+	for (size_t i = 0; i < nbytes; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		data[i] = (uint8_t)x;
+	}
+
+	uint8_t oldmd5[MD5_BYTELEN];
+	uint8_t newmd5[MD5_BYTELEN];
+	clock_t start = clock();
+	old_md5(data, nbytes, oldmd5);
+	double oldtime = seconds(start);
+	start = clock();
+	MD5_buffer((const char*)data, nbytes, newmd5);
+	double newtime = seconds(start);
+
+	printf("%zu MB\n", megabytes);
+	printf("old rounds: %8.1f MB/s  %s\n", megabytes / oldtime, MD5_format(oldmd5));
+	printf("MD5_buffer: %8.1f MB/s  %s\n", megabytes / newtime, MD5_format(newmd5));
+	int same = memcmp(oldmd5, newmd5, MD5_BYTELEN) == 0;
+
+	// The same bytes as files of 4 KB
+	size_t filesize = 4096;
+	size_t nfiles = nbytes / filesize;
+	const void** inputs = (const void**)malloc(sizeof(void*) * (nfiles + 1));
+	size_t* lens = (size_t*)malloc(sizeof(size_t) * (nfiles + 1));
+	uint8_t* serial = (uint8_t*)malloc(MD5_BYTELEN * (nfiles + 1));
+	uint8_t* batch = (uint8_t*)malloc(MD5_BYTELEN * (nfiles + 1));
+	void** results = (void**)malloc(sizeof(void*) * (nfiles + 1));
+	if (inputs == NULL || lens == NULL || serial == NULL || batch == NULL || results == NULL) {
+		fprintf(stderr, "cannot allocate %zu files\n", nfiles);
+		return 1;
+	}
+	for (size_t i = 0; i < nfiles; i++) {
+		inputs[i] = data + i * filesize;
+		lens[i] = filesize;
+		results[i] = batch + i * MD5_BYTELEN;
+	}
+	start = clock();
+	for (size_t i = 0; i < nfiles; i++) {
+		MD5_buffer((const char*)inputs[i], lens[i], serial + i * MD5_BYTELEN);
+	}
+	double serialtime = seconds(start);
+	start = clock();
+	MD5_buffers(nfiles, inputs, lens, results);
+	double batchtime = seconds(start);
+	printf("%zu files of %zu bytes\n", nfiles, filesize);
+	printf("one at a time: %8.1f MB/s\n", megabytes / serialtime);
+	printf("MD5_buffers:   %8.1f MB/s\n", megabytes / batchtime);
+	same = same && memcmp(serial, batch, MD5_BYTELEN * nfiles) == 0;
+	printf("%s\n", same ? "digests match" : "DIGESTS DIFFER");
+	free(inputs);
+	free(lens);
+	free(serial);
+	free(batch);
+	free(results);
+	free(data);
+	return same ? 0 : 1;
+}